@@ -81,7 +81,11 @@ void Editor::openStatusChanged( int openStatus ) {
 		case BaseFile::Ready:
 			if ( mFirstOpen ) {
 				mFirstOpen = false;
-				mEditor->moveCursor( QTextCursor::Start, QTextCursor::MoveAnchor );
+				if ( mFile->getRestoreLine() > 1 ) {
+					gotoLine( mFile->getRestoreLine() );
+				} else {
+					mEditor->moveCursor( QTextCursor::Start, QTextCursor::MoveAnchor );
+				}
 
 				if ( mFile->isReadOnly() ) {
 					setReadOnly( true );
@@ -94,6 +98,7 @@ void Editor::openStatusChanged( int openStatus ) {
 		case BaseFile::Disconnected:
 		case BaseFile::Reconnecting:
 		case BaseFile::Repairing:
+		case BaseFile::Refreshing:
 			setCurrentWidget( mEditorPane );
 			if ( hasFocus() ) {
 				mEditor->setFocus();
@@ -1,5 +1,8 @@
 #include <QCryptographicHash>
 #include <QDebug>
+#include <QTextCursor>
+#include <QTextStream>
+#include <QThreadPool>
 
 #include "basefile.h"
 #include "editor/editor.h"
@@ -24,6 +27,7 @@ const char *BaseFile::sStatusLabels[] = {
 	"Disconnected",
 	"Reconnecting...",
 	"Lost Synchronization; Repairing",
+	"Refreshing...",
 	"Syncronization Error",
 	"Closing",
 	"Closed"
@@ -93,6 +97,9 @@ BaseFile::BaseFile( const Location &location ) :
 	mLastSaveChecksum( NULL ),
 	mProgress( -1 ),
 	mOpenStatus( BaseFile::Closed ),
+	mOpenGeneration( 0 ),
+	mDeferred( false ),
+	mRestoreLine( 0 ),
 	mAttachedEditors(),
 	mHighlighter( NULL ) {
 	mDocument->setDocumentLayout( mDocumentLayout );
@@ -156,25 +163,150 @@ void BaseFile::openSuccess( const QString &content, const QByteArray &checksum,
 		return;
 	}
 
+	// Detect line ending mode, then convert it to unix-style. Use unix-style line endings everywhere, only convert
+	// to DOS at save time.
+	mOpenGeneration++;
+	QString unixContent = content;
+	bool dosLineEndings = unixContent.contains( "\r\n" );
+	if ( dosLineEndings ) {
+		unixContent.replace( "\r\n", "\n" );
+	}
+
+	openDecoded( unixContent, dosLineEndings, checksum, getChecksum( unixContent.toUtf8() ).toLatin1(), readOnly );
+}
+
+void BaseFile::openDecoded( const QString &content,
+                            bool dosLineEndings,
+                            const QByteArray &checksum,
+                            const QByteArray &contentChecksum,
+                            bool readOnly ) {
 	mLastSaveChecksum = checksum;
 	mContent = content;
+	mDosLineEndings = dosLineEndings;
 	mReadOnly = readOnly;
 
-	// Detect line ending mode, then convert it to unix-style. Use unix-style line endings everywhere, only convert
-	// to DOS at save time.
+	ignoreChanges();
+	autodetectSyntax();
+	mDocument->setPlainText( mContent );
+	unignoreChanges();
+
+	mDocument->clearUndoRedoStacks();
+	savedRevision( mRevision, mDocument->availableUndoSteps(), contentChecksum );
+
+	setOpenStatus( Ready );
+}
+
+FileDecoder::FileDecoder( BaseFile *file, const QByteArray &data, const QByteArray &checksum, bool readOnly ) :
+	QObject(),
+	QRunnable(),
+	mFile( file ),
+	mGeneration( ++file->mOpenGeneration ),
+	mLocalPath(),
+	mData( data ),
+	mChecksum( checksum ),
+	mReadOnly( readOnly ),
+	mContent(),
+	mDosLineEndings( false ),
+	mContentChecksum() {
+	setAutoDelete( false );
+}
+
+FileDecoder::FileDecoder( BaseFile *file, const QString &localPath ) :
+	QObject(),
+	QRunnable(),
+	mFile( file ),
+	mGeneration( ++file->mOpenGeneration ),
+	mLocalPath( localPath ),
+	mData(),
+	mChecksum(),
+	mReadOnly( false ),
+	mContent(),
+	mDosLineEndings( false ),
+	mContentChecksum() {
+	setAutoDelete( false );
+}
+
+void FileDecoder::start( FileDecoder *decoder ) {
+	static QThreadPool *pool = NULL;
+	if ( pool == NULL ) {
+		pool = new QThreadPool();
+		pool->setMaxThreadCount( FILE_DECODER_THREADS );
+	}
+
+	pool->start( decoder );
+}
+
+void FileDecoder::run() {
+	if ( mLocalPath.isNull() ) {
+		mContent = QString::fromUtf8( mData );
+		mData.clear();
+	} else {
+		QFile fileHandle( mLocalPath );
+		fileHandle.open( QIODevice::ReadOnly );
+		mReadOnly = ! ( fileHandle.permissions() & QFile::WriteUser );
+
+		QTextStream stream( &fileHandle );
+		mContent = stream.readAll();
+		fileHandle.close();
+
+		mChecksum = BaseFile::getChecksum( mContent.toUtf8() ).toLatin1();
+	}
+
 	mDosLineEndings = mContent.contains( "\r\n" );
 	if ( mDosLineEndings ) {
 		mContent.replace( "\r\n", "\n" );
 	}
+	mContentChecksum = BaseFile::getChecksum( mContent.toUtf8() ).toLatin1();
+
+	QMetaObject::invokeMethod( this, "deliver", Qt::QueuedConnection );
+}
+
+void FileDecoder::deliver() {
+	if ( mFile && mFile->mOpenGeneration == mGeneration && mFile->getOpenStatus() != BaseFile::Closing &&
+	     ! mFile->isClosed() ) {
+		mFile->openDecoded( mContent, mDosLineEndings, mChecksum, mContentChecksum, mReadOnly );
+	}
+
+	deleteLater();
+}
+
+void BaseFile::applyDelta( const QByteArray &oldContent,
+                           const QByteArray &newContent,
+                           const QList< FileDelta::Hunk > &byteHunks,
+                           const QByteArray &checksum,
+                           bool readOnly ) {
+	QString newText = QString::fromUtf8( newContent );
+
+	mOpenGeneration++;
+	mLastSaveChecksum = checksum;
+	mReadOnly = readOnly;
 
 	ignoreChanges();
-	autodetectSyntax();
-	mDocument->setPlainText( content );
-	unignoreChanges();
+	if ( mDocument->toPlainText() == mContent ) {
+		QList< FileDelta::Hunk > hunks = FileDelta::toCharOffsets( oldContent, newContent, byteHunks );
+
+		// Apply from the bottom up so earlier offsets stay valid; one edit block means one undo step.
+		QTextCursor cursor( mDocument );
+		cursor.beginEditBlock();
+		for ( int i = hunks.length() - 1; i >= 0; i-- ) {
+			const FileDelta::Hunk &hunk = hunks.at( i );
+			cursor.setPosition( hunk.oldStart );
+			cursor.setPosition( hunk.oldStart + hunk.oldLength, QTextCursor::KeepAnchor );
+			cursor.insertText( newText.mid( hunk.newStart, hunk.newLength ) );
+		}
+		cursor.endEditBlock();
+	}
 
-	mDocument->clearUndoRedoStacks();
-	savedRevision( mRevision, mDocument->availableUndoSteps(), QByteArray( getChecksum().toLatin1() ) );
+	// If the document and content have drifted apart (eg; stray carriage returns), fall back to a full reload.
+	mContent = newText;
+	if ( mDocument->toPlainText() != mContent ) {
+		QLOG_WARN() << "Delta refresh of" << mLocation.getLabel() << "diverged; reloading document";
+		mDocument->setPlainText( mContent );
+		mDocument->clearUndoRedoStacks();
+	}
+	unignoreChanges();
 
+	savedRevision( mRevision, mDocument->availableUndoSteps(), checksum );
 	setOpenStatus( Ready );
 }
 
@@ -193,6 +325,24 @@ void BaseFile::setOpenStatus( OpenStatus newStatus ) {
 void BaseFile::editorAttached( Editor *editor ) {
 	// Call only from Editor constructor.
 	mAttachedEditors.append( editor );
+	openDeferred();
+}
+
+void BaseFile::setDeferred( int restoreLine ) {
+	mDeferred = true;
+	mRestoreLine = restoreLine;
+}
+
+void BaseFile::openDeferred() {
+	if ( ! mDeferred ) {
+		return;
+	}
+
+	// Something may have opened it meanwhile, eg a refresh.
+	mDeferred = false;
+	if ( isClosed() ) {
+		open();
+	}
 }
 
 void BaseFile::editorDetached( Editor *editor ) {
@@ -5,21 +5,29 @@
 #include <QMutex>
 #include <QObject>
 #include <QPlainTextDocumentLayout>
+#include <QPointer>
+#include <QRunnable>
 #include <QString>
 #include <QTextDocument>
 
+#include "filedelta.h"
 #include "location.h"
 
+// Opened files are read and decoded on a pool of this many threads, so opening a batch doesn't stall the UI.
+#define FILE_DECODER_THREADS 2
+
 class Editor;
+class FileDecoder;
 class SyntaxHighlighter;
 class SyntaxDefinition;
 
 class BaseFile : public QObject {
 	Q_OBJECT
+	friend class FileDecoder;
 
 	public:
 		struct Change { int revision; int position; int remove; QString insert; };
-		enum OpenStatus { Loading, LoadError, Ready, /**/ Disconnected, Reconnecting, Repairing, SyncError, /**/ Closing, Closed };
+		enum OpenStatus { Loading, LoadError, Ready, /**/ Disconnected, Reconnecting, Repairing, Refreshing, SyncError, /**/ Closing, Closed };
 		static const char *sStatusLabels[];
 
 		static BaseFile *getFile( const Location &location );
@@ -62,6 +70,17 @@ class BaseFile : public QObject {
 			return mReadOnly;
 		}
 
+		// A restored file nobody has looked at yet is left unopened, remembering only the line its cursor was on.
+		// It's opened when an editor is made for it, or when something else wants its content.
+		void setDeferred( int restoreLine );
+		void openDeferred();    // Does nothing if the file isn't deferred.
+		inline bool isDeferred() const {
+			return mDeferred;
+		}
+		inline int getRestoreLine() const {
+			return mRestoreLine;
+		}
+
 		virtual BaseFile *newFile( const QString &content ) = 0;
 		virtual void open() = 0;
 		virtual void save() = 0;
@@ -137,6 +156,13 @@ class BaseFile : public QObject {
 		void setOpenStatus( OpenStatus newStatus );
 		void setProgress( int percent );
 
+		// Takes on content that already has unix line endings; contentChecksum is of the content as it now is.
+		void openDecoded( const QString &content,
+		                  bool dosLineEndings,
+		                  const QByteArray &checksum,
+		                  const QByteArray &contentChecksum,
+		                  bool readOnly );
+
 		virtual void handleDocumentChange( int position, int removeChars, const QString &insert );
 		virtual void setLastSavedRevision( int lastSavedRevision );
 
@@ -144,6 +170,14 @@ class BaseFile : public QObject {
 
 		void autodetectSyntax();
 
+		// Brings an already-loaded file up to date by applying the changed regions found by FileDelta as
+		// document edits, leaving undo history and editor scroll positions intact.
+		void applyDelta( const QByteArray &oldContent,
+		                 const QByteArray &newContent,
+		                 const QList< FileDelta::Hunk > &byteHunks,
+		                 const QByteArray &checksum,
+		                 bool readOnly );
+
 		Location mLocation;
 		QString mContent;
 		QString mError;
@@ -169,6 +203,9 @@ class BaseFile : public QObject {
 
 		int mProgress;
 		OpenStatus mOpenStatus;
+		int mOpenGeneration;    // Bumped whenever content is loaded or starts decoding; see FileDecoder.
+		bool mDeferred;
+		int mRestoreLine;
 		QList< Editor * > mAttachedEditors;
 
 		SyntaxHighlighter *mHighlighter;
@@ -177,4 +214,34 @@ class BaseFile : public QObject {
 		                                // deletion of files from getting upset.
 };
 
+// The content of a file being opened, decoded on the decoder pool (and read there too, for local files). It's
+// handed to the file back on the main thread, unless the file has been closed meanwhile, or has loaded or started
+// decoding other content since (a refresh, or a close and reopen); each decoder is stamped with the file's open
+// generation for that.
+class FileDecoder : public QObject, public QRunnable {
+	Q_OBJECT
+
+	public:
+		FileDecoder( BaseFile *file, const QByteArray &data, const QByteArray &checksum, bool readOnly );
+		FileDecoder( BaseFile *file, const QString &localPath );
+
+		static void start( FileDecoder *decoder );
+		void run();
+
+	private slots:
+		void deliver();
+
+	private:
+		QPointer< BaseFile > mFile;     // Main thread only; the pool works from the copies below.
+		int mGeneration;
+		QString mLocalPath;
+		QByteArray mData;
+		QByteArray mChecksum;
+		bool mReadOnly;
+
+		QString mContent;
+		bool mDosLineEndings;
+		QByteArray mContentChecksum;
+};
+
 #endif  // FILE_H
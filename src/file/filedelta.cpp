@@ -0,0 +1,173 @@
+#include <QCryptographicHash>
+#include <QString>
+#include <QtCore/qmath.h>
+
+#include "filedelta.h"
+
+#define MIN_DELTA_BLOCK_SIZE 512
+#define MAX_DELTA_BLOCK_SIZE 16384
+
+static inline bool isUtf8Continuation( const QByteArray &data, int index ) {
+	return index >= 0 && index < data.size() && ( ( unsigned char ) data.at( index ) & 0xC0 ) == 0x80;
+}
+
+int FileDelta::chooseBlockSize( int contentLength ) {
+	// Roughly sqrt(n), like rsync; keeps the signature list and the literal overhead of a miss balanced.
+	int blockSize = ( int ) qSqrt( ( qreal ) contentLength );
+	blockSize = ( blockSize + 63 ) & ~63;
+	return qBound( MIN_DELTA_BLOCK_SIZE, blockSize, MAX_DELTA_BLOCK_SIZE );
+}
+
+quint32 FileDelta::weakChecksum( const unsigned char *data, int length ) {
+	// Adler-style rolling checksum, as per rsync. Must match Delta::weak in server.pl.
+	quint32 a = 0;
+	quint32 b = 0;
+	for ( int i = 0; i < length; i++ ) {
+		a += data[ i ];
+		b += ( length - i ) * data[ i ];
+	}
+
+	return ( a & 0xFFFF ) | ( ( b & 0xFFFF ) << 16 );
+}
+
+QByteArray FileDelta::signatures( const QByteArray &content, int blockSize ) {
+	const unsigned char *data = ( const unsigned char * ) content.constData();
+	int blockCount = ( content.size() + blockSize - 1 ) / blockSize;
+
+	// 8 hex chars of weak checksum, followed by the first 8 hex chars of the block's md5.
+	QByteArray result;
+	result.reserve( blockCount * 16 );
+
+	for ( int offset = 0; offset < content.size(); offset += blockSize ) {
+		int length = qMin( blockSize, content.size() - offset );
+
+		QCryptographicHash hash( QCryptographicHash::Md5 );
+		hash.addData( content.constData() + offset, length );
+
+		result.append( QByteArray::number( weakChecksum( data + offset, length ), 16 ).rightJustified( 8, '0' ) );
+		result.append( hash.result().toHex().left( 8 ) );
+	}
+
+	return result;
+}
+
+bool FileDelta::apply( const QByteArray &oldContent,
+                       int blockSize,
+                       const QVariantList &instructions,
+                       QByteArray *newContent,
+                       QList< Hunk > *hunks ) {
+	int blockCount = ( oldContent.size() + blockSize - 1 ) / blockSize;
+	int oldCursor = 0;
+	int hunkNewStart = 0;
+
+	newContent->clear();
+	newContent->reserve( oldContent.size() );
+	hunks->clear();
+
+	foreach ( const QVariant &instruction, instructions ) {
+		QByteArray op = instruction.toByteArray();
+
+		if ( op.startsWith( 'c' ) ) {
+			int comma = op.indexOf( ',' );
+			if ( comma < 0 ) {
+				return false;
+			}
+
+			bool firstOk, countOk;
+			int first = op.mid( 1, comma - 1 ).toInt( &firstOk );
+			int count = op.mid( comma + 1 ).toInt( &countOk );
+			if ( ! firstOk || ! countOk || first < 0 || count < 1 || first + count > blockCount ) {
+				return false;
+			}
+
+			int start = first * blockSize;
+			int length = qMin( count * blockSize, oldContent.size() - start );
+
+			if ( start >= oldCursor ) {
+				// Everything skipped over in the old copy, and added to the new one since the last in-order
+				// copy, is a single changed region.
+				if ( start > oldCursor || newContent->size() > hunkNewStart ) {
+					Hunk hunk = { oldCursor, start - oldCursor, hunkNewStart, newContent->size() - hunkNewStart };
+					hunks->append( hunk );
+				}
+
+				newContent->append( oldContent.constData() + start, length );
+				oldCursor = start + length;
+				hunkNewStart = newContent->size();
+			} else {
+				// Blocks reused out of order are treated as new data.
+				newContent->append( oldContent.constData() + start, length );
+			}
+		} else if ( op.startsWith( 'l' ) ) {
+			newContent->append( QByteArray::fromBase64( op.mid( 1 ) ) );
+		} else {
+			return false;
+		}
+	}
+
+	if ( oldCursor < oldContent.size() || newContent->size() > hunkNewStart ) {
+		Hunk hunk = { oldCursor, oldContent.size() - oldCursor, hunkNewStart, newContent->size() - hunkNewStart };
+		hunks->append( hunk );
+	}
+
+	return true;
+}
+
+QList< FileDelta::Hunk > FileDelta::toCharOffsets( const QByteArray &oldContent,
+                                                   const QByteArray &newContent,
+                                                   const QList< Hunk > &byteHunks ) {
+	// Widen each hunk so it never splits a multi-byte character. The bytes either side of a hunk come from the
+	// same copied block in both versions, so both sides can be moved together.
+	QList< Hunk > widened;
+	foreach ( Hunk hunk, byteHunks ) {
+		while ( hunk.oldStart > 0 && hunk.newStart > 0 &&
+		        ( isUtf8Continuation( oldContent, hunk.oldStart ) ||
+		          isUtf8Continuation( newContent, hunk.newStart ) ) ) {
+			hunk.oldStart--;
+			hunk.newStart--;
+			hunk.oldLength++;
+			hunk.newLength++;
+		}
+
+		while ( hunk.oldStart + hunk.oldLength < oldContent.size() &&
+		        hunk.newStart + hunk.newLength < newContent.size() &&
+		        ( isUtf8Continuation( oldContent, hunk.oldStart + hunk.oldLength ) ||
+		          isUtf8Continuation( newContent, hunk.newStart + hunk.newLength ) ) ) {
+			hunk.oldLength++;
+			hunk.newLength++;
+		}
+
+		if ( ! widened.isEmpty() && hunk.oldStart <= widened.last().oldStart + widened.last().oldLength ) {
+			Hunk &last = widened.last();
+			last.oldLength = hunk.oldStart + hunk.oldLength - last.oldStart;
+			last.newLength = hunk.newStart + hunk.newLength - last.newStart;
+		} else {
+			widened.append( hunk );
+		}
+	}
+
+	// Walk both copies once, converting byte offsets to UTF-16 offsets as we go.
+	QList< Hunk > result;
+	int oldByteCursor = 0, oldCharCursor = 0;
+	int newByteCursor = 0, newCharCursor = 0;
+	foreach ( const Hunk &hunk, widened ) {
+		oldCharCursor +=
+			QString::fromUtf8( oldContent.constData() + oldByteCursor, hunk.oldStart - oldByteCursor ).length();
+		newCharCursor +=
+			QString::fromUtf8( newContent.constData() + newByteCursor, hunk.newStart - newByteCursor ).length();
+
+		Hunk converted;
+		converted.oldStart = oldCharCursor;
+		converted.oldLength = QString::fromUtf8( oldContent.constData() + hunk.oldStart, hunk.oldLength ).length();
+		converted.newStart = newCharCursor;
+		converted.newLength = QString::fromUtf8( newContent.constData() + hunk.newStart, hunk.newLength ).length();
+		result.append( converted );
+
+		oldByteCursor = hunk.oldStart + hunk.oldLength;
+		oldCharCursor += converted.oldLength;
+		newByteCursor = hunk.newStart + hunk.newLength;
+		newCharCursor += converted.newLength;
+	}
+
+	return result;
+}
@@ -0,0 +1,41 @@
+#ifndef FILEDELTA_H
+#define FILEDELTA_H
+
+#include <QByteArray>
+#include <QList>
+#include <QVariantList>
+
+//
+// rsync-style delta support for refreshing remote files. The client sends the block signatures of the copy it
+// already holds, the server script replies with a list of instructions that rebuild the new copy from those
+// blocks plus literal data. See msg_open / Delta in server.pl for the other half.
+//
+// Instruction format (one string each):
+//   "c<first>,<count>" - copy <count> consecutive blocks starting at block <first> of the old content
+//   "l<base64>"        - insert literal bytes
+//
+
+class FileDelta {
+	public:
+		// A single changed region; offsets are in bytes until converted with toCharOffsets.
+		struct Hunk { int oldStart; int oldLength; int newStart; int newLength; };
+
+		static int chooseBlockSize( int contentLength );
+		static quint32 weakChecksum( const unsigned char *data, int length );
+		static QByteArray signatures( const QByteArray &content, int blockSize );
+
+		// Rebuilds the new content from the old one. Returns false if the instructions are malformed.
+		// hunks receives the minimal list of changed regions (in byte offsets) in ascending order.
+		static bool apply( const QByteArray &oldContent,
+		                   int blockSize,
+		                   const QVariantList &instructions,
+		                   QByteArray *newContent,
+		                   QList< Hunk > *hunks );
+
+		// Widens byte hunks to UTF-8 character boundaries and converts them to QString (UTF-16) offsets.
+		static QList< Hunk > toCharOffsets( const QByteArray &oldContent,
+		                                    const QByteArray &newContent,
+		                                    const QList< Hunk > &byteHunks );
+};
+
+#endif  // FILEDELTA_H
@@ -37,6 +37,55 @@
 	#define UPDIR_MODIFIER Qt::AltModifier
 #endif
 
+// A cell of the file list that looks up its icon, size or date when the view first asks for it. On a network mount,
+// that's the slow part of listing a local folder; this way only the rows on screen (or a sort by that column) pay.
+class FileListItem : public QStandardItem {
+	public:
+		enum Column { Name, Size, LastModified };
+
+		FileListItem( const Location &location, Column column ) :
+			QStandardItem(),
+			mLocation( location ),
+			mColumn( column ),
+			mIcon() {}
+
+		QVariant data( int role ) const {
+			switch ( mColumn ) {
+				case Name:
+					if ( role == Qt::DecorationRole ) {
+						if ( mIcon.isNull() ) {
+							mIcon = mLocation.getIcon();
+						}
+						return mIcon;
+					}
+					break;
+
+				case Size:
+					if ( role == Qt::DisplayRole ) {
+						return mLocation.isDirectory() ? QString() : Tools::humanReadableBytes( mLocation.getSize() );
+					} else if ( role == SORT_ROLE ) {
+						return mLocation.getSize();
+					}
+					break;
+
+				case LastModified:
+					if ( role == Qt::DisplayRole ) {
+						return mLocation.getLastModified().toString();
+					} else if ( role == SORT_ROLE ) {
+						return mLocation.getLastModified();
+					}
+					break;
+			}
+
+			return QStandardItem::data( role );
+		}
+
+	private:
+		Location mLocation;
+		Column mColumn;
+		mutable QIcon mIcon;
+};
+
 Location FileDialog::mLastLocation;
 
 FileDialog::FileDialog( QWidget *parent, bool saveAs ) :
@@ -66,6 +115,10 @@ FileDialog::FileDialog( QWidget *parent, bool saveAs ) :
 	ui->fileList->setFocus();
 	ui->fileList->horizontalHeader()->setHighlightSections( false );
 	ui->fileList->horizontalHeader()->setSortIndicatorShown( true );
+	// Sizing columns to contents goes by the horizontal header's precision, and rows by the vertical one's; only
+	// measure what's on screen, rather than the first 1000 entries of a big folder.
+	ui->fileList->horizontalHeader()->setResizeContentsPrecision( 0 );
+	ui->fileList->verticalHeader()->setResizeContentsPrecision( 0 );
 
 	QList< int > sizes = ui->splitter->sizes();
 	sizes[ 0 ] = 1;
@@ -93,6 +146,11 @@ FileDialog::FileDialog( QWidget *parent, bool saveAs ) :
 	         this,
 	         SLOT( folderChildrenLoaded( QList< Location >, QString ) ),
 	         Qt::QueuedConnection );
+	connect( gDispatcher,
+	         SIGNAL( locationListPart( QList< Location >, QString, bool ) ),
+	         this,
+	         SLOT( folderChildrenPart( QList< Location >, QString, bool ) ),
+	         Qt::QueuedConnection );
 	connect( gDispatcher,
 	         SIGNAL( locationListFailure( QString, QString, bool ) ),
 	         this,
@@ -105,6 +163,7 @@ FileDialog::FileDialog( QWidget *parent, bool saveAs ) :
 	         SIGNAL( buttonClicked( StatusWidget::Button ) ),
 	         this,
 	         SLOT( statusButtonClicked( StatusWidget::Button ) ) );
+	connect( ui->streamingCancel, SIGNAL( clicked() ), this, SLOT( cancelStreaming() ) );
 	connect( ui->showHidden, SIGNAL( stateChanged( int ) ), this, SLOT( refresh() ) );
 	connect( ui->filterList, SIGNAL( currentIndexChanged( int ) ), this, SLOT( refresh() ) );
 	connect( ui->fileName, SIGNAL( currentIndexChanged( int ) ), this, SLOT( fileNameIndexChanged() ) );
@@ -348,113 +407,157 @@ void FileDialog::locationExpanded( CustomTreeEntry *entry ) {
 }
 
 void FileDialog::folderChildrenLoaded( const QList< Location > &children, const QString &locationPath ) {
+	mStreamingLocations.remove( locationPath );
+
 	// Update the folder tree if appropriate
 	CustomTreeEntry *entry = mLoadingLocations.value( locationPath, NULL );
 	if ( entry ) {
 		mLoadingLocations.remove( locationPath );
 		entry->removeAllChildren();
+		addFoldersToTree( entry, children );
+	}
 
-		foreach ( Location childLocation, children ) {
-			if ( childLocation.isDirectory() && ! childLocation.isHidden() ) {
-				addLocationToTree( entry, childLocation );
-			}
+	// Update the file list if appropriate
+	if ( mCurrentLocation.getPath() == locationPath ) {
+		beginFileList();
+		addToFileList( children );
+		endFileList();
+		updateStreamingBar();
+	}
+}
+
+void FileDialog::folderChildrenPart( const QList< Location > &children, const QString &locationPath, bool complete ) {
+	// The first part replaces whatever was there; the rest add to it. Sorting waits for the last.
+	bool first = ! mStreamingLocations.contains( locationPath );
+	if ( complete ) {
+		mStreamingLocations.remove( locationPath );
+	} else {
+		mStreamingLocations.insert( locationPath );
+	}
+
+	CustomTreeEntry *entry = mLoadingLocations.value( locationPath, NULL );
+	if ( entry ) {
+		if ( first ) {
+			entry->removeAllChildren();
+		}
+		addFoldersToTree( entry, children );
+		if ( complete ) {
+			mLoadingLocations.remove( locationPath );
 		}
 	}
 
-	// Update the file list if appropriate
 	if ( mCurrentLocation.getPath() == locationPath ) {
-		ui->fileListStack->setCurrentWidget( ui->fileListLayer );
-		mFileListModel->clear();
-
-		ui->fileName->clear();
-
-		QStringList headerLabels;
-		headerLabels.append( "Filename" );
-		headerLabels.append( "Size" );
-		headerLabels.append( "Last Modified" );
-		mFileListModel->setHorizontalHeaderLabels( headerLabels );
-		ui->fileList->setColumnWidth( 0, 250 );
-
-		QVariant itemData = ui->filterList->itemData( ui->filterList->currentIndex() );
-		QList< QVariant > filters =
-			( itemData.isValid() ? ui->filterList->itemData( ui->filterList->currentIndex() ).toList() :
-			  QList<
-				  QVariant >() );
-
-		foreach ( Location childLocation, children ) {
-			const QString &name = childLocation.getLabel();
-			if ( ! childLocation.isDirectory() && filters.length() ) {
-				bool match = false;
-				foreach ( QVariant filter, filters ) {
-					if ( filter.toRegExp().exactMatch( name ) ) {
-						match = true;
-						break;
-					}
-				}
+		if ( first ) {
+			beginFileList();
+		}
+		addToFileList( children );
+		if ( complete ) {
+			endFileList();
+		}
+		updateStreamingBar();
+	}
+}
+
+void FileDialog::addFoldersToTree( CustomTreeEntry *entry, const QList< Location > &children ) {
+	foreach ( Location childLocation, children ) {
+		if ( childLocation.isDirectory() && ! childLocation.isHidden() ) {
+			addLocationToTree( entry, childLocation );
+		}
+	}
+}
+
+void FileDialog::beginFileList() {
+	ui->fileListStack->setCurrentWidget( ui->fileListLayer );
+	mFileListModel->clear();
 
-				if ( ! match ) {
-					continue;
+	ui->fileName->clear();
+
+	QStringList headerLabels;
+	headerLabels.append( "Filename" );
+	headerLabels.append( "Size" );
+	headerLabels.append( "Last Modified" );
+	mFileListModel->setHorizontalHeaderLabels( headerLabels );
+	ui->fileList->setColumnWidth( 0, 250 );
+}
+
+void FileDialog::addToFileList( const QList< Location > &children ) {
+	QVariant itemData = ui->filterList->itemData( ui->filterList->currentIndex() );
+	QList< QVariant > filters =
+		( itemData.isValid() ? ui->filterList->itemData( ui->filterList->currentIndex() ).toList() :
+		  QList<
+			  QVariant >() );
+
+	foreach ( Location childLocation, children ) {
+		const QString &name = childLocation.getLabel();
+		if ( ! childLocation.isDirectory() && filters.length() ) {
+			bool match = false;
+			foreach ( QVariant filter, filters ) {
+				if ( filter.toRegExp().exactMatch( name ) ) {
+					match = true;
+					break;
 				}
 			}
 
-			if ( ! childLocation.isDirectory() ) {
-				ui->fileName->addItem( name );
+			if ( ! match ) {
+				continue;
 			}
+		}
 
-			QList< QStandardItem * > row;
-
-			QStandardItem *item = new QStandardItem();
-			item->setIcon( childLocation.getIcon() );
-			item->setText( name );
-			item->setData( QVariant::fromValue< Location >( childLocation ), DATA_ROLE );
-			item->setData( QVariant( name.toLower() ), SORT_ROLE );
-			row.append( item );
+		if ( ! childLocation.isDirectory() ) {
+			ui->fileName->addItem( name );
+		}
 
-			int size = childLocation.getSize();
-			item = new QStandardItem();
-			item->setText( childLocation.isDirectory() ? "" : Tools::humanReadableBytes( size ) );
-			item->setData( QVariant( size ), SORT_ROLE );
-			row.append( item );
+		QList< QStandardItem * > row;
 
-			QDateTime lastModified = childLocation.getLastModified();
-			item = new QStandardItem();
-			item->setText( lastModified.toString() );
-			item->setData( QVariant( lastModified ), SORT_ROLE );
-			row.append( item );
+		QStandardItem *item = new FileListItem( childLocation, FileListItem::Name );
+		item->setText( name );
+		item->setData( QVariant::fromValue< Location >( childLocation ), DATA_ROLE );
+		item->setData( QVariant( name.toLower() ), SORT_ROLE );
+		row.append( item );
 
-			item = new QStandardItem();
-			item->setData( QVariant( childLocation.isDirectory() ? 0 : 1 ), SORT_ROLE );
-			row.append( item );
+		row.append( new FileListItem( childLocation, FileListItem::Size ) );
+		row.append( new FileListItem( childLocation, FileListItem::LastModified ) );
 
-			mFileListModel->appendRow( row );
-		}
+		item = new QStandardItem();
+		item->setData( QVariant( childLocation.isDirectory() ? 0 : 1 ), SORT_ROLE );
+		row.append( item );
 
-		ui->fileName->setCurrentIndex( -1 );
+		mFileListModel->appendRow( row );
+	}
+}
 
-		ui->fileList->resizeColumnsToContents();
-		ui->fileList->resizeRowsToContents();
-		ui->fileList->setColumnWidth( 0, ui->fileList->columnWidth( 0 ) + 30 );
-		ui->fileList->setColumnWidth( 1, ui->fileList->columnWidth( 1 ) + 30 );
-		ui->fileList->setColumnHidden( 3, true );
+void FileDialog::endFileList() {
+	ui->fileName->setCurrentIndex( -1 );
 
-		applySort();
+	// Rows are all alike; sizing each would look up every file (see FileListItem).
+	ui->fileList->resizeColumnsToContents();
+	if ( mFileListModel->rowCount() > 0 ) {
+		ui->fileList->resizeRowToContents( 0 );
+		ui->fileList->verticalHeader()->setDefaultSectionSize( ui->fileList->rowHeight( 0 ) );
+	}
+	ui->fileList->setColumnWidth( 0, ui->fileList->columnWidth( 0 ) + 30 );
+	ui->fileList->setColumnWidth( 1, ui->fileList->columnWidth( 1 ) + 30 );
+	ui->fileList->setColumnHidden( 3, true );
 
-		if ( ! mSelectFile.isNull() ) {
-			QList< QStandardItem * > items = mFileListModel->findItems( mSelectFile );
+	applySort();
 
-			QItemSelectionModel *mdl = ui->fileList->selectionModel();
-			mdl->clearSelection();
+	if ( ! mSelectFile.isNull() ) {
+		QList< QStandardItem * > items = mFileListModel->findItems( mSelectFile );
 
-			foreach ( QStandardItem *item, items ) {
-				mdl->select( item->index(), QItemSelectionModel::Select );
-			}
+		QItemSelectionModel *mdl = ui->fileList->selectionModel();
+		mdl->clearSelection();
 
-			mSelectFile = "";
+		foreach ( QStandardItem *item, items ) {
+			mdl->select( item->index(), QItemSelectionModel::Select );
 		}
+
+		mSelectFile = "";
 	}
 }
 
-void FileDialog::folderChildrenFailed( const QString &error, const QString & /*locationPath*/, bool permissionError ) {
+void FileDialog::folderChildrenFailed( const QString &error, const QString &locationPath, bool permissionError ) {
+	mStreamingLocations.remove( locationPath );
+	updateStreamingBar();
 	mFileListModel->clear();
 
 	showStatus( QPixmap( ":/icons/error.png" ), QString( "Error: " + error ) );
@@ -495,6 +598,14 @@ void FileDialog::statusButtonClicked( StatusWidget::Button button ) {
 			showLocation( mCurrentLocation );
 			break;
 
+		case StatusWidget::Cancel:
+			mCurrentLocation.cancelListing();
+			mStreamingLocations.remove( mCurrentLocation.getPath() );
+			updateStreamingBar();
+			showStatus( QPixmap( ":/icons/error.png" ), tr( "Cancelled" ) );
+			ui->statusWidget->setButtons( StatusWidget::Retry );
+			break;
+
 		case StatusWidget::ShowLog: {
 			SshHost *host = mCurrentLocation.getRemoteHost();
 			if ( host != NULL ) {
@@ -507,6 +618,26 @@ void FileDialog::statusButtonClicked( StatusWidget::Button button ) {
 	}
 }
 
+void FileDialog::cancelStreaming() {
+	QString path = mCurrentLocation.getPath();
+	if ( ! mStreamingLocations.contains( path ) ) {
+		return;
+	}
+
+	mCurrentLocation.cancelListing();
+	mStreamingLocations.remove( path );
+	endFileList();
+	updateStreamingBar();
+}
+
+void FileDialog::updateStreamingBar() {
+	bool streaming = ( ! mCurrentLocation.isNull() && mStreamingLocations.contains( mCurrentLocation.getPath() ) );
+	if ( streaming ) {
+		ui->streamingLabel->setText( tr( "Loading ... (%1 so far)" ).arg( mFileListModel->rowCount() ) );
+	}
+	ui->streamingBar->setVisible( streaming );
+}
+
 void FileDialog::showLocation( const Location &location ) {
 	if ( location.isNull() ) {
 		return;
@@ -514,11 +645,21 @@ void FileDialog::showLocation( const Location &location ) {
 
 	mLastLocation = location;
 
+	// Whatever is still coming in for the last location would only be thrown away, unless the tree wants it.
+	if ( ! mCurrentLocation.isNull() && ! mLoadingLocations.contains( mCurrentLocation.getPath() ) ) {
+		mCurrentLocation.cancelListing();
+		mStreamingLocations.remove( mCurrentLocation.getPath() );
+	}
+
 	ui->currentPath->setText( location.getDisplayPath() );
 	mCurrentLocation = location;
+	updateStreamingBar();
 
 	mFileListModel->clear();
 	showStatus( QPixmap( ":/icons/loading.png" ), tr( "Loading ..." ) );
+	if ( location.getRemoteHost() != NULL ) {
+		ui->statusWidget->setButtons( StatusWidget::Cancel );
+	}
 
 	mCurrentLocation.asyncGetChildren( ui->showHidden->isChecked() );
 
@@ -657,6 +798,10 @@ void FileDialog::accept() {
 }
 
 void FileDialog::closing() {
+	if ( ! mCurrentLocation.isNull() ) {
+		mCurrentLocation.cancelListing();
+	}
+
 	// Save the geometry of this window on the way out
 	QSettings settings;
 	settings.setValue( "filedialog/geometry", saveGeometry() );
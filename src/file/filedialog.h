@@ -6,6 +6,7 @@
 #include <QFileIconProvider>
 #include <QMap>
 #include <QMouseEvent>
+#include <QSet>
 #include <QStandardItemModel>
 #include <QTableView>
 #include <QTreeWidgetItem>
@@ -54,6 +55,7 @@ class FileDialog : public QDialog {
 
 	private slots:
 		void folderChildrenLoaded( const QList< Location > &children, const QString &locationPath );
+		void folderChildrenPart( const QList< Location > &children, const QString &locationPath, bool complete );
 		void folderChildrenFailed( const QString &error, const QString &locationPath, bool permissionError );
 		void upLevel();
 		void fileDoubleClicked( QModelIndex index );
@@ -63,6 +65,7 @@ class FileDialog : public QDialog {
 		void addToFavorites();
 		void createNewFolder();
 		void statusButtonClicked( StatusWidget::Button button );// Called when "try again" or "sudo" is clicked
+		void cancelStreaming(); // Stops a listing that's still arriving, keeping what's shown so far.
 		                                                        // on an
 		                                                        // error
 		void refresh();
@@ -84,8 +87,14 @@ class FileDialog : public QDialog {
 		void showStatus( const QPixmap &icon, const QString &text );
 		void applySort();
 
+		void beginFileList();
+		void addToFileList( const QList< Location > &children );
+		void endFileList();
+		void updateStreamingBar();      // Shown while the current location's listing is still arriving.
+
 		void populateFolderTree();
 		CustomTreeEntry *addLocationToTree( CustomTreeEntry *parent, const Location &location );
+		void addFoldersToTree( CustomTreeEntry *entry, const QList< Location > &children );
 		void updateFavorites();
 		void populateFilterList();
 
@@ -100,6 +109,7 @@ class FileDialog : public QDialog {
 #endif
 
 		QMap< QString, CustomTreeEntry * > mLoadingLocations;
+		QSet< QString > mStreamingLocations;    // Listings that have started arriving in parts.
 
 		static Location mLastLocation;
 
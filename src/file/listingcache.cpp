@@ -0,0 +1,167 @@
+#include <QPair>
+#include <algorithm>
+
+#include "listingcache.h"
+
+ListingCache::ListingCache() :
+	mListings(),
+	mTrees(),
+	mUseCounter( 0 ),
+	mTotalEntries( 0 ) {}
+
+QString ListingCache::makeKey( const QString &remotePath, int flags ) {
+	return QString::number( flags & AllFlags ) + ":" + remotePath;
+}
+
+bool ListingCache::lookup( const QString &remotePath, int flags, QVariantMap *entries, bool *fresh ) {
+	QHash< QString, Listing >::iterator i = mListings.find( makeKey( remotePath, flags ) );
+	if ( i == mListings.end() ) {
+		for ( int t = mTrees.length() - 1; t >= 0; t-- ) {
+			if ( ( mTrees[ t ]->getFlags() & AllFlags ) == ( flags & AllFlags ) &&
+			     mTrees[ t ]->getListing( remotePath, entries ) ) {
+				*fresh = ( mTrees[ t ]->getFetched().msecsTo( QDateTime::currentDateTimeUtc() ) <
+				           LISTING_CACHE_FRESH_MSEC );
+				return true;
+			}
+		}
+		return false;
+	}
+
+	i->lastUsed = ++mUseCounter;
+	*entries = i->entries;
+	*fresh = ( i->fetched.msecsTo( QDateTime::currentDateTimeUtc() ) < LISTING_CACHE_FRESH_MSEC );
+	return true;
+}
+
+bool ListingCache::store( const QString &remotePath, int flags, const QVariantMap &entries ) {
+	QString key = makeKey( remotePath, flags );
+	QHash< QString, Listing >::iterator i = mListings.find( key );
+	bool changed = ( i == mListings.end() || i->entries != entries );
+
+	remove( key );
+	if ( entries.count() > LISTING_CACHE_MAX_ENTRIES ) {
+		return changed;
+	}
+
+	Listing listing;
+	listing.entries = entries;
+	listing.fetched = QDateTime::currentDateTimeUtc();
+	listing.lastUsed = ++mUseCounter;
+	mListings.insert( key, listing );
+	mTotalEntries += entries.count();
+
+	trim();
+	return changed;
+}
+
+void ListingCache::invalidate( const QString &remotePath ) {
+	for ( int flags = 0; flags <= AllFlags; flags++ ) {
+		remove( makeKey( remotePath, flags ) );
+	}
+	foreach ( const QSharedPointer< RemoteTree > &tree, mTrees ) {
+		tree->invalidate( remotePath );
+	}
+}
+
+void ListingCache::clear() {
+	mListings.clear();
+	mTrees.clear();
+	mTotalEntries = 0;
+}
+
+void ListingCache::storeTree( const QSharedPointer< RemoteTree > &tree ) {
+	for ( int i = mTrees.length() - 1; i >= 0; i-- ) {
+		if ( mTrees[ i ]->getRootPath() == tree->getRootPath() && mTrees[ i ]->getFlags() == tree->getFlags() ) {
+			mTrees.removeAt( i );
+		}
+	}
+
+	mTrees.append( tree );
+	while ( mTrees.length() > LISTING_CACHE_MAX_TREES ) {
+		mTrees.removeFirst();
+	}
+}
+
+QSharedPointer< RemoteTree > ListingCache::findTree( const QString &remotePath, int flags ) const {
+	for ( int i = mTrees.length() - 1; i >= 0; i-- ) {
+		if ( mTrees[ i ]->getFlags() == flags && mTrees[ i ]->contains( remotePath ) ) {
+			return mTrees[ i ];
+		}
+	}
+	return QSharedPointer< RemoteTree >();
+}
+
+void ListingCache::remove( const QString &key ) {
+	QHash< QString, Listing >::iterator i = mListings.find( key );
+	if ( i != mListings.end() ) {
+		mTotalEntries -= i->entries.count();
+		mListings.erase( i );
+	}
+}
+
+void ListingCache::trim() {
+	while ( mListings.count() > LISTING_CACHE_MAX_DIRECTORIES || mTotalEntries > LISTING_CACHE_MAX_ENTRIES ) {
+		QHash< QString, Listing >::const_iterator oldest = mListings.constBegin();
+		for ( QHash< QString, Listing >::const_iterator i = mListings.constBegin(); i != mListings.constEnd(); ++i ) {
+			if ( i->lastUsed < oldest->lastUsed ) {
+				oldest = i;
+			}
+		}
+		remove( oldest.key() );
+	}
+}
+
+QVariantList ListingCache::save() const {
+	// Most recently used first, as many as fit.
+	QList< QPair< quint64, QString > > byUse;
+	for ( QHash< QString, Listing >::const_iterator i = mListings.constBegin(); i != mListings.constEnd(); ++i ) {
+		byUse.append( qMakePair( i->lastUsed, i.key() ) );
+	}
+	std::sort( byUse.begin(), byUse.end() );
+
+	QVariantList result;
+	int savedEntries = 0;
+	for ( int i = byUse.length() - 1; i >= 0 && result.length() < LISTING_CACHE_SAVED_DIRECTORIES; i-- ) {
+		const QString &key = byUse[ i ].second;
+		const Listing &listing = mListings[ key ];
+		if ( savedEntries + listing.entries.count() > LISTING_CACHE_SAVED_ENTRIES ) {
+			continue;
+		}
+		savedEntries += listing.entries.count();
+
+		int separator = key.indexOf( ':' );
+		QVariantMap saved;
+		saved.insert( "flags", key.left( separator ).toInt() );
+		saved.insert( "path", key.mid( separator + 1 ) );
+		saved.insert( "fetched", listing.fetched );
+		saved.insert( "entries", listing.entries );
+		result.append( saved );
+	}
+
+	return result;
+}
+
+void ListingCache::restore( const QVariantList &saved ) {
+	clear();
+
+	// Saved most recently used first; keep it that way.
+	for ( int i = saved.length() - 1; i >= 0; i-- ) {
+		QVariantMap item = saved[ i ].toMap();
+		QString path = item.value( "path" ).toString();
+		if ( path.isEmpty() ) {
+			continue;
+		}
+
+		Listing listing;
+		listing.entries = item.value( "entries" ).toMap();
+		listing.fetched = item.value( "fetched" ).toDateTime();
+		listing.lastUsed = ++mUseCounter;
+
+		QString key = makeKey( path, item.value( "flags" ).toInt() );
+		remove( key );
+		mListings.insert( key, listing );
+		mTotalEntries += listing.entries.count();
+	}
+
+	trim();
+}
@@ -0,0 +1,89 @@
+#ifndef LISTINGCACHE_H
+#define LISTINGCACHE_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QSharedPointer>
+#include <QString>
+#include <QVariantList>
+#include <QVariantMap>
+
+#include "file/remotetree.h"
+
+//
+// Remembers a host's directory listings, so a remote folder can be shown straight away while it's fetched again in
+// the background (stale-while-revalidate). Listings are kept as the "entries" map both flavours of ls reply with,
+// along with when they were fetched; storing a fresh one says whether anything changed.
+//
+// The cache is bounded by directory count and by total entries, dropping the least recently used listings first.
+// Only the most recently used listings are saved, to a cache file at exit (see Tools::saveListingCaches). Main
+// thread only.
+//
+// Trees of whole folders are kept alongside; a listing that isn't cached is taken from a tree that covers it, if
+// any. A tree is trusted as fresh for as long as a listing would be, counting from when it was asked for; trees
+// aren't saved.
+//
+
+#define LISTING_CACHE_MAX_DIRECTORIES 512
+#define LISTING_CACHE_MAX_ENTRIES 200000
+
+// Listings fetched this recently are trusted as they are; saves asking twice when a folder is shown and expanded.
+#ifndef LISTING_CACHE_FRESH_MSEC
+	#define LISTING_CACHE_FRESH_MSEC 2000
+#endif
+
+// Limits on what is saved.
+#define LISTING_CACHE_SAVED_DIRECTORIES 64
+#define LISTING_CACHE_SAVED_ENTRIES 20000
+
+// Trees kept at once; the oldest goes first.
+#define LISTING_CACHE_MAX_TREES 4
+
+class ListingCache {
+	public:
+		// The same directory lists differently depending on how it's asked.
+		enum Flag { Hidden = 1, Sudo = 2, Sftp = 4, AllFlags = 7 };
+
+		ListingCache();
+
+		// Returns false if there is nothing cached. fresh is set if the listing doesn't need revalidating.
+		bool lookup( const QString &remotePath, int flags, QVariantMap *entries, bool *fresh );
+
+		// Returns true if the listing is new or different from the cached one.
+		bool store( const QString &remotePath, int flags, const QVariantMap &entries );
+
+		void invalidate( const QString &remotePath );   // All flavours of it.
+		void clear();
+
+		// Replaces any tree of the same folder and flavour.
+		void storeTree( const QSharedPointer< RemoteTree > &tree );
+		QSharedPointer< RemoteTree > findTree( const QString &remotePath, int flags ) const;
+
+		inline int count() const {
+			return mListings.count();
+		}
+		inline int getTotalEntries() const {
+			return mTotalEntries;
+		}
+
+		QVariantList save() const;
+		void restore( const QVariantList &saved );
+
+	private:
+		struct Listing {
+			QVariantMap entries;
+			QDateTime fetched;
+			quint64 lastUsed;
+		};
+
+		static QString makeKey( const QString &remotePath, int flags );
+		void remove( const QString &key );
+		void trim();
+
+		QHash< QString, Listing > mListings;
+		QList< QSharedPointer< RemoteTree > > mTrees;   // Newest last.
+		quint64 mUseCounter;
+		int mTotalEntries;
+};
+
+#endif  // LISTINGCACHE_H
@@ -22,23 +22,11 @@ BaseFile *LocalFile::newFile( const QString &content ) {
 }
 
 void LocalFile::open() {
-	QFile fileHandle( mLocation.getPath() );
-	fileHandle.open( QIODevice::ReadOnly );
-
-	bool readOnly = false;
-	if ( ! ( fileHandle.permissions() & QFile::WriteUser ) ) {
-		readOnly = true;
+	if ( isClosed() ) {
+		setOpenStatus( Loading );
 	}
 
-	QTextStream stream( &fileHandle );
-
-	QString content = stream.readAll();
-
-	fileHandle.close();
-
-	mContent = content;
-
-	emit localFileOpened( content, getChecksum().toLatin1(), readOnly );
+	FileDecoder::start( new FileDecoder( this, mLocation.getPath() ) );
 }
 
 void LocalFile::save() {
@@ -5,8 +5,10 @@
 #include <QMetaMethod>
 #include <QObject>
 #include <QSettings>
+#include <QThreadPool>
 
 #include "file/favoritelocationdialog.h"
+#include "file/listingcache.h"
 #include "file/location.h"
 #include "file/openfilemanager.h"
 #include "file/serverfile.h"
@@ -18,12 +20,13 @@
 
 #ifdef Q_OS_WIN32
 	#include <windows.h>
+#else
+	#include <dirent.h>
+	#include <errno.h>
+	#include <string.h>
+	#include <sys/stat.h>
 #endif
 
-QRegExp gSshServerRegExp( "^(?:([^@:]+)@)?([a-zA-Z0-9_\\-.]{2,}):(.+)?" );
-QRegExp gSftpServerRegExp( "^sftp://(([^@/]+)@)?([^/]+)(.*)" );
-QRegExp gLocalPathSeparators( "/" );
-QRegExp gSshPathSeparators( "[/:]" );
 QList< Location::Favorite > Location::sFavorites;
 
 
@@ -86,14 +89,14 @@ Location::Location( const QString &path ) {
 }
 
 Location::Location( const Location &parent,
-                    const QString &path,
+                    const QString &name,
                     Type type,
                     int size,
                     QDateTime lastModified,
                     bool canRead,
                     bool canWrite ) {
 	mData = new LocationShared();
-	mData->setPath( path );
+	mData->setChildPath( parent.mData, name );
 	mData->mType = type;
 	mData->mSize = size;
 	mData->mLastModified = lastModified;
@@ -103,6 +106,15 @@ Location::Location( const Location &parent,
 	mData->mCanWrite = canWrite;
 }
 
+Location::Location( const Location &parent, const QString &name, Type type ) {
+	mData = new LocationShared();
+	mData->setChildPath( parent.mData, name );
+	mData->mType = type;
+	mData->mSelfLoaded = true;
+	mData->mStatPending = ( mData->mProtocol == Local );
+	mData->mParent = parent;
+}
+
 LocationShared::LocationShared() :
 	mReferences( 1 ),
 	mPath(),
@@ -112,17 +124,13 @@ LocationShared::LocationShared() :
 	mLastModified(),
 	mParent(),
 	mSelfLoaded( false ),
+	mStatPending( false ),
 	mSize( -1 ),
 	mCanRead( false ),
 	mCanWrite( false ),
 	mSudo( false ),
 	mHost( NULL ),
-	mRemoteHostName(),
-	mRemoteUserName(),
-	mRemotePath(),
-	mRemoteHost( NULL ),
-	mServerChannel( NULL ),
-	mFtpChannel( NULL ) {
+	mListings() {
 	initIconProvider();
 }
 
@@ -140,7 +148,7 @@ Location::~Location() {
 /////////////////////////////
 
 const QString &Location::getPath() const {
-	return mData->mPath;
+	return mData->mPath.getPath();
 }
 
 const QString &Location::getLabel() const {
@@ -152,26 +160,42 @@ bool Location::isNull() const {
 }
 
 int Location::getSize() const {
+	if ( mData->mStatPending ) {
+		mData->localLoadAttributes();
+	}
+
 	return mData->mSize;
 }
 
 const QDateTime &Location::getLastModified() const {
+	if ( mData->mStatPending ) {
+		mData->localLoadAttributes();
+	}
+
 	return mData->mLastModified;
 }
 
 bool Location::canRead() const {
+	if ( mData->mStatPending ) {
+		mData->localLoadAttributes();
+	}
+
 	return mData->mCanRead;
 }
 
 bool Location::canWrite() const {
+	if ( mData->mStatPending ) {
+		mData->localLoadAttributes();
+	}
+
 	return mData->mCanWrite;
 }
 
 bool Location::isHidden() const {
 #ifdef Q_OS_WIN32
 	if ( mData->mProtocol == Local ) {
-		WCHAR *wchar = ( WCHAR * ) malloc( ( mData->mPath.length() + 1 ) * sizeof( WCHAR ) );
-		wchar[ mData->mPath.toWCharArray( wchar ) ] = 0;
+		WCHAR *wchar = ( WCHAR * ) malloc( ( mData->mPath.getPath().length() + 1 ) * sizeof( WCHAR ) );
+		wchar[ mData->mPath.getPath().toWCharArray( wchar ) ] = 0;
 		DWORD result = GetFileAttributes( wchar );
 		free( wchar );
 
@@ -187,10 +211,10 @@ QString Location::getHostName() const {
 			return QObject::tr( "Local Computer" );
 
 		case Ssh:
-			return mData->mRemoteUserName + ( mData->mSudo ? "*@" : "@" ) + mData->mRemoteHostName;
+			return mData->mPath.getUserName() + ( mData->mSudo ? "*@" : "@" ) + mData->mPath.getHostName();
 
 		case Sftp:
-			return "sftp://" + mData->mRemoteUserName + "@" + mData->mRemoteHostName;
+			return "sftp://" + mData->mPath.getUserName() + "@" + mData->mPath.getHostName();
 
 		case Unsaved:
 			return QObject::tr( "New Files" );
@@ -203,11 +227,11 @@ QString Location::getHostName() const {
 QString Location::getHostlessPath() const {
 	switch ( mData->mProtocol ) {
 		case Local:
-			return mData->mPath;
+			return mData->mPath.getPath();
 
 		case Ssh:
 		case Sftp:
-			return mData->mRemotePath;
+			return mData->mPath.getRemotePath();
 
 		default:
 			throw( QObject::tr( "Unknown protocol" ) );
@@ -215,7 +239,7 @@ QString Location::getHostlessPath() const {
 }
 
 bool Location::operator==( const Location &other ) const {
-	return mData->mPath == other.mData->mPath;
+	return mData->mPath.getPath() == other.mData->mPath.getPath();
 }
 
 const Location &Location::getDirectory() const {
@@ -275,7 +299,7 @@ QIcon Location::getIcon() const {
 	// do something nicer for Windows.
 	switch ( mData->mProtocol ) {
 		case Local:
-			return sIconProvider->icon( QFileInfo( mData->mPath ) );
+			return sIconProvider->icon( QFileInfo( mData->mPath.getPath() ) );
 
 		case Ssh:
 		case Sftp:
@@ -311,94 +335,135 @@ bool Location::isDirectory() const {
 }
 
 void LocationShared::setPath( const QString &path ) {
-	mPath = path.trimmed();
-	mPath.replace( '\\', '/' );
-
-	// Clean off any trailing slashes
-	while ( mPath.endsWith( '/' ) && mPath.length() > 1 ) {
-		mPath.truncate( mPath.length() - 1 );
-	}
-
-	// Work out what kind of path this is. Default if no pattern matches, is local.
-	if ( gSftpServerRegExp.indexIn( mPath ) > -1 ) {
-		mProtocol = Location::Sftp;
-		QStringList parts = gSftpServerRegExp.capturedTexts();
-		mRemoteUserName = parts[ 2 ];
-		mRemoteHostName = parts[ 3 ];
-		mRemotePath = parts[ 4 ];
+	mPath = LocationPath( path );
+	pathChanged();
+}
 
-		if ( mRemotePath.length() == 0 ) {
-			mRemotePath = "/";
-		}
-		mRemotePath.replace( QRegExp( "^/~" ), "~" );
-	} else if ( gSshServerRegExp.indexIn( mPath ) > -1 ) {
-		mProtocol = Location::Ssh;
-		QStringList parts = gSshServerRegExp.capturedTexts();
-		mRemoteUserName = parts[ 1 ];
-		mRemoteHostName = parts[ 2 ];
-		mRemotePath = parts[ 3 ];
-
-		if ( mRemotePath.length() == 0 ) {
-			mRemotePath = "/";
-		}
+void LocationShared::setChildPath( LocationShared *parent, const QString &name ) {
+	mPath = LocationPath( parent->mPath, name );
+	pathChanged();
+}
 
-		if ( mRemoteUserName.endsWith( '*' ) ) {
-			mSudo = true;
-			mRemoteUserName.truncate( mRemoteUserName.length() - 1 );
-		}
-	} else if ( mPath.length() == 0 ) {
-		mProtocol = Location::Unsaved;
-	} else {
-		mProtocol = Location::Local;
-	}
+void LocationShared::pathChanged() {
+	mProtocol = ( Location::Protocol ) mPath.getProtocol();
+	mSudo = mPath.isSudo();
 
 	// Work out what to label this path...
-	int lastSeparatorIndex = mPath.lastIndexOf(
-		mProtocol == Location::Ssh || mProtocol == Location::Sftp ? gSshPathSeparators : gLocalPathSeparators );
-	mLabel = mPath.mid( lastSeparatorIndex + 1 );
-	if ( mPath == "/" ) {
-		mLabel = "Root (/)";
-	} else if ( mPath.isEmpty() ) {
-		mLabel = QString( "New File %1" ).arg( gOpenFileManager.newFileNumber() );
+	mLabel = mPath.getName();
+	if ( mLabel.isEmpty() ) {
+		if ( mPath.getPath() == "/" ) {
+			mLabel = "Root (/)";
+		} else if ( mPath.getPath().isEmpty() ) {
+			mLabel = QString( "New File %1" ).arg( gOpenFileManager.newFileNumber() );
+		}
 	}
 }
 
 void LocationShared::localLoadSelf() {
-	QFileInfo fileInfo = QFileInfo( mPath );
+	QFileInfo fileInfo = QFileInfo( mPath.getPath() );
 	mType = fileInfo.isDir() ? Location::Directory : Location::File;
 	mSelfLoaded = true;
 }
 
+void LocationShared::localLoadAttributes() {
+	QFileInfo fileInfo( mPath.getPath() );
+	mSize = fileInfo.size();
+	mLastModified = fileInfo.lastModified();
+	mCanRead = fileInfo.isReadable() | fileInfo.isWritable();
+	mCanWrite = fileInfo.isWritable();
+	mStatPending = false;
+}
+
 void LocationShared::localLoadListing( bool includeHidden ) {
-	if ( ! mSelfLoaded ) {
-		localLoadSelf();
+	static QThreadPool *pool = NULL;
+	if ( pool == NULL ) {
+		pool = new QThreadPool();
+		pool->setMaxThreadCount( LOCAL_LISTING_THREADS );
 	}
 
-	QList< Location > children;
+	pool->start( new LocalListing( this, includeHidden ) );
+}
 
+LocalListing::LocalListing( LocationShared *location, bool includeHidden ) :
+	QObject(),
+	QRunnable(),
+	mLocation( location ),
+	mPath( location->mPath.getPath() ),
+	mIncludeHidden( includeHidden ),
+	mNames(),
+	mDirectories(),
+	mError(),
+	mPermissionError( false ) {
+	setAutoDelete( false );
+}
+
+void LocalListing::run() {
+#ifdef Q_OS_WIN32
 	QDir directory( mPath + ( mPath.endsWith( ":" ) ? "/" : "" ) );
 	QDir::Filters filters = QDir::AllEntries | QDir::NoDotAndDotDot;
-	if ( includeHidden ) {
+	if ( mIncludeHidden ) {
 		filters |= QDir::Hidden;
 	}
 
-	QStringList entries = directory.entryList( filters );
-	foreach ( QString entry, entries ) {
-		if ( ! includeHidden && entry.startsWith( '.' ) ) {
+	// The directory scan already knows what each entry is; asking costs no extra trip to the disk.
+	foreach ( const QFileInfo &fileInfo, directory.entryInfoList( filters ) ) {
+		if ( ! mIncludeHidden && fileInfo.fileName().startsWith( '.' ) ) {
 			continue;
 		}
+		mNames.append( fileInfo.fileName() );
+		mDirectories.append( fileInfo.isDir() );
+	}
+#else
+	DIR *directory = opendir( QFile::encodeName( mPath ).constData() );
+	if ( directory == NULL ) {
+		mPermissionError = ( errno == EACCES );
+		mError = QString::fromLocal8Bit( strerror( errno ) );
+	} else {
+		QByteArray prefix = QFile::encodeName( mPath.endsWith( '/' ) ? mPath : mPath + "/" );
+		while ( struct dirent *entry = readdir( directory ) ) {
+			if ( entry->d_name[ 0 ] == '.' &&
+			     ( ! mIncludeHidden || entry->d_name[ 1 ] == 0 ||
+			       ( entry->d_name[ 1 ] == '.' && entry->d_name[ 2 ] == 0 ) ) ) {
+				continue;
+			}
 
-		QFileInfo fileInfo( mPath + "/" + entry );
-		children.append( Location( Location( this ),
-		                           fileInfo.absoluteFilePath(),
-		                           fileInfo.isDir() ? Location::Directory : Location::File,
-		                           fileInfo.size(),
-		                           fileInfo.lastModified(),
-		                           fileInfo.isReadable(),
-		                           fileInfo.isWritable() ) );
+			// Only links, and filesystems that don't fill in d_type, need a stat to tell folders apart.
+			bool isDir = ( entry->d_type == DT_DIR );
+			if ( entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK ) {
+				struct stat info;
+				isDir = ( stat( ( prefix + entry->d_name ).constData(), &info ) == 0 && S_ISDIR( info.st_mode ) );
+			}
+
+			mNames.append( QFile::decodeName( entry->d_name ) );
+			mDirectories.append( isDir );
+		}
+		closedir( directory );
+	}
+#endif
+
+	QMetaObject::invokeMethod( this, "deliver", Qt::QueuedConnection );
+}
+
+void LocalListing::deliver() {
+	LocationShared *data = mLocation.mData;
+	if ( ! data->mSelfLoaded ) {
+		data->localLoadSelf();
+	}
+
+	if ( ! mError.isEmpty() ) {
+		gDispatcher->emitLocationListFailure( mError, data->mPath.getPath(), mPermissionError );
+	} else {
+		QList< Location > children;
+		for ( int i = 0; i < mNames.length(); i++ ) {
+			children.append( Location( mLocation,
+			                           mNames[ i ],
+			                           mDirectories[ i ] ? Location::Directory : Location::File ) );
+		}
+
+		gDispatcher->emitLocationListSuccess( children, data->mPath.getPath() );
 	}
 
-	gDispatcher->emitLocationListSuccess( children, mPath );
+	deleteLater();
 }
 
 void Location::asyncGetChildren( bool includeHidden ) {
@@ -408,11 +473,8 @@ void Location::asyncGetChildren( bool includeHidden ) {
 			break;
 
 		case Ssh:
-			mData->sshLoadListing( includeHidden );
-			break;
-
 		case Sftp:
-			mData->sftpLoadListing( includeHidden );
+			mData->remoteLoadListing( includeHidden );
 			break;
 
 		default:
@@ -425,7 +487,7 @@ BaseFile *Location::getFile() {
 }
 
 QString Location::getRemotePath() const {
-	return mData->mRemotePath;
+	return mData->mPath.getRemotePath();
 }
 
 Location::Protocol Location::getProtocol() const {
@@ -436,20 +498,48 @@ SshHost *Location::getRemoteHost() const {
 	return mData->getHost();
 }
 
-void LocationShared::sftpLoadListing( bool includeHidden ) {
+void LocationShared::remoteLoadListing( bool includeHidden ) {
+	int cacheFlags = ( includeHidden ? ListingCache::Hidden : 0 ) |
+	                 ( mSudo ? ListingCache::Sudo : 0 ) |
+	                 ( mProtocol == Location::Sftp ? ListingCache::Sftp : 0 );
+
+	// Show what's known straight away, then check it for changes.
+	QVariantMap entries;
+	bool fresh = false;
+	bool cached = getHost()->getListingCache().lookup( mPath.getRemotePath(), cacheFlags, &entries, &fresh );
+	if ( cached ) {
+		emitListing( entries );
+		if ( fresh ) {
+			return;
+		}
+	}
+
+	LocationListing *listing = new LocationListing( this, cacheFlags, cached );
+	mListings.append( listing );
+
+	if ( mProtocol == Location::Sftp ) {
+		sftpLoadListing( listing, includeHidden );
+	} else {
+		sshLoadListing( listing, includeHidden );
+	}
+}
+
+void LocationShared::sftpLoadListing( LocationListing *listing, bool includeHidden ) {
 	SFTPRequest *request =
 		new SFTPRequest( SFTPRequest::Ls,
-		                 Callback( this,
-		                           SLOT( sshLsSuccess( QVariantMap ) ),
+		                 Callback( listing,
+		                           SLOT( lsSuccess( QVariantMap ) ),
 		                           SLOT( sftpLsFailure( QString, int ) ) ) );
-	request->setPath( mRemotePath );
+	request->setPath( mPath.getRemotePath() );
 	request->setIncludeHidden( includeHidden );
 	getHost()->sendSftpRequest( request );
 }
 
-void LocationShared::sshLoadListing( bool includeHidden ) {
+void LocationShared::sshLoadListing( LocationListing *listing, bool includeHidden ) {
 	QMap< QString, QVariant > params;
-	params.insert( "dir", mRemotePath );
+	params.insert( "dir", mPath.getRemotePath() );
+	params.insert( "batch", LISTING_BATCH_SIZE );
+	params.insert( "watch", true );
 	if ( includeHidden ) {
 		params.insert( "hidden", true );
 	}
@@ -457,16 +547,59 @@ void LocationShared::sshLoadListing( bool includeHidden ) {
 	                              NULL,
 	                              "ls",
 	                              QVariant( params ),
-	                              Callback( this,
-	                                        SLOT( sshLsSuccess( QVariantMap ) ),
+	                              Callback( listing,
+	                                        SLOT( lsSuccess( QVariantMap ) ),
 	                                        SLOT( sshLsFailure( QString, int ) ) ) );
 }
 
-void LocationShared::sshLsSuccess( QVariantMap results ) {
+void Location::cancelListing() {
+	// Whatever's still to come has nowhere to go once the listing is gone.
+	foreach ( LocationListing *listing, mData->mListings ) {
+		if ( listing ) {
+			listing->deleteLater();
+		}
+	}
+	mData->mListings.clear();
+}
+
+void Location::asyncGetTree( int depth, const QStringList &globs, bool useIgnoreFiles, const Callback &callback ) {
+	if ( mData->mProtocol != Ssh ) {
+		callback.triggerFailure( QObject::tr( "Only available over SSH" ) );
+		return;
+	}
+
+	int flags = ( mData->mSudo ? ListingCache::Sudo : 0 );
+	bool filtered = ( ! globs.isEmpty() || useIgnoreFiles );
+	QSharedPointer< RemoteTree > tree( new RemoteTree( mData->mPath.getRemotePath(), flags, depth, filtered ) );
+
+	QVariantMap params;
+	params.insert( "dir", mData->mPath.getRemotePath() );
+	params.insert( "batch", REMOTE_TREE_BATCH_SIZE );
+	params.insert( "max", REMOTE_TREE_MAX_ENTRIES );
+	if ( depth > 0 ) {
+		params.insert( "depth", depth );
+	}
+	if ( ! globs.isEmpty() ) {
+		params.insert( "glob", globs );
+	}
+	if ( useIgnoreFiles ) {
+		params.insert( "ignore", true );
+	}
+
+	LocationTreeRequest *request = new LocationTreeRequest( mData, tree, callback );
+	mData->getHost()->sendServerRequest( mData->mSudo,
+	                                     NULL,
+	                                     "tree",
+	                                     QVariant( params ),
+	                                     Callback( request,
+	                                               SLOT( treeSuccess( QVariantMap ) ),
+	                                               SLOT( treeFailure( QString, int ) ) ) );
+}
+
+QList< Location > LocationShared::makeChildren( const QVariantMap &entries ) {
 	QList< Location > children;
 	Location parentLocation( this );
 
-	QVariantMap entries = results.value( "entries" ).toMap();
 	QMapIterator< QString, QVariant > i( entries );
 	while ( i.hasNext() ) {
 		i.next();
@@ -480,7 +613,7 @@ void LocationShared::sshLsSuccess( QVariantMap results ) {
 		qint64 lastModified = entry.value( "m", 0 ).toLongLong();
 
 		children.append( Location( parentLocation,
-		                           mPath + "/" + i.key(),
+		                           i.key(),
 		                           isDir ? Location::Directory : Location::File,
 		                           size,
 		                           QDateTime::fromMSecsSinceEpoch( lastModified * 1000 ),
@@ -488,21 +621,102 @@ void LocationShared::sshLsSuccess( QVariantMap results ) {
 		                           canWrite ) );
 	}
 
+	return children;
+}
 
-	gDispatcher->emitLocationListSuccess( children, mPath );
+void LocationShared::emitListing( const QVariantMap &entries ) {
+	gDispatcher->emitLocationListSuccess( makeChildren( entries ), mPath.getPath() );
 }
 
-void LocationShared::sshLsFailure( QString error, int flags ) {
-	gDispatcher->emitLocationListFailure( error, mPath, flags & ServerRequest::PermissionError );
+LocationListing::LocationListing( LocationShared *location, int cacheFlags, bool showingCached ) :
+	QObject(),
+	mLocation( location ),
+	mCacheFlags( cacheFlags ),
+	mShowingCached( showingCached ),
+	mStreaming( false ),
+	mEntries() {}
+
+void LocationListing::lsSuccess( QVariantMap results ) {
+	LocationShared *data = mLocation.mData;
+	QVariantMap entries = results.value( "entries" ).toMap();
+	bool more = results.value( "more" ).toBool();
+
+	// Big listings arrive in parts. Unless a cached copy is already showing, pass each part on as it comes.
+	if ( more || mStreaming ) {
+		mStreaming = true;
+		for ( QVariantMap::const_iterator i = entries.constBegin(); i != entries.constEnd(); ++i ) {
+			mEntries.insert( i.key(), i.value() );
+		}
+		if ( ! mShowingCached ) {
+			gDispatcher->emitLocationListPart( data->makeChildren( entries ), data->mPath.getPath(), ! more );
+		}
+		if ( more ) {
+			return;
+		}
+		entries = mEntries;
+	}
+
+	// With a cached copy showing, only tell anyone if it's news.
+	bool changed =
+		data->getHost()->getListingCache().store( data->mPath.getRemotePath(), mCacheFlags, entries );
+	if ( mShowingCached ? changed : ! mStreaming ) {
+		data->emitListing( entries );
+	}
+	finish();
+}
+
+void LocationListing::sshLsFailure( QString error, int flags ) {
+	fail( error, flags & ServerRequest::PermissionError );
+}
+
+void LocationListing::sftpLsFailure( QString error, int /*flags*/ ) {
+	fail( error, false );
 }
 
-void LocationShared::sftpLsFailure( QString error, int /*flags*/ ) {
-	gDispatcher->emitLocationListFailure( error, mPath, false );
+void LocationListing::fail( const QString &error, bool permissionError ) {
+	LocationShared *data = mLocation.mData;
+	data->getHost()->getListingCache().invalidate( data->mPath.getRemotePath() );
+	gDispatcher->emitLocationListFailure( error, data->mPath.getPath(), permissionError );
+	finish();
+}
+
+void LocationListing::finish() {
+	mLocation.mData->mListings.removeAll( this );
+	deleteLater();
+}
+
+LocationTreeRequest::LocationTreeRequest( LocationShared *location,
+                                          const QSharedPointer< RemoteTree > &tree,
+                                          const Callback &callback ) :
+	QObject(),
+	mLocation( location ),
+	mTree( tree ),
+	mCallback( callback ) {}
+
+void LocationTreeRequest::treeSuccess( QVariantMap results ) {
+	mTree->addEntries( results.value( "files" ).toList() );
+	if ( results.value( "more" ).toBool() ) {
+		return;
+	}
+
+	mTree->setTruncated( results.value( "truncated" ).toBool() );
+	mLocation.mData->getHost()->getListingCache().storeTree( mTree );
+
+	QVariantMap result;
+	result.insert( "files", mTree->getFiles() );
+	result.insert( "truncated", mTree->isTruncated() );
+	mCallback.triggerSuccess( result );
+	deleteLater();
+}
+
+void LocationTreeRequest::treeFailure( QString error, int flags ) {
+	mCallback.triggerFailure( error, flags );
+	deleteLater();
 }
 
 SshHost *LocationShared::getHost() {
 	if ( mHost == NULL ) {
-		mHost = SshHost::getHost( mRemoteHostName.toLatin1(), mRemoteUserName.toLatin1() );
+		mHost = SshHost::getHost( mPath.getHostName().toLatin1(), mPath.getUserName().toLatin1() );
 	}
 
 	return mHost;
@@ -579,7 +793,8 @@ QString Location::getDefaultFavoriteName() {
 	switch ( mData->mProtocol ) {
 		case Ssh:
 		case Sftp:
-			return QObject::tr( "%1 on %2", "eg: ~ on Server X" ).arg( getLabel() ).arg( mData->mRemoteHostName );
+			return QObject::tr( "%1 on %2", "eg: ~ on Server X" ).arg( getLabel() ).arg(
+				mData->mPath.getHostName() );
 
 		case Unsaved:
 			return QObject::tr( "Unsaved" );
@@ -591,17 +806,21 @@ QString Location::getDefaultFavoriteName() {
 }
 
 void Location::createNewDirectory( const QString &name, const Callback &callback ) {
+	if ( mData->mProtocol == Ssh || mData->mProtocol == Sftp ) {
+		mData->getHost()->getListingCache().invalidate( mData->mPath.getRemotePath() );
+	}
+
 	switch ( mData->mProtocol ) {
 		case Ssh: {
 			QVariantMap params;
-			params.insert( "dir", mData->mRemotePath + "/" + name );
+			params.insert( "dir", mData->mPath.getRemotePath() + "/" + name );
 			mData->getHost()->sendServerRequest( mData->mSudo, NULL, "mkdir", QVariant( params ), callback );
 			break;
 		}
 
 		case Sftp: {
 			SFTPRequest *request = new SFTPRequest( SFTPRequest::MkDir, callback );
-			request->setPath( mData->mRemotePath + "/" + name );
+			request->setPath( mData->mPath.getRemotePath() + "/" + name );
 			mData->getHost()->sendSftpRequest( request );
 			break;
 		}
@@ -626,5 +845,6 @@ Location Location::getSudoLocation() const {
 	if ( isSudo() ) {
 		return *this;
 	}
-	return Location( mData->mRemoteUserName + "*@" + mData->mRemoteHostName + ":" + mData->mRemotePath );
+	return Location( mData->mPath.getUserName() + "*@" + mData->mPath.getHostName() + ":" +
+	                 mData->mPath.getRemotePath() );
 }
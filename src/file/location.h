@@ -2,20 +2,33 @@
 #define LOCATION_H
 
 #include <QDateTime>
+#include <QPointer>
+#include <QRunnable>
+#include <QSharedPointer>
 #include <QString>
+#include <QStringList>
 #include <QVariant>
 #include <tools/callback.h>
 
-class OldSshHost;
+#include "file/locationpath.h"
+
+// Local directories are read on a pool of this many threads, so a slow mount doesn't hold up the UI.
+#define LOCAL_LISTING_THREADS 4
+
 class BaseFile;
+class LocalListing;
+class LocationListing;
 class LocationShared;
+class LocationTreeRequest;
+class RemoteTree;
 class SshConnection;
-class OldServerChannel;
-class FTPChannel;
 class SshHost;
 
 class Location {
 	friend class LocationShared;
+	friend class LocalListing;
+	friend class LocationListing;
+	friend class LocationTreeRequest;
 
 	public:
 		enum Type { Unknown, File, Directory };
@@ -26,13 +39,16 @@ class Location {
 		Location( const Location &other );
 		Location &operator=( const Location &other );
 		Location( const QString &path );
-		Location( const Location &parent,
-		          const QString &path,
+		Location( const Location &parent,       // A child of parent, called name; it shares parent's path
+		          const QString &name,          // rather than parsing its own.
 		          Type type,
 		          int size,
 		          QDateTime lastModified,
 		          bool canRead,
 		          bool canWrite );
+		Location( const Location &parent, const QString &name, Type type );     // Size, date and permissions of
+		                                                                        // local files are looked up
+		                                                                        // when first asked for.
 		~Location();
 
 		QString getDisplayPath() const;
@@ -66,7 +82,14 @@ class Location {
 		BaseFile *getFile();
 
 		void asyncGetChildren( bool includeHidden );    // Results are returned via the global dispatcher
-		                                                // (locationListSuccess, locationListFailure)
+		                                                // (locationListSuccess, locationListFailure); big remote
+		                                                // directories come in parts (locationListPart).
+		void cancelListing();                           // Drops whatever is still to come.
+
+		// Fetches everything below a remote folder in one go; depth 0 is unlimited, globs pick the files wanted.
+		// Succeeds with "files", their paths relative to this folder, and "truncated" if there were too many.
+		// The tree is kept with the host's listings, so folders it covers list without asking again. Ssh only.
+		void asyncGetTree( int depth, const QStringList &globs, bool useIgnoreFiles, const Callback &callback );
 
 		bool operator==( const Location &other ) const;
 
@@ -97,33 +120,103 @@ class Location {
 		static QList< Favorite > sFavorites;
 };
 
-class LocationShared : public QObject {
+// One listing of a remote directory on its way in. Replies go here rather than to the LocationShared, so
+// cancelling a listing is just a matter of deleting it.
+class LocationListing : public QObject {
 	Q_OBJECT
-	friend class Location;
 
 	public:
-		static void cleanupIconProvider();
+		LocationListing( LocationShared *location, int cacheFlags, bool showingCached );
 
 	private slots:
-		void sshLsSuccess( QVariantMap results );
+		void lsSuccess( QVariantMap results );
 		void sshLsFailure( QString error, int flags );
 		void sftpLsFailure( QString error, int flags );
 
+	private:
+		void fail( const QString &error, bool permissionError );
+		void finish();
+
+		Location mLocation;
+		int mCacheFlags;
+		bool mShowingCached;    // A cached copy was shown; the fresh one only goes out if it's different.
+		bool mStreaming;
+		QVariantMap mEntries;   // Parts so far.
+};
+
+// One listing of a local directory. Names and types are read on the listing pool (from d_type where the
+// platform has it, so most entries need no stat); the Locations are made and sent out back on the main thread.
+class LocalListing : public QObject, public QRunnable {
+	Q_OBJECT
+
+	public:
+		LocalListing( LocationShared *location, bool includeHidden );
+		void run();
+
+	private slots:
+		void deliver();
+
+	private:
+		Location mLocation;     // Main thread only; the pool works from the copies below.
+		QString mPath;
+		bool mIncludeHidden;
+
+		QStringList mNames;
+		QList< bool > mDirectories;
+		QString mError;
+		bool mPermissionError;
+};
+
+// A tree of a remote folder on its way in; parts of it are gathered here until the last arrives.
+class LocationTreeRequest : public QObject {
+	Q_OBJECT
+
+	public:
+		LocationTreeRequest( LocationShared *location,
+		                     const QSharedPointer< RemoteTree > &tree,
+		                     const Callback &callback );
+
+	private slots:
+		void treeSuccess( QVariantMap results );
+		void treeFailure( QString error, int flags );
+
+	private:
+		Location mLocation;
+		QSharedPointer< RemoteTree > mTree;
+		Callback mCallback;
+};
+
+// Not a QObject; a big listing makes one of these per entry.
+class LocationShared {
+	friend class Location;
+	friend class LocalListing;
+	friend class LocationListing;
+	friend class LocationTreeRequest;
+
+	public:
+		static void cleanupIconProvider();
+
 	private:
 		LocationShared();
 		static void initIconProvider();
 
 		void setPath( const QString &path );
+		void setChildPath( LocationShared *parent, const QString &name );
+		void pathChanged();
 
 		void localLoadSelf();
+		void localLoadAttributes();
 		void localLoadListing( bool includeHidden );
-		void sshLoadListing( bool includeHidden );
-		void sftpLoadListing( bool includeHidden );
+		void remoteLoadListing( bool includeHidden );
+		void sshLoadListing( LocationListing *listing, bool includeHidden );
+		void sftpLoadListing( LocationListing *listing, bool includeHidden );
+		QList< Location > makeChildren( const QVariantMap &entries );
+		void emitListing( const QVariantMap &entries );
 
 		SshHost *getHost();
 
 		int mReferences;
-		QString mPath;
+		LocationPath mPath;
 		QString mLabel;
 
 		Location::Type mType;
@@ -131,20 +224,14 @@ class LocationShared : public QObject {
 		QDateTime mLastModified;
 		Location mParent;
 		bool mSelfLoaded;
+		bool mStatPending;      // Size, date and permissions still to be looked up.
 		int mSize;
 		bool mCanRead;
 		bool mCanWrite;
 		bool mSudo;
 
 		SshHost *mHost;
-
-// Todo: Remote hostname and login should be QByteArrays
-		QString mRemoteHostName;
-		QString mRemoteUserName;
-		QString mRemotePath;
-		OldSshHost *mRemoteHost;
-		OldServerChannel *mServerChannel;
-		FTPChannel *mFtpChannel;
+		QList< QPointer< LocationListing > > mListings;     // Remote listings on their way in.
 };
 
 Q_DECLARE_METATYPE( Location );
@@ -0,0 +1,182 @@
+#include "locationpath.h"
+
+LocationPath::LocationPath() :
+	mProtocol( Unsaved ),
+	mSudo( false ),
+	mUserName(),
+	mHostName(),
+	mName(),
+	mPath(),
+	mRemotePath(),
+	mParentPath(),
+	mParentRemotePath() {}
+
+LocationPath::LocationPath( const QString &path ) :
+	mProtocol( Unsaved ),
+	mSudo( false ),
+	mUserName(),
+	mHostName(),
+	mName(),
+	mPath(),
+	mRemotePath(),
+	mParentPath(),
+	mParentRemotePath() {
+	parse( path );
+}
+
+LocationPath::LocationPath( const LocationPath &parent, const QString &name ) :
+	mProtocol( parent.mProtocol ),
+	mSudo( parent.mSudo ),
+	mUserName( parent.mUserName ),
+	mHostName( parent.mHostName ),
+	mName( name ),
+	mPath(),
+	mRemotePath(),
+	mParentPath(),
+	mParentRemotePath() {
+	// Names that parsing would treat specially get the long way round, so both ways agree.
+	bool plain = ! name.isEmpty() && mProtocol != Unsaved && ! name[ name.length() - 1 ].isSpace() &&
+	             ! name.contains( '/' ) && ! name.contains( '\\' ) && ! ( isRemote() && name.contains( ':' ) );
+	if ( ! plain ) {
+		parse( join( parent.getPath(), name ) );
+		return;
+	}
+
+	mParentPath = parent.getPath();
+	if ( isRemote() ) {
+		mParentRemotePath = parent.getRemotePath();
+	}
+}
+
+const QString &LocationPath::getPath() const {
+	if ( mPath.isNull() && ! mParentPath.isNull() ) {
+		mPath = join( mParentPath, mName );
+	}
+	return mPath;
+}
+
+const QString &LocationPath::getRemotePath() const {
+	if ( mRemotePath.isNull() && ! mParentRemotePath.isNull() ) {
+		mRemotePath = join( mParentRemotePath, mName );
+	}
+	return mRemotePath;
+}
+
+QString LocationPath::join( const QString &parent, const QString &name ) {
+	return parent.endsWith( '/' ) ? parent + name : parent + '/' + name;
+}
+
+void LocationPath::parse( const QString &path ) {
+	mPath = path.trimmed();
+	mPath.replace( '\\', '/' );
+
+	// Clean off any trailing slashes
+	while ( mPath.endsWith( '/' ) && mPath.length() > 1 ) {
+		mPath.truncate( mPath.length() - 1 );
+	}
+
+	mSudo = false;
+	mUserName = QString();
+	mHostName = QString();
+	mRemotePath = QString();
+
+	// Work out what kind of path this is. Default if nothing matches, is local.
+	if ( parseSftp() ) {
+		mProtocol = Sftp;
+	} else if ( parseSsh() ) {
+		mProtocol = Ssh;
+	} else if ( mPath.isEmpty() ) {
+		mProtocol = Unsaved;
+	} else {
+		mProtocol = Local;
+	}
+
+	// The name is whatever follows the last separator; remote paths count the host's colon as one too.
+	int i = mPath.length() - 1;
+	while ( i >= 0 && mPath[ i ] != '/' && ! ( isRemote() && mPath[ i ] == ':' ) ) {
+		i--;
+	}
+	mName = mPath.mid( i + 1 );
+}
+
+bool LocationPath::parseSftp() {
+	static const QString prefix( "sftp://" );
+	if ( ! mPath.startsWith( prefix ) ) {
+		return false;
+	}
+
+	int hostStart = prefix.length();
+	int hostEnd = mPath.indexOf( '/', hostStart );
+	if ( hostEnd == -1 ) {
+		hostEnd = mPath.length();
+	}
+	if ( hostEnd == hostStart ) {
+		return false;
+	}
+
+	// A user comes before the first '@', as long as there's something either side of it.
+	int at = mPath.indexOf( '@', hostStart );
+	if ( at > hostStart && at < hostEnd - 1 ) {
+		mUserName = mPath.mid( hostStart, at - hostStart );
+		hostStart = at + 1;
+	}
+	mHostName = mPath.mid( hostStart, hostEnd - hostStart );
+
+	mRemotePath = mPath.mid( hostEnd );
+	if ( mRemotePath.isEmpty() ) {
+		mRemotePath = "/";
+	}
+	if ( mRemotePath.startsWith( "/~" ) ) {
+		mRemotePath.remove( 0, 1 );
+	}
+	return true;
+}
+
+bool LocationPath::parseSsh() {
+	int colon = mPath.indexOf( ':' );
+	if ( colon == -1 ) {
+		return false;
+	}
+
+	QString userName;
+	QString hostName = mPath.left( colon );
+	int at = hostName.indexOf( '@' );
+	if ( at != -1 ) {
+		userName = hostName.left( at );
+		hostName = hostName.mid( at + 1 );
+		if ( userName.isEmpty() ) {
+			return false;
+		}
+	}
+	if ( ! isHostName( hostName ) ) {
+		return false;
+	}
+
+	mUserName = userName;
+	mHostName = hostName;
+	if ( mUserName.endsWith( '*' ) ) {
+		mSudo = true;
+		mUserName.chop( 1 );
+	}
+
+	mRemotePath = mPath.mid( colon + 1 );
+	if ( mRemotePath.isEmpty() ) {
+		mRemotePath = "/";
+	}
+	return true;
+}
+
+bool LocationPath::isHostName( const QString &name ) {
+	if ( name.length() < 2 ) {
+		return false;
+	}
+
+	for ( int i = 0; i < name.length(); i++ ) {
+		ushort c = name[ i ].unicode();
+		if ( ! ( ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) ||
+		         c == '_' || c == '-' || c == '.' ) ) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -76,7 +76,7 @@ void OpenFileItemDelegate::paint( QPainter *painter,
 					               16,
 					               QPixmap( ":/icons/disconnected.png" ) );
 					labelRect.adjust( 0, 0, -18, 0 );
-				} else if ( fileStatus == BaseFile::Repairing ) {
+				} else if ( fileStatus == BaseFile::Repairing || fileStatus == BaseFile::Refreshing ) {
 					sp.drawPixmap( labelRect.right() - 16,
 					               labelRect.top(),
 					               16,
@@ -1,4 +1,5 @@
 #include <QDebug>
+#include <algorithm>
 
 #include "basefile.h"
 #include "openfilemanager.h"
@@ -17,32 +18,45 @@ BaseFile *OpenFileManager::getFile( const Location &location ) const {
 		return NULL;
 	}
 
-	foreach ( BaseFile *file, mOpenFiles ) {
-		if ( file->getLocation() == location ) {
-			return file;
-		}
-	}
+	return mFilesByPath.value( location.getPath(), NULL );
+}
 
-	return NULL;
+bool OpenFileManager::pathLessThan( const QString &path, BaseFile *file ) {
+	return path < file->getLocation().getPath();
 }
 
 void OpenFileManager::registerFile( BaseFile *file ) {
+	const Location &location = file->getLocation();
+	QString path = location.getPath();
+
 	// Keep the mOpenFiles list alphabetically sorted by Location.
-	int scan;
-	for ( scan = 0; scan < mOpenFiles.length(); scan++ ) {
-		if ( mOpenFiles[ scan ]->getLocation().getPath() > file->getLocation().getPath() ) {
-			break;
-		}
+	QList< BaseFile * >::iterator position = std::upper_bound( mOpenFiles.begin(), mOpenFiles.end(), path,
+	                                                            pathLessThan );
+	mOpenFiles.insert( position, file );
+
+	mPaths.insert( file, path );
+	if ( location.getProtocol() != Location::Unsaved ) {
+		mFilesByPath.insert( path, file );
 	}
-	mOpenFiles.insert( scan, file );
 
 	emit fileOpened( file );
 }
 
 void OpenFileManager::deregisterFile( BaseFile *file ) {
-	if ( mOpenFiles.removeAll( file ) ) {
-		emit fileClosed( file );
+	// The file may have moved since it was registered; forget it by the path it was registered under.
+	QHash< BaseFile *, QString >::iterator registered = mPaths.find( file );
+	if ( registered == mPaths.end() ) {
+		return;
 	}
+
+	QHash< QString, BaseFile * >::iterator indexed = mFilesByPath.find( registered.value() );
+	if ( indexed != mFilesByPath.end() && indexed.value() == file ) {
+		mFilesByPath.erase( indexed );
+	}
+	mPaths.erase( registered );
+	mOpenFiles.removeAll( file );
+
+	emit fileClosed( file );
 }
 
 void OpenFileManager::reregisterFile( BaseFile *file ) {
@@ -66,7 +80,7 @@ bool OpenFileManager::closeFiles( const QList< BaseFile * > &files, bool force )
 	}
 
 	foreach ( BaseFile *file, files ) {
-		if ( mOpenFiles.contains( file ) ) {
+		if ( mPaths.contains( file ) ) {
 			try {
 				file->close();
 			} catch ( QString &e ) {
@@ -112,7 +126,7 @@ bool OpenFileManager::refreshFiles( const QList< BaseFile * > &files, bool force
 	}
 
 	foreach ( BaseFile *file, files ) {
-		if ( mOpenFiles.contains( file ) ) {
+		if ( mPaths.contains( file ) ) {
 			try {
 				file->refresh();
 			} catch ( QString &e ) {
@@ -1,6 +1,7 @@
 #ifndef OPENFILEMANAGER_H
 #define OPENFILEMANAGER_H
 
+#include <QHash>
 #include <QList>
 #include <QObject>
 
@@ -8,6 +9,11 @@
 
 class BaseFile;
 
+//
+// Keeps track of the open files. They're indexed by path for lookups, and kept alphabetically in a separate list
+// for the UI to walk through.
+//
+
 class OpenFileManager : public QObject {
 	Q_OBJECT
 
@@ -58,7 +64,11 @@ class OpenFileManager : public QObject {
 		                                        // deletion
 
 	private:
-		QList< BaseFile * > mOpenFiles;
+		static bool pathLessThan( const QString &path, BaseFile *file );
+
+		QList< BaseFile * > mOpenFiles;             // Sorted by path.
+		QHash< QString, BaseFile * > mFilesByPath;  // Unsaved files aren't in here.
+		QHash< BaseFile *, QString > mPaths;        // Path each file was registered under.
 		int mNewFiles;
 };
 
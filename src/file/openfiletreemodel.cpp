@@ -1,5 +1,7 @@
 #include <QDebug>
 #include <QMessageBox>
+#include <QTimer>
+#include <algorithm>
 
 #include "basefile.h"
 #include "openfilemanager.h"
@@ -14,6 +16,7 @@ OpenFileTreeModel::OpenFileTreeModel( QObject *parent,
 	mOptionFlags = flags;
 	mTopLevelNode = new Node( Root );
 	mParent = reinterpret_cast< OpenFileTreeView * >( parent );
+	mChangesScheduled = false;
 
 	mExplicitFiles = ( files != NULL );
 	if ( mExplicitFiles ) {
@@ -35,6 +38,8 @@ OpenFileTreeModel::OpenFileTreeModel( QObject *parent,
 			fileOpened( file );
 		}
 	}
+
+	applyChanges();
 }
 
 OpenFileTreeModel::~OpenFileTreeModel() {
@@ -57,31 +62,27 @@ QString OpenFileTreeModel::Node::getLabel() {
 	}
 }
 
-OpenFileTreeModel::Node *OpenFileTreeModel::Node::findChildNode( const QString &label ) {
-	foreach ( Node *node, children ) {
-		if ( node->getLabel() == label ) {
-			return node;
-		}
-	}
-	return NULL;
+QString OpenFileTreeModel::Node::getKey() {
+	return ( level == Host ? location.getHostName() : location.getPath() );
 }
 
-OpenFileTreeModel::Node *OpenFileTreeModel::Node::findChildNode( const Location &location ) {
-	foreach ( Node *node, children ) {
-		if ( node->location == location ) {
-			return node;
-		}
-	}
-	return NULL;
+OpenFileTreeModel::Node *OpenFileTreeModel::Node::findChildNode( const QString &key ) const {
+	return childIndex.value( key, NULL );
 }
 
-OpenFileTreeModel::Node *OpenFileTreeModel::Node::findChildNode( BaseFile *file ) {
-	foreach ( Node *node, children ) {
-		if ( node->file == file ) {
-			return node;
+int OpenFileTreeModel::Node::getRow( Node *child ) const {
+	// New files all have the same empty path, so look through any ties.
+	QList< Node * >::const_iterator i = std::lower_bound( children.begin(), children.end(), child, nodeLessThan );
+	for ( ; i != children.end(); ++i ) {
+		if ( *i == child ) {
+			return i - children.begin();
 		}
 	}
-	return NULL;
+	return -1;
+}
+
+bool OpenFileTreeModel::nodeLessThan( Node *a, Node *b ) {
+	return a->location.getPath() < b->location.getPath();
 }
 
 QModelIndex OpenFileTreeModel::getNodeIndex( Node *node ) const {
@@ -89,28 +90,54 @@ QModelIndex OpenFileTreeModel::getNodeIndex( Node *node ) const {
 	if ( ! parentNode ) {
 		return QModelIndex();
 	}
-	return createIndex( parentNode->children.indexOf( node ), 0, static_cast< void * >( node ) );
+	return createIndex( parentNode->getRow( node ), 0, static_cast< void * >( node ) );
 }
 
-void OpenFileTreeModel::addNodeToTree( Node *parentNode, Node *node ) {
-	QModelIndex parentIndex = getNodeIndex( parentNode );
-
-	// Work out where within the parent to insert this new item... (Sorting alphabetically)
-	int insertIndex;
-	for ( insertIndex = 0; insertIndex < parentNode->children.length(); insertIndex++ ) {
-		if ( parentNode->children[ insertIndex ]->location.getPath() > node->location.getPath() ) {
-			break;
-		}
+void OpenFileTreeModel::scheduleChanges() {
+	if ( ! mChangesScheduled ) {
+		mChangesScheduled = true;
+		QTimer::singleShot( 0, this, SLOT( applyChanges() ) );
 	}
+}
 
-	// Lock the model, insert the row, unlock the model.
-	beginInsertRows( parentIndex, insertIndex, insertIndex );
-	parentNode->children.insert( insertIndex, node );
+void OpenFileTreeModel::addChildNode( Node *parentNode, Node *node, Insertions *insertions ) {
 	node->parent = parentNode;
-	endInsertRows();
+	if ( node->level != File ) {
+		parentNode->childIndex.insert( node->getKey(), node );
+	}
+	( *insertions )[ parentNode ].append( node );
+}
+
+void OpenFileTreeModel::insertChildNodes( Node *parentNode, QList< Node * > nodes, bool announce ) {
+	// Keep the children sorted alphabetically; new nodes that land next to each other go in together.
+	std::stable_sort( nodes.begin(), nodes.end(), nodeLessThan );
+	QModelIndex parentIndex = ( announce ? getNodeIndex( parentNode ) : QModelIndex() );
+	QList< Node * > &children = parentNode->children;
+
+	int first = 0;
+	while ( first < nodes.length() ) {
+		int row = std::upper_bound( children.begin(), children.end(), nodes[ first ], nodeLessThan ) - children.begin();
+		int last = first + 1;
+		while ( last < nodes.length() &&
+		        ( row == children.length() || nodeLessThan( nodes[ last ], children[ row ] ) ) ) {
+			last++;
+		}
+
+		if ( announce ) {
+			beginInsertRows( parentIndex, row, row + last - first - 1 );
+		}
+		for ( int i = first; i < last; i++ ) {
+			children.insert( row + i - first, nodes[ i ] );
+		}
+		if ( announce ) {
+			endInsertRows();
+		}
+
+		first = last;
+	}
 }
 
-OpenFileTreeModel::Node *OpenFileTreeModel::getHostNode( const Location &location ) {
+OpenFileTreeModel::Node *OpenFileTreeModel::getHostNode( const Location &location, Insertions *insertions ) {
 	// See if there is already an Node for this location.
 	Node *existingNode = mTopLevelNode->findChildNode( location.getHostName() );
 	if ( existingNode ) {
@@ -119,43 +146,34 @@ OpenFileTreeModel::Node *OpenFileTreeModel::getHostNode( const Location &locatio
 
 	Node *newNode = new Node( Host );
 	newNode->location = location;
-	addNodeToTree( mTopLevelNode, newNode );
+	addChildNode( mTopLevelNode, newNode, insertions );
 	return newNode;
 }
 
-OpenFileTreeModel::Node *OpenFileTreeModel::getDirectoryNode( const Location &location ) {
+OpenFileTreeModel::Node *OpenFileTreeModel::getDirectoryNode( const Location &location, Insertions *insertions ) {
 	// New files don't show directory subtrees.
 	if ( location.getPath().isEmpty() ) {
-		return getHostNode( location );
+		return getHostNode( location, insertions );
 	}
 
 	// Find / Create a node for the host this directory is on
-	Node *hostNode = getHostNode( location );
+	Node *hostNode = getHostNode( location, insertions );
 
 	// See if there is already a Node for this directory
-	Node *existingNode = hostNode->findChildNode( location );
+	Node *existingNode = hostNode->findChildNode( location.getPath() );
 	if ( existingNode ) {
 		return existingNode;
 	}
 
 	Node *newNode = new Node( Directory );
 	newNode->location = location;
-	addNodeToTree( hostNode, newNode );
+	addChildNode( hostNode, newNode, insertions );
 	return newNode;
 }
 
 void OpenFileTreeModel::fileOpened( BaseFile *file ) {
-	// Find / Create a node for the directory this file is in
-	Node *directoryNode = getDirectoryNode( file->getLocation().getDirectory() );
-
-	// Create a Node for the new file
-	Node *newNode = new Node( File );
-	newNode->file = file;
-	newNode->location = file->getLocation();
-	addNodeToTree( directoryNode, newNode );
-	mFileLookup.insert( file, newNode );
-
-	mParent->expandAll();
+	mOpenedFiles.append( file );
+	scheduleChanges();
 
 	connect( file, SIGNAL( openStatusChanged( int ) ), this, SLOT( fileChanged() ) );
 	connect( file, SIGNAL( fileProgress( int ) ), this, SLOT( fileChanged() ) );
@@ -163,18 +181,75 @@ void OpenFileTreeModel::fileOpened( BaseFile *file ) {
 }
 
 void OpenFileTreeModel::fileClosed( BaseFile *file ) {
-	removeFile( file );
+	// The file is about to be deleted, and anything painting its row would reach it; so its row goes straight
+	// away, rather than with the next batch.
+	mOpenedFiles.removeAll( file );
+	mChangedFiles.remove( file );
+	Node *node = mFileLookup.take( file );
+	if ( node ) {
+		removeNodes( QList< Node * >() << node );
+	}
+
+	mFiles.removeAll( file );
 }
 
 void OpenFileTreeModel::fileChanged() {
 	BaseFile *file = reinterpret_cast< BaseFile * >( QObject::sender() );
-	Node *fileNode = mFileLookup.value( file );
-	if ( fileNode ) {
-		QModelIndex index = getNodeIndex( fileNode );
+	if ( mFileLookup.contains( file ) ) {
+		mChangedFiles.insert( file );
+		scheduleChanges();
+	}
+}
+
+void OpenFileTreeModel::applyChanges() {
+	mChangesScheduled = false;
+
+	if ( ! mOpenedFiles.isEmpty() ) {
+		// Find / Create a node for the directory each file is in, and one for the file.
+		Insertions insertions;
+		foreach ( BaseFile *file, mOpenedFiles ) {
+			if ( mFileLookup.contains( file ) ) {
+				continue;
+			}
+
+			Node *directoryNode = getDirectoryNode( file->getLocation().getDirectory(), &insertions );
+			Node *newNode = new Node( File );
+			newNode->file = file;
+			newNode->location = file->getLocation();
+			addChildNode( directoryNode, newNode, &insertions );
+			mFileLookup.insert( file, newNode );
+		}
+		mOpenedFiles.clear();
+
+		// Fill in new hosts and directories before they go in themselves, unannounced; then announce what goes into
+		// the nodes that were already there.
+		QList< Node * > unseen;
+		QList< Node * > seen;
+		for ( Insertions::const_iterator i = insertions.constBegin(); i != insertions.constEnd(); ++i ) {
+			Node *parentNode = i.key();
+			if ( parentNode->parent && parentNode->parent->getRow( parentNode ) < 0 ) {
+				unseen.append( parentNode );
+			} else {
+				seen.append( parentNode );
+			}
+		}
+		foreach ( Node *parentNode, unseen ) {
+			insertChildNodes( parentNode, insertions.value( parentNode ), false );
+		}
+		foreach ( Node *parentNode, seen ) {
+			insertChildNodes( parentNode, insertions.value( parentNode ), true );
+		}
+
+		mParent->expandAll();
+	}
+
+	foreach ( BaseFile *file, mChangedFiles ) {
+		QModelIndex index = getNodeIndex( mFileLookup.value( file ) );
 		if ( index.isValid() ) {
 			emit dataChanged( index, index.sibling( index.row(), 1 ) );
 		}
 	}
+	mChangedFiles.clear();
 }
 
 QModelIndex OpenFileTreeModel::index( int row, int column, const QModelIndex &parent ) const {
@@ -260,10 +335,15 @@ Qt::ItemFlags OpenFileTreeModel::flags( const QModelIndex &index ) const {
 	         ( index.column() == 0 ? Qt::ItemIsEnabled : Qt::NoItemFlags ) : Qt::NoItemFlags );
 }
 
-QModelIndex OpenFileTreeModel::findFile( BaseFile *file ) const {
+QModelIndex OpenFileTreeModel::findFile( BaseFile *file ) {
+	// A file opened this time round the event loop isn't in the tree yet.
+	if ( mChangesScheduled ) {
+		applyChanges();
+	}
+
 	Node *fileNode = mFileLookup.value( file );
 	if ( fileNode && fileNode->parent ) {
-		int row = fileNode->parent->children.indexOf( fileNode );
+		int row = fileNode->parent->getRow( fileNode );
 		if ( row >= 0 ) {
 			return createIndex( row, 0, fileNode );
 		}
@@ -272,34 +352,53 @@ QModelIndex OpenFileTreeModel::findFile( BaseFile *file ) const {
 	return QModelIndex();
 }
 
-void OpenFileTreeModel::removeNode( const QModelIndex &index ) {
-	if ( ! index.isValid() ) {
-		return;
-	}
-
-	Node *node = reinterpret_cast< Node * >( index.internalPointer() );
-	if ( ! node ) {
-		return;
-	}
-
-	Node *parentNode = node->parent;
-	if ( ! parentNode ) {
-		return;
-	}
-
-	int row = parentNode->children.indexOf( node );
-	QModelIndex parentIndex = parent( index );
+void OpenFileTreeModel::removeNodes( const QList< Node * > &nodes ) {
+	QList< Node * > removing = nodes;
+	while ( ! removing.isEmpty() ) {
+		// Group the rows by parent, and take each run of neighbouring rows out at once.
+		QHash< Node *, QList< int > > rows;
+		foreach ( Node *node, removing ) {
+			int row = ( node->parent ? node->parent->getRow( node ) : -1 );
+			if ( row >= 0 ) {
+				rows[ node->parent ].append( row );
+			}
+		}
 
-	beginRemoveRows( parentIndex, row, row );
-	parentNode->children.removeAt( row );
-	endRemoveRows();
+		QList< Node * > emptied;
+		for ( QHash< Node *, QList< int > >::iterator i = rows.begin(); i != rows.end(); ++i ) {
+			Node *parentNode = i.key();
+			QList< int > &parentRows = i.value();
+			std::sort( parentRows.begin(), parentRows.end() );
+			QModelIndex parentIndex = getNodeIndex( parentNode );
+
+			// From the bottom up, so the rows still to go stay put.
+			int last = parentRows.length() - 1;
+			while ( last >= 0 ) {
+				int first = last;
+				while ( first > 0 && parentRows[ first - 1 ] == parentRows[ first ] - 1 ) {
+					first--;
+				}
+
+				beginRemoveRows( parentIndex, parentRows[ first ], parentRows[ last ] );
+				for ( int row = parentRows[ last ]; row >= parentRows[ first ]; row-- ) {
+					Node *node = parentNode->children.takeAt( row );
+					if ( node->level != File ) {
+						parentNode->childIndex.remove( node->getKey() );
+					}
+					delete node;
+				}
+				endRemoveRows();
+
+				last = first - 1;
+			}
 
-	mFileLookup.remove( node->file );
-	delete node;
+			// If the parent is not the top level, remove if empty
+			if ( parentNode->level != Root && parentNode->children.isEmpty() ) {
+				emptied.append( parentNode );
+			}
+		}
 
-	// If the parent is not the top level, remove if empty
-	if ( parentNode->level != Root && parentNode->children.length() == 0 ) {
-		removeNode( parentIndex );
+		removing = emptied;
 	}
 }
 
@@ -339,11 +438,5 @@ QList< BaseFile * > OpenFileTreeModel::getIndexAndChildFiles( const QModelIndex
 }
 
 void OpenFileTreeModel::removeFile( BaseFile *file ) {
-	QModelIndex index = findFile( file );
-	if ( index.isValid() ) {
-		// We need to remove a node from the tree.
-		removeNode( index );
-	}
-
-	mFiles.removeAll( file );
+	fileClosed( file );
 }
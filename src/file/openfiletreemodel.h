@@ -2,12 +2,20 @@
 #define OPENFILEMODEL_H
 
 #include <QAbstractItemModel>
+#include <QHash>
 #include <QList>
+#include <QSet>
 #include "location.h"
 #include "openfiletreeview.h"
 
 class BaseFile;
 
+//
+// Files opened and changed are gathered up and applied together on the next pass of the event loop, so opening a
+// big batch of files makes a handful of row insertions rather than one each. Closed files are taken out straight
+// away, as they're about to be deleted and nothing may paint them after that.
+//
+
 class OpenFileTreeModel : public QAbstractItemModel {
 	Q_OBJECT
 
@@ -38,7 +46,7 @@ class OpenFileTreeModel : public QAbstractItemModel {
 		QVariant data( const QModelIndex &index, int role ) const;
 		Qt::ItemFlags flags( const QModelIndex &index ) const;
 
-		QModelIndex findFile( BaseFile *file ) const;
+		QModelIndex findFile( BaseFile *file );    // Applies any changes waiting first.
 		BaseFile *getFileAtIndex( const QModelIndex &index );
 		QList< BaseFile * > getIndexAndChildFiles( const QModelIndex &index );
 
@@ -48,6 +56,7 @@ class OpenFileTreeModel : public QAbstractItemModel {
 		void fileOpened( BaseFile *file );
 		void fileClosed( BaseFile *file );
 		void fileChanged();
+		void applyChanges();
 
 	private:
 		class Node {
@@ -56,28 +65,41 @@ class OpenFileTreeModel : public QAbstractItemModel {
 					level( l ),
 					parent( 0 ),
 					file( 0 ) {}
-				Node *findChildNode( const QString &label );
-				Node *findChildNode( const Location &location );
-				Node *findChildNode( BaseFile *file );
+				Node *findChildNode( const QString &key ) const;
+				int getRow( Node *child ) const;
 				QString getLabel();
+				QString getKey();       // Host name for hosts, path for directories.
 
 				Level level;
 				Node *parent;
 				BaseFile *file;
 				Location location;
-				QList< Node * > children;
+				QList< Node * > children;       // Sorted by path.
+				QHash< QString, Node * > childIndex;    // Host and directory children, by key.
 		};
 
+		// Parents mapped to children that are waiting to go into them.
+		typedef QHash< Node *, QList< Node * > > Insertions;
+
+		static bool nodeLessThan( Node *a, Node *b );
 		QModelIndex getNodeIndex( Node *node ) const;
-		void addNodeToTree( Node *parentNode, Node *node );
-		Node *getHostNode( const Location &location );
-		Node *getDirectoryNode( const Location &location );
-		void removeNode( const QModelIndex &index );
+		void scheduleChanges();
+		void addChildNode( Node *parentNode, Node *node, Insertions *insertions );
+		void insertChildNodes( Node *parentNode, QList< Node * > nodes, bool announce );
+		Node *getHostNode( const Location &location, Insertions *insertions );
+		Node *getDirectoryNode( const Location &location, Insertions *insertions );
+		void removeNodes( const QList< Node * > &nodes );
 		QList< BaseFile * > getIndexAndChildFiles( Node *node );
 
 		QList< BaseFile * > mFiles;      // Used if a list of files explicitly supplied
 		Node *mTopLevelNode;
-		QMap< BaseFile *, Node * > mFileLookup;
+		QHash< BaseFile *, Node * > mFileLookup;
+
+		// Waiting for the next applyChanges.
+		QList< BaseFile * > mOpenedFiles;
+		QSet< BaseFile * > mChangedFiles;
+		bool mChangesScheduled;
+
 		void dumpNodes( Node *node );
 		OpenFileTreeView *mParent;
 
@@ -50,10 +50,11 @@ OpenFileTreeView::OpenFileTreeView( QWidget *parent, int optionFlags, const QLis
 	}
 }
 
-void OpenFileTreeView::dataChanged( const QModelIndex & /*topLeft*/,
-                                    const QModelIndex & /*bottomRight*/,
-                                    const QVector< int > & /*roles*/ ) {
-	this->expandAll();
+void OpenFileTreeView::dataChanged( const QModelIndex &topLeft,
+                                    const QModelIndex &bottomRight,
+                                    const QVector< int > &roles ) {
+	// The model expands new rows as it adds them; a file's status changing only needs its row repainting.
+	QTreeView::dataChanged( topLeft, bottomRight, roles );
 }
 
 BaseFile *OpenFileTreeView::getSelectedFile() const {
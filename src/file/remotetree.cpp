@@ -0,0 +1,118 @@
+#include "remotetree.h"
+
+RemoteTree::RemoteTree( const QString &rootPath, int flags, int depth, bool filtered ) :
+	mRootPath( rootPath ),
+	mFlags( flags ),
+	mDepth( depth ),
+	mFiltered( filtered ),
+	mTruncated( false ),
+	mFetched( QDateTime::currentDateTimeUtc() ),
+	mEntries(),
+	mChildren(),
+	mInvalid() {
+	while ( mRootPath.length() > 1 && mRootPath.endsWith( '/' ) ) {
+		mRootPath.chop( 1 );
+	}
+}
+
+void RemoteTree::addEntries( const QVariantList &files ) {
+	for ( int i = 0; i + 3 < files.length(); i += 4 ) {
+		QString path = files[ i ].toString();
+		if ( path.isEmpty() ) {
+			continue;
+		}
+
+		Entry entry;
+		entry.flags = files[ i + 1 ].toByteArray();
+		entry.size = files[ i + 2 ].toLongLong();
+		entry.mtime = files[ i + 3 ].toLongLong();
+
+		if ( ! mEntries.contains( path ) ) {
+			int slash = path.lastIndexOf( '/' );
+			mChildren[ slash == -1 ? QString() : path.left( slash ) ].append( path.mid( slash + 1 ) );
+		}
+		mEntries.insert( path, entry );
+	}
+}
+
+void RemoteTree::setTruncated( bool truncated ) {
+	mTruncated = truncated;
+}
+
+bool RemoteTree::makeRelative( const QString &remotePath, QString *relativePath ) const {
+	QString path = remotePath;
+	while ( path.length() > 1 && path.endsWith( '/' ) ) {
+		path.chop( 1 );
+	}
+
+	if ( path == mRootPath ) {
+		*relativePath = QString();
+		return true;
+	}
+
+	QString prefix = ( mRootPath == "/" ? mRootPath : mRootPath + "/" );
+	if ( ! path.startsWith( prefix ) ) {
+		return false;
+	}
+
+	*relativePath = path.mid( prefix.length() );
+	return true;
+}
+
+bool RemoteTree::contains( const QString &remotePath ) const {
+	QString relativePath;
+	return makeRelative( remotePath, &relativePath ) &&
+	       ( relativePath.isEmpty() || mEntries.contains( relativePath ) );
+}
+
+QStringList RemoteTree::getFiles() const {
+	QStringList files;
+	for ( QHash< QString, Entry >::const_iterator i = mEntries.constBegin(); i != mEntries.constEnd(); ++i ) {
+		if ( ! i->flags.contains( 'd' ) ) {
+			files.append( i.key() );
+		}
+	}
+	return files;
+}
+
+bool RemoteTree::getListing( const QString &remotePath, QVariantMap *entries ) const {
+	QString relativePath;
+	if ( mFiltered || mTruncated || ! makeRelative( remotePath, &relativePath ) || mInvalid.contains( relativePath ) ) {
+		return false;
+	}
+
+	// The walk stopped at the depth limit, at symlinks ('l') and at folders it couldn't read; those were listed, but
+	// not what's in them.
+	if ( ! relativePath.isEmpty() ) {
+		QHash< QString, Entry >::const_iterator folder = mEntries.find( relativePath );
+		if ( folder == mEntries.constEnd() || ! folder->flags.contains( 'd' ) || folder->flags.contains( 'l' ) ||
+		     ! folder->flags.contains( 'r' ) ) {
+			return false;
+		}
+		if ( mDepth > 0 && relativePath.count( '/' ) + 1 >= mDepth ) {
+			return false;
+		}
+	}
+
+	QString prefix = ( relativePath.isEmpty() ? QString() : relativePath + "/" );
+	entries->clear();
+	foreach ( const QString &name, mChildren.value( relativePath ) ) {
+		const Entry &entry = mEntries[ prefix + name ];
+
+		// As ls would have it.
+		QVariantMap item;
+		item.insert( "f", QString::fromLatin1( entry.flags ).remove( 'l' ) );
+		item.insert( "s", entry.size );
+		item.insert( "m", entry.mtime );
+		entries->insert( name, item );
+	}
+
+	return true;
+}
+
+void RemoteTree::invalidate( const QString &remotePath ) {
+	QString relativePath;
+	if ( makeRelative( remotePath, &relativePath ) ) {
+		mInvalid.insert( relativePath );
+	}
+}
@@ -0,0 +1,79 @@
+#ifndef REMOTETREE_H
+#define REMOTETREE_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVariantList>
+#include <QVariantMap>
+
+//
+// A snapshot of everything below a remote folder, as sent back by the server script's tree call. Project-wide tools
+// take the file list from it in one go. Entries are indexed by folder, so a tree taken without filters can also
+// answer listings of any folder it walked completely; the listing cache does that, saving an ls per folder.
+//
+// Paths inside the tree are relative to its root. Main thread only.
+//
+
+// Entries per part of a tree reply, and how many to take before giving up.
+#define REMOTE_TREE_BATCH_SIZE 5000
+#define REMOTE_TREE_MAX_ENTRIES 500000
+
+class RemoteTree {
+	public:
+		// flags are the listing cache's; depth 0 is unlimited. A filtered tree leaves things out, so can't do listings.
+		RemoteTree( const QString &rootPath, int flags, int depth, bool filtered );
+
+		// Takes the tree reply's flat path, flags, size, mtime list. Folders arrive before anything in them; those
+		// flagged 'l' (symlinks) weren't walked.
+		void addEntries( const QVariantList &files );
+		void setTruncated( bool truncated );
+
+		inline const QString &getRootPath() const {
+			return mRootPath;
+		}
+		inline int getFlags() const {
+			return mFlags;
+		}
+		inline const QDateTime &getFetched() const {   // When it was asked for, in UTC.
+			return mFetched;
+		}
+		inline int count() const {
+			return mEntries.count();
+		}
+		inline bool isTruncated() const {
+			return mTruncated;
+		}
+
+		bool contains( const QString &remotePath ) const;
+		QStringList getFiles() const;   // Relative paths, in no particular order.
+
+		// Returns false unless the tree walked all of the folder; entries come in the same form ls gives them.
+		bool getListing( const QString &remotePath, QVariantMap *entries ) const;
+
+		void invalidate( const QString &remotePath );   // The folder has changed; stop answering for it.
+
+	private:
+		struct Entry {
+			QByteArray flags;
+			qint64 size;
+			qint64 mtime;
+		};
+
+		bool makeRelative( const QString &remotePath, QString *relativePath ) const;
+
+		QString mRootPath;
+		int mFlags;
+		int mDepth;
+		bool mFiltered;
+		bool mTruncated;
+		QDateTime mFetched;
+
+		QHash< QString, Entry > mEntries;           // By relative path.
+		QHash< QString, QStringList > mChildren;    // Names in each folder, by the folder's relative path.
+		QSet< QString > mInvalid;
+};
+
+#endif  // REMOTETREE_H
@@ -2,6 +2,7 @@
 #include <QDebug>
 #include <QMessageBox>
 
+#include "file/filedelta.h"
 #include "file/openfilemanager.h"
 #include "file/serverfile.h"
 #include "filestatuswidget.h"
@@ -16,6 +17,9 @@ ServerFile::ServerFile( const Location &location ) :
 	BaseFile( location ) {
 	mHost = location.getRemoteHost();
 	mChangePumpCursor = 0;
+	mRefreshBlockSize = 0;
+
+	connect( mHost, SIGNAL( remotePathsChanged( QStringList ) ), this, SLOT( remotePathsChanged( QStringList ) ) );
 }
 
 ServerFile::~ServerFile() {
@@ -117,7 +121,7 @@ void ServerFile::finalizeFileOpen() {
 	}
 
 	bool readOnly = ! mServerOpenResults.value( "writable" ).toBool();
-	BaseFile::openSuccess( QString::fromUtf8( mDownloadedData ), mDownloadedChecksum, readOnly );
+	FileDecoder::start( new FileDecoder( this, mDownloadedData, mDownloadedChecksum, readOnly ) );
 	mChangePumpCursor = 0;
 
 	clearTempOpenData();
@@ -277,9 +281,86 @@ void ServerFile::close() {
 	closeCompleted();
 }
 
+void ServerFile::remotePathsChanged( const QStringList &paths ) {
+	if ( mOpenStatus != Ready || ! paths.contains( mLocation.getRemotePath() ) ) {
+		return;
+	}
+
+	// Nothing to lose, so pick up the change straight away; otherwise leave it to the user.
+	if ( ! hasUnsavedChanges() ) {
+		SSHLOG_INFO( mHost ) << mLocation.getLabel() << "changed on the server; refreshing";
+		refresh();
+	} else {
+		gDispatcher->emitGeneralStatusMessage(
+			tr( "%1 has changed on the server; refresh it to load the changes." ).arg( mLocation.getLabel() ) );
+	}
+}
+
 void ServerFile::refresh() {
 	mHost->sendServerRequest( mLocation.isSudo(), this, "close" );
-	open();
+
+	// Only a fully loaded file has a copy worth diffing against; anything else gets a full reload.
+	if ( mOpenStatus != Ready ) {
+		open();
+		return;
+	}
+
+	setOpenStatus( Refreshing );
+	clearTempOpenData();
+
+	// Reopen the buffer, sending signatures of the current content so the server can reply with a delta.
+	mRefreshBase = mContent.toUtf8();
+	mRefreshBlockSize = FileDelta::chooseBlockSize( mRefreshBase.length() );
+
+	QMap< QString, QVariant > params;
+	params.insert( "file", mLocation.getRemotePath() );
+	params.insert( "blockSize", mRefreshBlockSize );
+	params.insert( "length", mRefreshBase.length() );
+	params.insert( "sums", FileDelta::signatures( mRefreshBase, mRefreshBlockSize ) );
+	mHost->sendServerRequest( mLocation.isSudo(),
+	                          this,
+	                          "open",
+	                          QVariant( params ),
+	                          Callback( this,
+	                                    SLOT( serverRefreshSuccess( QVariantMap ) ),
+	                                    SLOT( openFailure( QString, int ) ) ) );
+}
+
+void ServerFile::serverRefreshSuccess( QVariantMap results ) {
+	if ( getOpenStatus() != BaseFile::Refreshing ) {
+		mRefreshBase.clear();
+		return;
+	}
+
+	QByteArray checksum = results.value( "checksum" ).toByteArray();
+	bool readOnly = ! results.value( "writable" ).toBool();
+
+	QByteArray newContent;
+	QList< FileDelta::Hunk > hunks;
+	if ( results.contains( "delta" ) &&
+	     FileDelta::apply( mRefreshBase, mRefreshBlockSize, results.value( "delta" ).toList(), &newContent, &hunks ) &&
+	     BaseFile::getChecksum( newContent ).toLatin1() == checksum ) {
+		SSHLOG_TRACE( mHost ) << "Refreshed" << mLocation.getLabel() << "by delta;" << hunks.length() <<
+		        "changed regions";
+
+		applyDelta( mRefreshBase, newContent, hunks, checksum, readOnly );
+		mRefreshBase.clear();
+		mChangePumpCursor = 0;
+		return;
+	}
+
+	// The delta didn't check out; fetch the whole file, reusing the buffer the server just opened.
+	SSHLOG_WARN( mHost ) << "Delta refresh failed for" << mLocation.getLabel() << "- downloading full copy";
+	mRefreshBase.clear();
+	setOpenStatus( BaseFile::Loading );
+	mServerOpenResults = results;
+
+	mHost->getFileContent( mLocation.isSudo(),
+	                       mLocation.getRemotePath().toLatin1(),
+	                       Callback( this,
+	                                 SLOT( downloadSuccess( QVariantMap ) ),
+	                                 SLOT( openFailure( QString, int ) ),
+	                                 SLOT( downloadProgress( int ) ) ) );
 }
 
 void ServerFile::sudo() {
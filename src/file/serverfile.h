@@ -23,6 +23,7 @@ class ServerFile : public BaseFile {
 		void createSuccess( QVariantMap result );
 
 		void serverOpenSuccess( QVariantMap results );
+		void serverRefreshSuccess( QVariantMap results );
 		void downloadProgress( int percent );
 		void downloadSuccess( QVariantMap result );
 		void serverChannelFailure();
@@ -35,6 +36,8 @@ class ServerFile : public BaseFile {
 		void serverReconnectSuccess( QVariantMap results );
 		void serverReconnectFailure( QString error, int flags );
 
+		void remotePathsChanged( const QStringList &paths );
+
 	signals:
 		void resyncSuccessRethreadSignal( int );
 
@@ -62,6 +65,10 @@ class ServerFile : public BaseFile {
 		QVariantMap mServerOpenResults;
 		QByteArray mDownloadedData;
 		QByteArray mDownloadedChecksum;
+
+// Temporary stuff used during a delta refresh
+		QByteArray mRefreshBase;
+		int mRefreshBlockSize;
 };
 
 #endif  // SSHFILE_H
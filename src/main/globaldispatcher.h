@@ -32,6 +32,10 @@ class GlobalDispatcher : public QObject {
 			emit locationListSuccess( children, locationPath );
 		}
 
+		void emitLocationListPart( const QList< Location > &children, QString locationPath, bool complete ) {
+			emit locationListPart( children, locationPath, complete );
+		}
+
 		void emitLocationListFailure( const QString &error, QString locationPath, bool permissionError ) {
 			emit locationListFailure( error, locationPath, permissionError );
 		}
@@ -59,6 +63,7 @@ class GlobalDispatcher : public QObject {
 		void generalStatusMessage( QString message );
 
 		void locationListSuccess( const QList< Location > &children, QString locationPath );
+		void locationListPart( const QList< Location > &children, QString locationPath, bool complete );
 		void locationListFailure( const QString &error, QString locationPath, bool permissionError );
 
 		void selectFile( BaseFile *file );
@@ -54,9 +54,11 @@ int main( int argc, char *argv[] ) {
 			}
 		} else {
 			// App not running; open given filenames here.
+			QList< Location > locations;
 			foreach ( QString arg, positionalArguments ) {
-				gMainWindow->openSingleFile( Location( arg ) );
+				locations.append( Location( arg ) );
 			}
+			gMainWindow->openFiles( locations );
 		}
 
 		QNetworkProxyFactory::setUseSystemConfiguration( true );
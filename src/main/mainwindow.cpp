@@ -213,9 +213,7 @@ void MainWindow::openFile() {
 				return;
 			}
 		}
-		foreach ( Location location, locations ) {
-			openSingleFile( location );
-		}
+		openFiles( locations );
 	}
 }
 
@@ -227,30 +225,81 @@ void MainWindow::openSingleFile() {
 }
 
 void MainWindow::openSingleFile( const Location &loc ) {
-	if ( ! loc.isDirectory() ) {
+	openFiles( QList< Location >() << loc );
+}
+
+void MainWindow::openFiles( const QList< Location > &locations ) {
+	QList< BaseFile * > files;
+	foreach ( const Location &loc, locations ) {
+		if ( loc.isDirectory() ) {
+			continue;
+		}
+
 		BaseFile *file;
 		try {
 			file = Location( loc ).getFile();
 		} catch ( QString &e ) {
-			QLOG_ERROR() << "Error opening a single file" << loc.getPath() << ": " << e;
-			return;
+			QLOG_ERROR() << "Error opening a file" << loc.getPath() << ": " << e;
+			continue;
 		}
 
-		if ( file->isClosed() ) {
+		if ( ! files.contains( file ) ) {
+			files.append( file );
+		}
+	}
+
+	// Start every load before making any editors, so they're all on their way at once; requests are queued in
+	// order, so the file left on show comes in first.
+	foreach ( BaseFile *file, files ) {
+		if ( file->isDeferred() ) {
+			file->openDeferred();
+		} else if ( file->isClosed() ) {
 			file->open();
 		}
+	}
 
+	// The first file's editor goes last, so that's the one on show and the most recent.
+	for ( int i = files.length() - 1; i >= 0; i-- ) {
+		BaseFile *file = files[ i ];
 		gWindowManager->displayFile( file );
 
-		gDispatcher->emitSelectFile( file );
+		addRecentFile( file->getLocation() );
 
-		addRecentFile( loc );
+		connect( file, SIGNAL( openStatusChanged( int ) ), this, SLOT( updateTitle() ), Qt::UniqueConnection );
+		connect( file, SIGNAL( unsavedStatusChanged() ), this, SLOT( updateTitle() ), Qt::UniqueConnection );
+	}
 
-		connect( file, SIGNAL( openStatusChanged( int ) ), this, SLOT( updateTitle() ) );
-		connect( file, SIGNAL( unsavedStatusChanged() ), this, SLOT( updateTitle() ) );
+	if ( ! files.isEmpty() ) {
+		gDispatcher->emitSelectFile( files.first() );
 	}
 }
 
+void MainWindow::restoreFiles( const QList< Location > &locations, const QList< int > &lines ) {
+	// Only the first file is opened and shown; the rest wait, unopened, until they're looked at.
+	QList< Location > first;
+	for ( int i = 0; i < locations.length(); i++ ) {
+		BaseFile *file;
+		try {
+			file = Location( locations[ i ] ).getFile();
+		} catch ( QString &e ) {
+			QLOG_ERROR() << "Error restoring a file" << locations[ i ].getPath() << ": " << e;
+			continue;
+		}
+
+		if ( file->isClosed() ) {
+			file->setDeferred( lines.value( i, 1 ) );
+		}
+		if ( first.isEmpty() ) {
+			first.append( file->getLocation() );
+		}
+
+		connect( file, SIGNAL( openStatusChanged( int ) ), this, SLOT( updateTitle() ), Qt::UniqueConnection );
+		connect( file, SIGNAL( unsavedStatusChanged() ), this, SLOT( updateTitle() ), Qt::UniqueConnection );
+	}
+
+	openFiles( first );
+}
+
 void MainWindow::saveFile() {
 	Editor *current = gWindowManager->currentEditor();
 	if ( current ) {
@@ -32,6 +32,8 @@ class MainWindow : public QMainWindow {
 		void openFile();
 		void openSingleFile();
 		void openSingleFile( const Location &loc );
+		void openFiles( const QList< Location > &locations );   // The first is left on show.
+		void restoreFiles( const QList< Location > &locations, const QList< int > &lines );
 		void saveFile();
 		void saveFileAs();
 		void saveAllFiles();
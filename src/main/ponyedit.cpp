@@ -18,6 +18,7 @@
 #include "QsLog.h"
 #include "ssh2/serverchannel.h"
 #include "ssh2/sshhost.h"
+#include "ssh2/sshreactor.h"
 #include "ssh2/xferrequest.h"
 #include "syntax/syntaxdefmanager.h"
 #include "syntax/syntaxrule.h"
@@ -109,6 +110,9 @@ PonyEdit::PonyEdit( int argc, char **argv ) :
 		gDispatcher = new GlobalDispatcher();
 		mDialogRethreader = new DialogRethreader();
 
+		// Get connections to recently used hosts going while the rest of the UI comes up.
+		SshHost::prewarmRecentHosts();
+
 		gMainWindow = new MainWindow();
 		gMainWindow->show();
 
@@ -120,6 +124,7 @@ PonyEdit::~PonyEdit() {
 	sApplicationExiting = true;
 
 	SshHost::cleanup();
+	SshReactor::shutdown();
 
 	delete gDispatcher;
 	delete gSiteManager;
@@ -6,9 +6,12 @@
 #include "ssh2/sshhost.h"
 #include "windowmanager.h"
 
+#include <QDataStream>
 #include <QDebug>
+#include <QFile>
 #include <QRegExp>
 #include <QSettings>
+#include <QStandardPaths>
 #include <QtXml>
 #include <QThread>
 
@@ -17,6 +20,10 @@
 #define MEGABYTE_MULTIPLIER 1048576
 #define KILOBYTE_MULTIPLIER 1024
 
+// Remote directory listings are kept out of the settings, in a cache file of their own.
+#define LISTING_CACHE_FILE "/listings.dat"
+#define LISTING_CACHE_FILE_VERSION 1
+
 QThread *sMainThread = NULL;
 QString Tools::sResourcePath;
 
@@ -55,6 +62,14 @@ void Tools::saveServers() {
 			settings.setValue( "name", host->getName() );
 			settings.setValue( "defaultDirectory", host->getDefaultDirectory() );
 			settings.setValue( "connectionType", host->getConnectionType() );
+			settings.setValue( "channelPool", host->getChannelPool().save() );
+			settings.remove( "listingCache" );      // Older versions kept it here.
+
+			// Hints for reconnecting quickly, and for deciding which hosts to connect to at startup.
+			settings.setValue( "cachedIpAddress", ( qulonglong ) host->getCachedIpAddress() );
+			settings.setValue( "cachedAuthMethod", ( int ) host->getCachedAuthMethod() );
+			settings.setValue( "homeDirectory", host->getHomeDirectory() );
+			settings.setValue( "lastConnected", host->getLastConnected() );
 		}
 	}
 	settings.endArray();
@@ -95,6 +110,16 @@ void Tools::loadServers() {
 // host->setConnectionType(static_cast<OldSshHost::ConnectionType>(settings.value("connectionType",
 // QVariant(OldSshHost::SSH)).toInt()));
 
+		host->getChannelPool().restore( settings.value( "channelPool" ).toMap() );
+
+		host->setCachedIpAddress( ( unsigned long ) settings.value( "cachedIpAddress", 0 ).toULongLong() );
+		host->setCachedAuthMethod( ( SshSession::AuthMethod ) settings.value( "cachedAuthMethod",
+		                                                                      SshSession::AuthNone ).toInt() );
+		if ( settings.contains( "homeDirectory" ) ) {
+			host->setHomeDirectory( settings.value( "homeDirectory" ).toByteArray() );
+		}
+		host->setLastConnected( settings.value( "lastConnected" ).toDateTime() );
+
 		SshHost::recordKnownHost( host );
 	}
 	settings.endArray();
@@ -107,6 +132,56 @@ void Tools::loadServers() {
 		QByteArray key = settings.value( "hostkey" ).toByteArray();
 		SshHost::registerKnownFingerprint( hostname, key );
 	}
+
+	loadListingCaches();
+}
+
+static QString listingCacheKey( SshHost *host ) {
+	return QString( "%1@%2:%3" ).arg( QString( host->getUsername() ), QString( host->getHostname() ) )
+	       .arg( host->getPort() );
+}
+
+void Tools::saveListingCaches() {
+	QVariantMap caches;
+	foreach ( SshHost *host, SshHost::getKnownHosts() ) {
+		if ( host->getSaveHost() ) {
+			QVariantList saved = host->getListingCache().save();
+			if ( ! saved.isEmpty() ) {
+				caches.insert( listingCacheKey( host ), saved );
+			}
+		}
+	}
+
+	QString path = QStandardPaths::writableLocation( QStandardPaths::CacheLocation );
+	QDir().mkpath( path );
+	QFile file( path + LISTING_CACHE_FILE );
+	if ( ! file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) {
+		QLOG_WARN() << "Failed to save listing cache:" << file.errorString();
+		return;
+	}
+
+	QDataStream stream( &file );
+	stream << ( qint32 ) LISTING_CACHE_FILE_VERSION << caches;
+}
+
+void Tools::loadListingCaches() {
+	QFile file( QStandardPaths::writableLocation( QStandardPaths::CacheLocation ) + LISTING_CACHE_FILE );
+	if ( ! file.open( QIODevice::ReadOnly ) ) {
+		return;
+	}
+
+	QDataStream stream( &file );
+	qint32 version = 0;
+	QVariantMap caches;
+	stream >> version;
+	if ( version != LISTING_CACHE_FILE_VERSION ) {
+		return;
+	}
+	stream >> caches;
+
+	foreach ( SshHost *host, SshHost::getKnownHosts() ) {
+		host->getListingCache().restore( caches.value( listingCacheKey( host ) ).toList() );
+	}
 }
 
 void Tools::saveHostFingerprints() {
@@ -275,7 +350,9 @@ void Tools::loadStartupFiles() {
 			break;
 
 		case Options::SetFiles:
-		case Options::ReopenFiles:
+		case Options::ReopenFiles: {
+			QList< Location > locations;
+			QList< int > lines;
 			for ( int ii = 0; ii < Options::StartupFiles.length(); ii++ ) {
 				QString name = Options::StartupFiles[ ii ].trimmed();
 
@@ -283,14 +360,13 @@ void Tools::loadStartupFiles() {
 					continue;
 				}
 
-				gMainWindow->openSingleFile( Location( name ) );
-
-				Editor *current = gMainWindow->getCurrentEditor();
-				if ( current ) {
-					current->gotoLine( Options::StartupFilesLineNo[ ii ] );
-				}
+				locations.append( Location( name ) );
+				lines.append( Options::StartupFilesLineNo.value( ii, 1 ) );
 			}
+
+			gMainWindow->restoreFiles( locations, lines );
 			break;
+		}
 
 		case Options::NoFiles:
 		default:
@@ -317,6 +393,8 @@ void Tools::saveCurrentFiles() {
 		Options::StartupFiles.append( loc.getDisplayPath() );
 		if ( file->getAttachedEditors().size() > 0 ) {
 			Options::StartupFilesLineNo.append( file->getAttachedEditors().at( 0 )->currentLine() );
+		} else {
+			Options::StartupFilesLineNo.append( file->getRestoreLine() );
 		}
 	}
 
@@ -357,74 +435,3 @@ QString Tools::stringifyIpAddress( unsigned long ipAddress ) {
 	       .arg( ( ipAddress >> 16 ) & 0xFF )
 	       .arg( ( ipAddress >> 24 ) & 0xFF );
 }
-
-QByteArray Tools::bin( const QByteArray &source ) {
-	const unsigned char *c = ( const unsigned char * ) source.constData();
-	const unsigned char *end = c + source.length();
-	QByteArray result;
-
-	while ( c < end ) {
-		if ( *c == 0x3 || *c == 0x4 || *c == 0x8 || *c == 0x11 || *c == 0x13 || *c == 0x1D || *c == 0x1E ||
-		     *c == 0x18 || *c == 0x1A || *c == 0x1C || *c == 0x7F ) {
-			result.append( ( unsigned short ) 255 ).append( *c + 128 );
-		} else if ( *c == 10 ) {
-			result.append( ( unsigned short ) 253 );
-		} else if ( *c == 13 ) {
-			result.append( ( unsigned short ) 254 );
-		} else if ( *c == 253 ) {
-			result.append( ( unsigned short ) 255 ).append( 'A' );
-		} else if ( *c == 254 ) {
-			result.append( ( unsigned short ) 255 ).append( 'B' );
-		} else if ( *c == 255 ) {
-			result.append( ( unsigned short ) 255 ).append( 'C' );
-		} else {
-			result.append( *c );
-		}
-
-		c++;
-	}
-
-	return result;
-}
-
-unsigned char Tools::unbinEscape( unsigned char c ) {
-	return ( c < 128 ? c + 188 : c - 128 );
-}
-
-int Tools::unbin( QByteArray &target, const char *source, int maxTarget, int maxSource, bool *leftoverEscape ) {
-	const unsigned char *unsignedSource = ( const unsigned char * ) source;
-	const unsigned char *sourceEnd = unsignedSource + maxSource;
-	const unsigned char *c = unsignedSource;
-
-	if ( leftoverEscape && *leftoverEscape && c < sourceEnd ) {
-		target.append( unbinEscape( *c ) );
-		*leftoverEscape = false;
-		c++;
-	}
-
-	for (; c < sourceEnd; c++ ) {
-		if ( target.length() >= maxTarget ) {
-			return ( c - unsignedSource );
-		}
-
-		if ( *c < 253 ) {
-			target.append( *c );
-		} else if ( *c == 253 ) {
-			target.append( ( unsigned char ) 10 );
-		} else if ( *c == 254 ) {
-			target.append( ( unsigned char ) 13 );
-		} else {
-			c++;
-			if ( c >= sourceEnd ) {
-				if ( leftoverEscape ) {
-					*leftoverEscape = true;
-				}
-				break;
-			}
-
-			target.append( unbinEscape( *c ) );
-		}
-	}
-
-	return c - unsignedSource;
-}
@@ -16,6 +16,8 @@ class Tools {
 		static void saveServers();
 		static void saveHostFingerprints();
 		static void loadServers();
+		static void saveListingCaches();        // Only at exit; listings change too often to save with the servers.
+		static void loadListingCaches();
 		static bool isMainThread();
 
 		static QList< Location > loadRecentFiles();
@@ -43,10 +45,6 @@ class Tools {
 
 		static QString stringifyIpAddress( unsigned long ipAddress );
 
-		static int unbin( QByteArray &target, const char *source, int maxTarget, int maxSource, bool *leftoverEscape = NULL );
-		static QByteArray bin( const QByteArray &source );
-		static unsigned char unbinEscape( unsigned char c );
-
 	private:
 		static QString sResourcePath;
 };
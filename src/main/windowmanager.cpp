@@ -14,6 +14,9 @@ WindowManager::WindowManager( QWidget *parent ) :
 	mEditorSelectionLocked = false;
 	mParent = reinterpret_cast< MainWindow * >( parent );
 	mCurrentEditorPanel = NULL;
+	mPendingSearchCaseSensitive = false;
+	mPendingSearchUseRegExp = false;
+	mPendingSearchShowReplaceOptions = false;
 	gWindowManager = this;
 
 	// Create a root editor stack
@@ -300,6 +303,29 @@ void WindowManager::searchInFiles( const QList< BaseFile * > files,
                                    bool caseSensitive,
                                    bool useRegExp,
                                    bool showReplaceOptions ) {
+	forgetPendingSearch();
+
+	// Restored files nobody has looked at yet have no content; open them, and search once everything's loaded.
+	foreach ( BaseFile *file, files ) {
+		file->openDeferred();
+		if ( file->getOpenStatus() == BaseFile::Loading ) {
+			mPendingSearchFiles.append( file );
+		}
+	}
+
+	if ( ! mPendingSearchFiles.isEmpty() ) {
+		mPendingSearchFiles.clear();
+		foreach ( BaseFile *file, files ) {
+			mPendingSearchFiles.append( file );
+			connect( file, SIGNAL( openStatusChanged( int ) ), this, SLOT( pendingSearchStatusChanged() ) );
+		}
+		mPendingSearchText = text;
+		mPendingSearchCaseSensitive = caseSensitive;
+		mPendingSearchUseRegExp = useRegExp;
+		mPendingSearchShowReplaceOptions = showReplaceOptions;
+		return;
+	}
+
 	QList< SearchResultModel::Result > results;
 
 	foreach ( BaseFile *file, files ) {
@@ -324,6 +350,33 @@ void WindowManager::searchInFiles( const QList< BaseFile * > files,
 	showSearchResults( results, showReplaceOptions );
 }
 
+void WindowManager::pendingSearchStatusChanged() {
+	QList< BaseFile * > files;
+	foreach ( const QPointer< BaseFile > &file, mPendingSearchFiles ) {
+		if ( file ) {
+			if ( file->getOpenStatus() == BaseFile::Loading ) {
+				return;
+			}
+			files.append( file );
+		}
+	}
+
+	searchInFiles( files,
+	               mPendingSearchText,
+	               mPendingSearchCaseSensitive,
+	               mPendingSearchUseRegExp,
+	               mPendingSearchShowReplaceOptions );
+}
+
+void WindowManager::forgetPendingSearch() {
+	foreach ( const QPointer< BaseFile > &file, mPendingSearchFiles ) {
+		if ( file ) {
+			disconnect( file, SIGNAL( openStatusChanged( int ) ), this, SLOT( pendingSearchStatusChanged() ) );
+		}
+	}
+	mPendingSearchFiles.clear();
+}
+
 void WindowManager::showSearchResults( const QList< SearchResultModel::Result > &results, bool showReplaceOptions ) {
 	mSearchResults->showResults( results );
 	mSearchResults->showReplaceOptions( showReplaceOptions );
@@ -3,6 +3,7 @@
 
 #include <QList>
 #include <QMap>
+#include <QPointer>
 #include <QSplitter>
 #include <QVBoxLayout>
 #include <QWidget>
@@ -91,6 +92,9 @@ class WindowManager : public QWidget {
 		void nextSplit();
 		void previousSplit();
 
+	private slots:
+		void pendingSearchStatusChanged();
+
 	private:
 		int find( Editor *editor, const QString &text, bool backwards, bool caseSensitive, bool useRegexp, bool loop = true );
 		int replace( Editor *editor,
@@ -103,6 +107,7 @@ class WindowManager : public QWidget {
 		void createSearchBar();
 		void createRegExpTester();
 		void createSearchResults();
+		void forgetPendingSearch();
 
 		MainWindow *mParent;
 
@@ -121,6 +126,13 @@ class WindowManager : public QWidget {
 
 		QDockWidget *mSearchResultsWrapper;
 		SearchResults *mSearchResults;
+
+		// A search of files that were still loading; it runs once they've all come in.
+		QList< QPointer< BaseFile > > mPendingSearchFiles;
+		QString mPendingSearchText;
+		bool mPendingSearchCaseSensitive;
+		bool mPendingSearchUseRegExp;
+		bool mPendingSearchShowReplaceOptions;
 };
 
 // One and only WindowManager object, created by MainWindow.
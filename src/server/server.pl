@@ -14,14 +14,20 @@ use utf8;
 
 our %buffers = ();
 our $nextBufferId = 1;
+our $daemonIdleSeconds = 600;
+our $forkLongCalls = 0;
+our %longCalls = ('ls' => 1, 'tree' => 1, 'open' => 1);
+our %workers = ();             # pipe fileno => {'pipe', 'pid', 'output', 'id', 'partial'}
 our %calls =
 (
+	'cancel' => \&msg_cancel,
 	'ls' => \&msg_ls,
 	'open' => \&msg_open,
 	'change' => \&msg_change,
 	'save' => \&msg_save,
 	'close' => \&msg_close,
 	'mkdir' => \&msg_mkdir,
+	'tree' => \&msg_tree,
 );
 
 #	Open and unbuffer a logfile
@@ -30,15 +36,20 @@ select((select(LOGFILE), $|=1)[0]);
 sub errlog { print LOGFILE POSIX::strftime("[%Y-%m-%d %H:%M:%S] - ", localtime) . $_[0] . "\n"; }
 $| = 1;
 
-#	Startup information
+#	Startup information. Clients share one daemon per script version, if they can reach it.
+my $daemon = ($ARGV[0] eq 'client') ? connectDaemon() : undef;
 print "Server OK\n";
-print json::encode({'~' => getcwd()}) . "\n";
+print json::encode({'~' => getcwd(), 'shared' => ($daemon ? 1 : 0)}) . "\n";
 print "\%-ponyedit-\%";
 
 if ($ARGV[0] eq 'xfer')
 {
 	xferLoop();
 }
+elsif ($daemon)
+{
+	relayLoop($daemon);
+}
 else
 {
 	serverLoop();
@@ -49,37 +60,229 @@ sub serverLoop
 	my $inBuffer = '';
 	our $inputs = IO::Select->new();
 	$inputs->add(\*STDIN);
+	$SIG{CHLD} = 'IGNORE';
+	$forkLongCalls = 1;
+	Watcher::init($inputs);
 	while (1)
 	{
-		my @ready = $inputs->can_read;
+		my @ready = $inputs->can_read(Watcher::timeout());
+		Watcher::tick();
 		foreach my $in (@ready)
 		{
+			if (Watcher::isEventSource($in))
+			{
+				Watcher::readEvents();
+				next;
+			}
+			next if (readWorker($in));
+
 			my $retry = 1;
 			while ($retry)
 			{
 				my $data;
 				$retry = (sysread($in, $data, 2048) == 2048);
-				$inBuffer .= $data;
+				handleInput(\$inBuffer, $data);
+			}
+		}
+	}
+}
+
+#	Handles every complete line of input; anything after the last newline waits in $$inBuffer for the rest.
+sub handleInput
+{
+	my ($inBuffer, $data) = @_;
+	$$inBuffer .= $data;
+
+	my @pieces = split("\n", $$inBuffer, -1);
+	$$inBuffer = pop @pieces;
+	foreach my $piece (@pieces)
+	{
+		eval
+		{
+			my $leftover = 0;
+			my $command = unbin($piece, \$leftover);
+			Encode::_utf8_on($command);
+			serverCommand($command); 1;
+		}
+		or do
+		{
+			errlog("Error handling server command: $@\nCause: $piece");
+		};
+	}
+}
+
+#	Returns a connection to the shared daemon, starting one if there isn't one running. The daemon holds every
+#	buffer, so any channel can serve any file. Returns undef if that can't be done; the channel runs its own server.
+sub connectDaemon
+{
+	my $socketPath = $0;
+	$socketPath =~ s/\.pl$/.sock/;
+	return undef if ($socketPath eq $0 || !eval { require IO::Socket::UNIX; 1 });
+
+	#	Anyone who can reach the daemon can read and write files as this user; keep its folder to ourselves.
+	my $socketDir = $socketPath;
+	$socketDir =~ s{/[^/]*$}{};
+	chmod 0700, $socketDir if ($socketDir ne $socketPath);
+
+	#	Connect with the lock held, so the daemon can't shut down between this connecting and being accepted; and
+	#	only one channel at a time gets to replace a missing daemon.
+	open(my $lock, '>', "$socketPath.lock") or return undef;
+	flock($lock, Fcntl::LOCK_EX()) or return undef;
+
+	my $socket = IO::Socket::UNIX->new(Peer => $socketPath);
+	if (!$socket)
+	{
+		#	Listen before forking, so the connection below can't beat the daemon to it. The socket is made
+		#	private to this user from the start, not after.
+		unlink $socketPath;
+		my $umask = umask(0077);
+		my $listener = IO::Socket::UNIX->new(Local => $socketPath, Listen => 16);
+		umask($umask);
+		return undef if (!$listener);
+		chmod 0600, $socketPath;
+		my $pid = fork();
+		return undef if (!defined $pid);
+		if ($pid == 0)
+		{
+			close $lock;
+			POSIX::setsid();
+			open STDIN, '<', '/dev/null';
+			open STDOUT, '>', '/dev/null';
+			open STDERR, '>', '/dev/null';
+			daemonLoop($listener, $socketPath);
+			exit 0;
+		}
+
+		close $listener;
+		$socket = IO::Socket::UNIX->new(Peer => $socketPath);
+	}
+
+	close $lock;
+	return $socket;
+}
+
+#	Replies are queued per client and written as each can take them, so one slow client doesn't hold up the rest;
+#	long calls run in workers for the same reason.
+sub daemonLoop
+{
+	my ($listener, $socketPath) = @_;
+	our $inputs = IO::Select->new($listener);
+	my %clients = ();              # socket fileno => {'socket', 'input', 'output', 'handle'}
+	$SIG{CHLD} = 'IGNORE';
+	$SIG{PIPE} = 'IGNORE';
+	$forkLongCalls = 1;
+	Watcher::init($inputs);
+	my $idleCount = $inputs->count();
+	errlog("Shared server started");
+
+	while (1)
+	{
+		my $writers = IO::Select->new(map { $_->{'socket'} } grep { $_->{'output'} ne '' } values %clients);
+
+		#	Hang around for a while after the last client leaves, in case the editor is only restarting.
+		my ($ready, $writable) = IO::Select->select($inputs, $writers, undef,
+			$inputs->count() > $idleCount ? Watcher::timeout() : $daemonIdleSeconds);
+		Watcher::tick();
+
+		foreach my $out (@{$writable || []})
+		{
+			my $client = $clients{fileno($out)};
+			my $written = syswrite($out, $client->{'output'});
+			next if (!$written);
+			substr($client->{'output'}, 0, $written) = '';
+			seek($client->{'handle'}, 0, 2);
+		}
 
-				my @pieces = split("\n", $inBuffer, 2048);
-				if (@pieces > 1)
+		if (!$ready && !$writable)
+		{
+			next if ($inputs->count() > $idleCount);
+
+			#	Clients only connect with the lock held, so once it's ours nobody new can turn up; but someone
+			#	may have connected just before, and mustn't be cut off.
+			open(my $lock, '>', "$socketPath.lock");
+			flock($lock, Fcntl::LOCK_EX());
+			if (IO::Select->new($listener)->can_read(0))
+			{
+				close $lock;
+				next;
+			}
+
+			close $listener;
+			unlink $socketPath;
+			close $lock;
+			last;
+		}
+
+		foreach my $in (@{$ready || []})
+		{
+			if (Watcher::isEventSource($in))
+			{
+				Watcher::readEvents();
+				next;
+			}
+
+			if ($in == $listener)
+			{
+				my $socket = $listener->accept() or next;
+				$socket->blocking(0);
+				my $client = {'socket' => $socket, 'input' => '', 'output' => ''};
+				open($client->{'handle'}, '>>', \$client->{'output'});
+				$client->{'handle'}->autoflush(1);
+				$clients{fileno($socket)} = $client;
+				$inputs->add($socket);
+				Watcher::addClient($client->{'handle'});
+				next;
+			}
+
+			next if (readWorker($in));
+
+			my $client = $clients{fileno($in)};
+			my $data;
+			if (!sysread($in, $data, 65536))
+			{
+				#	Its workers have nobody left to answer.
+				foreach my $worker (values %workers)
 				{
-					$inBuffer = substr($inBuffer, rindex($inBuffer, "\n") + 1);
-					for (my $i = 0; $i < (@pieces - 1); $i++)
-					{
-						eval
-						{
-							my $leftover = 0;
-							my $command = unbin($pieces[$i], \$leftover);
-							Encode::_utf8_on($command);
-							serverCommand($command); 1;
-						}
-						or do
-						{
-							errlog("Error handling server command: $@\nCause: $pieces[$i]");
-						};
-					}
+					stopWorker($worker) if ($worker->{'output'} == $client->{'handle'});
 				}
+
+				Watcher::forgetClient($client->{'handle'});
+				$inputs->remove($in);
+				delete $clients{fileno($in)};
+				close $client->{'handle'};
+				close $in;
+				next;
+			}
+
+			#	Replies go back to whoever asked.
+			my $previous = select($client->{'handle'});
+			handleInput(\$client->{'input'}, $data);
+			select($previous);
+		}
+	}
+
+	errlog("Shared server idle; exiting");
+}
+
+#	Passes everything between the channel and the daemon, until either goes away.
+sub relayLoop
+{
+	my ($daemon) = @_;
+	$daemon->autoflush(1);
+	my $inputs = IO::Select->new(\*STDIN, $daemon);
+	while (1)
+	{
+		foreach my $in ($inputs->can_read)
+		{
+			my $data;
+			exit 0 if (!sysread($in, $data, 65536));
+			if ($in == $daemon)
+			{
+				print STDOUT $data;
+			}
+			else
+			{
+				print $daemon $data;
 			}
 		}
 	}
@@ -89,10 +292,105 @@ sub serverCommand
 {
 	my ($line) = @_;
 	my $message = json::decode($line);
-	my $call = $calls{$message->{'c'}};
-	my $reply;
 
 	errlog("Handling: $line");
+	return if ($forkLongCalls && $longCalls{$message->{'c'}} && forkCommand($message));
+	runCommand($message);
+}
+
+#	Runs a call in a child process, with its reply read back through a pipe; so the server can carry on with other
+#	requests meanwhile, and a cancelled call can be stopped. Returns 0 if it couldn't fork, and the call should be
+#	run in place.
+sub forkCommand
+{
+	my ($message) = @_;
+	my $p = $message->{'p'};
+	my $call;
+
+	#	Only refreshes are slow to open, working out a delta a byte at a time. The buffer belongs in the server, so
+	#	only the delta is left to the worker.
+	if ($message->{'c'} eq 'open')
+	{
+		return 0 if (!ref($p) || !defined($p->{'sums'}) || $p->{'blockSize'} <= 0);
+		my $opened = eval { openBuffer($p) };
+		return 0 if (!$opened);
+		$call = sub { addDelta($opened, $_[0]); return $opened; };
+	}
+
+	#	Watches live in the server, not the worker.
+	if ($message->{'c'} eq 'ls' && ref($p) && $p->{'watch'})
+	{
+		my $name = $p->{'dir'};
+		my $dir = $name;
+		Watcher::watchDirectory(expandPath($dir), $name);
+		delete $p->{'watch'};
+	}
+
+	pipe(my $reader, my $writer) or return 0;
+	my $pid = fork();
+	if (!defined $pid)
+	{
+		close $reader;
+		close $writer;
+		return 0;
+	}
+
+	if ($pid == 0)
+	{
+		close $reader;
+		$SIG{PIPE} = 'DEFAULT';
+		select($writer);
+		$| = 1;
+		runCommand($message, $call);
+		close $writer;
+		POSIX::_exit(0);
+	}
+
+	close $writer;
+	our $inputs;
+	$workers{fileno($reader)} =
+		{'pipe' => $reader, 'pid' => $pid, 'output' => Watcher::output(), 'id' => $message->{'i'}, 'partial' => ''};
+	$inputs->add($reader);
+	return 1;
+}
+
+#	A worker's reply is passed on a whole line at a time, so it can't split anyone else's. Returns 0 if $in isn't a
+#	worker's.
+sub readWorker
+{
+	my ($in) = @_;
+	my $worker = ref($in) ? $workers{fileno($in)} : undef;
+	return 0 if (!$worker);
+
+	my $data;
+	if (!sysread($in, $data, 65536))
+	{
+		stopWorker($worker, 1);
+		return 1;
+	}
+
+	$worker->{'partial'} .= $data;
+	my $end = rindex($worker->{'partial'}, "\n") + 1;
+	print {$worker->{'output'}} substr($worker->{'partial'}, 0, $end, '') if ($end > 0);
+	return 1;
+}
+
+sub stopWorker
+{
+	my ($worker, $finished) = @_;
+	our $inputs;
+	kill 'TERM', $worker->{'pid'} if (!$finished);
+	$inputs->remove($worker->{'pipe'});
+	delete $workers{fileno($worker->{'pipe'})};
+	close $worker->{'pipe'};
+}
+
+#	$call stands in for the message's own, if given.
+sub runCommand
+{
+	my ($message, $call) = @_;
+	$call ||= $calls{$message->{'c'}};
+	my $reply;
 
 	if (defined $call)
 	{
@@ -104,9 +402,19 @@ sub serverCommand
 			{
 				$buff = $buffers{$message->{'b'}};
 				die "Invalid buffer id" if (!defined($buff));
+				Watcher::claimBuffer($buff->{NAME}, $buff->id);
 			}
 
-			$reply = $call->($message->{'p'}, $buff); 1;
+			#	Calls with a lot to say can send parts of their reply ahead of the rest.
+			my $part = sub
+			{
+				my ($partial) = @_;
+				$partial->{'i'} = $message->{'i'};
+				$partial->{'more'} = 1;
+				print json::encode($partial) . "\n";
+			};
+
+			$reply = $call->($message->{'p'}, $buff, $part); 1;
 		};
 		if ($@)
 		{
@@ -130,12 +438,31 @@ sub expandPath
 	return $_[0];
 }
 
-sub msg_ls
+#	Stops a listing or tree still being sent to this client; whatever it has sent so far stands.
+sub msg_cancel
 {
 	my ($p) = @_;
+	my $output = Watcher::output();
+	foreach my $worker (values %workers)
+	{
+		stopWorker($worker) if ($worker->{'output'} == $output && $worker->{'id'} == $p->{'id'});
+	}
+	return {};
+}
+
+#	Big directories are sent in parts of 'batch' entries, if asked; so the client can show them as they come.
+#	With 'watch', the client hears about later changes to the directory.
+sub msg_ls
+{
+	my ($p, $buff, $part) = @_;
 	my $hidden = $p->{'hidden'};
+	my $batch = $p->{'batch'} || 0;
+	my $name = $p->{'dir'};
 	my $dir = expandPath($p->{'dir'});
+	Watcher::watchDirectory($dir, $name) if ($p->{'watch'});
 	my $entries = {};
+	my $count = 0;
+	my $pending = 0;
 
 	opendir DIR, $dir;
 	while (my $filename = readdir DIR)
@@ -146,35 +473,65 @@ sub msg_ls
 		my ($dev,$ino,$mode,$nlink,$uid,$gid,$rdev,$size,
 			$atime,$mtime,$ctime,$blksize,$blocks) = stat("$dir/$filename");
 
+		#	The file tests reuse the stat above rather than asking again.
 		my $flags =
 			(S_ISDIR($mode) ? 'd' : '') .
-			((-r "$dir/$filename") ? 'r' : '') .
-			((-w "$dir/$filename") ? 'w' : '');
+			((-r _) ? 'r' : '') .
+			((-w _) ? 'w' : '');
 
 		$entries->{$filename} = {'f'=>$flags, 's'=>$size, 'm'=>$mtime};
+		$count++;
+
+		if ($batch && ++$pending >= $batch)
+		{
+			$part->({'entries' => $entries});
+			$entries = {};
+			$pending = 0;
+		}
 	}
 	close DIR;
 
-	return {'error' => 'Permission denied', 'code' => 'perm'} if (scalar(keys %$entries) == 0 && !(-r $dir));
+	return {'error' => 'Permission denied', 'code' => 'perm'} if ($count == 0 && !(-r $dir));
 	return {'entries' => $entries};
 }
 
-
 sub msg_open
 {
 	my ($p) = @_;
+	my $reply = openBuffer($p);
+	addDelta($reply, $p);
+	return $reply;
+}
 
+#	Reads the file into a new buffer, and replies with all but the delta.
+sub openBuffer
+{
+	my ($p) = @_;
+
+	my $clientName = $p->{'file'};
 	my $name = expandPath($p->{'file'});
-	my $buff = Buffer->new();
+	my $bufferId = $nextBufferId;
+	my $buff = Buffer->new($bufferId);
 	$buff->openFile($name);
+	Watcher::watchBuffer($name, $clientName, $bufferId);
 
-	my $bufferId = $nextBufferId;
+	#	Closing goes by the buffer's id; the shared daemon lives long enough for strays to add up.
 	$nextBufferId += 1;
 	$buffers{$bufferId} = $buff;
 
 	return {'writable' => (-w $name ?1:0), 'bufferId' => $bufferId, 'checksum' => $buff->checksum()};
 }
 
+#	Refreshing an already-loaded file; reply with a delta against the client's copy
+sub addDelta
+{
+	my ($reply, $p) = @_;
+	return if (!defined($p->{'sums'}) || $p->{'blockSize'} <= 0);
+
+	my $buff = $buffers{$reply->{'bufferId'}};
+	$reply->{'delta'} = Delta::compute(encode('UTF-8', $buff->{DATA}), $p->{'blockSize'}, $p->{'length'}, $p->{'sums'});
+}
+
 #	change
 sub msg_change
 {
@@ -193,6 +550,7 @@ sub msg_save
 	die "Checksums do not match: $s vs $c\n" if (defined($c) && $c ne $s);
 
 	$buff->save();
+	Watcher::refresh($buff->{NAME});
 	return $p;
 }
 
@@ -200,6 +558,7 @@ sub msg_save
 sub msg_close
 {
 	my ($p, $buff) = @_;
+	Watcher::unwatchBuffer($buff->{NAME}, $buff->id);
 	delete $buffers{$buff->id};
 	return {};
 }
@@ -216,6 +575,89 @@ sub msg_mkdir
 	return {};
 }
 
+#	Walks a whole tree, so project-wide tools don't need an ls per folder. Replies with 'files', a flat list of path,
+#	flags, size and mtime for each entry, paths relative to 'dir'; sent in parts of 'batch' entries if asked. Flags
+#	are as ls gives them, plus 'l' on symlinked folders, which are listed but not walked.
+#	'depth' stops the walk that many levels down, 'glob' limits which files are listed (folders always are), 'ignore'
+#	honours .gitignore files along the way, and 'max' gives up after that many entries, flagging the reply 'truncated'.
+sub msg_tree
+{
+	my ($p, $buff, $part) = @_;
+	my $root = expandPath($p->{'dir'});
+	my $hidden = $p->{'hidden'};
+	my $depth = $p->{'depth'} || 0;
+	my $batch = $p->{'batch'} || 0;
+	my $max = $p->{'max'} || 0;
+	my @globs = map { Tree::globRegex($_) } @{$p->{'glob'} || []};
+	my $ignore = $p->{'ignore'};
+
+	return {'error' => 'Permission denied', 'code' => 'perm'} if (!(-d $root && -r _));
+
+	my $files = [];
+	my $count = 0;
+	my $pending = 0;
+	my $truncated = 0;
+	my @stack = (['', 1, $ignore ? Tree::readIgnoreFile($root, '', []) : []]);
+
+	WALK: while (my $next = pop @stack)
+	{
+		my ($relative, $level, $rules) = @$next;
+		my $dir = ($relative eq '') ? $root : "$root/$relative";
+		opendir(my $dh, $dir) or next;
+		my @names = readdir $dh;
+		closedir $dh;
+
+		foreach my $filename (@names)
+		{
+			next if ($filename eq '.' || $filename eq '..');
+			next if (!$hidden && $filename =~ /^\./);
+			next if ($ignore && $filename eq '.git');
+
+			my $path = ($relative eq '') ? $filename : "$relative/$filename";
+			my ($dev,$ino,$mode,$nlink,$uid,$gid,$rdev,$size,
+				$atime,$mtime,$ctime,$blksize,$blocks) = stat("$root/$path");
+			my $isDir = S_ISDIR($mode);
+			my $flags =
+				($isDir ? 'd' : '') .
+				((-r _) ? 'r' : '') .
+				((-w _) ? 'w' : '');
+
+			next if ($ignore && Tree::ignored($rules, $path, $isDir));
+			next if (!$isDir && @globs && !grep { $filename =~ $_ } @globs);
+
+			#	Symlinked folders are listed but not followed; they can loop.
+			my $follow = ($isDir && !(-l "$root/$path"));
+			$flags .= 'l' if ($isDir && !$follow);
+
+			if ($max && $count >= $max)
+			{
+				$truncated = 1;
+				last WALK;
+			}
+
+			push @$files, $path, $flags, $size, $mtime;
+			$count++;
+
+			if ($follow && ($depth == 0 || $level < $depth))
+			{
+				my $childRules = $ignore ? Tree::readIgnoreFile("$root/$path", $path, $rules) : $rules;
+				push @stack, [$path, $level + 1, $childRules];
+			}
+
+			if ($batch && ++$pending >= $batch)
+			{
+				$part->({'files' => $files});
+				$files = [];
+				$pending = 0;
+			}
+		}
+	}
+
+	my $reply = {'files' => $files};
+	$reply->{'truncated'} = 1 if ($truncated);
+	return $reply;
+}
+
 #	Buffer class
 { package Buffer;
 	use Encode qw(encode decode);
@@ -282,6 +724,466 @@ sub msg_mkdir
 	}
 }
 
+#	Delta class; rsync-style rolling checksum matching. See file/filedelta.cpp for the client half.
+{ package Delta;
+	use Digest::MD5 qw(md5_hex);
+	use MIME::Base64;
+
+	#	Returns (a, b) halves of the weak checksum of a block
+	sub weak
+	{
+		my ($block) = @_;
+		my ($wa, $wb) = (0, 0);
+		my $i = length $block;
+		foreach my $c (unpack('C*', $block))
+		{
+			$wa += $c;
+			$wb += $i-- * $c;
+		}
+		return ($wa % 65536, $wb % 65536);
+	}
+
+	sub strong { substr(md5_hex($_[0]), 0, 8) }
+
+	#	Returns a list of "c<first>,<count>" (copy client blocks) and "l<base64>" (literal) instructions
+	sub compute
+	{
+		my ($data, $blockSize, $oldLength, $sums) = @_;
+		my $length = length $data;
+		my $blockCount = int(length($sums) / 16);
+		my $tailLength = $oldLength % $blockSize;
+		my (%weakIndex, @strongSums);
+
+		for (my $i = 0; $i < $blockCount; $i++)
+		{
+			$strongSums[$i] = substr($sums, $i * 16 + 8, 8);
+			next if ($i == $blockCount - 1 && $tailLength);
+			push @{$weakIndex{hex substr($sums, $i * 16, 8)}}, $i;
+		}
+
+		my @ops;
+		my $literalStart = 0;
+		my $pos = 0;
+		my $nextExpected = 0;
+		my ($wa, $wb);
+
+		while ($pos + $blockSize <= $length)
+		{
+			($wa, $wb) = weak(substr($data, $pos, $blockSize)) if (!defined $wa);
+
+			my $match;
+			if (my $candidates = $weakIndex{$wa | ($wb << 16)})
+			{
+				#	Prefer the block following the last match, so unchanged runs stay in order
+				my $s = strong(substr($data, $pos, $blockSize));
+				foreach my $c ((grep { $_ == $nextExpected } @$candidates), (grep { $_ != $nextExpected } @$candidates))
+				{
+					if ($strongSums[$c] eq $s) { $match = $c; last; }
+				}
+			}
+
+			if (defined $match)
+			{
+				_literal(\@ops, $data, $literalStart, $pos);
+				_copy(\@ops, $match);
+				$nextExpected = $match + 1;
+				$pos += $blockSize;
+				$literalStart = $pos;
+				$wa = undef;
+			}
+			else
+			{
+				#	Roll the window one byte forward
+				if ($pos + $blockSize < $length)
+				{
+					my $out = ord substr($data, $pos, 1);
+					my $in = ord substr($data, $pos + $blockSize, 1);
+					$wa = ($wa - $out + $in) % 65536;
+					$wb = ($wb - $blockSize * $out + $wa) % 65536;
+				}
+				$pos++;
+			}
+		}
+
+		#	The client's trailing partial block can only match the very end of the file
+		if ($tailLength && $length - $tailLength >= $literalStart &&
+			strong(substr($data, $length - $tailLength)) eq $strongSums[$blockCount - 1])
+		{
+			_literal(\@ops, $data, $literalStart, $length - $tailLength);
+			_copy(\@ops, $blockCount - 1);
+			$literalStart = $length;
+		}
+		_literal(\@ops, $data, $literalStart, $length);
+
+		return [map { $_->[0] eq 'c' ? "c$_->[1],$_->[2]" : 'l' . encode_base64(substr($data, $_->[1], $_->[2] - $_->[1]), '') } @ops];
+	}
+
+	sub _copy
+	{
+		my ($ops, $block) = @_;
+		my $last = $ops->[-1];
+		if (defined($last) && $last->[0] eq 'c' && $last->[1] + $last->[2] == $block)
+		{
+			$last->[2]++;
+		}
+		else
+		{
+			push @$ops, ['c', $block, 1];
+		}
+	}
+
+	sub _literal
+	{
+		my ($ops, $data, $start, $end) = @_;
+		push @$ops, ['l', $start, $end] if ($end > $start);
+	}
+}
+
+#	Tells clients when open files or browsed directories change under them, as an unsolicited {'changed' => [paths]}
+#	message naming them the way the client did. Uses inotify if Linux::Inotify2 is installed, otherwise polls mtimes
+#	every few seconds. Files are only reported if their mtime, size or inode actually moved, so saves made through
+#	a buffer don't bounce back; directories are reported on any inotify event in them.
+{ package Watcher;
+
+	#	Constants, as this package's code runs after the main loop has started.
+	use constant POLL_SECONDS => 3;
+	use constant MAX_DIRECTORIES => 64;     # Per client; the least recently browsed are dropped first.
+	use constant HASH_BYTES => 65536;       # Files up to this size are hashed, to catch same-size rewrites.
+
+	our $inotify;
+	our $hiresStat;
+	our $inotifyFd;
+	our $lastPoll = 0;
+	our %watches = ();             # path => {'dir', 'signature', 'owners' => {key => [output, name]}}; a buffer's
+	                               # output is undef while no client has it.
+	our %inotifyWatches = ();      # directory => inotify watch, shared by every watch in or on it
+	our %pending = ();             # Paths inotify says may have changed.
+	our %browsed = ();             # output => [directories, oldest first]
+	our %clients = ();             # output => output, for every connected client
+
+	sub init
+	{
+		my ($select) = @_;
+		$hiresStat = eval { require Time::HiRes; defined(&Time::HiRes::stat) };
+		eval
+		{
+			require Linux::Inotify2;
+			$inotify = Linux::Inotify2->new() or die;
+			$inotify->blocking(0);
+			$inotifyFd = $inotify->fileno;
+			$select->add($inotifyFd);
+			1;
+		}
+		or do
+		{
+			$inotify = undef;
+		};
+	}
+
+	#	How long the main loop can sleep for.
+	sub timeout
+	{
+		return undef if ($inotify || !%watches);
+		return POLL_SECONDS;
+	}
+
+	sub isEventSource
+	{
+		my ($in) = @_;
+		return defined($inotifyFd) && !ref($in) && $in eq $inotifyFd;
+	}
+
+	sub output
+	{
+		my $out = select();
+		return ref($out) ? $out : \*STDOUT;
+	}
+
+	#	Sub-second times where the system has them; a rewrite within the same second to the same size can still
+	#	slip past those, so small files are hashed as well.
+	sub signature
+	{
+		my ($path, $isDir) = @_;
+		my @s = $hiresStat ? Time::HiRes::stat($path) : stat($path);
+		return '' if (!@s);
+		return $s[9] if ($isDir);
+
+		my $signature = "$s[1]:$s[7]:$s[9]:$s[10]";
+		if ($s[7] <= HASH_BYTES && open(my $fh, '<', $path))
+		{
+			binmode $fh;
+			$signature .= ':' . main::md5File($fh);
+			close $fh;
+		}
+		return $signature;
+	}
+
+	sub add
+	{
+		my ($path, $isDir, $key, $name) = @_;
+		if (!$watches{$path})
+		{
+			$watches{$path} = {'dir' => $isDir, 'signature' => signature($path, $isDir), 'owners' => {}};
+			addInotify($isDir ? $path : parentOf($path));
+		}
+		$watches{$path}->{'owners'}->{$key} = [output(), $name];
+	}
+
+	sub remove
+	{
+		my ($path, $key) = @_;
+		my $watch = $watches{$path} or return;
+		delete $watch->{'owners'}->{$key};
+		return if (%{$watch->{'owners'}});
+
+		delete $watches{$path};
+		removeInotify($watch->{'dir'} ? $path : parentOf($path));
+	}
+
+	sub watchBuffer
+	{
+		my ($path, $name, $bufferId) = @_;
+		add($path, 0, "b$bufferId", $name);
+	}
+
+	#	Buffers live in the daemon, not in the channel that opened them; whichever client last used one hears
+	#	about its changes.
+	sub claimBuffer
+	{
+		my ($path, $bufferId) = @_;
+		my $watch = $watches{$path} or return;
+		my $owner = $watch->{'owners'}->{"b$bufferId"} or return;
+		$owner->[0] = output();
+	}
+
+	sub unwatchBuffer
+	{
+		my ($path, $bufferId) = @_;
+		remove($path, "b$bufferId") if (defined $path);
+	}
+
+	sub watchDirectory
+	{
+		my ($path, $name) = @_;
+		my $client = Scalar::Util::refaddr(output());
+		my $list = ($browsed{$client} ||= []);
+
+		@$list = grep { $_ ne $path } @$list;
+		push @$list, $path;
+		add($path, 1, "d$client", $name);
+
+		remove(shift @$list, "d$client") while (@$list > MAX_DIRECTORIES);
+	}
+
+	sub addClient
+	{
+		my ($out) = @_;
+		$clients{Scalar::Util::refaddr($out)} = $out;
+	}
+
+	#	A client went away; so do its folder watches. Its buffers stay open in the daemon, so their watches are
+	#	left for whoever takes them over, and heard by everyone until then.
+	sub forgetClient
+	{
+		my ($out) = @_;
+		my $client = Scalar::Util::refaddr($out);
+		foreach my $path (keys %watches)
+		{
+			foreach my $key (keys %{$watches{$path}->{'owners'}})
+			{
+				next if (!$watches{$path});
+				my $owner = $watches{$path}->{'owners'}->{$key};
+				next if (!defined($owner->[0]) || $owner->[0] != $out);
+
+				if ($key =~ /^b/)
+				{
+					$owner->[0] = undef;
+				}
+				else
+				{
+					remove($path, $key);
+				}
+			}
+		}
+		delete $browsed{$client};
+		delete $clients{$client};
+	}
+
+	#	Called after writing a watched file ourselves.
+	sub refresh
+	{
+		my ($path) = @_;
+		my $watch = $watches{$path} or return;
+		$watch->{'signature'} = signature($path, $watch->{'dir'});
+	}
+
+	sub parentOf
+	{
+		my ($path) = @_;
+		return ($path =~ m{^(.*)/[^/]*$}) ? ($1 eq '' ? '/' : $1) : '.';
+	}
+
+	sub addInotify
+	{
+		my ($dir) = @_;
+		return if (!$inotify);
+		if ($inotifyWatches{$dir})
+		{
+			$inotifyWatches{$dir}->{'count'}++;
+			return;
+		}
+
+		my $mask = Linux::Inotify2::IN_MODIFY() | Linux::Inotify2::IN_ATTRIB() | Linux::Inotify2::IN_CLOSE_WRITE() |
+			Linux::Inotify2::IN_CREATE() | Linux::Inotify2::IN_DELETE() | Linux::Inotify2::IN_MOVED_FROM() |
+			Linux::Inotify2::IN_MOVED_TO() | Linux::Inotify2::IN_DELETE_SELF() | Linux::Inotify2::IN_MOVE_SELF();
+		my $w = $inotify->watch($dir, $mask) or return;
+		$inotifyWatches{$dir} = {'watch' => $w, 'count' => 1};
+	}
+
+	sub removeInotify
+	{
+		my ($dir) = @_;
+		my $entry = $inotifyWatches{$dir} or return;
+		return if (--$entry->{'count'} > 0);
+		$entry->{'watch'}->cancel;
+		delete $inotifyWatches{$dir};
+	}
+
+	sub readEvents
+	{
+		foreach my $event ($inotify->read)
+		{
+			if ($event->IN_Q_OVERFLOW)
+			{
+				$pending{$_} = 1 foreach (keys %watches);
+				next;
+			}
+
+			my $dir = $event->w->name;
+			$pending{$dir} = 1;
+			$pending{$event->fullname} = 1 if ($event->name ne '');
+		}
+
+		my %changed;
+		foreach my $path (keys %pending)
+		{
+			my $watch = $watches{$path} or next;
+			$changed{$path} = 1 if ($watch->{'dir'} || check($path));
+		}
+		%pending = ();
+		notify(keys %changed);
+	}
+
+	#	Polls every watch once per tick, when there's no inotify.
+	sub tick
+	{
+		return if ($inotify || !%watches || time() - $lastPoll < POLL_SECONDS);
+		$lastPoll = time();
+		notify(grep { check($_) } keys %watches);
+	}
+
+	sub check
+	{
+		my ($path) = @_;
+		my $watch = $watches{$path};
+		my $signature = signature($path, $watch->{'dir'});
+		return 0 if ($signature eq $watch->{'signature'});
+		$watch->{'signature'} = $signature;
+		return 1;
+	}
+
+	#	One message per client per batch of changes.
+	sub notify
+	{
+		my (%byClient, %outputs);
+		foreach my $path (@_)
+		{
+			foreach my $owner (values %{$watches{$path}->{'owners'}})
+			{
+				foreach my $out (defined($owner->[0]) ? ($owner->[0]) : values %clients)
+				{
+					my $client = Scalar::Util::refaddr($out);
+					$outputs{$client} = $out;
+					$byClient{$client}->{$owner->[1]} = 1;
+				}
+			}
+		}
+
+		foreach my $client (keys %byClient)
+		{
+			my $out = $outputs{$client};
+			print $out json::encode({'changed' => [keys %{$byClient{$client}}]}) . "\n";
+		}
+	}
+}
+
+#	Tree walking helpers; just enough of .gitignore for project trees.
+{ package Tree;
+
+	#	Turns a glob into a regex matching whole paths under $base, if given.
+	sub globRegex
+	{
+		my ($glob, $base) = @_;
+		$base = '' if (!defined $base);
+
+		my $regex = '';
+		while ($glob =~ /\G(\*\*\/|\/\*\*$|\*|\?|\[[^\]]*\]|.)/gs)
+		{
+			my $token = $1;
+			if    ($token eq '**/') { $regex .= '(?:.*/)?'; }
+			elsif ($token eq '/**') { $regex .= '/.*'; }
+			elsif ($token eq '*')   { $regex .= '[^/]*'; }
+			elsif ($token eq '?')   { $regex .= '[^/]'; }
+			elsif ($token =~ /^\[(!?)(.*)\]$/s) { $regex .= '[' . ($1 ? '^' : '') . $2 . ']'; }
+			else                    { $regex .= quotemeta($token); }
+		}
+
+		return qr/^\Q$base\E$regex$/;
+	}
+
+	#	Returns the rules in force below a folder: the parent's, then its own .gitignore's, which win.
+	sub readIgnoreFile
+	{
+		my ($dir, $relative, $parentRules) = @_;
+		open(my $fh, '<', "$dir/.gitignore") or return $parentRules;
+
+		my @rules = @$parentRules;
+		my $base = ($relative eq '') ? '' : "$relative/";
+		while (my $line = <$fh>)
+		{
+			$line =~ s/\r?\n$//;
+			$line =~ s/(?<!\\)\s+$//;
+			next if ($line eq '' || $line =~ /^#/);
+
+			my $negate = ($line =~ s/^!//);
+			$line =~ s/^\\//;
+			my $dirOnly = ($line =~ s/\/$//);
+
+			#	A slash anywhere but the end ties the pattern to this folder; otherwise it matches at any depth.
+			my $anchoredHere = ($line =~ s/^\/// || $line =~ /\//);
+			$line = "**/$line" if (!$anchoredHere);
+
+			push @rules, {'re' => globRegex($line, $base), 'negate' => $negate, 'dir' => $dirOnly};
+		}
+		close $fh;
+
+		return \@rules;
+	}
+
+	#	The last rule to match decides.
+	sub ignored
+	{
+		my ($rules, $path, $isDir) = @_;
+		my $ignored = 0;
+		foreach my $rule (@$rules)
+		{
+			next if ($rule->{'dir'} && !$isDir);
+			$ignored = !$rule->{'negate'} if ($path =~ $rule->{'re'});
+		}
+		return $ignored;
+	}
+}
+
 #	json class
 { package json;
 	sub encode
@@ -291,7 +1193,7 @@ sub msg_mkdir
 
 		my $ref = ref $obj;
 		return '{' . join(',', map { _escape($_) . ':' . encode($obj->{$_}) } keys %$obj) . '}' if ($ref eq 'HASH');
-		return '[' . join(',', map { encode($ref->{$_}) } @$obj) . ']' if ($ref eq 'ARRAY');
+		return '[' . join(',', map { encode($_) } @$obj) . ']' if ($ref eq 'ARRAY');
 		return $obj if Scalar::Util::looks_like_number($obj);
 		return _escape($obj);
 	}
@@ -541,6 +1443,22 @@ sub md5File
 	return $md5->hexdigest;
 }
 
+sub md5Range
+{
+	my ($file, $size) = @_;
+
+	my $md5 = Digest::MD5->new;
+	my $data;
+	while ($size > 0)
+	{
+		my $read = read($file, $data, min(65536, $size));
+		die "Failed to read\n" if (!$read);
+		$md5->add($data);
+		$size -= $read;
+	}
+	return $md5->hexdigest;
+}
+
 sub xferLoop
 {
 	my ($in, $size, $read);
@@ -571,6 +1489,25 @@ sub xferLoop
 				die "Checksum error: '$e' vs '$checksum'\n" if ($e ne $checksum);
 				close F;
 			}
+			elsif ($c eq 'r')
+			{
+				#	Ranged download; reply with whole file size, range length and range checksum
+				my ($offset, $want) = split(',', <STDIN>);
+				chomp $want;
+				die ($in . (-e $in ? " - Denied\n" : " - File not found\n")) if (!-r $in);
+				$size = -s $in;
+				$offset = $size if ($offset > $size);
+				$want = $size - $offset if ($offset + $want > $size);
+
+				open F, $in or die "Denied\n";
+				binmode F;
+				seek F, $offset, 0;
+				my $md5 = md5Range(*F, $want);
+				print "$size,$want,$md5\n";
+				seek F, $offset, 0;
+				stream($want, *F, *STDOUT, 1);
+				close F;
+			}
 			else
 			{
 				#	Download
@@ -134,6 +134,8 @@ SOURCES += \
 	ssh2/xferrequest.cpp \
 	ssh2/xferchannel.cpp \
 	ssh2/sshsession.cpp \
+	ssh2/sshreactor.cpp \
+	ssh2/channelpool.cpp \
 	ssh2/sshhost.cpp \
 	ssh2/sshchannel.cpp \
 	ssh2/shellchannel.cpp \
@@ -156,7 +158,12 @@ SOURCES += \
 	file/serverfile.cpp \
 	ssh2/serverchannel.cpp \
 	ssh2/serverrequest.cpp \
-	ssh2/sshsettings.cpp
+	ssh2/sshsettings.cpp \
+	file/filedelta.cpp \
+	file/listingcache.cpp \
+	file/remotetree.cpp \
+	file/locationpath.cpp \
+	tools/bincodec.cpp
 
 HEADERS  += \
 	editor/linenumberwidget.h \
@@ -221,6 +228,9 @@ HEADERS  += \
 	ssh2/xferrequest.h \
 	ssh2/xferchannel.h \
 	ssh2/sshsession.h \
+	ssh2/sshreactor.h \
+	ssh2/channelpool.h \
+	ssh2/requestqueue.h \
 	ssh2/sshhost.h \
 	ssh2/sshchannel.h \
 	ssh2/shellchannel.h \
@@ -243,7 +253,13 @@ HEADERS  += \
 	file/serverfile.h \
 	ssh2/serverchannel.h \
 	ssh2/serverrequest.h \
-	ssh2/sshsettings.h
+	ssh2/sshsettings.h \
+	file/filedelta.h \
+	file/listingcache.h \
+	file/remotetree.h \
+	file/locationpath.h \
+	tools/bincodec.h \
+	tools/mpscqueue.h
 
 FORMS += \
 	file/filedialog.ui \
@@ -0,0 +1,217 @@
+#include <QDateTime>
+
+#include "channelpool.h"
+
+// Where a host with no history starts out.
+static const int sDefaultChannels[ ChannelPool::KindCount ] = { 3, 7, 5 };
+static const int sDefaultMultipliers[ ChannelPool::KindCount ] = { 3, 2, 2 };
+
+// Round trip estimates are smoothed the way TCP does it; each new sample moves the estimate 1/8th of the way.
+#define ROUND_TRIP_WEIGHT 0.125
+
+ChannelPool::ChannelPool() :
+	mSampleLock(),
+	mRoundTripMsec( -1 ),
+	mInterval(),
+	mIntervalMsec( 0 ) {
+	for ( int i = 0; i < KindCount; i++ ) {
+		KindState &state = mKinds[ i ];
+		state.maxChannels = sDefaultChannels[ i ];
+		state.defaultChannels = sDefaultChannels[ i ];
+		state.defaultMultiplier = sDefaultMultipliers[ i ];
+		state.ceiling = 0;
+		state.ceilingSetMsec = 0;
+		state.idleIntervals = 0;
+		state.bytes = 0;
+		state.trialBaseline = -1;
+		state.lastDequeued = 0;
+		state.lastTotalWaitMsec = 0;
+	}
+}
+
+const char *ChannelPool::getKindName( Kind kind ) {
+	switch ( kind ) {
+		case Server: return "server";
+		case Xfer:   return "xfer";
+		case Sftp:   return "sftp";
+		default:     return "";
+	}
+}
+
+void ChannelPool::recordRoundTrip( qint64 msec ) {
+	QMutexLocker locker( &mSampleLock );
+	if ( mRoundTripMsec < 0 ) {
+		mRoundTripMsec = msec;
+	} else {
+		mRoundTripMsec += ( msec - mRoundTripMsec ) * ROUND_TRIP_WEIGHT;
+	}
+}
+
+void ChannelPool::recordTransfer( Kind kind, qint64 bytes ) {
+	QMutexLocker locker( &mSampleLock );
+	mKinds[ kind ].bytes += bytes;
+}
+
+qint64 ChannelPool::getRoundTripMsec() const {
+	QMutexLocker locker( &mSampleLock );
+	return mRoundTripMsec < 0 ? -1 : ( qint64 ) mRoundTripMsec;
+}
+
+bool ChannelPool::beginInterval() {
+	if ( ! mInterval.isValid() ) {
+		mInterval.start();
+		return false;
+	}
+
+	qint64 elapsed = mInterval.elapsed();
+	if ( elapsed < CHANNEL_POOL_INTERVAL_MSEC ) {
+		return false;
+	}
+
+	mInterval.restart();
+	mIntervalMsec = elapsed;
+	return true;
+}
+
+ChannelPool::Change ChannelPool::evaluate( Kind kind,
+                                           const RequestQueueBase::Metrics &metrics,
+                                           bool saturated,
+                                           int channelLimit ) {
+	KindState &state = mKinds[ kind ];
+	bool transfer = ( kind != Server );
+
+	mSampleLock.lock();
+	qint64 bytes = state.bytes;
+	state.bytes = 0;
+	double roundTrip = mRoundTripMsec;
+	mSampleLock.unlock();
+
+	// Work out how the last interval went.
+	qint64 dequeued = metrics.dequeued - state.lastDequeued;
+	qint64 waited = metrics.totalWaitMsec - state.lastTotalWaitMsec;
+	state.lastDequeued = metrics.dequeued;
+	state.lastTotalWaitMsec = metrics.totalWaitMsec;
+
+	qint64 averageWait = ( dequeued > 0 ? waited / dequeued : 0 );
+	averageWait = qMax( averageWait, metrics.oldestWaitMsec );  // Requests nobody got to count too.
+	double throughput = ( bytes * 1000.0 ) / qMax( mIntervalMsec, ( qint64 ) 1 );
+
+	// Settle the last growth. If the queue drained in the meantime there's no telling, so it stays.
+	if ( state.trialBaseline >= 0 ) {
+		double baseline = state.trialBaseline;
+		state.trialBaseline = -1;
+		if ( saturated && throughput < baseline * CHANNEL_POOL_MIN_GAIN && state.maxChannels > 1 ) {
+			state.maxChannels--;
+			state.ceiling = state.maxChannels + 1;
+			state.ceilingSetMsec = QDateTime::currentMSecsSinceEpoch();
+			state.idleIntervals = 0;
+			return Shrunk;
+		}
+	}
+
+	// Let a ceiling that has held long enough go up by one; the next growth puts it back on trial. Once it's past
+	// anything the server allows, it no longer means anything.
+	if ( state.ceiling > 0 ) {
+		qint64 now = QDateTime::currentMSecsSinceEpoch();
+		if ( now - state.ceilingSetMsec >= CHANNEL_POOL_CEILING_DECAY_MSEC ) {
+			state.ceiling++;
+			state.ceilingSetMsec = now;
+			if ( state.ceiling > channelLimit ) {
+				state.ceiling = 0;
+			}
+		}
+	}
+
+	// Never hold more than the server lets a connection have.
+	int cap = qMax( 1, channelLimit );
+	if ( state.ceiling > 0 ) {
+		cap = qMax( 1, qMin( cap, state.ceiling - 1 ) );
+	}
+	if ( state.maxChannels > cap ) {
+		state.maxChannels = cap;
+		return Shrunk;
+	}
+
+	// Extra channels earned during a busy spell are given back once the host goes quiet.
+	if ( dequeued == 0 && metrics.depth == 0 && bytes == 0 ) {
+		state.idleIntervals++;
+		if ( state.idleIntervals >= CHANNEL_POOL_IDLE_INTERVALS && state.maxChannels > state.defaultChannels ) {
+			state.idleIntervals = 0;
+			state.maxChannels--;
+			return Shrunk;
+		}
+	} else {
+		state.idleIntervals = 0;
+	}
+
+	qint64 waitThreshold = CHANNEL_POOL_MIN_WAIT_MSEC;
+	if ( roundTrip > 0 ) {
+		waitThreshold = qMax( waitThreshold, ( qint64 ) ( roundTrip * CHANNEL_POOL_WAIT_ROUND_TRIPS ) );
+	}
+
+	if ( saturated && averageWait > waitThreshold && state.maxChannels < cap ) {
+		if ( transfer ) {
+			state.trialBaseline = throughput;
+		}
+		state.maxChannels++;
+		return Grown;
+	}
+
+	return Unchanged;
+}
+
+int ChannelPool::getQueueMultiplier( Kind kind ) const {
+	qint64 roundTrip = getRoundTripMsec();
+	int multiplier = mKinds[ kind ].defaultMultiplier;
+
+	if ( roundTrip < 0 ) {
+		return multiplier;
+	} else if ( roundTrip >= CHANNEL_POOL_FAR_MSEC ) {
+		return 1;
+	} else if ( roundTrip <= CHANNEL_POOL_NEAR_MSEC ) {
+		return multiplier * 2;
+	}
+	return multiplier;
+}
+
+bool ChannelPool::wantsChannel( Kind kind, int queueLength, int openChannels ) const {
+	return openChannels < getMaxChannels( kind ) && queueLength > openChannels * getQueueMultiplier( kind );
+}
+
+QVariantMap ChannelPool::save() const {
+	QVariantMap result;
+	qint64 roundTrip = getRoundTripMsec();
+	if ( roundTrip >= 0 ) {
+		result.insert( "roundTripMsec", roundTrip );
+	}
+
+	for ( int i = 0; i < KindCount; i++ ) {
+		QVariantMap kind;
+		kind.insert( "max", mKinds[ i ].maxChannels );
+		kind.insert( "ceiling", mKinds[ i ].ceiling );
+		kind.insert( "ceilingSet", mKinds[ i ].ceilingSetMsec );
+		result.insert( getKindName( ( Kind ) i ), kind );
+	}
+
+	return result;
+}
+
+void ChannelPool::restore( const QVariantMap &state ) {
+	if ( state.contains( "roundTripMsec" ) ) {
+		QMutexLocker locker( &mSampleLock );
+		mRoundTripMsec = qMax( 0, state.value( "roundTripMsec" ).toInt() );
+	}
+
+	for ( int i = 0; i < KindCount; i++ ) {
+		QVariantMap kind = state.value( getKindName( ( Kind ) i ) ).toMap();
+		if ( kind.isEmpty() ) {
+			continue;
+		}
+
+		mKinds[ i ].maxChannels = qMax( 1, kind.value( "max", mKinds[ i ].defaultChannels ).toInt() );
+		mKinds[ i ].ceiling = qMax( 0, kind.value( "ceiling" ).toInt() );
+
+		// Ceilings saved before they were timestamped are due to be raised straight away.
+		mKinds[ i ].ceilingSetMsec = kind.value( "ceilingSet", 0 ).toLongLong();
+	}
+}
@@ -0,0 +1,102 @@
+#ifndef CHANNELPOOL_H
+#define CHANNELPOOL_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QVariantMap>
+#include "requestqueue.h"
+
+//
+// Decides how many channels of each kind a host runs. Channels report round trips and finished transfers as they
+// go; once per CHANNEL_POOL_INTERVAL_MSEC, SshHost hands over its queue metrics and the pool adjusts:
+//
+//  - A kind grows by one channel when all of its channels are busy and requests wait longer than a few round trips.
+//  - When a transfer kind grows but its total bytes/sec doesn't follow, the link is saturated: it shrinks back, and
+//    remembers not to try that again for a while. That ceiling lifts by one every CHANNEL_POOL_CEILING_DECAY_MSEC,
+//    so one bad sample (or a link that has since improved) doesn't cap the host forever.
+//  - A kind that sits idle for CHANNEL_POOL_IDLE_INTERVALS in a row shrinks by one, back towards its default.
+//
+// The queue length that justifies opening another channel depends on latency. On a LAN a channel works through a
+// backlog quickly, so it takes a longer queue to be worth the handshake; across an ocean, any backlog is.
+//
+// Round trips are measured per host rather than per kind, as they're a property of the link. Limits never exceed
+// the server's channel limit. State is saved with the host, so the next connection starts where this one left off.
+//
+// The record calls are safe from session threads; everything else is for the main thread.
+//
+
+#ifndef CHANNEL_POOL_INTERVAL_MSEC
+	#define CHANNEL_POOL_INTERVAL_MSEC 5000
+#endif
+
+// Requests must wait at least this long, and at least this many round trips, before it's worth growing.
+#define CHANNEL_POOL_MIN_WAIT_MSEC 250
+#define CHANNEL_POOL_WAIT_ROUND_TRIPS 4
+
+// Round trips below / above these make a host "near" / "far" for queue multipliers.
+#define CHANNEL_POOL_NEAR_MSEC 20
+#define CHANNEL_POOL_FAR_MSEC 150
+
+// Growing a transfer pool has to buy at least this much more throughput to stick.
+#define CHANNEL_POOL_MIN_GAIN 1.1
+
+// How long a saturation ceiling holds before it's raised by one, and how many idle evaluations shrink a kind.
+#ifndef CHANNEL_POOL_CEILING_DECAY_MSEC
+	#define CHANNEL_POOL_CEILING_DECAY_MSEC 600000
+#endif
+#ifndef CHANNEL_POOL_IDLE_INTERVALS
+	#define CHANNEL_POOL_IDLE_INTERVALS 12
+#endif
+
+class ChannelPool {
+	public:
+		enum Kind { Server = 0, Xfer = 1, Sftp = 2, KindCount = 3 };
+		enum Change { Shrunk = -1, Unchanged = 0, Grown = 1 };
+
+		ChannelPool();
+
+		void recordRoundTrip( qint64 msec );
+		void recordTransfer( Kind kind, qint64 bytes );
+
+		bool beginInterval();   // Returns true (and starts the next one) if it's time to evaluate.
+		Change evaluate( Kind kind, const RequestQueueBase::Metrics &metrics, bool saturated, int channelLimit );
+
+		bool wantsChannel( Kind kind, int queueLength, int openChannels ) const;
+
+		inline int getMaxChannels( Kind kind ) const {
+			return mKinds[ kind ].maxChannels;
+		}
+
+		int getQueueMultiplier( Kind kind ) const;
+		qint64 getRoundTripMsec() const;        // -1 until measured.
+
+		QVariantMap save() const;
+		void restore( const QVariantMap &state );
+
+		static const char *getKindName( Kind kind );
+
+	private:
+		struct KindState {
+			int maxChannels;
+			int defaultChannels;
+			int defaultMultiplier;
+			int ceiling;            // A limit found to saturate the link; 0 for none.
+			qint64 ceilingSetMsec;  // When the ceiling was last set or raised, in msecs since the epoch.
+			int idleIntervals;      // Evaluations in a row with nothing queued, dequeued or transferred.
+
+			qint64 bytes;           // Transferred since the last evaluation.
+			double trialBaseline;   // Bytes/sec before the last growth, while it's on trial; otherwise -1.
+
+			qint64 lastDequeued;
+			qint64 lastTotalWaitMsec;
+		};
+
+		mutable QMutex mSampleLock;
+		double mRoundTripMsec;
+		KindState mKinds[ KindCount ];
+
+		QElapsedTimer mInterval;
+		qint64 mIntervalMsec;
+};
+
+#endif  // CHANNELPOOL_H
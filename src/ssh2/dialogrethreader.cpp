@@ -23,8 +23,18 @@ bool DialogRethreader::event( QEvent *event ) {
 		rq->result = dialog->getResult();
 		delete dialog;
 
-		// Unlock the provided mutex to tell the calling thread that we're done here.
-		rq->lock->unlock();
+		if ( rq->lock ) {
+			// Unlock the provided mutex to tell the calling thread that we're done here.
+			rq->lock->unlock();
+		} else {
+			if ( rq->target ) {
+				QMetaObject::invokeMethod( rq->target,
+				                           rq->slot.constData(),
+				                           Qt::QueuedConnection,
+				                           Q_ARG( QVariantMap, rq->result ) );
+			}
+			delete rq;
+		}
 		return true;
 	} else {
 		return QObject::event( event );
@@ -5,6 +5,7 @@
 #include <QEvent>
 #include <QMutex>
 #include <QObject>
+#include <QPointer>
 #include <QVariantMap>
 #include "ssh2/passworddlg.h"
 #include "threadcrossingdialog.h"
@@ -14,6 +15,10 @@
 // Make sure any cross thread dialogs inherit ThreadCrossingDialog instead of QDialog, then summon them thusly:
 // QVariant result = DialogRethreader<MyDialog>::rethreadDialog(QVariant options);
 //
+// Threads that mustn't block (eg: session reactor threads, shared by many sessions) pass a target object and the
+// name of a slot taking a QVariantMap instead; the call returns at once, and the slot is invoked (queued) with the
+// result once the dialog closes, unless the target has been deleted by then.
+//
 
 class DialogRethreader : public QObject {
 	Q_OBJECT
@@ -40,6 +45,21 @@ class DialogRethreader : public QObject {
 			return rq.result;
 		}
 
+		template < class T > static void rethreadDialog( const QVariantMap &options,
+		                                                 QObject *target,
+		                                                 const char *slot ) {
+			DialogRethreadRequest *rq = new DialogRethreadRequest();
+			rq->options = options;
+			rq->factoryMethod = ( createDialog< T >);
+			rq->lock = NULL;
+			rq->target = target;
+			rq->slot = slot;
+
+			DialogEvent *e = new DialogEvent( sRunDialogEventId );
+			e->request = rq;
+			QCoreApplication::postEvent( sInstance, e );
+		}
+
 		bool event( QEvent *event );
 
 	private:
@@ -49,7 +69,9 @@ class DialogRethreader : public QObject {
 			DialogFactory factoryMethod;
 			QVariantMap options;
 			QVariantMap result;
-			QMutex *lock;
+			QMutex *lock;   // NULL for asynchronous requests, which own themselves and report to target instead.
+			QPointer< QObject > target;
+			QByteArray slot;
 		};
 
 		class DialogEvent : public QEvent {
@@ -0,0 +1,363 @@
+#ifndef REQUESTQUEUE_H
+#define REQUESTQUEUE_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QVariantMap>
+#include "tools/mpscqueue.h"
+
+//
+// Scheduler for requests waiting on a channel. Interactive work (edits, saves) goes ahead of listings, which go
+// ahead of bulk transfers; but a request climbs one class for every REQUEST_AGING_MSEC it waits, so nothing
+// starves behind a steady stream of higher priority work.
+//
+// Requests sharing an order key (eg: the same file) are never reordered relative to each other: a request is never
+// scheduled in a better class than an earlier one with the same key that's still waiting.
+//
+// Requests can also be routed, so only a channel that holds the route (eg: a server channel with the file's buffer
+// open) can take them. Each route gets its own lane, so a dequeue only ever looks at the front of each class in the
+// lanes the caller can handle.
+//
+// Producers post() requests through a lock-free inbox, which is safe from any thread without locking. Everything
+// else is for consumers, which must serialize among themselves; SshHost guards each queue with a mutex of its own.
+// Consumer calls move anything posted so far into the queue first.
+//
+// T must provide getPriority() and getOrderKey() (0 for none).
+//
+
+#ifndef REQUEST_AGING_MSEC
+	#define REQUEST_AGING_MSEC 2000
+#endif
+
+class RequestQueueBase {
+	public:
+		enum Priority { Interactive = 0, Listing = 1, Bulk = 2, PriorityCount = 3 };
+
+		struct Metrics {
+			int depth;
+			int depthByPriority[ PriorityCount ];
+			qint64 oldestWaitMsec;  // How long the longest-waiting request in the queue has been there so far.
+			qint64 dequeued;
+			qint64 totalWaitMsec;   // Across everything dequeued.
+			qint64 maxWaitMsec;
+
+			void add( const Metrics &other );      // Combines two queues' worth.
+			QVariantMap toVariantMap() const;
+		};
+};
+
+template < class T, class Route = void * > class RequestQueue : public RequestQueueBase {
+	public:
+		RequestQueue();
+
+		bool post( T *request, Route route = Route() );        // Lock-free; returns true if the inbox was empty.
+		void enqueue( T *request, Route route = Route() );
+		void requeue( T *request );     // Puts an interrupted request at the front of its class.
+
+		T *dequeue( const QList< Route > &routes = QList< Route >() );  // Unrouted requests, and those routed to
+		                                                                // any of routes.
+
+		QList< T * > takeAll();
+		QList< T * > takeRoutes( const QList< Route > &routes );
+
+		inline int length() const {     // Includes anything posted; approximate while producers are busy.
+			return mLength + mInbox.count();
+		}
+
+		inline bool isEmpty() const {
+			return length() == 0;
+		}
+
+		Metrics getMetrics();
+
+	private:
+		struct Entry {
+			T *request;
+			int priority;
+			uint orderKey;
+			QElapsedTimer queued;
+		};
+
+		struct Posted {
+			T *request;
+			Route route;
+			QElapsedTimer queued;
+		};
+
+		struct Lane {
+			Lane() :
+				route(),
+				length( 0 ) {}
+			Route route;
+			int length;
+			QList< Entry > classes[ PriorityCount ];
+		};
+
+		struct OrderKeyState {
+			OrderKeyState() :
+				pending( 0 ),
+				priority( 0 ) {}
+			int pending;
+			int priority;   // The worst class any of the pending requests went into.
+		};
+
+		void absorbInbox();
+		void insert( T *request, Route route, bool front, const QElapsedTimer *queued = NULL );
+		void consider( Lane *lane, Lane **bestLane, int *bestPriority, qint64 *bestScore );
+		void releaseEntry( const Entry &entry );
+		void takeLane( Lane *lane, QList< T * > *result );
+
+		MpscQueue< Posted > mInbox;
+		QHash< Route, Lane > mLanes;
+		QHash< uint, OrderKeyState > mOrderKeys;
+		int mLength;
+		int mDepth[ PriorityCount ];
+
+		qint64 mDequeued;
+		qint64 mTotalWaitMsec;
+		qint64 mMaxWaitMsec;
+};
+
+inline void RequestQueueBase::Metrics::add( const Metrics &other ) {
+	depth += other.depth;
+	for ( int i = 0; i < PriorityCount; i++ ) {
+		depthByPriority[ i ] += other.depthByPriority[ i ];
+	}
+	oldestWaitMsec = qMax( oldestWaitMsec, other.oldestWaitMsec );
+	dequeued += other.dequeued;
+	totalWaitMsec += other.totalWaitMsec;
+	maxWaitMsec = qMax( maxWaitMsec, other.maxWaitMsec );
+}
+
+inline QVariantMap RequestQueueBase::Metrics::toVariantMap() const {
+	QVariantMap result;
+	result.insert( "depth", depth );
+	result.insert( "interactive", depthByPriority[ Interactive ] );
+	result.insert( "listing", depthByPriority[ Listing ] );
+	result.insert( "bulk", depthByPriority[ Bulk ] );
+	result.insert( "oldestWaitMsec", oldestWaitMsec );
+	result.insert( "dequeued", dequeued );
+	result.insert( "averageWaitMsec", dequeued ? totalWaitMsec / dequeued : 0 );
+	result.insert( "maxWaitMsec", maxWaitMsec );
+	return result;
+}
+
+template < class T, class Route > RequestQueue< T, Route >::RequestQueue() :
+	mInbox(),
+	mLanes(),
+	mOrderKeys(),
+	mLength( 0 ),
+	mDequeued( 0 ),
+	mTotalWaitMsec( 0 ),
+	mMaxWaitMsec( 0 ) {
+	for ( int i = 0; i < PriorityCount; i++ ) {
+		mDepth[ i ] = 0;
+	}
+}
+
+template < class T, class Route > bool RequestQueue< T, Route >::post( T *request, Route route ) {
+	Posted posted;
+	posted.request = request;
+	posted.route = route;
+	posted.queued.start();
+	return mInbox.push( posted );
+}
+
+template < class T, class Route > void RequestQueue< T, Route >::absorbInbox() {
+	if ( mInbox.isEmpty() ) {
+		return;
+	}
+
+	foreach ( const Posted &posted, mInbox.takeAll() ) {
+		insert( posted.request, posted.route, false, &posted.queued );
+	}
+}
+
+template < class T, class Route > void RequestQueue< T, Route >::enqueue( T *request, Route route ) {
+	absorbInbox();
+	insert( request, route, false );
+}
+
+template < class T, class Route > void RequestQueue< T, Route >::requeue( T *request ) {
+	absorbInbox();
+	insert( request, Route(), true );
+}
+
+template < class T, class Route > void RequestQueue< T, Route >::insert( T *request,
+                                                                        Route route,
+                                                                        bool front,
+                                                                        const QElapsedTimer *queued ) {
+	Entry entry;
+	entry.request = request;
+	entry.priority = qBound( 0, ( int ) request->getPriority(), PriorityCount - 1 );
+	entry.orderKey = request->getOrderKey();
+	if ( queued ) {
+		entry.queued = *queued;
+	} else {
+		entry.queued.start();
+	}
+
+	// Never let a request overtake an earlier one with the same key.
+	if ( entry.orderKey ) {
+		OrderKeyState &state = mOrderKeys[ entry.orderKey ];
+		if ( state.pending++ > 0 ) {
+			entry.priority = qMax( entry.priority, state.priority );
+		}
+		state.priority = entry.priority;
+	}
+
+	Lane &lane = mLanes[ route ];
+	lane.route = route;
+	lane.length++;
+
+	QList< Entry > &list = lane.classes[ entry.priority ];
+	if ( front ) {
+		list.prepend( entry );
+	} else {
+		list.append( entry );
+	}
+
+	mLength++;
+	mDepth[ entry.priority ]++;
+}
+
+template < class T, class Route > void RequestQueue< T, Route >::consider( Lane *lane,
+                                                                          Lane **bestLane,
+                                                                          int *bestPriority,
+                                                                          qint64 *bestScore ) {
+	// Each class is a head start of REQUEST_AGING_MSEC; whoever is furthest past their head start goes first.
+	// Classes are FIFO, so only the front of each one can win.
+	for ( int priority = 0; priority < PriorityCount; priority++ ) {
+		const QList< Entry > &list = lane->classes[ priority ];
+		if ( list.isEmpty() ) {
+			continue;
+		}
+
+		qint64 score = priority * REQUEST_AGING_MSEC - list.first().queued.elapsed();
+		if ( *bestLane == NULL || score < *bestScore ) {
+			*bestLane = lane;
+			*bestPriority = priority;
+			*bestScore = score;
+		}
+	}
+}
+
+template < class T, class Route > T *RequestQueue< T, Route >::dequeue( const QList< Route > &routes ) {
+	absorbInbox();
+	if ( mLength == 0 ) {
+		return NULL;
+	}
+
+	Lane *bestLane = NULL;
+	int bestPriority = 0;
+	qint64 bestScore = 0;
+
+	typename QHash< Route, Lane >::iterator unrouted = mLanes.find( Route() );
+	if ( unrouted != mLanes.end() ) {
+		consider( &unrouted.value(), &bestLane, &bestPriority, &bestScore );
+	}
+
+	foreach ( const Route &route, routes ) {
+		typename QHash< Route, Lane >::iterator lane = mLanes.find( route );
+		if ( route != Route() && lane != mLanes.end() ) {
+			consider( &lane.value(), &bestLane, &bestPriority, &bestScore );
+		}
+	}
+
+	if ( bestLane == NULL ) {
+		return NULL;
+	}
+
+	Entry entry = bestLane->classes[ bestPriority ].takeFirst();
+	releaseEntry( entry );
+
+	// Lanes come and go with their routes (eg: open files); the unrouted one stays.
+	if ( --bestLane->length == 0 && bestLane->route != Route() ) {
+		Route emptied = bestLane->route;
+		mLanes.remove( emptied );
+	}
+
+	qint64 waited = entry.queued.elapsed();
+	mDequeued++;
+	mTotalWaitMsec += waited;
+	mMaxWaitMsec = qMax( mMaxWaitMsec, waited );
+
+	return entry.request;
+}
+
+template < class T, class Route > void RequestQueue< T, Route >::releaseEntry( const Entry &entry ) {
+	mLength--;
+	mDepth[ entry.priority ]--;
+
+	if ( entry.orderKey ) {
+		typename QHash< uint, OrderKeyState >::iterator state = mOrderKeys.find( entry.orderKey );
+		if ( state != mOrderKeys.end() && --state.value().pending <= 0 ) {
+			mOrderKeys.erase( state );
+		}
+	}
+}
+
+template < class T, class Route > void RequestQueue< T, Route >::takeLane( Lane *lane, QList< T * > *result ) {
+	for ( int priority = 0; priority < PriorityCount; priority++ ) {
+		foreach ( const Entry &entry, lane->classes[ priority ] ) {
+			releaseEntry( entry );
+			result->append( entry.request );
+		}
+		lane->classes[ priority ].clear();
+	}
+	lane->length = 0;
+}
+
+template < class T, class Route > QList< T * > RequestQueue< T, Route >::takeAll() {
+	absorbInbox();
+
+	QList< T * > result;
+	for ( typename QHash< Route, Lane >::iterator i = mLanes.begin(); i != mLanes.end(); ++i ) {
+		takeLane( &i.value(), &result );
+	}
+	mLanes.clear();
+	return result;
+}
+
+template < class T, class Route > QList< T * > RequestQueue< T, Route >::takeRoutes( const QList< Route > &routes ) {
+	absorbInbox();
+
+	QList< T * > result;
+	foreach ( const Route &route, routes ) {
+		typename QHash< Route, Lane >::iterator lane = mLanes.find( route );
+		if ( route != Route() && lane != mLanes.end() ) {
+			takeLane( &lane.value(), &result );
+			mLanes.erase( lane );
+		}
+	}
+	return result;
+}
+
+template < class T, class Route > RequestQueueBase::Metrics RequestQueue< T, Route >::getMetrics() {
+	absorbInbox();
+
+	Metrics metrics;
+	metrics.depth = mLength;
+	metrics.oldestWaitMsec = 0;
+	metrics.dequeued = mDequeued;
+	metrics.totalWaitMsec = mTotalWaitMsec;
+	metrics.maxWaitMsec = mMaxWaitMsec;
+
+	for ( int priority = 0; priority < PriorityCount; priority++ ) {
+		metrics.depthByPriority[ priority ] = mDepth[ priority ];
+	}
+
+	for ( typename QHash< Route, Lane >::const_iterator i = mLanes.constBegin(); i != mLanes.constEnd(); ++i ) {
+		for ( int priority = 0; priority < PriorityCount; priority++ ) {
+			if ( ! i.value().classes[ priority ].isEmpty() ) {
+				metrics.oldestWaitMsec =
+					qMax( metrics.oldestWaitMsec, i.value().classes[ priority ].first().queued.elapsed() );
+			}
+		}
+	}
+
+	return metrics;
+}
+
+#endif  // REQUESTQUEUE_H
@@ -12,11 +12,13 @@
 #include "sshhost.h"
 #include "sshsettings.h"
 
+// The server script is installed under a name that includes its checksum, so once one channel has verified it,
+// others on the same host only need to check that it's there.
 #define SERVER_INIT      " cd ~;" \
 	"if type perl >/dev/null 2>&1;then " \
 	"perl -e '" \
 	"use Digest::MD5;" \
-	"my $f=\".ponyedit/server.pl\";" \
+	"my $f=\"[[SERVER_PATH]]\";" \
 	"die \"No Server\\n\" if(!-e $f);" \
 	"$d=Digest::MD5->new;" \
 	"open F,$f;" \
@@ -28,23 +30,51 @@
 	"echo 'No Perl';" \
 	"fi\n"
 
+#define SERVER_FAST_INIT " cd ~;" \
+	"if [ -f [[SERVER_PATH]] ];then " \
+	"exec [[SERVER_RUN]];" \
+	"else " \
+	"echo 'No Server';" \
+	"fi\n"
 
+// The uploader takes the script zlib-compressed and base64-encoded where Perl can unpack that, and as plain text
+// otherwise. Either way it arrives in lines short enough for the pty, and is moved into place only once complete.
+// Other versions of the script are then cleared out, with their daemon sockets and locks, unless a daemon still
+// answers on one.
 #define SERVER_START_UPLOAD      " perl -e '" \
 	"mkdir \".ponyedit\" unless(-d \".ponyedit\");" \
-	"open F,\">.ponyedit/server.pl\" or die \"Server write error\\n\";" \
-	"print \"uploader ready\";" \
+	"my $z=eval{require Compress::Zlib;require MIME::Base64;1};" \
+	"my $t=\".ponyedit/server.tmp$$\";" \
+	"open F,\">$t\" or die \"Server write error\\n\";" \
+	"print(($z?\"zlib:\":\"\").\"uploader ready\");" \
+	"my $b=\"\";" \
 	"while(1)" \
 	"{" \
 	"my $line=<STDIN>;" \
 	"last if($line=~/^END_OF_SERVER/);" \
-	"print F $line;" \
+	"$b.=$line;" \
 	"}" \
+	"$b=Compress::Zlib::uncompress(MIME::Base64::decode_base64($b)) if($z);" \
+	"die \"Server write error\\n\" unless(defined $b&&print F $b);" \
 	"close F;" \
+	"rename $t,\"[[SERVER_PATH]]\" or die \"Server write error\\n\";" \
+	"for my $o(glob(\".ponyedit/server-*.pl\"))" \
+	"{" \
+	"next if($o eq \"[[SERVER_PATH]]\");" \
+	"(my $s=$o)=~s/\\.pl$/.sock/;" \
+	"next if(-S $s&&eval{require IO::Socket::UNIX;IO::Socket::UNIX->new(Peer=>$s)});" \
+	"unlink $o,$s,\"$s.lock\";" \
+	"}" \
 	"'&&" \
 	"[[SERVER_RUN]]\n"
 
+#define SERVER_UPLOAD_END "END_OF_SERVER\n"
+
 QByteArray ServerChannel::sServerChannelInit( SERVER_INIT );
+QByteArray ServerChannel::sServerChannelFastInit( SERVER_FAST_INIT );
 QByteArray ServerChannel::sServerScript;
+QByteArray ServerChannel::sServerScriptPath;
+QByteArray ServerChannel::sServerScriptCompressed;
 QByteArray ServerChannel::sServerUpload;
 
 ServerChannel::ServerChannel( SshHost *host, bool sudo ) :
@@ -55,7 +85,14 @@ ServerChannel::ServerChannel( SshHost *host, bool sudo ) :
 	mSudo( sudo ),
 	mSudoPasswordAttempt(),
 	mTriedSudoPassword( false ),
+	mAwaitingSudoPassword( false ),
+	mSudoPasswordLock(),
+	mSudoPasswordArrived( false ),
+	mSudoPasswordResult(),
+	mCompressedUpload( false ),
+	mShared( false ),
 	mRequestsAwaitingReplies(),
+	mPendingCancels(),
 	mBufferIds() {
 	SSHLOG_TRACE( host ) << "Creating a new server channel";
 }
@@ -79,9 +116,19 @@ void ServerChannel::initialize() {
 	QCryptographicHash hash( QCryptographicHash::Md5 );
 	hash.addData( sServerScript );
 	QByteArray checksum = hash.result().toHex().toLower();
+	sServerScriptPath = ".ponyedit/server-" + checksum.left( 12 ) + ".pl";
+
+	// qCompress() puts the uncompressed length in front of the zlib stream; Perl only wants the stream.
+	QByteArray encoded = qCompress( sServerScript, 9 ).mid( 4 ).toBase64();
+	for ( int i = 0; i < encoded.length(); i += 76 ) {
+		sServerScriptCompressed.append( encoded.mid( i, 76 ) ).append( '\n' );
+	}
 
 	sServerChannelInit.replace( "[[CHECKSUM]]", checksum );
+	sServerChannelInit.replace( "[[SERVER_PATH]]", sServerScriptPath );
+	sServerChannelFastInit.replace( "[[SERVER_PATH]]", sServerScriptPath );
 	sServerUpload = SERVER_START_UPLOAD;
+	sServerUpload.replace( "[[SERVER_PATH]]", sServerScriptPath );
 }
 
 bool ServerChannel::update() {
@@ -116,7 +163,8 @@ bool ServerChannel::handleOpening() {
 			return true;
 		}
 
-		QByteArray serverInit = sServerChannelInit;
+		// Once a channel has verified the script on this host, the rest can skip straight to running it.
+		QByteArray serverInit = ( mHost->isServerScriptVerified() ? sServerChannelFastInit : sServerChannelInit );
 		serverInit.replace( "[[SERVER_RUN]]", getServerRun( mSudo ) );
 
 		SendResponse r = sendData( serverInit );
@@ -188,11 +236,13 @@ bool ServerChannel::handleOpening() {
 			return true;
 		}
 
+		mCompressedUpload = rr.data.endsWith( "zlib:" );
 		setInternalStatus( _UploadingServerScript );
 	}
 
 	if ( mInternalStatus == _UploadingServerScript ) {
-		SendResponse r = sendData( sServerScript + QByteArray( "END_OF_SERVER\n" ) );
+		SendResponse r = sendData( ( mCompressedUpload ? sServerScriptCompressed : sServerScript ) +
+		                           QByteArray( SERVER_UPLOAD_END ) );
 		if ( r == SendAgain ) {
 			return true;
 		}
@@ -233,15 +283,30 @@ bool ServerChannel::handleOpening() {
 
 	if ( mInternalStatus == _SendingSudoPassword ) {
 		if ( mTriedSudoPassword ) {
-			// Need to ask the user for a new sudo password
-			QVariantMap options;
-			options.insert( "title", QObject::tr( "%1 Sudo Password" ).arg( mHost->getName() ) );
-			options.insert( "blurb",
-			                QObject::tr( "Please enter your sudo password for %1 below." ).arg( mHost->
-			                                                                                    getName() ) );
-			options.insert( "memorable", false );
-
-			QVariantMap result = DialogRethreader::rethreadDialog< PasswordDlg >( options );
+			// Need to ask the user for a new sudo password. The reactor thread is shared with other sessions, so
+			// rather than wait on the dialog here, sit in this state until sudoPasswordEntered wakes the session.
+			mSudoPasswordLock.lock();
+			bool arrived = mSudoPasswordArrived;
+			QVariantMap result = mSudoPasswordResult;
+			mSudoPasswordArrived = false;
+			mSudoPasswordLock.unlock();
+
+			if ( ! arrived ) {
+				if ( ! mAwaitingSudoPassword ) {
+					QString hostName = mHost->getName();
+					QVariantMap options;
+					options.insert( "title", QObject::tr( "%1 Sudo Password" ).arg( hostName ) );
+					options.insert( "blurb",
+					                QObject::tr( "Please enter your sudo password for %1 below." ).arg( hostName ) );
+					options.insert( "memorable", false );
+
+					mAwaitingSudoPassword = true;
+					DialogRethreader::rethreadDialog< PasswordDlg >( options, this, "sudoPasswordEntered" );
+				}
+				return false;
+			}
+
+			mAwaitingSudoPassword = false;
 			if ( ! result.value( "accepted" ).toBool() ) {
 				criticalError( "Failed to sudo" );
 				return false;
@@ -268,6 +333,15 @@ bool ServerChannel::handleOpening() {
 	return true;
 }
 
+void ServerChannel::sudoPasswordEntered( QVariantMap result ) {
+	mSudoPasswordLock.lock();
+	mSudoPasswordResult = result;
+	mSudoPasswordArrived = true;
+	mSudoPasswordLock.unlock();
+
+	emit mHost->wakeAllSessions();
+}
+
 void ServerChannel::criticalError( const QString &error ) {
 	// Fail the current job (if there is one)
 	if ( mCurrentRequest ) {
@@ -300,13 +374,8 @@ bool ServerChannel::mainUpdate() {
 						{
 							if ( request->getOpeningFile() &&
 							     response.contains( "bufferId" ) ) {
-								mBufferIds.insert( request->getOpeningFile(),
-								                   response.value( "bufferId" ).toInt() );
-								connect( this,
-								         SIGNAL( channelShutdown() ),
-								         request->getOpeningFile(),
-								         SLOT( serverChannelFailure() ),
-								         Qt::QueuedConnection );
+								registerBuffer( request->getOpeningFile(),
+								                response.value( "bufferId" ).toInt() );
 							}
 						}
 						BaseFile::deletionUnlock();
@@ -315,7 +384,16 @@ bool ServerChannel::mainUpdate() {
 						ServerRequest *request =
 							mRequestsAwaitingReplies.value( responseId, NULL );
 						if ( request != NULL ) {
+							qint64 roundTrip = request->takeMsecsSinceSent();
+							if ( roundTrip >= 0 ) {
+								mHost->getChannelPool().recordRoundTrip( roundTrip );
+							}
 							request->handleReply( response );
+
+							// Nobody wants the rest of an abandoned listing; stop the server sending it.
+							if ( response.contains( "more" ) && request->isAbandoned() && request->takeCancel() ) {
+								mPendingCancels.append( responseId );
+							}
 						}
 					} else {
 						// This response has an id, but no related request. This should not
@@ -338,15 +416,21 @@ bool ServerChannel::mainUpdate() {
 
 	// Check if there's requests to be made
 	if ( mInternalStatus == _WaitingForRequests ) {
-		mCurrentRequest = mHost->getNextServerRequest( mSudo, mBufferIds );
+		if ( ! mPendingCancels.isEmpty() ) {
+			QVariantMap params;
+			params.insert( "id", mPendingCancels.takeFirst() );
+			mCurrentRequest = new ServerRequest( NULL, "cancel", params, Callback() );
+		} else {
+			mCurrentRequest = ( mShared ? mHost->getNextSharedServerRequest( this ) :
+			                    mHost->getNextServerRequest( mSudo, mBufferIds ) );
+		}
 		if ( mCurrentRequest ) {
 			mCurrentRequest->setMessageId( mNextMessageId++ );
 			mInternalStatus = _SendingRequest;
 
 			// If this new request is closing a file, remove it from my record of bufferIds.
 			if ( mCurrentRequest->getRequest() == "close" ) {
-				disconnect( mCurrentRequest->getFile() );
-				mBufferIds.remove( mCurrentRequest->getFile() );
+				forgetBuffer( mCurrentRequest->getFile() );
 			}
 		} else {
 			return false;
@@ -356,7 +440,7 @@ bool ServerChannel::mainUpdate() {
 	// Make requests if there are any to make.
 	if ( mInternalStatus == _SendingRequest ) {
 		const QByteArray &packedRequest =
-			mCurrentRequest->getPackedRequest( mBufferIds.value( mCurrentRequest->getFile(), -1 ) );
+			mCurrentRequest->getPackedRequest( getBufferId( mCurrentRequest->getFile() ) );
 		int rc = libssh2_channel_write( mHandle, packedRequest, packedRequest.length() );
 		if ( rc < 0 ) {
 			if ( rc == -1 ) {
@@ -370,6 +454,7 @@ bool ServerChannel::mainUpdate() {
 		}
 
 		SSHLOG_TRACE( mHost ) << "Sent: " << packedRequest;
+		mCurrentRequest->markSent();
 		mRequestsAwaitingReplies.insert( mCurrentRequest->getMessageId(), mCurrentRequest );
 
 		mCurrentRequest = NULL;
@@ -404,6 +489,11 @@ void ServerChannel::finalizeServerInit( const QByteArray &initString ) {
 	SSHLOG_INFO( mHost ) << "Home directory: " << homeDir;
 	mHost->setHomeDirectory( homeDir );
 
+	mShared = initBlob.value( "shared" ).toBool();
+	if ( mShared ) {
+		SSHLOG_INFO( mHost ) << "Connected to shared server";
+	}
+
 	setInternalStatus( _WaitingForRequests );
 
 	mHost->firstServerCheckComplete();
@@ -451,6 +541,43 @@ void ServerChannel::setInternalStatus( InternalStatus newStatus ) {
 QByteArray ServerChannel::getServerRun( bool sudo ) {
 	if ( sudo ) {
 		mSudoPasswordAttempt = mHost->getSudoPassword();
+		return "sudo -p Sudo-prompt%-ponyedit-% perl " + sServerScriptPath;
 	}
-	return sudo ? "sudo -p Sudo-prompt%-ponyedit-% perl .ponyedit/server.pl" : "perl .ponyedit/server.pl";
+
+	// Regular channels share a daemon, where the server can manage one; sudo ones each run their own as root.
+	return "perl " + sServerScriptPath + " client";
+}
+
+bool ServerChannel::handlesFileBuffer( ServerFile *file ) {
+	return mShared ? mHost->hasSharedBuffer( file ) : mBufferIds.contains( file );
+}
+
+void ServerChannel::registerBuffer( ServerFile *file, int bufferId ) {
+	if ( mShared ) {
+		// This channel takes the file's requests while it lasts, then another shared channel takes over; the file
+		// only needs to reconnect if they all go.
+		mHost->registerSharedBuffer( file, bufferId, this );
+		connect( mHost,
+		         SIGNAL( sharedServerLost() ),
+		         file,
+		         SLOT( serverChannelFailure() ),
+		         ( Qt::ConnectionType ) ( Qt::QueuedConnection | Qt::UniqueConnection ) );
+	} else {
+		mBufferIds.insert( file, bufferId );
+		connect( this, SIGNAL( channelShutdown() ), file, SLOT( serverChannelFailure() ), Qt::QueuedConnection );
+	}
+}
+
+void ServerChannel::forgetBuffer( ServerFile *file ) {
+	if ( mShared ) {
+		disconnect( mHost, SIGNAL( sharedServerLost() ), file, SLOT( serverChannelFailure() ) );
+		mHost->forgetSharedBuffer( file );
+	} else {
+		disconnect( file );
+		mBufferIds.remove( file );
+	}
+}
+
+int ServerChannel::getBufferId( ServerFile *file ) {
+	return mShared ? mHost->getSharedBufferId( file ) : mBufferIds.value( file, -1 );
 }
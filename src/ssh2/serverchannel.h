@@ -3,7 +3,9 @@
 
 #include <QByteArray>
 #include <QMap>
+#include <QMutex>
 #include <QSet>
+#include <QVariantMap>
 
 #include "shellchannel.h"
 
@@ -23,13 +25,22 @@ class ServerChannel : public ShellChannel {
 			return mSudo ? SudoServer : Server;
 		}
 
-		inline bool handlesFileBuffer( ServerFile *file ) {
-			return mBufferIds.contains( file );
+		bool handlesFileBuffer( ServerFile *file );
+
+		inline QList< ServerFile * > getFileBuffers() const {       // Only those held by this channel alone.
+			return mBufferIds.keys();
+		}
+
+		inline bool isShared() const {  // Connected to the host's shared server daemon.
+			return mShared;
 		}
 
 	signals:
 		void channelShutdown(); // Used to signal associated ServerFiles.
 
+	protected slots:
+		void sudoPasswordEntered( QVariantMap result );      // From the password dialog, on the main thread.
+
 	protected:
 		void shellReady();
 		void finalizeServerInit( const QByteArray &initString );
@@ -60,6 +71,10 @@ class ServerChannel : public ShellChannel {
 		bool handleOpening();
 		void setInternalStatus( InternalStatus newStatus );
 
+		void registerBuffer( ServerFile *file, int bufferId );
+		void forgetBuffer( ServerFile *file );
+		int getBufferId( ServerFile *file );
+
 		InternalStatus mInternalStatus;
 		ServerRequest *mCurrentRequest;
 		int mNextMessageId;
@@ -67,13 +82,24 @@ class ServerChannel : public ShellChannel {
 		bool mSudo;
 		QByteArray mSudoPasswordAttempt;
 		bool mTriedSudoPassword;
+		bool mAwaitingSudoPassword;     // The password dialog is up; the channel waits without blocking its thread.
+
+		QMutex mSudoPasswordLock;       // Guards the dialog's answer on its way over from the main thread.
+		bool mSudoPasswordArrived;
+		QVariantMap mSudoPasswordResult;
+		bool mCompressedUpload; // Whether the uploader can take the script compressed.
+		bool mShared;           // Buffers live in the shared daemon, and are registered with the host.
 
 		QMap< int, ServerRequest * > mRequestsAwaitingReplies;
+		QList< int > mPendingCancels;   // Ids of abandoned requests the server is still answering in parts.
 		QMap< ServerFile *, int > mBufferIds;
 
 		static QByteArray sServerScript;
+		static QByteArray sServerScriptPath;    // Relative to the home directory; includes the checksum.
+		static QByteArray sServerScriptCompressed;
 
 		static QByteArray sServerChannelInit;
+		static QByteArray sServerChannelFastInit;
 		static QByteArray sServerUpload;
 };
 
@@ -1,8 +1,8 @@
 #include <QDebug>
 #include <QJsonDocument>
 
-#include "main/tools.h"
 #include "serverrequest.h"
+#include "tools/bincodec.h"
 
 ServerRequest::ServerRequest( ServerFile *file,
                               const QByteArray &request,
@@ -12,7 +12,11 @@ ServerRequest::ServerRequest( ServerFile *file,
 	mOpeningFile( NULL ),
 	mRequest( request ),
 	mParameters( parameters ),
+	mTarget( callback.getTarget() ),
+	mHadTarget( callback.getTarget() != NULL ),
+	mCancelled( false ),
 	mMessageId( 0 ),
+	mSent(),
 	mPackedRequest() {
 	if ( callback.getFailureSlot() ) {
 		connect( this,
@@ -39,7 +43,7 @@ const QByteArray &ServerRequest::prepare( int bufferId ) {
 	}
 
 	mPackedRequest = QJsonDocument::fromVariant( QVariant( requestRoot ) ).toJson();
-	mPackedRequest = Tools::bin( mPackedRequest );
+	mPackedRequest = BinCodec::encode( mPackedRequest );
 	mPackedRequest += "\n";
 
 	// "bin" the request; clear out characters that are trouble for ssh comms
@@ -2,9 +2,11 @@
 #define SERVEREQUEST_H
 
 #include <QByteArray>
+#include <QElapsedTimer>
 #include <QObject>
 #include <QVariant>
 #include "file/serverfile.h"
+#include "requestqueue.h"
 #include "tools/callback.h"
 
 class ServerRequest : QObject {
@@ -45,6 +47,39 @@ class ServerRequest : QObject {
 			mOpeningFile = file;
 		}
 
+		// Scheduling; see RequestQueue. Listings wait behind edits and saves; requests for one file stay in order.
+		inline RequestQueueBase::Priority getPriority() const {
+			return mRequest == "ls" ? RequestQueueBase::Listing : RequestQueueBase::Interactive;
+		}
+
+		inline uint getOrderKey() const {
+			return mFile ? qHash( mFile.data() ) : 0;
+		}
+
+		// Round trip timing, for sizing the channel pool.
+		inline void markSent() {
+			mSent.start();
+		}
+
+		// Only the first reply counts; a listing sent in parts takes longer than a round trip to finish.
+		inline qint64 takeMsecsSinceSent() {
+			qint64 elapsed = ( mSent.isValid() ? mSent.elapsed() : -1 );
+			mSent.invalidate();
+			return elapsed;
+		}
+
+		// A request whose callback target has gone has nobody to answer; one still arriving in parts is cancelled
+		// on the server, once.
+		inline bool isAbandoned() const {
+			return mHadTarget && mTarget.isNull();
+		}
+
+		inline bool takeCancel() {
+			bool cancel = ! mCancelled;
+			mCancelled = true;
+			return cancel;
+		}
+
 		inline const QByteArray &getPackedRequest( int bufferId ) {
 			return mPackedRequest.isNull() ? prepare( bufferId ) : mPackedRequest;
 		}
@@ -65,7 +100,12 @@ class ServerRequest : QObject {
 		QByteArray mRequest;
 		QVariant mParameters;
 
+		QPointer< QObject > mTarget;
+		bool mHadTarget;
+		bool mCancelled;
+
 		int mMessageId;
+		QElapsedTimer mSent;
 
 		QByteArray mPackedRequest;
 };
@@ -2,6 +2,7 @@
 #include <libssh2_sftp.h>
 #include <QDebug>
 #include "file/basefile.h"
+#include "options/options.h"
 #include "serverrequest.h"
 #include "sftpchannel.h"
 #include "sftprequest.h"
@@ -16,7 +17,19 @@ SFTPChannel::SFTPChannel( SshHost *host ) :
 	mRequestState(),
 	mResult(),
 	mOperationSize( 0 ),
-	mOperationCursor( 0 ) {}
+	mOperationCursor( 0 ),
+	mOperationTimer(),
+	mVerifyHash( QCryptographicHash::Md5 ),
+	mVerifyBuffer(),
+	mVerifyReading( false ),
+	mVerifyMatched( false ),
+	mIoSize( qBound( SFTP_MIN_IO_SIZE,
+	                 Options::get( "SftpIoSize", SFTP_DEFAULT_IO_SIZE ).toInt(),
+	                 SFTP_MAX_IO_SIZE ) ) {}
+
+SFTPChannel::~SFTPChannel() {
+	abandonCurrentRequest( tr( "Channel closed." ), true );
+}
 
 bool SFTPChannel::update() {
 	switch ( mStatus ) {
@@ -59,14 +72,35 @@ bool SFTPChannel::handleOpening() {
 }
 
 void SFTPChannel::criticalError( const QString &error ) {
-	// Fail the current job (if there is one)
-	if ( mCurrentRequest ) {
+	// Errors reported by the SFTP server itself (eg: permission denied) won't go away on a retry.
+	bool serverError = ( mSession != NULL &&
+	                     libssh2_session_last_errno( mSession->sessionHandle() ) == LIBSSH2_ERROR_SFTP_PROTOCOL );
+	abandonCurrentRequest( error, ! serverError );
+
+	SshChannel::criticalError( error );
+}
+
+void SFTPChannel::abandonCurrentRequest( const QString &error, bool retry ) {
+	if ( mCurrentRequest == NULL ) {
+		return;
+	}
+
+	// Reads keep their partial content in the request; both need to remember how far they got.
+	bool transferring = ( mRequestState == Reading || mRequestState == Writing || mRequestState == Finishing );
+	SFTPRequest::Type type = mCurrentRequest->getType();
+	if ( transferring && ( type == SFTPRequest::ReadFile || type == SFTPRequest::WriteFile ) ) {
+		mCurrentRequest->setResumeOffset( mOperationCursor );
+	}
+
+	if ( retry && mCurrentRequest->prepareRetry() ) {
+		SSHLOG_INFO( mHost ) << "SFTP request for" << mCurrentRequest->getPath() << "interrupted; will resume";
+		mHost->requeueSftpRequest( mCurrentRequest );
+	} else {
 		mCurrentRequest->triggerFailure( error, ServerRequest::ConnectionError );
 		delete mCurrentRequest;
-		mCurrentRequest = NULL;
 	}
 
-	SshChannel::criticalError( error );
+	mCurrentRequest = NULL;
 }
 
 bool SFTPChannel::mainUpdate() {
@@ -155,6 +189,15 @@ bool SFTPChannel::updateLs() {
 				details.insert( "s", attrs.filesize );
 				details.insert( "m", ( qulonglong ) attrs.mtime );
 				mResult.insert( buffer, details );
+
+				// Big directories go out in parts, the way server.pl sends them.
+				if ( mResult.count() >= LISTING_BATCH_SIZE ) {
+					QVariantMap part;
+					part.insert( "entries", mResult );
+					part.insert( "more", true );
+					mCurrentRequest->triggerSuccess( part );
+					mResult.clear();
+				}
 			}
 		}
 	}
@@ -210,6 +253,8 @@ bool SFTPChannel::updateReadFile() {
 			criticalError( tr( "Failed to open remote file for reading: %1" ).arg( rc ) );
 			return false;
 		}
+
+		mOperationTimer.start();
 	}
 
 	if ( mRequestState == Sizing ) {
@@ -222,28 +267,53 @@ bool SFTPChannel::updateReadFile() {
 			return false;
 		}
 
-		mOperationSize = attr.filesize;
-		if ( mOperationSize == 0 ) {
-			mOperationSize = 1;
+		// Resuming an interrupted read; only carry on if the file is still the one we started reading. SFTP can't
+		// checksum the remote file, so size and mtime have to do; without an mtime to go by, start over.
+		qint64 mtime = ( attr.flags & LIBSSH2_SFTP_ATTR_ACMODTIME ) ? ( qint64 ) attr.mtime : -1;
+		int received = mCurrentRequest->getResumeOffset();
+		if ( received > 0 ) {
+			if ( ( qint64 ) attr.filesize != mCurrentRequest->getExpectedSize() || mtime < 0 ||
+			     mtime != mCurrentRequest->getExpectedMtime() ) {
+				SSHLOG_INFO( mHost ) << "SFTP read of" << mCurrentRequest->getPath() << "can't be resumed; restarting";
+				received = 0;
+				mCurrentRequest->setResumeOffset( 0 );
+			} else {
+				libssh2_sftp_seek64( mOperationHandle, received );
+			}
 		}
+		mCurrentRequest->setExpectedSize( attr.filesize );
+		mCurrentRequest->setExpectedMtime( mtime );
+
+		// Read straight into content sized up front; it grows if the file does.
+		mOperationSize = attr.filesize;
+		mOperationCursor = received;
+		mCurrentRequest->resizeContent( mOperationSize );
 		mRequestState = Reading;
 	}
 
 	if ( mRequestState == Reading ) {
-		char buffer[ 4096 ];
+		if ( mOperationCursor == mOperationSize ) {
+			mOperationSize += mIoSize;
+			mCurrentRequest->resizeContent( mOperationSize );
+		}
 
-		rc = libssh2_sftp_read( mOperationHandle, buffer, sizeof( buffer ) );
+		// Large reads let libssh2 keep several read requests in flight at once.
+		rc = libssh2_sftp_read( mOperationHandle,
+		                        mCurrentRequest->getContentBuffer() + mOperationCursor,
+		                        qMin( mIoSize, mOperationSize - mOperationCursor ) );
 		if ( rc == LIBSSH2_ERROR_EAGAIN ) {
 			return true;    // Try again
 		} else if ( rc == 0 ) {
+			mCurrentRequest->resizeContent( mOperationCursor );
 			mRequestState = Finishing;
 		} else if ( rc < 0 ) {
 			criticalError( tr( "Error while reading file contents: %1" ).arg( rc ) );
 			return false;
 		} else {// Got some data
-			mCurrentRequest->addContent( buffer, rc );
-			mCurrentRequest->triggerProgress(
-				( mCurrentRequest->getContent().length() * 100 ) / mOperationSize );
+			mOperationCursor += rc;
+			mHost->getChannelPool().recordTransfer( ChannelPool::Sftp, rc );
+			qint64 expected = qMax( mCurrentRequest->getExpectedSize(), ( qint64 ) 1 );
+			mCurrentRequest->triggerProgress( ( int ) qMin( ( mOperationCursor * 100 ) / expected, ( qint64 ) 100 ) );
 		}
 	}
 
@@ -256,6 +326,8 @@ bool SFTPChannel::updateReadFile() {
 			return false;
 		}
 
+		SSHLOG_DEBUG( mHost ) << "SFTP read of" << mOperationCursor << "bytes at" << throughput() << "MB/s";
+
 		// Success! Send a response and finish up.
 		QVariantMap finalResult;
 		finalResult.insert( "content", mCurrentRequest->getContent() );
@@ -270,15 +342,21 @@ bool SFTPChannel::updateWriteFile() {
 	int rc;
 
 	if ( mRequestState == Beginning ) {
+		// A resumed write keeps what made it to the remote file last time, and carries on after it.
+		int resumeOffset = mCurrentRequest->getResumeOffset();
+		if ( resumeOffset > 0 ) {
+			mCurrentRequest->setResumed( true );
+		}
 		QByteArray path = mCurrentRequest->getPath().toUtf8();
 		mOperationHandle = libssh2_sftp_open_ex( mHandle,
 		                                         path,
 		                                         path.length(),
-		                                         LIBSSH2_FXF_WRITE | LIBSSH2_FXF_TRUNC | LIBSSH2_FXF_CREAT,
+		                                         LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT |
+		                                         ( resumeOffset ? 0 : LIBSSH2_FXF_TRUNC ),
 		                                         0644,
 		                                         LIBSSH2_SFTP_OPENFILE );
 		if ( mOperationHandle ) {
-			mRequestState = Writing;
+			mRequestState = ( resumeOffset < mCurrentRequest->getContent().length() ? Writing : Finishing );
 		} else if ( ( rc = libssh2_session_last_errno( mSession->sessionHandle() ) ) == LIBSSH2_ERROR_EAGAIN ) {
 			return true;    // try again
 		} else {
@@ -286,14 +364,18 @@ bool SFTPChannel::updateWriteFile() {
 			return false;
 		}
 
-		mOperationCursor = 0;
+		libssh2_sftp_seek64( mOperationHandle, resumeOffset );
+		mOperationCursor = resumeOffset;
+		mOperationTimer.start();
 	}
 
 	if ( mRequestState == Writing ) {
+		// As with reads, large writes are split and pipelined by libssh2. After EAGAIN it must be called
+		// again with the same buffer, which this is, as the cursor hasn't moved.
 		const QByteArray &content = mCurrentRequest->getContent();
 		rc = libssh2_sftp_write( mOperationHandle,
 		                         content.constData() + mOperationCursor,
-		                         content.length() - mOperationCursor );
+		                         qMin( mIoSize, content.length() - mOperationCursor ) );
 		if ( rc == LIBSSH2_ERROR_EAGAIN ) {
 			return true;    // Try again
 		} else if ( rc < 0 ) {
@@ -301,6 +383,7 @@ bool SFTPChannel::updateWriteFile() {
 			return false;
 		} else {// Wrote some data
 			mOperationCursor += rc;
+			mHost->getChannelPool().recordTransfer( ChannelPool::Sftp, rc );
 			mCurrentRequest->triggerProgress( ( mOperationCursor * 100 ) / content.length() );
 		}
 
@@ -318,6 +401,24 @@ bool SFTPChannel::updateWriteFile() {
 			return false;
 		}
 
+		SSHLOG_DEBUG( mHost ) << "SFTP write of" << mOperationCursor << "bytes at" << throughput() << "MB/s";
+
+		// SFTP has no remote checksum; a file pieced together over several attempts is read back and compared
+		// before it's reported saved.
+		if ( mCurrentRequest->wasResumed() ) {
+			mOperationHandle = NULL;
+			mOperationCursor = 0;
+			mVerifyHash.reset();
+			mRequestState = Verifying;
+			return true;
+		}
+	}
+
+	if ( mRequestState == Verifying ) {
+		return updateVerifyWrite();
+	}
+
+	if ( mRequestState == Finishing || mRequestState == Verified ) {
 		// Success! Send a response and finish up.
 		QVariantMap finalResult;
 		finalResult.insert( "revision", mCurrentRequest->getRevision() );
@@ -329,3 +430,76 @@ bool SFTPChannel::updateWriteFile() {
 
 	return true;
 }
+
+bool SFTPChannel::updateVerifyWrite() {
+	int rc;
+
+	if ( mOperationHandle == NULL ) {
+		QByteArray path = mCurrentRequest->getPath().toUtf8();
+		mOperationHandle = libssh2_sftp_open_ex( mHandle,
+		                                         path,
+		                                         path.length(),
+		                                         LIBSSH2_FXF_READ,
+		                                         0,
+		                                         LIBSSH2_SFTP_OPENFILE );
+		if ( mOperationHandle == NULL ) {
+			if ( ( rc = libssh2_session_last_errno( mSession->sessionHandle() ) ) == LIBSSH2_ERROR_EAGAIN ) {
+				return true;
+			}
+			criticalError( tr( "Failed to open remote file for checking: %1" ).arg( rc ) );
+			return false;
+		}
+		mVerifyBuffer.resize( mIoSize );
+		mVerifyMatched = false;
+		mVerifyReading = true;
+	}
+
+	if ( mVerifyReading ) {
+		rc = libssh2_sftp_read( mOperationHandle, mVerifyBuffer.data(), mIoSize );
+		if ( rc == LIBSSH2_ERROR_EAGAIN ) {
+			return true;
+		} else if ( rc < 0 ) {
+			criticalError( tr( "Error while checking file contents: %1" ).arg( rc ) );
+			return false;
+		} else if ( rc > 0 ) {
+			mVerifyHash.addData( mVerifyBuffer.constData(), rc );
+			mOperationCursor += rc;
+			return true;
+		}
+
+		const QByteArray &content = mCurrentRequest->getContent();
+		mVerifyMatched = ( mOperationCursor == content.length() &&
+		                   mVerifyHash.result() == QCryptographicHash::hash( content, QCryptographicHash::Md5 ) );
+		mVerifyReading = false;
+	}
+
+	rc = libssh2_sftp_close_handle( mOperationHandle );
+	if ( rc == LIBSSH2_ERROR_EAGAIN ) {
+		return true;
+	} else if ( rc < 0 ) {
+		criticalError( tr( "Failed to cleanly close SFTP file: %1" ).arg( rc ) );
+		return false;
+	}
+	mOperationHandle = NULL;
+
+	if ( mVerifyMatched ) {
+		mRequestState = Verified;
+		return updateWriteFile();
+	}
+
+	// Something else went wrong between attempts; write the whole file again.
+	if ( ! mCurrentRequest->prepareRetry() ) {
+		mCurrentRequest->triggerFailure( tr( "Saved file doesn't match after resuming" ), 0 );
+		return false;
+	}
+	SSHLOG_WARN( mHost ) << "Resumed SFTP write of" << mCurrentRequest->getPath() << "didn't match; rewriting";
+	mCurrentRequest->setResumeOffset( 0 );
+	mCurrentRequest->setResumed( false );
+	mRequestState = Beginning;
+	return true;
+}
+
+double SFTPChannel::throughput() const {
+	qint64 elapsed = qMax( mOperationTimer.elapsed(), ( qint64 ) 1 );
+	return ( mOperationCursor / ( 1024.0 * 1024.0 ) ) / ( elapsed / 1000.0 );
+}
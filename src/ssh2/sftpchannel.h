@@ -1,9 +1,17 @@
 #ifndef SFTPCHANNEL_H
 #define SFTPCHANNEL_H
 
+#include <QCryptographicHash>
+#include <QElapsedTimer>
 #include <QVariantMap>
 #include "sshchannel.h"
 
+// Size of each SFTP read/write call, tunable with the SftpIoSize option. libssh2 splits large calls into
+// several protocol requests and keeps them all in flight, so bigger means fewer round trips.
+#define SFTP_MIN_IO_SIZE ( 32 * 1024 )
+#define SFTP_DEFAULT_IO_SIZE ( 128 * 1024 )
+#define SFTP_MAX_IO_SIZE ( 256 * 1024 )
+
 struct _LIBSSH2_SFTP;
 typedef _LIBSSH2_SFTP LIBSSH2_SFTP;
 
@@ -14,6 +22,7 @@ class SFTPRequest;
 class SFTPChannel : public SshChannel {
 	public:
 		SFTPChannel( SshHost *host );
+		~SFTPChannel();
 
 		virtual bool update();
 		virtual Type getType() {
@@ -22,15 +31,19 @@ class SFTPChannel : public SshChannel {
 
 	protected:
 		void criticalError( const QString &error );
+		void abandonCurrentRequest( const QString &error, bool retry );
 		bool handleOpening();
 		bool mainUpdate();
 		bool updateLs();
 		bool updateMkDir();
 		bool updateReadFile();
 		bool updateWriteFile();
+		bool updateVerifyWrite();       // Reads a resumed write back, and rewrites it if it doesn't match.
+
+		double throughput() const;      // MB/s of the current read or write, for the log.
 
 	private:
-		enum RequestState { Beginning, Sizing, Reading, Writing, Finishing };
+		enum RequestState { Beginning, Sizing, Reading, Writing, Finishing, Verifying, Verified };
 
 		LIBSSH2_SFTP *mHandle;
 		LIBSSH2_SFTP_HANDLE *mOperationHandle;
@@ -40,6 +53,12 @@ class SFTPChannel : public SshChannel {
 		QVariantMap mResult;
 		int mOperationSize;
 		int mOperationCursor;
+		QElapsedTimer mOperationTimer;
+		QCryptographicHash mVerifyHash;
+		QByteArray mVerifyBuffer;
+		bool mVerifyReading;
+		bool mVerifyMatched;
+		int mIoSize;
 };
 
 #endif  // SFTPCHANNEL_H
@@ -9,7 +9,12 @@ SFTPRequest::SFTPRequest( SFTPRequest::Type type, const Callback &callback ) :
 	mCallback( callback ),
 	mContent(),
 	mRevision( 0 ),
-	mUndoLength( 0 ) {}
+	mUndoLength( 0 ),
+	mRetriesLeft( SFTP_RETRY_ATTEMPTS ),
+	mResumeOffset( 0 ),
+	mExpectedSize( -1 ),
+	mExpectedMtime( -1 ),
+	mResumed( false ) {}
 
 void SFTPRequest::setPath( const QString &path ) {
 	mPath = path;
@@ -3,8 +3,12 @@
 
 #include <QByteArray>
 #include <QVariantMap>
+#include "requestqueue.h"
 #include "tools/callback.h"
 
+// Number of times a request interrupted by a connection dropout is retried before it is failed.
+#define SFTP_RETRY_ATTEMPTS 5
+
 class SFTPRequest {
 	public:
 		enum Type { Ls, MkDir, ReadFile, WriteFile };
@@ -20,18 +24,41 @@ class SFTPRequest {
 			return mPath;
 		}
 
-		inline void setContent( const QByteArray &content ) {
-			mContent = content;
+		// Scheduling; see RequestQueue. Listings wait behind edits, and file reads (which can be big)
+		// behind listings.
+		inline RequestQueueBase::Priority getPriority() const {
+			switch ( mType ) {
+				case Ls:
+					return RequestQueueBase::Listing;
+
+				case ReadFile:
+					return RequestQueueBase::Bulk;
+
+				default:
+					return RequestQueueBase::Interactive;
+			}
+		}
+
+		inline uint getOrderKey() const {       // Reads and writes of one path stay in order.
+			return mType == Ls ? 0 : qHash( mPath );
 		}
 
-		inline void addContent( const char *data, int length ) {
-			mContent.append( data, length );
+		inline void setContent( const QByteArray &content ) {
+			mContent = content;
 		}
 
 		inline const QByteArray &getContent() const {
 			return mContent;
 		}
 
+		inline void resizeContent( int size ) {
+			mContent.resize( size );
+		}
+
+		inline char *getContentBuffer() {
+			return mContent.data();
+		}
+
 		inline void setRevision( int revision ) {
 			mRevision = revision;
 		}
@@ -56,6 +83,45 @@ class SFTPRequest {
 			return mIncludeHidden;
 		}
 
+		// Connection dropout support. Reads and writes carry on from the resume offset. The expected size and
+		// mtime guard a resumed read against the file changing in between; a resumed write is read back and
+		// compared once it's done, as SFTP has no way to checksum the remote file.
+		inline bool prepareRetry() {
+			return mRetriesLeft-- > 0;
+		}
+
+		inline void setResumeOffset( int offset ) {
+			mResumeOffset = offset;
+		}
+
+		inline int getResumeOffset() const {
+			return mResumeOffset;
+		}
+
+		inline void setExpectedSize( qint64 size ) {
+			mExpectedSize = size;
+		}
+
+		inline qint64 getExpectedSize() const {
+			return mExpectedSize;
+		}
+
+		inline void setExpectedMtime( qint64 mtime ) {  // -1 if the server didn't say.
+			mExpectedMtime = mtime;
+		}
+
+		inline qint64 getExpectedMtime() const {
+			return mExpectedMtime;
+		}
+
+		inline void setResumed( bool resumed ) {
+			mResumed = resumed;
+		}
+
+		inline bool wasResumed() const {        // Some attempt carried on from where an earlier one stopped.
+			return mResumed;
+		}
+
 		inline void triggerSuccess( const QVariantMap &result ) {
 			mCallback.triggerSuccess( result );
 		}
@@ -76,6 +142,11 @@ class SFTPRequest {
 		QByteArray mContent;
 		int mRevision;
 		int mUndoLength;
+		int mRetriesLeft;
+		int mResumeOffset;
+		qint64 mExpectedSize;
+		qint64 mExpectedMtime;
+		bool mResumed;
 };
 
 #endif  // SFTPREQUEST_H
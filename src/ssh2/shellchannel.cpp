@@ -164,7 +164,7 @@ ShellChannel::ReadReply ShellChannel::readUntil( const QByteArray &marker ) {
 	// If there's data ready to go, pack it into the reply.
 	if ( markerIndex > -1 ) {
 		result.data = mReadBuffer.left( markerIndex );
-		mReadBuffer = mReadBuffer.right( mReadBuffer.size() - ( markerIndex + marker.length() ) );
+		mReadBuffer.remove( 0, markerIndex + marker.length() );
 	}
 
 	return result;
@@ -7,6 +7,7 @@ SshChannel::SshChannel( SshHost *host ) :
 	mHost( host ),
 	mSession( NULL ),
 	mStatus( Sessionless ),
+	mHasOpened( false ),
 	mErrorDetails( "" ) {}
 
 SshChannel::~SshChannel() {}
@@ -38,6 +39,7 @@ void SshChannel::criticalError( const QString &error ) {
 void SshChannel::setStatus( Status status ) {
 	if ( mStatus != status ) {
 		mStatus = status;
+		mHasOpened |= ( status == Open );
 		mHost->invalidateOverallStatus();
 	}
 }
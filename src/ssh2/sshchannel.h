@@ -36,6 +36,10 @@ class SshChannel : public QObject {
 			return mErrorDetails;
 		}
 
+		inline bool hasOpened() const { // True once the channel has been Open, whatever its status now.
+			return mHasOpened;
+		}
+
 		virtual void criticalError( const QString &error );
 
 		virtual int getConnectionScore();       // Returns a number indicative of how close to connected this
@@ -50,6 +54,7 @@ class SshChannel : public QObject {
 		SshSession *mSession;
 
 		Status mStatus;
+		bool mHasOpened;
 		QString mErrorDetails;
 };
 
@@ -1,8 +1,10 @@
+#include <algorithm>
 #include <QDebug>
 
 #include "main/globaldispatcher.h"
 #include "main/ponyedit.h"
 #include "main/tools.h"
+#include "options/options.h"
 #include "serverchannel.h"
 #include "serverrequest.h"
 #include "sftpchannel.h"
@@ -23,6 +25,9 @@ SshHost::SshHost() :
 	mCachedIpAddress( 0 ),
 	mCachedAuthMethod( SshSession::AuthNone ),
 	mChannelLimitGuess( CHANNEL_LIMIT_GUESS ),
+	mChannelPool(),
+	mChannelRetryTimer(),
+	mListingCache(),
 	mSettings(),
 	mSaveHost( true ),
 	mSavePassword( false ),
@@ -31,6 +36,13 @@ SshHost::SshHost() :
 	mOverallStatusDirty = true;
 	updateOverallStatus();
 
+	for ( int i = 0; i < ChannelPool::KindCount; i++ ) {
+		mChannelFailures[ i ] = 0;
+	}
+
+	mChannelRetryTimer.setSingleShot( true );
+	QObject::connect( &mChannelRetryTimer, SIGNAL( timeout() ), this, SLOT( checkChannelCount() ) );
+
 	QObject::connect( this,
 	                  SIGNAL( overallStatusInvalidated() ),
 	                  this,
@@ -46,6 +58,10 @@ SshHost::~SshHost() {
 }
 
 void SshHost::cleanup() {
+	// Hang on to what each host has learned about its channel pool, and the listings it has seen.
+	Tools::saveServers();
+	Tools::saveListingCaches();
+
 	// Call every host's destructor, forcing them to do nasty shutdowns.
 	foreach ( SshHost *host, sKnownHosts ) {
 		delete host;
@@ -91,6 +107,76 @@ void SshHost::disconnect() {
 	mDesiredStatus = Disconnected;
 }
 
+static bool connectedMoreRecently( SshHost *a, SshHost *b ) {
+	return a->getLastConnected() > b->getLastConnected();
+}
+
+void SshHost::prewarmRecentHosts() {
+	if ( ! Options::get( "PrewarmConnections", true ).toBool() ) {
+		return;
+	}
+
+	QDateTime cutoff = QDateTime::currentDateTime().addDays( -PREWARM_RECENT_DAYS );
+	QList< SshHost * > recent;
+	foreach ( SshHost *host, sKnownHosts ) {
+		if ( host->getLastConnected().isValid() && host->getLastConnected() > cutoff ) {
+			recent.append( host );
+		}
+	}
+
+	std::sort( recent.begin(), recent.end(), connectedMoreRecently );
+
+	int warmed = 0;
+	foreach ( SshHost *host, recent ) {
+		if ( warmed >= PREWARM_MAX_HOSTS ) {
+			break;
+		}
+		if ( host->prewarm() ) {
+			warmed++;
+		}
+	}
+}
+
+bool SshHost::prewarm() {
+	if ( ! mChannels.isEmpty() ) {
+		return false;
+	}
+
+	// A password or passphrase prompt popping up at startup, for a file nobody asked for yet, would be rude. Only
+	// warm up hosts whose last successful login can be repeated unattended.
+	bool unattended;
+	switch ( mCachedAuthMethod ) {
+		case SshSession::AuthPublicKey:
+			// A key file without a saved passphrase may well need one.
+			unattended = ( mKeyFile.isEmpty() || ! mKeyPassphrase.isEmpty() );
+			break;
+
+		case SshSession::AuthPassword:
+		case SshSession::AuthKeyboardInteractive:
+			unattended = ! mPassword.isEmpty();
+			break;
+
+		default:
+			unattended = false;
+	}
+
+	if ( ! unattended ) {
+		return false;
+	}
+
+	// Connecting, logging in and (for ssh hosts) checking the server script all happen in the background; by the
+	// time remote files are reopened, the channel they need is likely to be ready.
+	SSHLOG_INFO( this ) << "Prewarming connection";
+	connect();
+	if ( mConnectionType == SFTP ) {
+		registerChannel( new SFTPChannel( this ) );
+	} else {
+		registerChannel( new ServerChannel( this, false ) );
+	}
+
+	return true;
+}
+
 SshHost::LogHelper::~LogHelper() {
 	QString completeLine = QsLogging::LogMessage( mBuffer, QDateTime::currentDateTime(), mLevel ).formatted;
 	QsLogging::Logger::Helper( mLevel ).stream() << completeLine;
@@ -144,6 +230,7 @@ void SshHost::channelRejected( SshChannel *channel ) {
 
 void SshHost::channelNeatlyClosed( SshChannel *channel ) {
 	removeChannel( channel );
+	checkChannelCount();
 }
 
 void SshHost::removeChannel( SshChannel *channel ) {
@@ -154,6 +241,23 @@ void SshHost::removeChannel( SshChannel *channel ) {
 			                    mServerRequestQueueMutex,
 			                    mServerRequestQueue,
 			                    static_cast< ServerChannel * >( channel ) );
+
+			// Shared buffers outlive any one channel; but without any channel to reach them, they're gone.
+			if ( static_cast< ServerChannel * >( channel )->isShared() ) {
+				bool lastShared = true;
+				foreach ( SshChannel *other, mChannels ) {
+					if ( other != channel && other->is( SshChannel::Server ) &&
+					     static_cast< ServerChannel * >( other )->isShared() ) {
+						lastShared = false;
+						break;
+					}
+				}
+				if ( lastShared ) {
+					loseSharedServer();
+				} else {
+					releaseSharedBuffers( static_cast< ServerChannel * >( channel ) );
+				}
+			}
 			break;
 
 		case SshChannel::SudoServer:
@@ -165,11 +269,10 @@ void SshHost::removeChannel( SshChannel *channel ) {
 			break;
 
 		case SshChannel::Xfer:
-			failXferRequests( "Channel closed.", 0, mXferRequestQueueMutex, mXferRequestQueue );
-			break;
-
 		case SshChannel::SudoXfer:
-			failXferRequests( "Channel closed.", 0, mSudoXferRequestQueueMutex, mSudoXferRequestQueue );
+		case SshChannel::Sftp:
+			// Queued transfers aren't tied to a channel; they wait for the next one (see checkChannelCount), and
+			// in-flight ones are handed back by the channel itself.
 			break;
 
 		default:
@@ -177,6 +280,89 @@ void SshHost::removeChannel( SshChannel *channel ) {
 	}
 
 	mChannels.removeAll( channel );
+	recordChannelClosed( channel );
+}
+
+void SshHost::recordChannelClosed( SshChannel *channel ) {
+	ChannelPool::Kind kind;
+	switch ( channel->getType() ) {
+		case SshChannel::Server:
+		case SshChannel::SudoServer:
+			kind = ChannelPool::Server;
+			break;
+
+		case SshChannel::Xfer:
+		case SshChannel::SudoXfer:
+			kind = ChannelPool::Xfer;
+			break;
+
+		case SshChannel::Sftp:
+			kind = ChannelPool::Sftp;
+			break;
+
+		default:
+			return;
+	}
+
+	if ( channel->hasOpened() ) {
+		mChannelFailures[ kind ] = 0;
+		return;
+	}
+
+	mChannelFailedAt[ kind ].start();
+	if ( ++mChannelFailures[ kind ] < CHANNEL_RETRY_LIMIT ) {
+		return;
+	}
+
+	// Requests queued for a kind nobody can open would otherwise wait (and reopen channels) forever. If some
+	// channels of the kind are still around, they can carry on with the queue.
+	mChannelFailures[ kind ] = 0;
+	SSHLOG_WARN( this ) << ChannelPool::getKindName( kind ) << "channels failed to open" << CHANNEL_RETRY_LIMIT
+	                    << "times running; failing queued requests";
+
+	QString error = tr( "Failed to open a channel to the remote host." );
+	switch ( kind ) {
+		case ChannelPool::Server:
+			if ( countChannels( SshChannel::Server ) == 0 ) {
+				failServerRequests( error, 0, mServerRequestQueueMutex, mServerRequestQueue, NULL );
+			}
+			if ( countChannels( SshChannel::SudoServer ) == 0 ) {
+				failServerRequests( error, 0, mSudoServerRequestQueueMutex, mSudoServerRequestQueue, NULL );
+			}
+			break;
+
+		case ChannelPool::Xfer:
+			if ( countChannels( SshChannel::Xfer ) == 0 ) {
+				failXferRequests( error, 0, mXferRequestQueueMutex, mXferRequestQueue );
+			}
+			if ( countChannels( SshChannel::SudoXfer ) == 0 ) {
+				failXferRequests( error, 0, mSudoXferRequestQueueMutex, mSudoXferRequestQueue );
+			}
+			break;
+
+		default:
+			if ( countChannels( SshChannel::Sftp ) == 0 ) {
+				failSftpRequests( error, 0 );
+			}
+	}
+}
+
+bool SshHost::isChannelRetryDue( ChannelPool::Kind kind ) {
+	int failures = mChannelFailures[ kind ];
+	if ( failures == 0 ) {
+		return true;
+	}
+
+	qint64 delay = ( ( qint64 ) CHANNEL_RETRY_BASE_MSEC << ( failures - 1 ) ) - mChannelFailedAt[ kind ].elapsed();
+	if ( delay <= 0 ) {
+		return true;
+	}
+
+	// Come back when it is.
+	if ( ! mChannelRetryTimer.isActive() || mChannelRetryTimer.remainingTime() > delay ) {
+		mChannelRetryTimer.start( ( int ) delay );
+	}
+	return false;
 }
 
 void SshHost::registerChannel( SshChannel *channel ) {
@@ -187,9 +373,7 @@ void SshHost::registerChannel( SshChannel *channel ) {
 
 void SshHost::assignSession( SshChannel *channel ) {
 	// Just add this channel to the homeless queue.
-	mHomelessChannelsMutex.lock();
-	mHomelessChannels.append( channel );
-	mHomelessChannelsMutex.unlock();
+	mHomelessChannels.push( channel );
 
 	// Check that there are enough sessions with free room to adopt the homeless...
 	checkHeadroom();
@@ -198,20 +382,14 @@ void SshHost::assignSession( SshChannel *channel ) {
 	wakeAllSessions();
 }
 
-SshChannel *SshHost::takeNextHomelessChannel() {
-	SshChannel *taken = NULL;
-
-	if ( PonyEdit::isApplicationExiting() ) {
-		return NULL;
-	}
-
-	mHomelessChannelsMutex.lock();
-	if ( ! mHomelessChannels.isEmpty() ) {
-		taken = mHomelessChannels.takeFirst();
+QList< SshChannel * > SshHost::takeHomelessChannels() {
+	// Every session asks on every update; keep the common case cheap.
+	if ( PonyEdit::isApplicationExiting() || mHomelessChannels.isEmpty() ) {
+		return QList< SshChannel * >();
 	}
-	mHomelessChannelsMutex.unlock();
 
-	return taken;
+	// Any the session can't fit come back through channelRejected.
+	return mHomelessChannels.takeAll();
 }
 
 SshSession *SshHost::openSession() {
@@ -242,14 +420,46 @@ void SshHost::showStatus() {
 	foreach ( SshSession *session, mSessions ) {
 		SSHLOG_INFO( this ) << "Session " << i++ << " has " << session->getChannelCount() << " channels.";
 	}
+
+	QVariantMap metrics = getQueueMetrics();
+	foreach ( const QString &queue, metrics.keys() ) {
+		SSHLOG_INFO( this ) << "Queue" << queue << metrics.value( queue ).toMap();
+	}
+
+	SSHLOG_INFO( this ) << "Channel pool" << mChannelPool.save();
 }
 
-void SshHost::sendSftpRequest( SFTPRequest *request ) {
+QVariantMap SshHost::getQueueMetrics() {
+	QVariantMap result;
+
+	mServerRequestQueueMutex.lock();
+	result.insert( "server", mServerRequestQueue.getMetrics().toVariantMap() );
+	mServerRequestQueueMutex.unlock();
+
+	mSudoServerRequestQueueMutex.lock();
+	result.insert( "sudoServer", mSudoServerRequestQueue.getMetrics().toVariantMap() );
+	mSudoServerRequestQueueMutex.unlock();
+
+	mXferRequestQueueMutex.lock();
+	result.insert( "xfer", mXferRequestQueue.getMetrics().toVariantMap() );
+	mXferRequestQueueMutex.unlock();
+
+	mSudoXferRequestQueueMutex.lock();
+	result.insert( "sudoXfer", mSudoXferRequestQueue.getMetrics().toVariantMap() );
+	mSudoXferRequestQueueMutex.unlock();
+
 	mSftpRequestQueueMutex.lock();
-	mSftpRequestQueue.append( request );
+	result.insert( "sftp", mSftpRequestQueue.getMetrics().toVariantMap() );
 	mSftpRequestQueueMutex.unlock();
 
-	emit wakeAllSessions();
+	return result;
+}
+
+void SshHost::sendSftpRequest( SFTPRequest *request ) {
+	// Sessions are only nudged for the first request into an empty inbox; whichever takes that one takes the rest too.
+	if ( mSftpRequestQueue.post( request ) ) {
+		emit wakeAllSessions();
+	}
 	checkChannelCount();
 }
 
@@ -288,25 +498,22 @@ void SshHost::sendServerRequest( bool sudo,
 		}
 	}
 
-	// Add the new request to the queue.
-	if ( sudo ) {
-		mSudoServerRequestQueueMutex.lock();
-		mSudoServerRequestQueue.append( newRequest );
-		mSudoServerRequestQueueMutex.unlock();
-	} else {
-		mServerRequestQueueMutex.lock();
-		mServerRequestQueue.append( newRequest );
-		mServerRequestQueueMutex.unlock();
-	}
+	// Add the new request to the queue. Requests for an open file can only go to the channel holding its buffer.
+	RequestQueue< ServerRequest, ServerFile * > &queue = ( sudo ? mSudoServerRequestQueue : mServerRequestQueue );
 
-	// Nudge all sessions - if their threads are asleep they need to get this message
-	emit wakeAllSessions();
+	// Nudge all sessions - if their threads are asleep they need to get this message. Only needed for the first
+	// request into an empty inbox; whichever channel takes that one takes in the rest too.
+	if ( queue.post( newRequest, relevantFile ) ) {
+		emit wakeAllSessions();
+	}
 
 	// Ensure there are enough server channels to handle this.
 	checkChannelCount();
 }
 
 void SshHost::checkChannelCount() {
+	adaptChannelPool();
+
 	// For each type of channel, check their counts.
 	int serverCount = countChannels( SshChannel::Server );
 	int sudoServerCount = countChannels( SshChannel::SudoServer );
@@ -314,35 +521,89 @@ void SshHost::checkChannelCount() {
 	int sudoXferCount = countChannels( SshChannel::SudoXfer );
 	int sftpCount = countChannels( SshChannel::Sftp );
 
+	// Kinds whose channels keep failing to open back off before trying again.
+	bool serverDue = isChannelRetryDue( ChannelPool::Server );
+	bool xferDue = isChannelRetryDue( ChannelPool::Xfer );
+	bool sftpDue = isChannelRetryDue( ChannelPool::Sftp );
+
 	// Check if we need more server channels.
-	if ( serverCount < MAX_SERVER_CHANNELS &&
-	     mServerRequestQueue.length() > serverCount * SERVER_CHANNEL_QUEUE_MULTIPLIER ) {
+	if ( serverDue && mChannelPool.wantsChannel( ChannelPool::Server, mServerRequestQueue.length(), serverCount ) ) {
 		registerChannel( new ServerChannel( this, false ) );
 	}
 
 	// Check if we need more server channels.
-	if ( sudoServerCount < MAX_SERVER_CHANNELS &&
-	     mSudoServerRequestQueue.length() > sudoServerCount * SERVER_CHANNEL_QUEUE_MULTIPLIER ) {
+	if ( serverDue &&
+	     mChannelPool.wantsChannel( ChannelPool::Server, mSudoServerRequestQueue.length(), sudoServerCount ) ) {
 		registerChannel( new ServerChannel( this, true ) );
 	}
 
-	// Check if we need more server channels.
-	if ( xferCount < MAX_XFER_CHANNELS && mXferRequestQueue.length() > xferCount * XFER_CHANNEL_QUEUE_MULTIPLIER ) {
+	// Check if we need more xfer channels.
+	if ( xferDue && mChannelPool.wantsChannel( ChannelPool::Xfer, mXferRequestQueue.length(), xferCount ) ) {
 		registerChannel( new XferChannel( this, false ) );
 	}
 
-	// Check if we need more server channels.
-	if ( sudoXferCount < MAX_XFER_CHANNELS &&
-	     mSudoXferRequestQueue.length() > sudoXferCount * XFER_CHANNEL_QUEUE_MULTIPLIER ) {
+	// Check if we need more xfer channels.
+	if ( xferDue && mChannelPool.wantsChannel( ChannelPool::Xfer, mSudoXferRequestQueue.length(), sudoXferCount ) ) {
 		registerChannel( new XferChannel( this, true ) );
 	}
 
 	// Check if we need more sftp channels.
-	if ( sftpCount < MAX_SFTP_CHANNELS && mSftpRequestQueue.length() > sftpCount * SFTP_CHANNEL_QUEUE_MULTIPLIER ) {
+	if ( sftpDue && mChannelPool.wantsChannel( ChannelPool::Sftp, mSftpRequestQueue.length(), sftpCount ) ) {
 		registerChannel( new SFTPChannel( this ) );
 	}
 }
 
+void SshHost::adaptChannelPool() {
+	if ( ! mChannelPool.beginInterval() ) {
+		return;
+	}
+
+	// Sudo and regular channels of a kind share a limit, so they're judged together.
+	RequestQueueBase::Metrics metrics[ ChannelPool::KindCount ];
+	bool saturated[ ChannelPool::KindCount ];
+
+	mServerRequestQueueMutex.lock();
+	metrics[ ChannelPool::Server ] = mServerRequestQueue.getMetrics();
+	mServerRequestQueueMutex.unlock();
+
+	mSudoServerRequestQueueMutex.lock();
+	metrics[ ChannelPool::Server ].add( mSudoServerRequestQueue.getMetrics() );
+	mSudoServerRequestQueueMutex.unlock();
+
+	mXferRequestQueueMutex.lock();
+	metrics[ ChannelPool::Xfer ] = mXferRequestQueue.getMetrics();
+	mXferRequestQueueMutex.unlock();
+
+	mSudoXferRequestQueueMutex.lock();
+	metrics[ ChannelPool::Xfer ].add( mSudoXferRequestQueue.getMetrics() );
+	mSudoXferRequestQueueMutex.unlock();
+
+	mSftpRequestQueueMutex.lock();
+	metrics[ ChannelPool::Sftp ] = mSftpRequestQueue.getMetrics();
+	mSftpRequestQueueMutex.unlock();
+
+	// A kind can only use more channels if it's using all the ones it has.
+	int limit = mChannelPool.getMaxChannels( ChannelPool::Server );
+	saturated[ ChannelPool::Server ] = ( countChannels( SshChannel::Server ) >= limit ||
+	                                     countChannels( SshChannel::SudoServer ) >= limit );
+	limit = mChannelPool.getMaxChannels( ChannelPool::Xfer );
+	saturated[ ChannelPool::Xfer ] = ( countChannels( SshChannel::Xfer ) >= limit ||
+	                                   countChannels( SshChannel::SudoXfer ) >= limit );
+	limit = mChannelPool.getMaxChannels( ChannelPool::Sftp );
+	saturated[ ChannelPool::Sftp ] = ( countChannels( SshChannel::Sftp ) >= limit );
+
+	for ( int i = 0; i < ChannelPool::KindCount; i++ ) {
+		ChannelPool::Kind kind = ( ChannelPool::Kind ) i;
+		ChannelPool::Change change = mChannelPool.evaluate( kind, metrics[ i ], saturated[ i ], mChannelLimitGuess );
+		if ( change != ChannelPool::Unchanged ) {
+			SSHLOG_INFO( this ) << ( change == ChannelPool::Grown ? "Growing" : "Shrinking" )
+			                    << ChannelPool::getKindName( kind ) << "channel pool to"
+			                    << mChannelPool.getMaxChannels( kind ) << "; round trip"
+			                    << mChannelPool.getRoundTripMsec() << "msec";
+		}
+	}
+}
+
 int SshHost::countChannels( SshChannel::Type type ) {
 	int count = 0;
 	foreach ( SshChannel *channel, mChannels ) {
@@ -357,35 +618,112 @@ SFTPRequest *SshHost::getNextSftpRequest() {
 	SFTPRequest *request = NULL;
 
 	mSftpRequestQueueMutex.lock();
-	if ( ! mSftpRequestQueue.isEmpty() ) {
-		request = mSftpRequestQueue.takeFirst();
-	}
+	request = mSftpRequestQueue.dequeue();
 	mSftpRequestQueueMutex.unlock();
 
 	return request;
 }
 
+void SshHost::requeueSftpRequest( SFTPRequest *request ) {
+	mSftpRequestQueueMutex.lock();
+	mSftpRequestQueue.requeue( request );
+	mSftpRequestQueueMutex.unlock();
+
+	emit wakeAllSessions();
+	QMetaObject::invokeMethod( this, "checkChannelCount", Qt::QueuedConnection );
+}
+
 ServerRequest *SshHost::getNextServerRequest( bool sudo, const QMap< ServerFile *, int > &registeredBuffers ) {
 	ServerRequest *request = NULL;
 
 	QMutex &lock = sudo ? mSudoServerRequestQueueMutex : mServerRequestQueueMutex;
-	QList< ServerRequest * > &list = sudo ? mSudoServerRequestQueue : mServerRequestQueue;
+	RequestQueue< ServerRequest, ServerFile * > &queue = sudo ? mSudoServerRequestQueue : mServerRequestQueue;
 
+	// Requests bound to a buffer on another channel are left for that channel; if it dies, removeChannel fails them.
 	lock.lock();
-	for ( int i = 0; i < list.length(); i++ ) {
-		ServerFile *file = list[ i ]->getFile();
-		if ( file == NULL || registeredBuffers.contains( file ) ) {
-			// TODO: Add some code to ensure no request gets lost in the queue permanently if its
-			// buffer-locked channel gets killed
-			request = list.takeAt( i );
-			break;
+	request = queue.dequeue( registeredBuffers.keys() );
+	lock.unlock();
+
+	return request;
+}
+
+ServerRequest *SshHost::getNextSharedServerRequest( ServerChannel *channel ) {
+	// Each channel has its own socket into the daemon, which reads them in no particular order; so a buffer's
+	// requests all go through the one channel, and an orphaned buffer is taken over by whoever gets its next one.
+	QMutexLocker locker( &mSharedBuffersLock );
+	QList< ServerFile * > sharedBuffers;
+	for ( QMap< ServerFile *, ServerChannel * >::const_iterator i = mSharedBufferChannels.constBegin();
+	      i != mSharedBufferChannels.constEnd();
+	      ++i ) {
+		if ( i.value() == channel || i.value() == NULL ) {
+			sharedBuffers.append( i.key() );
 		}
 	}
-	lock.unlock();
+
+	ServerRequest *request = NULL;
+	mServerRequestQueueMutex.lock();
+	request = mServerRequestQueue.dequeue( sharedBuffers );
+	mServerRequestQueueMutex.unlock();
+
+	if ( request && request->getFile() && mSharedBufferChannels.value( request->getFile() ) == NULL ) {
+		mSharedBufferChannels.insert( request->getFile(), channel );
+	}
 
 	return request;
 }
 
+void SshHost::registerSharedBuffer( ServerFile *file, int bufferId, ServerChannel *channel ) {
+	QMutexLocker locker( &mSharedBuffersLock );
+	mSharedBuffers.insert( file, bufferId );
+	mSharedBufferChannels.insert( file, channel );
+}
+
+void SshHost::releaseSharedBuffers( ServerChannel *channel ) {
+	QMutexLocker locker( &mSharedBuffersLock );
+	for ( QMap< ServerFile *, ServerChannel * >::iterator i = mSharedBufferChannels.begin();
+	      i != mSharedBufferChannels.end();
+	      ++i ) {
+		if ( i.value() == channel ) {
+			i.value() = NULL;
+		}
+	}
+}
+
+void SshHost::forgetSharedBuffer( ServerFile *file ) {
+	QMutexLocker locker( &mSharedBuffersLock );
+	mSharedBuffers.remove( file );
+	mSharedBufferChannels.remove( file );
+}
+
+bool SshHost::hasSharedBuffer( ServerFile *file ) {
+	QMutexLocker locker( &mSharedBuffersLock );
+	return mSharedBuffers.contains( file );
+}
+
+int SshHost::getSharedBufferId( ServerFile *file ) {
+	QMutexLocker locker( &mSharedBuffersLock );
+	return mSharedBuffers.value( file, -1 );
+}
+
+void SshHost::loseSharedServer() {
+	mSharedBuffersLock.lock();
+	QList< ServerFile * > sharedBuffers = mSharedBuffers.keys();
+	mSharedBuffers.clear();
+	mSharedBufferChannels.clear();
+	mSharedBuffersLock.unlock();
+
+	mServerRequestQueueMutex.lock();
+	QList< ServerRequest * > failed = mServerRequestQueue.takeRoutes( sharedBuffers );
+	mServerRequestQueueMutex.unlock();
+
+	foreach ( ServerRequest *request, failed ) {
+		request->failRequest( "Channel closed.", 0 );
+		delete request;
+	}
+
+	emit sharedServerLost();
+}
+
 bool SshHost::waitBeforeCheckingServer( SshChannel *channel ) {
 	// Only wait if the server script hasn't been checked before.
 	if ( mServerScriptChecked ) {
@@ -413,8 +751,32 @@ void SshHost::firstServerCheckComplete() {
 	mFirstServerScriptChecker = NULL;
 }
 
-void SshHost::handleUnsolicitedServerMessage( const QVariantMap & /*message*/ ) {
-	SSHLOG_INFO( this ) << "Unsolicited server message received";
+void SshHost::handleUnsolicitedServerMessage( const QVariantMap &message ) {
+	// Arrives on a session thread; caches and files live on the main one.
+	if ( message.contains( "changed" ) ) {
+		QMetaObject::invokeMethod( this, "remoteChanged", Qt::QueuedConnection, Q_ARG( QVariantMap, message ) );
+	} else {
+		SSHLOG_INFO( this ) << "Unsolicited server message received";
+	}
+}
+
+void SshHost::remoteChanged( const QVariantMap &message ) {
+	QStringList paths;
+	foreach ( const QVariant &path, message.value( "changed" ).toList() ) {
+		paths.append( path.toString() );
+	}
+	SSHLOG_TRACE( this ) << "Changed on the server:" << paths;
+
+	// A file changing makes its folder's listing stale too.
+	foreach ( const QString &path, paths ) {
+		mListingCache.invalidate( path );
+		int slash = path.lastIndexOf( '/' );
+		if ( slash > 0 ) {
+			mListingCache.invalidate( path.left( slash ) );
+		}
+	}
+
+	emit remotePathsChanged( paths );
 }
 
 void SshHost::getFileContent( bool sudo, const QByteArray &filename, const Callback &callback ) {
@@ -433,20 +795,45 @@ void SshHost::setFileContent( bool sudo,
 }
 
 void SshHost::enqueueXferRequest( XferRequest *request ) {
-	if ( request->isSudo() ) {
-		mSudoXferRequestQueueMutex.lock();
-		mSudoXferRequestQueue.append( request );
-		mSudoXferRequestQueueMutex.unlock();
+	RequestQueue< XferRequest > &queue = ( request->isSudo() ? mSudoXferRequestQueue : mXferRequestQueue );
+
+	// Nudge all sessions - if their threads are asleep they need to get this message (see sendServerRequest)
+	if ( queue.post( request ) ) {
+		emit wakeAllSessions();
+	}
+
+	checkChannelCount();
+}
+
+void SshHost::queueXferRequests( const QList< XferRequest * > &requests, bool urgent ) {
+	if ( requests.isEmpty() ) {
+		return;
+	}
+
+	bool sudo = requests.first()->isSudo();
+	QMutex &queueLock = ( sudo ? mSudoXferRequestQueueMutex : mXferRequestQueueMutex );
+	RequestQueue< XferRequest > &queue = ( sudo ? mSudoXferRequestQueue : mXferRequestQueue );
+
+	// Urgent requests (interrupted transfers being resumed) go to the front of their class, in their original order.
+	bool wake = urgent;
+	if ( urgent ) {
+		queueLock.lock();
+		for ( int i = requests.length() - 1; i >= 0; i-- ) {
+			queue.requeue( requests[ i ] );
+		}
+		queueLock.unlock();
 	} else {
-		mXferRequestQueueMutex.lock();
-		mXferRequestQueue.append( request );
-		mXferRequestQueueMutex.unlock();
+		foreach ( XferRequest *request, requests ) {
+			wake |= queue.post( request );
+		}
 	}
 
-	// Nudge all sessions - if their threads are asleep they need to get this message
-	emit wakeAllSessions();
+	if ( wake ) {
+		emit wakeAllSessions();
+	}
 
-	checkChannelCount();
+	// Usually called from a session thread; channel bookkeeping belongs to the main thread.
+	QMetaObject::invokeMethod( this, "checkChannelCount", Qt::QueuedConnection );
 }
 
 XferRequest *SshHost::getNextXferRequest( bool sudo ) {
@@ -454,15 +841,11 @@ XferRequest *SshHost::getNextXferRequest( bool sudo ) {
 
 	if ( sudo ) {
 		mSudoXferRequestQueueMutex.lock();
-		if ( mSudoXferRequestQueue.length() ) {
-			request = mSudoXferRequestQueue.takeFirst();
-		}
+		request = mSudoXferRequestQueue.dequeue();
 		mSudoXferRequestQueueMutex.unlock();
 	} else {
 		mXferRequestQueueMutex.lock();
-		if ( mXferRequestQueue.length() ) {
-			request = mXferRequestQueue.takeFirst();
-		}
+		request = mXferRequestQueue.dequeue();
 		mXferRequestQueueMutex.unlock();
 	}
 
@@ -544,6 +927,10 @@ void SshHost::setOverallStatus( Status newStatus, const QString &connectionStrin
 		mConnectionString = connectionString;
 		mOverallStatus = newStatus;
 
+		if ( newStatus == Connected ) {
+			mLastConnected = QDateTime::currentDateTime();
+		}
+
 		emit overallStatusChanged();
 	}
 }
@@ -554,7 +941,7 @@ void SshHost::invalidateOverallStatus() {
 }
 
 void SshHost::sessionEnded( SshSession *session ) {
-	// By the time, we get in here, the session's thread should be terminated and the connection closed.
+	// By the time, we get in here, the session should be closed and parked back on the main thread.
 	// Remove the session, and all its channels from my records.
 	mSessions.removeAll( session );
 	foreach ( SshChannel *channel, session->getChannels() ) {
@@ -580,13 +967,10 @@ void SshHost::sessionEnded( SshSession *session ) {
 }
 
 void SshHost::failAllHomelessChannels() {
-	mHomelessChannelsMutex.lock();
-	foreach ( SshChannel *channel, mHomelessChannels ) {
+	foreach ( SshChannel *channel, mHomelessChannels.takeAll() ) {
 		mChannels.removeAll( channel );
 		delete channel;
 	}
-	mHomelessChannels.clear();
-	mHomelessChannelsMutex.unlock();
 }
 
 void SshHost::failAllRequests( const QString &error, int flags ) {
@@ -594,41 +978,59 @@ void SshHost::failAllRequests( const QString &error, int flags ) {
 	failServerRequests( error, flags, mSudoServerRequestQueueMutex, mSudoServerRequestQueue, NULL );
 	failXferRequests( error, flags, mXferRequestQueueMutex, mXferRequestQueue );
 	failXferRequests( error, flags, mSudoXferRequestQueueMutex, mSudoXferRequestQueue );
+	failSftpRequests( error, flags );
 }
 
 void SshHost::failServerRequests( const QString &error,
                                   int flags,
                                   QMutex &listLock,
-                                  QList< ServerRequest * > &requestList,
+                                  RequestQueue< ServerRequest, ServerFile * > &queue,
                                   ServerChannel *channel ) {
+	// With a channel, only the requests bound to its buffers; everything else can still go to another channel.
 	listLock.lock();
-	QList< ServerRequest * > listCopy = requestList;
-	requestList.clear();
+	QList< ServerRequest * > failed = ( channel ? queue.takeRoutes( channel->getFileBuffers() ) : queue.takeAll() );
 	listLock.unlock();
 
-	foreach ( ServerRequest *request, listCopy ) {
-		ServerFile *relatedFile = request->getFile();
-		if ( channel == NULL || channel->handlesFileBuffer( relatedFile ) ) {
-			request->failRequest( error, flags );
-			delete request;
-		}
+	foreach ( ServerRequest *request, failed ) {
+		request->failRequest( error, flags );
+		delete request;
 	}
 }
 
 void SshHost::failXferRequests( const QString &error,
                                 int flags,
                                 QMutex &listLock,
-                                QList< XferRequest * > &requestList ) {
+                                RequestQueue< XferRequest > &queue ) {
 	listLock.lock();
-	for ( int i = 0; i < requestList.length(); i++ ) {
-		XferRequest *request = requestList[ i ];
-		requestList.removeAt( i );
-		request->handleFailure( error, flags );
-		delete request;
+	QList< XferRequest * > listCopy = queue.takeAll();
+
+	// Transfers lost to a dropped connection stay queued for the reconnect, while they have retries left.
+	foreach ( XferRequest *request, listCopy ) {
+		if ( ( flags & ServerRequest::ConnectionError ) && request->prepareRetry() ) {
+			queue.enqueue( request );
+		} else {
+			request->handleFailure( error, flags );
+			request->release();
+		}
 	}
 	listLock.unlock();
 }
 
+void SshHost::failSftpRequests( const QString &error, int flags ) {
+	mSftpRequestQueueMutex.lock();
+	QList< SFTPRequest * > listCopy = mSftpRequestQueue.takeAll();
+
+	foreach ( SFTPRequest *request, listCopy ) {
+		if ( ( flags & ServerRequest::ConnectionError ) && request->prepareRetry() ) {
+			mSftpRequestQueue.enqueue( request );
+		} else {
+			request->triggerFailure( error, flags );
+			delete request;
+		}
+	}
+	mSftpRequestQueueMutex.unlock();
+}
+
 QByteArray SshHost::getHostFingerprint() {
 	return sKnownHostFingerprints.value( mHostname );
 }
@@ -2,37 +2,46 @@
 #define SSHHOST_H
 
 #include <QByteArray>
+#include <QDateTime>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QList>
 #include <QMutex>
 #include <QObject>
 #include <QPointer>
 #include <QString>
 #include <QStringList>
+#include <QTimer>
 #include <QVariant>
 
+#include "channelpool.h"
+#include "file/listingcache.h"
 #include "file/location.h"
 #include "hostlog.h"
 #include "QsLog.h"
+#include "requestqueue.h"
 #include "sshchannel.h"
 #include "sshsession.h"
 #include "sshsettings.h"
+#include "tools/mpscqueue.h"
 
 // Configuration
 
-// Guess at the max number of channels per connection
+// Guess at the max number of channels per connection. How many of those each kind of channel gets is up to the
+// host's ChannelPool.
 #define CHANNEL_LIMIT_GUESS 10
 
-// When server-channel:server-queue-length ratio is off by at least this multiplier, think about opening additional
-// server channels
-#define SERVER_CHANNEL_QUEUE_MULTIPLIER 3
+// A kind of channel that fails to open this many times running gives up, failing whatever is queued for it. Until
+// then, each retry waits twice as long as the last, starting from CHANNEL_RETRY_BASE_MSEC.
+#define CHANNEL_RETRY_LIMIT 5
+#define CHANNEL_RETRY_BASE_MSEC 500
 
-// Maximum number of server channels per host
-#define MAX_SERVER_CHANNELS 3
-#define XFER_CHANNEL_QUEUE_MULTIPLIER 2
-#define MAX_XFER_CHANNELS 7
-#define MAX_SFTP_CHANNELS 5
-#define SFTP_CHANNEL_QUEUE_MULTIPLIER 2
+// At startup, connect ahead of time to hosts used within this many days; at most this many of them.
+#define PREWARM_RECENT_DAYS 7
+#define PREWARM_MAX_HOSTS 3
+
+// Directory listings longer than this arrive in parts of this many entries.
+#define LISTING_BATCH_SIZE 1000
 
 // Host-specific tracing macros
 #define SSHLOG_TRACE( h ) _SSHLOG_IF( h, QsLogging::TraceLevel )
@@ -69,6 +78,10 @@ class SshHost : public QObject {
 		void connect();
 		void disconnect();
 
+		static void prewarmRecentHosts();       // Called once at startup.
+		bool prewarm();         // Opens a channel ahead of time, if it can be done without bothering the
+		                        // user. Returns true if it did.
+
 		inline Status getOverallStatus() const {
 			return mOverallStatus;
 		}
@@ -151,6 +164,7 @@ class SshHost : public QObject {
 		//
 
 		void showStatus();
+		QVariantMap getQueueMetrics();  // Depth and wait times for each request queue, keyed by queue name.
 
 		inline void lockNewSessions() {
 			mNewSessionMutex.lock();
@@ -164,12 +178,31 @@ class SshHost : public QObject {
 		                                                         // wait before checking server (first check
 		                                                         // only)
 		void firstServerCheckComplete();
+		inline bool isServerScriptVerified() const {
+			return mServerScriptChecked;
+		}
 
 		ServerRequest *getNextServerRequest( bool sudo, const QMap< ServerFile *, int > &registeredBuffers );
+
+		// Buffers held by the shared server daemon. Each is served by one shared channel at a time, so its requests
+		// reach the daemon in order; when that channel goes, the next shared channel to ask takes the buffer over.
+		// Safe to call from session threads.
+		ServerRequest *getNextSharedServerRequest( ServerChannel *channel );
+		void registerSharedBuffer( ServerFile *file, int bufferId, ServerChannel *channel );
+		void releaseSharedBuffers( ServerChannel *channel );
+		void forgetSharedBuffer( ServerFile *file );
+		bool hasSharedBuffer( ServerFile *file );
+		int getSharedBufferId( ServerFile *file );
 		XferRequest *getNextXferRequest( bool sudo );
+		void queueXferRequests( const QList< XferRequest * > &requests, bool urgent );       // Safe to call
+		                                                                                     // from session
+		                                                                                     // threads.
 		SFTPRequest *getNextSftpRequest();
+		void requeueSftpRequest( SFTPRequest *request );        // Puts an interrupted request back at the
+		                                                        // front of the queue. Safe to call from
+		                                                        // session threads.
 
-		SshChannel *takeNextHomelessChannel();
+		QList< SshChannel * > takeHomelessChannels();  // Safe to call from session threads.
 
 		void handleUnsolicitedServerMessage( const QVariantMap &message );
 
@@ -189,6 +222,18 @@ class SshHost : public QObject {
 			return mChannelLimitGuess;
 		}
 
+		inline const QDateTime &getLastConnected() const {
+			return mLastConnected;
+		}
+
+		inline ChannelPool &getChannelPool() {
+			return mChannelPool;
+		}
+
+		inline ListingCache &getListingCache() {
+			return mListingCache;
+		}
+
 		const QByteArray &getHomeDirectory();   // Will make a guess if no home directory specified.
 
 		inline void setCachedIpAddress( unsigned long ipAddress ) {
@@ -203,6 +248,10 @@ class SshHost : public QObject {
 			mChannelLimitGuess = guess;
 		}
 
+		inline void setLastConnected( const QDateTime &lastConnected ) {
+			mLastConnected = lastConnected;
+		}
+
 		inline void setHomeDirectory( const QByteArray &homeDir ) {
 			mHomeDirectory = homeDir;
 		}
@@ -336,28 +385,41 @@ class SshHost : public QObject {
 		                        // for them.
 		void overallStatusInvalidated(); // see: invalidateOverallStatus
 		void overallStatusChanged();
+		void sharedServerLost();        // The last channel to the shared daemon closed; its files must reopen.
+		void remotePathsChanged( QStringList paths );   // Watched files or folders changed on the server.
 		void newLogLine( QString line );
 
+	protected slots:
+		void checkChannelCount();
+		void remoteChanged( const QVariantMap &message );
+
 	protected:
 		void checkHeadroom();
-		void checkChannelCount();
+		void adaptChannelPool();
 		SshSession *openSession();
 		void enqueueXferRequest( XferRequest *request );
 		void setOverallStatus( Status newStatus, const QString &connectionString );
 
 		void registerChannel( SshChannel *channel );
 		void removeChannel( SshChannel *channel );
+		void recordChannelClosed( SshChannel *channel );
+		bool isChannelRetryDue( ChannelPool::Kind kind );
 		void assignSession( SshChannel *channel );
 		int countChannels( SshChannel::Type type );
 
 		void failServerRequests( const QString &error,
 		                         int flags,
 		                         QMutex &listLock,
-		                         QList< ServerRequest * > &requestList,
+		                         RequestQueue< ServerRequest, ServerFile * > &queue,
 		                         ServerChannel *channel );
-		void failXferRequests( const QString &error, int flags, QMutex &listLock, QList< XferRequest * > &requestList );
+		void failXferRequests( const QString &error,
+		                       int flags,
+		                       QMutex &listLock,
+		                       RequestQueue< XferRequest > &queue );
+		void failSftpRequests( const QString &error, int flags );
 		void failAllRequests( const QString &error, int flags );
 		void failAllHomelessChannels();
+		void loseSharedServer();
 
 		void appendToHostLog( const QString &line );
 
@@ -387,8 +449,7 @@ class SshHost : public QObject {
 		QList< SshSession * > mSessions;
 		QList< SshChannel * > mChannels;
 
-		QMutex mHomelessChannelsMutex;
-		QList< SshChannel * > mHomelessChannels;
+		MpscQueue< SshChannel * > mHomelessChannels;
 
 		QMutex mServerRequestQueueMutex;
 		QMutex mSudoServerRequestQueueMutex;
@@ -396,11 +457,17 @@ class SshHost : public QObject {
 		QMutex mSudoXferRequestQueueMutex;
 		QMutex mSftpRequestQueueMutex;
 
-		QList< ServerRequest * > mServerRequestQueue;
-		QList< ServerRequest * > mSudoServerRequestQueue;
-		QList< XferRequest * > mXferRequestQueue;
-		QList< XferRequest * > mSudoXferRequestQueue;
-		QList< SFTPRequest * > mSftpRequestQueue;
+		// Requests are posted without locking; the mutexes only serialize the session threads taking them. Server
+		// requests for an open file are routed to the channel holding its buffer.
+		RequestQueue< ServerRequest, ServerFile * > mServerRequestQueue;
+		RequestQueue< ServerRequest, ServerFile * > mSudoServerRequestQueue;
+		RequestQueue< XferRequest > mXferRequestQueue;
+		RequestQueue< XferRequest > mSudoXferRequestQueue;
+		RequestQueue< SFTPRequest > mSftpRequestQueue;
+
+		QMutex mSharedBuffersLock;
+		QMap< ServerFile *, int > mSharedBuffers;
+		QMap< ServerFile *, ServerChannel * > mSharedBufferChannels;   // NULL while waiting to be taken over.
 
 		// Stuff for ensuring no two channels check the server script simultaneously on the first run
 		QMutex mFirstServerScriptCheckerLock;
@@ -411,7 +478,13 @@ class SshHost : public QObject {
 		unsigned long mCachedIpAddress; // TODO: Extend to support IPv6
 		SshSession::AuthMethod mCachedAuthMethod;
 		int mChannelLimitGuess;
+		ChannelPool mChannelPool;
+		int mChannelFailures[ ChannelPool::KindCount ];        // Channels that closed without opening, in a row.
+		QElapsedTimer mChannelFailedAt[ ChannelPool::KindCount ];
+		QTimer mChannelRetryTimer;
+		ListingCache mListingCache;
 		QByteArray mHomeDirectory;
+		QDateTime mLastConnected;
 
 		// SSH settings from the SSH config file
 		SshSettings mSettings;
@@ -0,0 +1,71 @@
+#include <QThread>
+
+#include "options/options.h"
+#include "QsLog.h"
+#include "sshreactor.h"
+
+QList< SshReactor::Reactor > SshReactor::sReactors;
+QMutex SshReactor::sLock;
+bool SshReactor::sShutdown = false;
+
+int SshReactor::getThreadLimit() {
+	int defaultLimit = qBound( 1, QThread::idealThreadCount(), SSH_REACTOR_MAX_THREADS );
+	return qMax( 1, Options::get( "SshReactorThreads", defaultLimit ).toInt() );
+}
+
+QThread *SshReactor::acquireThread() {
+	QMutexLocker locker( &sLock );
+	if ( sShutdown ) {
+		return NULL;
+	}
+
+	int leastLoaded = -1;
+	for ( int i = 0; i < sReactors.length(); i++ ) {
+		if ( leastLoaded < 0 || sReactors[ i ].sessions < sReactors[ leastLoaded ].sessions ) {
+			leastLoaded = i;
+		}
+	}
+
+	// Only start another thread when every existing one is already carrying sessions.
+	if ( leastLoaded < 0 || ( sReactors[ leastLoaded ].sessions > 0 && sReactors.length() < getThreadLimit() ) ) {
+		Reactor reactor;
+		reactor.thread = new QThread();
+		reactor.thread->setObjectName( QString( "SshReactor %1" ).arg( sReactors.length() ) );
+		reactor.thread->start();
+		reactor.sessions = 0;
+
+		sReactors.append( reactor );
+		leastLoaded = sReactors.length() - 1;
+	}
+
+	sReactors[ leastLoaded ].sessions++;
+	return sReactors[ leastLoaded ].thread;
+}
+
+void SshReactor::releaseThread( QThread *thread ) {
+	QMutexLocker locker( &sLock );
+	for ( int i = 0; i < sReactors.length(); i++ ) {
+		if ( sReactors[ i ].thread == thread ) {
+			sReactors[ i ].sessions--;
+			break;
+		}
+	}
+}
+
+void SshReactor::shutdown() {
+	sLock.lock();
+	sShutdown = true;
+	QList< Reactor > reactors = sReactors;
+	sReactors.clear();
+	sLock.unlock();
+
+	foreach ( const Reactor &reactor, reactors ) {
+		reactor.thread->quit();
+		if ( ! reactor.thread->wait( 2000 ) ) {
+			QLOG_WARN() << "SshReactor thread timed out during shutdown";
+			reactor.thread->terminate();
+			reactor.thread->wait( 2000 );
+		}
+		delete reactor.thread;
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef SSHREACTOR_H
+#define SSHREACTOR_H
+
+#include <QList>
+#include <QMutex>
+
+class QThread;
+
+//
+// A small pool of threads shared by every connected SshSession. Each runs a Qt event loop, multiplexing the socket
+// notifiers of all the sessions living on it. A session stays on one reactor thread for its whole life, so its
+// libssh2 calls are always serialized without any extra locking.
+//
+
+#define SSH_REACTOR_MAX_THREADS 4
+
+class SshReactor {
+	public:
+		static QThread *acquireThread();        // Returns the least loaded thread, starting a new one if all are busy
+		                                        // and there is room. Returns NULL once shut down.
+		static void releaseThread( QThread *thread );
+
+		static void shutdown();
+
+	private:
+		struct Reactor {
+			QThread *thread;
+			int sessions;
+		};
+
+		static int getThreadLimit();
+
+		static QList< Reactor > sReactors;
+		static QMutex sLock;
+		static bool sShutdown;
+};
+
+#endif  // SSHREACTOR_H
@@ -1,5 +1,7 @@
+#include <QCoreApplication>
 #include <QDebug>
 #include <QSocketNotifier>
+#include <QTimer>
 
 #include <libssh2.h>
 #include <openssl/crypto.h>
@@ -15,6 +17,7 @@
 #include "sshchannel.h"
 #include "sshhost.h"
 #include "sshsession.h"
+#include "sshreactor.h"
 #include "sshsettings.h"
 
 #ifdef Q_OS_WIN
@@ -40,14 +43,17 @@ SshSession::SshSession( SshHost *host ) :
 	mHost( host ),
 	mStatus( Disconnected ),
 	mErrorDetails(),
-	mThreadEndedCalled( false ),
+	mClosed( false ),
 	mKeepaliveTime( mHost->getKeepalive() * 1000 ),
 	mKeepaliveSent( false ),
 	mLastActivityTimer(),
 	mThread( NULL ),
+	mReactorThread( NULL ),
+	mHeartbeatTimer( NULL ),
 	mSocket( 0 ),
 	mHandle( NULL ),
 	mSocketReadNotifier( NULL ),
+	mSocketWriteNotifier( NULL ),
 	mSocketExceptionNotifier( NULL ),
 	mChannels(),
 	mChannelsLock(),
@@ -61,42 +67,37 @@ SshSession::SshSession( SshHost *host ) :
 
 	initializeLibrary();
 
+	// Connecting blocks (DNS, handshake, password dialogs), so it gets a thread of its own. Once connected, the
+	// session moves to a shared reactor thread; see threadMain.
 	mThread = new SshSessionThread( this );
-	QObject::connect( this, SIGNAL( killThread() ), mThread, SLOT( quit() ), Qt::QueuedConnection );
-	moveToThread( mThread );        // Give this QObject to the new thread; then all signals received by this object
-	                                // are run in the thread.
-
-	QObject::connect( mThread, SIGNAL( finished() ), this, SLOT( threadEnded() ) );
+	moveToThread( mThread );
 }
 
 SshSession::~SshSession() {
-	// Send a signal to tell the thread to die...
-	emit killThread();
-
-	// Wait for it to be dead, with a timeout.
+	// A connect can block indefinitely on a dialog or a dead host; give it a moment, then pull the plug.
 	if ( ! mThread->wait( 2000 ) ) {
 		QLOG_WARN() << "SshSession timed out during shutdown";
+		mThread->terminate();
+		if ( ! mThread->wait( 2000 ) ) {
+			QLOG_WARN() << "SshSession was unable to terminate during shutdown";
+		}
 	}
 
-	mThread->terminate();
-	if ( ! mThread->wait( 2000 ) ) {
-		QLOG_WARN() << "SshSession was unable to terminate during shutdown";
+	if ( ! mClosed ) {
+		if ( mReactorThread && thread() == mReactorThread && mReactorThread->isRunning() ) {
+			// The notifiers belong to the reactor thread; they have to be torn down there.
+			QMetaObject::invokeMethod( this, "close", Qt::BlockingQueuedConnection );
+		} else {
+			if ( mReactorThread ) {
+				SshReactor::releaseThread( mReactorThread );
+			}
+			if ( mSocket != 0 ) {
+				closesocket( mSocket );
+			}
+		}
 	}
 
 	delete mThread;
-	delete mSocketReadNotifier;
-	delete mSocketExceptionNotifier;
-}
-
-void SshSession::threadEnded() {
-	// Ensure this method is only called once. OSX has a habit of calling it twice.
-	if ( mThreadEndedCalled ) {
-		return;
-	}
-	mThreadEndedCalled = true;
-
-	// Tell the SshHost that I am no longer available. It will manage deletion of my remaining sessions.
-	emit sessionClosed( this );
 }
 
 void SshSession::start() {
@@ -105,12 +106,6 @@ void SshSession::start() {
 
 void SshSession::threadMain() {
 	bool holdingLock = false;
-	QTimer heartbeatTimer;
-
-	heartbeatTimer.setInterval( 1000 );
-	heartbeatTimer.setSingleShot( false );
-	QObject::connect( &heartbeatTimer, SIGNAL( timeout() ), this, SLOT( heartbeat() ) );
-	heartbeatTimer.start();
 
 	try {
 		// In the interests of UI sanity, only let 1 session per host connect at any given time. That way,
@@ -127,42 +122,98 @@ void SshSession::threadMain() {
 		// Kick libssh2 over to non-blocking mode. QSocketNotifiers require non-blocking sockets.
 		libssh2_session_set_blocking( mHandle, false );
 
-		// Hook my socket to Qt's event loop, allowing me to receive signals on network events
-		mSocketReadNotifier = new QSocketNotifier( mSocket, QSocketNotifier::Read );
-		mSocketExceptionNotifier = new QSocketNotifier( mSocket, QSocketNotifier::Exception );
-
-		QObject::connect( mSocketReadNotifier, SIGNAL( activated( int ) ), this, SLOT( handleReadActivity() ) );
-		QObject::connect( mSocketExceptionNotifier,
-		                  SIGNAL( activated( int ) ),
-		                  this,
-		                  SLOT( updateAllChannels() ) );
-		QObject::connect( mHost,
-		                  SIGNAL( wakeAllSessions() ),
-		                  this,
-		                  SLOT( updateAllChannels() ),
-		                  Qt::QueuedConnection );
-
-		mSocketReadNotifier->setEnabled( true );
-		mSocketExceptionNotifier->setEnabled( true );
-
-		// Queue up at least one channel update.
-		queueChannelUpdate();
-
-		// Enter Qt's event loop for this thread.
-		mThread->exec();
+		// Hand myself over to a reactor thread; everything from here on happens in its event loop, and this thread
+		// ends.
+		mReactorThread = SshReactor::acquireThread();
+		if ( ! mReactorThread ) {
+			throw( QObject::tr( "Shutting down" ) );
+		}
+
+		moveToThread( mReactorThread );
+		QMetaObject::invokeMethod( this, "attachToReactor", Qt::QueuedConnection );
+		return;
 	} catch ( QString &error ) {
-		SSHLOG_ERROR( mHost ) << "Unexpected throw in main session loop: " << error;
+		SSHLOG_ERROR( mHost ) << "Unexpected throw while connecting: " << error;
 		setErrorStatus( "Thrown error: " + error );
 		if ( holdingLock ) {
 			mHost->unlockNewSessions();
 		}
 	}
 
+	close();
+}
+
+void SshSession::attachToReactor() {
+	if ( mClosed ) {
+		return;
+	}
+
+	// Hook my socket to the reactor's event loop, allowing me to receive signals on network events
+	mSocketReadNotifier = new QSocketNotifier( mSocket, QSocketNotifier::Read );
+	mSocketWriteNotifier = new QSocketNotifier( mSocket, QSocketNotifier::Write );
+	mSocketExceptionNotifier = new QSocketNotifier( mSocket, QSocketNotifier::Exception );
+
+	QObject::connect( mSocketReadNotifier, SIGNAL( activated( int ) ), this, SLOT( handleReadActivity() ) );
+	QObject::connect( mSocketWriteNotifier, SIGNAL( activated( int ) ), this, SLOT( handleWriteActivity() ) );
+	QObject::connect( mSocketExceptionNotifier,
+	                  SIGNAL( activated( int ) ),
+	                  this,
+	                  SLOT( updateAllChannels() ) );
+	QObject::connect( mHost,
+	                  SIGNAL( wakeAllSessions() ),
+	                  this,
+	                  SLOT( updateAllChannels() ),
+	                  Qt::QueuedConnection );
+
+	mSocketReadNotifier->setEnabled( true );
+	mSocketWriteNotifier->setEnabled( false );
+	mSocketExceptionNotifier->setEnabled( true );
+
+	mHeartbeatTimer = new QTimer();
+	mHeartbeatTimer->setInterval( 1000 );
+	mHeartbeatTimer->setSingleShot( false );
+	QObject::connect( mHeartbeatTimer, SIGNAL( timeout() ), this, SLOT( heartbeat() ) );
+	mHeartbeatTimer->start();
+
+	// Queue up at least one channel update.
+	queueChannelUpdate();
+}
+
+void SshSession::close() {
+	// Errors can queue more than one close.
+	if ( mClosed ) {
+		return;
+	}
+	mClosed = true;
+
+	QObject::disconnect( mHost, SIGNAL( wakeAllSessions() ), this, SLOT( updateAllChannels() ) );
+
+	delete mSocketReadNotifier;
+	delete mSocketWriteNotifier;
+	delete mSocketExceptionNotifier;
+	delete mHeartbeatTimer;
+	mSocketReadNotifier = NULL;
+	mSocketWriteNotifier = NULL;
+	mSocketExceptionNotifier = NULL;
+	mHeartbeatTimer = NULL;
+
 	// Close my socket (if I have one)
 	if ( mSocket != 0 ) {
 		closesocket( mSocket );
 		mSocket = 0;
 	}
+
+	if ( mReactorThread ) {
+		SshReactor::releaseThread( mReactorThread );
+		mReactorThread = NULL;
+	}
+
+	// Park on the main thread, where SshHost deletes me. Anything still queued for me is then delivered (and
+	// ignored) there, rather than racing the deletion on a reactor thread.
+	moveToThread( QCoreApplication::instance()->thread() );
+
+	// Tell the SshHost that I am no longer available. It will manage deletion of my remaining sessions.
+	emit sessionClosed( this );
 }
 
 void SshSession::handleReadActivity() {
@@ -170,6 +221,13 @@ void SshSession::handleReadActivity() {
 	updateAllChannels();
 }
 
+void SshSession::handleWriteActivity() {
+	// The socket is writable again. Write notifiers fire for as long as that's true, so disarm until the next
+	// time a channel blocks on a write.
+	mSocketWriteNotifier->setEnabled( false );
+	updateAllChannels();
+}
+
 bool SshSession::openSocket( unsigned long ipAddress ) {
 	resetActivityCounter();
 
@@ -641,7 +699,13 @@ void SshSession::queueChannelUpdate() {
 }
 
 void SshSession::updateAllChannels() {
+	// Queued wake-ups can still arrive after a close.
+	if ( mClosed ) {
+		return;
+	}
+
 	bool goAgain = true;
+	bool waitForWrite = false;
 	while ( goAgain ) {
 		goAgain = false;
 
@@ -659,13 +723,19 @@ void SshSession::updateAllChannels() {
 			} catch ( QString &err ) {
 				QLOG_ERROR() << "Critical channel failure:" << err;
 				setErrorStatus( QObject::tr( "Critical channel failure: " ) + err );
-				mThread->quit();                // Abort QThread::exec, fall back to threadMain for
-				                                // cleanup.
+				QMetaObject::invokeMethod( this, "close", Qt::QueuedConnection );       // Once this update is
+				                                                                        // over.
 				continue;
 			}
 
+			// A channel with more to do because its last write hit EAGAIN can't make progress until the socket
+			// drains; wait for the write notifier rather than spinning on it.
 			if ( doMore ) {
-				goAgain = true;
+				if ( libssh2_session_block_directions( mHandle ) & LIBSSH2_SESSION_BLOCK_OUTBOUND ) {
+					waitForWrite = true;
+				} else {
+					goAgain = true;
+				}
 			}
 
 			// Deal with any of the possible failure states
@@ -684,8 +754,7 @@ void SshSession::updateAllChannels() {
 					                // is dead.
 					setErrorStatus( QObject::tr( "Critical channel failure: " ) +
 					                channel->getErrorDetails() );
-					mThread->quit();        // Abort QThread::exec, fall back to threadMain for
-					                        // cleanup.
+					QMetaObject::invokeMethod( this, "close", Qt::QueuedConnection );
 					break;
 
 				case SshChannel::Disconnected: // Neatly disconnected. Just take it out of the roster,
@@ -703,11 +772,16 @@ void SshSession::updateAllChannels() {
 
 		// If this update cycle went by without incident and I have headroom, see if there are homeless channels
 		// to adopt.
-		SshChannel *homelessChannel;
-		while ( ! isAtChannelLimit() && ( homelessChannel = mHost->takeNextHomelessChannel() ) != NULL ) {
-			adoptChannel( homelessChannel );
+		if ( ! isAtChannelLimit() ) {
+			foreach ( SshChannel *homelessChannel, mHost->takeHomelessChannels() ) {
+				adoptChannel( homelessChannel );
+			}
 		}
 	}
+
+	if ( waitForWrite && mSocketWriteNotifier ) {
+		mSocketWriteNotifier->setEnabled( true );
+	}
 }
 
 void SshSession::setErrorStatus( const QString &error ) {
@@ -768,14 +842,14 @@ QString SshSession::getConnectionDescription() {
 void SshSession::heartbeat() {
 	if ( mLastActivityTimer.elapsed() > TIMEOUT_MSEC ) {
 		setErrorStatus( QObject::tr( "Session timeout" ) );
-		mThread->quit();
+		QMetaObject::invokeMethod( this, "close", Qt::QueuedConnection );
 	} else if ( mLastActivityTimer.elapsed() > mKeepaliveTime ) {
 		SSHLOG_TRACE( mHost ) << "Sending keepalive heartbeat.";
 		mKeepaliveSent = true;
 		int dontCare;
 		if ( libssh2_keepalive_send( mHandle, &dontCare ) != 0 ) {
 			setErrorStatus( QObject::tr( "Connection ironically died during keepalive" ) );
-			mThread->quit();
+			QMetaObject::invokeMethod( this, "close", Qt::QueuedConnection );
 		}
 	}
 }
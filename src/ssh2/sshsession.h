@@ -25,6 +25,7 @@ class SshHost;
 class SshChannel;
 class SshSessionThread; // Defined at the bottom of this file.
 class QSocketNotifier;
+class QTimer;
 
 class SshSession : public QObject {
 	friend class SshSessionThread;
@@ -67,14 +68,13 @@ class SshSession : public QObject {
 		void channelNeatlyClosed( SshChannel *channel );
 		void sessionClosed( SshSession *session );
 
-// Used interally:
-		void killThread();
-
 	protected slots:
+		void attachToReactor();
 		void handleReadActivity();
+		void handleWriteActivity();
 		void updateAllChannels();
-		void threadEnded();
 		void heartbeat();
+		void close();
 
 	protected:
 		void adoptChannel( SshChannel *channel );
@@ -115,16 +115,19 @@ class SshSession : public QObject {
 		Status mStatus;
 		QString mErrorDetails;
 
-		bool mThreadEndedCalled;
+		bool mClosed;
 
 		int mKeepaliveTime;
 		bool mKeepaliveSent;
 		QTime mLastActivityTimer;
 
-		SshSessionThread *mThread;
+		SshSessionThread *mThread;      // Only used while connecting, which blocks.
+		QThread *mReactorThread;        // Shared with other sessions once connected.
+		QTimer *mHeartbeatTimer;
 		int mSocket;
 		LIBSSH2_SESSION *mHandle;
 		QSocketNotifier *mSocketReadNotifier;
+		QSocketNotifier *mSocketWriteNotifier;  // Only armed while a channel is waiting for the socket to drain.
 		QSocketNotifier *mSocketExceptionNotifier;
 
 		static bool sLibsInitialized;
@@ -147,10 +150,6 @@ class SshSessionThread : public QThread {
 			mSession->threadMain();
 		}
 
-		int exec() {
-			return QThread::exec();
-		}
-
 	private:
 		SshSession *mSession;
 };
@@ -1,8 +1,8 @@
 #include <libssh2.h>
-#include <QCryptographicHash>
 #include <QDebug>
-#include "main/tools.h"
+#include "serverrequest.h"
 #include "sshhost.h"
+#include "tools/bincodec.h"
 #include "xferchannel.h"
 #include "xferrequest.h"
 
@@ -10,14 +10,55 @@ XferChannel::XferChannel( SshHost *host, bool sudo ) :
 	ServerChannel( host, sudo ),
 	mInternalStatus( _WaitingForRequests ),
 	mCurrentRequest( NULL ),
-	mBinaryReadBuffer(),
-	mLeftoverEscape( false ) {}
+	mDrainRemaining( 0 ),
+	mLeftoverEscape( false ),
+	mUploadWindow(),
+	mUploadWindowLength( 0 ),
+	mUploadWindowSent( 0 ),
+	mUploadCursor( 0 ),
+	mHeaderTimer() {}
+
+XferChannel::~XferChannel() {
+	abandonCurrentRequest( tr( "Channel closed." ) );
+}
+
+void XferChannel::criticalError( const QString &error ) {
+	abandonCurrentRequest( error );
+	ServerChannel::criticalError( error );
+}
+
+void XferChannel::abandonCurrentRequest( const QString &error ) {
+	if ( mCurrentRequest == NULL ) {
+		return;
+	}
+
+	// An interrupted download keeps whatever made it into its buffer; uploads start over.
+	if ( mCurrentRequest->prepareRetry() ) {
+		SSHLOG_INFO( mHost ) << "Transfer of" << mCurrentRequest->getFilename() << "interrupted; will resume";
+		mHost->queueXferRequests( QList< XferRequest * >() << mCurrentRequest, true );
+	} else {
+		mCurrentRequest->handleFailure( error, ServerRequest::ConnectionError );
+		mCurrentRequest->release();
+	}
+
+	mCurrentRequest = NULL;
+	mInternalStatus = _WaitingForRequests;
+}
+
+void XferChannel::finishCurrentRequest() {
+	mCurrentRequest->release();
+	mCurrentRequest = NULL;
+}
 
 bool XferChannel::mainUpdate() {
 	if ( mInternalStatus == _WaitingForRequests ) {
 		mCurrentRequest = mHost->getNextXferRequest( mSudo );
 		if ( mCurrentRequest == NULL ) {
 			return false;
+		} else if ( mCurrentRequest->isAbandoned() ) {
+			// Another range of the same download already failed; don't bother fetching this one.
+			finishCurrentRequest();
+			return true;
 		} else {
 			mInternalStatus = _SendingRequestHeader;
 			return true;
@@ -25,16 +66,12 @@ bool XferChannel::mainUpdate() {
 	}
 
 	if ( mInternalStatus == _SendingRequestHeader ) {
-		// If uploading, make sure the data to be uploaded is encoded.
-		if ( mCurrentRequest->isUploadRequest() && mCurrentRequest->getEncodedData().isEmpty() ) {
-			mCurrentRequest->setEncodedData( Tools::bin( mCurrentRequest->getData() ) );
-		}
-
 		SendResponse r = sendData( mCurrentRequest->getRequestHeader() );
 		if ( r != SendSucceed ) {
 			return ( r == SendAgain );
 		}
 
+		mHeaderTimer.start();
 		mInternalStatus = ( mCurrentRequest->isUploadRequest() ? _WaitingForReady : _ReadingDownloadHeader );
 	}
 
@@ -47,16 +84,13 @@ bool XferChannel::mainUpdate() {
 			throw( tr( "Invalid response to download header" ) );
 		}
 
+		// Errors reported by the server script belong to the request, not the connection; retrying won't help.
 		if ( r.data.startsWith( "Error: " ) ) {
-			if ( r.data.contains( "File not found" ) ) {
-				mCurrentRequest->handleFailure( QString( mCurrentRequest->getFilename() ) + " - " +
-				                                tr( "File not found" ),
-				                                0 );
-				mInternalStatus = _WaitingForRequests;
-				return true;
-			} else {
-				throw( QString( r.data ) );
-			}
+			QString error = r.data.contains( "File not found" ) ? tr( "File not found" ) : QString( r.data.mid( 7 ) );
+			mCurrentRequest->handleFailure( QString( mCurrentRequest->getFilename() ) + " - " + error, 0 );
+			finishCurrentRequest();
+			mInternalStatus = _WaitingForRequests;
+			return true;
 		}
 
 		if ( r.data.endsWith( '\r' ) ) {
@@ -64,33 +98,56 @@ bool XferChannel::mainUpdate() {
 			r.data.chop( 1 );
 		}
 
+		// Ranged download header: <file size>,<range length>,<range checksum>
 		QList< QByteArray > parts = r.data.split( ',' );
-		mCurrentRequest->setDataSize( parts[ 0 ].toInt() );
-		mCurrentRequest->setChecksum( parts[ 1 ] );
+		if ( parts.length() < 3 ) {
+			throw( tr( "Invalid response to download header" ) );
+		}
+
+		// The first range of a large file splits the rest of the download into ranges for other channels.
+		QList< XferRequest * > chunks;
+		qint64 fileSize = parts[ 0 ].toLongLong();
+		int rangeLength = parts[ 1 ].toInt();
+		QString error;
+		if ( fileSize > XFER_MAX_FILE_SIZE ) {
+			error = tr( "File too large to open" );
+		} else if ( ! mCurrentRequest->handleFileSize( fileSize, &chunks ) ) {
+			error = tr( "File changed during download" );
+		} else if ( ! mCurrentRequest->beginRange( rangeLength, parts[ 2 ] ) ) {
+			error = tr( "Unexpected download range" );
+		}
+		mHost->queueXferRequests( chunks, false );
+
+		// The body still has to be read off the channel, even if there's nowhere to put it.
+		if ( ! error.isEmpty() ) {
+			mCurrentRequest->handleFailure( QString( mCurrentRequest->getFilename() ) + " - " + error, 0 );
+			finishCurrentRequest();
+			mDrainRemaining = rangeLength;
+		}
 
 		mLeftoverEscape = false;
 		mInternalStatus = _DownloadingBody;
 	}
 
 	if ( mInternalStatus == _DownloadingBody ) {
-		ReadReply r = readBinaryData( mCurrentRequest->getDataSize() );
-		if ( r.readAgain ) {
+		if ( ! readBody() ) {
 			return false;
 		}
 
-		// Check the checksum.
-		QCryptographicHash hash( QCryptographicHash::Md5 );
-		hash.addData( r.data );
-		QByteArray checksum = hash.result().toHex().toLower();
-
-		if ( checksum != mCurrentRequest->getChecksum() ) {
-			mCurrentRequest->handleFailure( tr( "Checksum failure: %1 vs %2" ).arg( QString(
-													checksum ) ).arg(
-								QString( mCurrentRequest->getChecksum() ) ),
-			                                0 );
+		if ( mCurrentRequest == NULL ) {
+			// Drained the body of a failed request.
+		} else if ( mCurrentRequest->finishRange() ) {
+			finishCurrentRequest();
+		} else if ( mCurrentRequest->prepareRetry() ) {
+			// Most likely the file changed under a resumed download; start the range over.
+			SSHLOG_WARN( mHost ) << "Checksum failure downloading" << mCurrentRequest->getFilename() << "; retrying";
+			mHost->queueXferRequests( QList< XferRequest * >() << mCurrentRequest, true );
+			mCurrentRequest = NULL;
 		} else {
-			mCurrentRequest->setData( r.data );
-			mCurrentRequest->handleSuccess();
+			mCurrentRequest->handleFailure( QString( mCurrentRequest->getFilename() ) + " - " +
+			                                tr( "Checksum failure" ),
+			                                0 );
+			finishCurrentRequest();
 		}
 
 		mInternalStatus = _WaitingForOk;
@@ -102,23 +159,32 @@ bool XferChannel::mainUpdate() {
 			return true;
 		}
 
+		if ( r.data.startsWith( "Error: " ) ) {
+			mCurrentRequest->handleFailure( QString( mCurrentRequest->getFilename() ) + " - " + r.data.mid( 7 ), 0 );
+			finishCurrentRequest();
+			mInternalStatus = _WaitingForRequests;
+			return true;
+		}
+
 		if ( r.data != "Ready" ) {
 			criticalError( "Failed to upload file" );
+			return false;
 		}
 
+		// Unlike a download header, nothing has to be read from disk before this comes back.
+		mHost->getChannelPool().recordRoundTrip( mHeaderTimer.elapsed() );
+
+		mUploadCursor = 0;
+		mUploadWindowLength = 0;
+		mUploadWindowSent = 0;
 		mInternalStatus = _UploadingBody;
 	}
 
 	if ( mInternalStatus == _UploadingBody ) {
-		QByteArray encoded = mCurrentRequest->getEncodedData();
-
-		SendResponse r = sendData( encoded );
-		if ( r != SendSucceed ) {
-			return ( r == SendAgain );
+		if ( ! sendBody() ) {
+			return true;
 		}
 
-		mCurrentRequest->handleSuccess();
-
 		mInternalStatus = _WaitingForOk;
 	}
 
@@ -133,8 +199,16 @@ bool XferChannel::mainUpdate() {
 			r.data.chop( 1 );
 		}
 
-		if ( r.data != "OK" ) {
+		// Uploads are only reported once the server has checked what it received.
+		if ( mCurrentRequest != NULL && r.data.startsWith( "Error: " ) ) {
+			mCurrentRequest->handleFailure( QString( mCurrentRequest->getFilename() ) + " - " + r.data.mid( 7 ), 0 );
+			finishCurrentRequest();
+		} else if ( r.data != "OK" ) {
 			criticalError( "Did not receive OK at the end of transmission. Got: " + r.data );
+			return false;
+		} else if ( mCurrentRequest != NULL ) {
+			mCurrentRequest->handleSuccess();
+			finishCurrentRequest();
 		}
 
 		mInternalStatus = _WaitingForRequests;
@@ -144,54 +218,100 @@ bool XferChannel::mainUpdate() {
 	return false;
 }
 
-ShellChannel::ReadReply XferChannel::readBinaryData( int size ) {
-	ReadReply reply;
-	reply.readAgain = false;
+bool XferChannel::readBody() {
+	char drainBuffer[ SSH_SHELL_BUFFER_SIZE ];
 
-	if ( size <= 0 ) {
-		return reply;
-	}
+	for ( ;; ) {
+		bool draining = ( mCurrentRequest == NULL );
+		int remaining = ( draining ? mDrainRemaining : mCurrentRequest->getRangeRemaining() );
+		if ( remaining <= 0 ) {
+			return true;
+		}
 
-	while ( mBinaryReadBuffer.length() < size ) {
-		// Flush anything from the read buffer into the binary buffer
-		int transferred = Tools::unbin( mBinaryReadBuffer,
-		                                mReadBuffer,
-		                                size,
-		                                mReadBuffer.length(),
-		                                &mLeftoverEscape );
-		mReadBuffer = mReadBuffer.right( mReadBuffer.size() - transferred );
-
-		if ( mBinaryReadBuffer.length() == size ) {
-			break;
-		}
-
-		// See if there's data waiting to be read, push it into the read buffer (raw)
-		int rc = libssh2_channel_read( mHandle, mScratchBuffer, SSH_SHELL_BUFFER_SIZE );
-		if ( rc > 0 ) {
-			mReadBuffer.append( mScratchBuffer, rc );
-		} else if ( rc == LIBSSH2_ERROR_EAGAIN ||
-		            ( rc == -1 &&
-		              libssh2_session_last_errno( mSession->sessionHandle() ) == LIBSSH2_ERROR_EAGAIN ) ) {
-			reply.readAgain = true;
-			return reply;
+		// Take leftovers from earlier reads first, then decode straight out of the scratch buffer. Only bytes
+		// past the end of the body are kept in the read buffer, for whoever reads next.
+		const char *source;
+		int sourceLength;
+		bool fromReadBuffer = ! mReadBuffer.isEmpty();
+		if ( fromReadBuffer ) {
+			source = mReadBuffer.constData();
+			sourceLength = mReadBuffer.length();
 		} else {
-			criticalError( "Connection closed unexpectedly!" );
+			int rc = libssh2_channel_read( mHandle, mScratchBuffer, SSH_SHELL_BUFFER_SIZE );
+			if ( rc == LIBSSH2_ERROR_EAGAIN ||
+			     ( rc == -1 && libssh2_session_last_errno( mSession->sessionHandle() ) == LIBSSH2_ERROR_EAGAIN ) ) {
+				return false;
+			} else if ( rc <= 0 ) {
+				criticalError( "Connection closed unexpectedly!" );
+				return false;
+			}
+
+			source = mScratchBuffer;
+			sourceLength = rc;
+		}
+
+		// Decoded bytes are hashed in place by the request as they arrive; drained ones are simply dropped.
+		int written;
+		int consumed = BinCodec::decode( draining ? drainBuffer : mCurrentRequest->getRangeWritePointer(),
+		                                 draining ? qMin( remaining, SSH_SHELL_BUFFER_SIZE ) : remaining,
+		                                 source,
+		                                 sourceLength,
+		                                 &written,
+		                                 &mLeftoverEscape );
+
+		if ( fromReadBuffer ) {
+			mReadBuffer.remove( 0, consumed );
+		} else if ( consumed < sourceLength ) {
+			mReadBuffer.append( source + consumed, sourceLength - consumed );
 		}
 
-		int currentLength = mBinaryReadBuffer.length();
-		int percent = ( int ) ( ( ( float ) currentLength / size ) * 100 );
-		mCurrentRequest->handleProgress( percent );
+		if ( draining ) {
+			mDrainRemaining -= written;
+		} else {
+			mCurrentRequest->handleRangeData( written );
+			mHost->getChannelPool().recordTransfer( ChannelPool::Xfer, written );
+		}
 	}
+}
+
+bool XferChannel::sendBody() {
+	const QByteArray &data = mCurrentRequest->getData();
+
+	for ( ;; ) {
+		// Encode the next window once the last one has gone out; the encoded body never exists in full.
+		if ( mUploadWindowSent == mUploadWindowLength ) {
+			if ( mUploadCursor >= data.length() ) {
+				return true;
+			}
 
-	// If it reaches here, enough data has been read.
-	reply.data = mBinaryReadBuffer;
-	mBinaryReadBuffer.clear();
-	return reply;
+			int length = qMin( XFER_UPLOAD_WINDOW, data.length() - mUploadCursor );
+			mUploadWindow.resize( XFER_UPLOAD_WINDOW * 2 );
+			mUploadWindowLength = BinCodec::encode( mUploadWindow.data(), data.constData() + mUploadCursor, length );
+			mUploadWindowSent = 0;
+			mUploadCursor += length;
+			mHost->getChannelPool().recordTransfer( ChannelPool::Xfer, length );
+		}
+
+		int rc = libssh2_channel_write( mHandle,
+		                                mUploadWindow.constData() + mUploadWindowSent,
+		                                mUploadWindowLength - mUploadWindowSent );
+		if ( rc < 0 ) {
+			if ( rc == -1 ) {
+				rc = libssh2_session_last_errno( mSession->sessionHandle() );
+			}
+			if ( rc != LIBSSH2_ERROR_EAGAIN ) {
+				criticalError( tr( "Failed to upload file: %1" ).arg( rc ) );
+			}
+			return false;
+		}
+
+		mUploadWindowSent += rc;
+	}
 }
 
 QByteArray XferChannel::getServerRun( bool sudo ) {
 	if ( sudo ) {
 		mSudoPasswordAttempt = mHost->getSudoPassword();
 	}
-	return sudo ? "sudo -p Sudo-prompt%-ponyedit-% perl .ponyedit/server.pl xfer" : "perl .ponyedit/server.pl xfer";
+	return ( sudo ? "sudo -p Sudo-prompt%-ponyedit-% perl " : "perl " ) + sServerScriptPath + " xfer";
 }
@@ -1,12 +1,17 @@
 #ifndef XFERCHANNEL_H
 #define XFERCHANNEL_H
 
+#include <QElapsedTimer>
 #include "serverchannel.h"
 
+// Uploads are encoded and sent this many (unencoded) bytes at a time.
+#define XFER_UPLOAD_WINDOW ( 64 * 1024 )
+
 class XferRequest;
 class XferChannel : public ServerChannel {
 	public:
 		XferChannel( SshHost *host, bool sudo );
+		~XferChannel();
 
 		virtual Type getType() {
 			return mSudo ? SudoXfer : Xfer;
@@ -16,8 +21,14 @@ class XferChannel : public ServerChannel {
 		virtual QByteArray getServerRun( bool sudo );
 
 		virtual bool mainUpdate();
+		virtual void criticalError( const QString &error );
+
+		// Hands an interrupted request back to the host to be resumed, or fails it once out of retries.
+		void abandonCurrentRequest( const QString &error );
+		void finishCurrentRequest();
 
-		ReadReply readBinaryData( int size );
+		bool readBody();        // Returns true once the whole body has been read.
+		bool sendBody();        // Returns true once the whole body has been sent.
 
 	private:
 		enum InternalStatus { _WaitingForRequests, _SendingRequestHeader, _WaitingForReady,
@@ -25,8 +36,15 @@ class XferChannel : public ServerChannel {
 		InternalStatus mInternalStatus;
 		XferRequest *mCurrentRequest;
 
-		QByteArray mBinaryReadBuffer;
+		int mDrainRemaining;    // Body bytes of a failed download still to be read off the channel.
 		bool mLeftoverEscape;
+
+		QByteArray mUploadWindow;
+		int mUploadWindowLength;
+		int mUploadWindowSent;
+		int mUploadCursor;
+
+		QElapsedTimer mHeaderTimer;     // Times the server's answer to an upload header, for the channel pool.
 };
 
 #endif  // XFERCHANNEL_H
@@ -1,5 +1,6 @@
 #include <QCryptographicHash>
 #include <QDebug>
+#include "tools/bincodec.h"
 #include "xferrequest.h"
 
 XferRequest::XferRequest( bool sudo, const QByteArray &filename, const Callback &callback ) :
@@ -7,10 +8,25 @@ XferRequest::XferRequest( bool sudo, const QByteArray &filename, const Callback
 	mUpload( false ),
 	mFilename( filename ),
 	mData(),
+	mDataBuffer( NULL ),
 	mRequestHeader(),
 	mChecksum(),
-	mEncodedData(),
-	mSize( 0 ) {
+	mSize( 0 ),
+	mRangeOffset( 0 ),
+	mRangeLength( XFER_CHUNK_SIZE ),
+	mReceived( 0 ),
+	mRangeHash( QCryptographicHash::Md5 ),
+	mOwner( NULL ),
+	mRetriesLeft( XFER_RETRY_ATTEMPTS ),
+	mLastPercent( -1 ),
+	mChunkLock(),
+	mChunks(),
+	mPendingChunks( 0 ),
+	mUnreleased( 1 ),
+	mSizeKnown( false ),
+	mTotalSize( 0 ),
+	mTotalReceived( 0 ),
+	mFailed( false ) {
 
 	connect( this, SIGNAL( transferSuccess( QVariantMap ) ), callback.getTarget(), callback.getSuccessSlot() );
 	connect( this, SIGNAL( transferFailure( QString, int ) ), callback.getTarget(), callback.getFailureSlot() );
@@ -20,22 +36,205 @@ XferRequest::XferRequest( bool sudo, const QByteArray &filename, const Callback
 	}
 }
 
+XferRequest::XferRequest( XferRequest *owner, qint64 offset, qint64 length ) :
+	mSudo( owner->isSudo() ),
+	mUpload( false ),
+	mFilename( owner->getFilename() ),
+	mData(),
+	mDataBuffer( NULL ),
+	mRequestHeader(),
+	mChecksum(),
+	mSize( 0 ),
+	mRangeOffset( offset ),
+	mRangeLength( length ),
+	mReceived( 0 ),
+	mRangeHash( QCryptographicHash::Md5 ),
+	mOwner( owner ),
+	mRetriesLeft( XFER_RETRY_ATTEMPTS ),
+	mLastPercent( -1 ),
+	mChunkLock(),
+	mChunks(),
+	mPendingChunks( 0 ),
+	mUnreleased( 0 ),
+	mSizeKnown( false ),
+	mTotalSize( 0 ),
+	mTotalReceived( 0 ),
+	mFailed( false ) {}
+
+XferRequest::~XferRequest() {
+	foreach ( XferRequest *chunk, mChunks ) {
+		delete chunk;
+	}
+}
+
 const QByteArray &XferRequest::prepareHeader() {
-	mRequestHeader = mFilename + ( isUploadRequest() ? "u" : "d" ) + "\n";
+	mRequestHeader = mFilename + ( isUploadRequest() ? "u" : "r" ) + "\n";
 	if ( isUploadRequest() ) {
+		// The body is encoded a window at a time as it is sent; only its length is needed up front.
 		QCryptographicHash hash( QCryptographicHash::Md5 );
 		hash.addData( mData );
 		QByteArray checksum = hash.result().toHex().toLower();
 
-		mRequestHeader.append( QString::number( getEncodedData().size() ) );
+		mRequestHeader.append( QString::number( BinCodec::encodedLength( mData.constData(), mData.length() ) ) );
 		mRequestHeader.append( "\n" );
 		mRequestHeader.append( checksum );
 		mRequestHeader.append( "\n" );
+	} else {
+		// A resumed download only asks for the part of its range it doesn't have yet.
+		mRequestHeader.append( QByteArray::number( mRangeOffset + mReceived ) );
+		mRequestHeader.append( "," );
+		mRequestHeader.append( QByteArray::number( mReceived ? mSize - mReceived : mRangeLength ) );
+		mRequestHeader.append( "\n" );
 	}
 
 	return mRequestHeader;
 }
 
+bool XferRequest::handleFileSize( qint64 fileSize, QList< XferRequest * > *newChunks ) {
+	if ( mOwner ) {
+		return fileSize == mOwner->mTotalSize;
+	}
+
+	// Resumed requests have already been through here.
+	if ( mSizeKnown ) {
+		return fileSize == mTotalSize;
+	}
+
+	// Size the download buffer once; every range decodes straight into its own part of it.
+	mSizeKnown = true;
+	mTotalSize = fileSize;
+	mData = QByteArray( ( int ) fileSize, Qt::Uninitialized );
+	mDataBuffer = mData.data();
+	if ( fileSize <= mRangeLength ) {
+		return true;
+	}
+
+	// This is the first range of a large file; split off the rest.
+	mChunkLock.lock();
+	for ( qint64 offset = mRangeLength; offset < fileSize; offset += XFER_CHUNK_SIZE ) {
+		XferRequest *chunk = new XferRequest( this, offset, qMin( ( qint64 ) XFER_CHUNK_SIZE, fileSize - offset ) );
+		mChunks.append( chunk );
+		newChunks->append( chunk );
+	}
+	mPendingChunks = mChunks.length() + 1;
+	mUnreleased += mChunks.length();
+	mChunkLock.unlock();
+
+	return true;
+}
+
+bool XferRequest::isChunked() {
+	if ( mOwner ) {
+		return true;
+	}
+
+	// Other channels count the owner's ranges down as they finish.
+	mChunkLock.lock();
+	bool chunked = ( mPendingChunks > 0 );
+	mChunkLock.unlock();
+
+	return chunked;
+}
+
+bool XferRequest::isAbandoned() {
+	if ( ! mOwner ) {
+		return false;
+	}
+
+	mOwner->mChunkLock.lock();
+	bool failed = mOwner->mFailed;
+	mOwner->mChunkLock.unlock();
+
+	return failed;
+}
+
+bool XferRequest::beginRange( int length, const QByteArray &checksum ) {
+	// Resuming; the size and checksum from the first attempt still describe the whole range.
+	if ( mReceived > 0 ) {
+		return length == mSize - mReceived;
+	}
+
+	XferRequest *owner = mOwner ? mOwner : this;
+	if ( length != qMin( mRangeLength, owner->mTotalSize - mRangeOffset ) ) {
+		return false;
+	}
+
+	mSize = length;
+	mChecksum = checksum;
+	mRangeHash.reset();
+	return true;
+}
+
+char *XferRequest::getRangeWritePointer() {
+	return ( mOwner ? mOwner->mDataBuffer : mDataBuffer ) + mRangeOffset + mReceived;
+}
+
+void XferRequest::handleRangeData( int length ) {
+	mRangeHash.addData( getRangeWritePointer(), length );
+	mReceived += length;
+
+	XferRequest *owner = mOwner ? mOwner : this;
+	owner->mChunkLock.lock();
+	owner->mTotalReceived += length;
+	int percent = ( int ) ( ( owner->mTotalReceived * 100 ) / qMax( owner->mTotalSize, ( qint64 ) 1 ) );
+
+	// Keep progress monotonic, even when a range has to start over.
+	bool advanced = ( percent > owner->mLastPercent );
+	if ( advanced ) {
+		owner->mLastPercent = percent;
+	}
+	owner->mChunkLock.unlock();
+
+	if ( advanced ) {
+		emit owner->transferProgress( percent );
+	}
+}
+
+bool XferRequest::finishRange() {
+	XferRequest *owner = mOwner ? mOwner : this;
+
+	if ( mRangeHash.result().toHex().toLower() != mChecksum ) {
+		owner->mChunkLock.lock();
+		owner->mTotalReceived -= mReceived;
+		owner->mChunkLock.unlock();
+
+		mReceived = 0;
+		mRangeHash.reset();
+		mRequestHeader = QByteArray();
+		return false;
+	}
+
+	// A single range covers the whole file, so its checksum is the file's.
+	if ( ! isChunked() ) {
+		handleSuccess();
+		return true;
+	}
+
+	// The last range in completes the download.
+	owner->mChunkLock.lock();
+	bool complete = ( --owner->mPendingChunks == 0 && ! owner->mFailed );
+	owner->mChunkLock.unlock();
+
+	if ( complete ) {
+		QCryptographicHash hash( QCryptographicHash::Md5 );
+		hash.addData( owner->mData );
+		owner->setChecksum( hash.result().toHex().toLower() );
+		owner->handleSuccess();
+	}
+
+	return true;
+}
+
+bool XferRequest::prepareRetry() {
+	if ( mRetriesLeft <= 0 || isAbandoned() ) {
+		return false;
+	}
+
+	mRetriesLeft--;
+	mRequestHeader = QByteArray();  // Regenerated with the resume offset.
+	return true;
+}
+
 void XferRequest::handleSuccess() {
 	QVariantMap result;
 	result.insert( "data", mData );
@@ -44,9 +243,26 @@ void XferRequest::handleSuccess() {
 }
 
 void XferRequest::handleFailure( const QString &error, int errorFlags ) {
-	emit transferFailure( error, errorFlags );
+	// Report only the first failure of a split download.
+	XferRequest *owner = mOwner ? mOwner : this;
+	owner->mChunkLock.lock();
+	bool alreadyFailed = owner->mFailed;
+	owner->mFailed = true;
+	owner->mChunkLock.unlock();
+
+	if ( ! alreadyFailed ) {
+		emit owner->transferFailure( error, errorFlags );
+	}
 }
 
-void XferRequest::handleProgress( int percent ) {
-	emit transferProgress( percent );
+void XferRequest::release() {
+	XferRequest *owner = mOwner ? mOwner : this;
+	owner->mChunkLock.lock();
+	bool done = ( --owner->mUnreleased == 0 );
+	owner->mChunkLock.unlock();
+
+	// Usually called from a session thread; let the owner's thread do the deleting.
+	if ( done ) {
+		owner->deleteLater();
+	}
 }
@@ -2,14 +2,29 @@
 #define XFERREQUEST_H
 
 #include <QByteArray>
+#include <QCryptographicHash>
+#include <QList>
+#include <QMutex>
 #include <QObject>
+#include "requestqueue.h"
 #include "tools/callback.h"
 
+// Downloads are fetched in ranges of this size. Files larger than one range are split, and the ranges are
+// spread across as many xfer channels as the host will open.
+#define XFER_CHUNK_SIZE ( 4 * 1024 * 1024 )
+
+// Downloads are reassembled in a single QByteArray, which can't hold much more than 2GB.
+#define XFER_MAX_FILE_SIZE ( ( qint64 ) 0x7FFFF000 )
+
+// Number of times a transfer interrupted by a connection dropout is retried before it is failed.
+#define XFER_RETRY_ATTEMPTS 5
+
 class XferRequest : public QObject {
 	Q_OBJECT
 
 	public:
 		XferRequest( bool sudo, const QByteArray &filename, const Callback &callback );
+		~XferRequest();
 
 		inline bool isUploadRequest() const {
 			return mUpload;
@@ -35,10 +50,6 @@ class XferRequest : public QObject {
 			mUpload = upload;
 		}
 
-		inline void setEncodedData( const QByteArray &encoded ) {
-			mEncodedData = encoded;
-		}
-
 		inline const QByteArray &getChecksum() const {
 			return mChecksum;
 		}
@@ -51,10 +62,6 @@ class XferRequest : public QObject {
 			return mData;
 		}
 
-		inline const QByteArray &getEncodedData() const {
-			return mEncodedData;
-		}
-
 		inline const QByteArray &getFilename() const {
 			return mFilename;
 		}
@@ -63,9 +70,52 @@ class XferRequest : public QObject {
 			return mSudo;
 		}
 
+		inline qint64 getRangeOffset() const {
+			return mRangeOffset;
+		}
+
+		inline bool isChunk() const {   // Ranges of a split download are owned by the first range's request.
+			return mOwner != NULL;
+		}
+
+		// Scheduling; see RequestQueue. Saves go ahead of downloads, and transfers of one file stay in order.
+		inline RequestQueueBase::Priority getPriority() const {
+			return mUpload ? RequestQueueBase::Interactive : RequestQueueBase::Bulk;
+		}
+
+		inline uint getOrderKey() const {
+			return qHash( mFilename );
+		}
+
+		// Called once the server reports the size of the whole file. Sizes the download buffer; the first range
+		// of a large file returns the requests for the remaining ranges, which should be queued. Returns false
+		// if the file has changed size since the first range was read. fileSize must be within XFER_MAX_FILE_SIZE.
+		bool handleFileSize( qint64 fileSize, QList< XferRequest * > *newChunks );
+
+		// True if this is a range of a download that has already failed elsewhere.
+		bool isAbandoned();
+
+		// Ranges are decoded straight into their place in the download buffer, and hashed as they arrive.
+		// beginRange returns false if the server's range doesn't match the one asked for.
+		bool beginRange( int length, const QByteArray &checksum );
+		char *getRangeWritePointer();
+		inline int getRangeRemaining() const {
+			return mSize - mReceived;
+		}
+
+		void handleRangeData( int length );     // The next length bytes have been written at the write pointer.
+		bool finishRange();     // Verifies the range checksum. On a mismatch the range is reset, ready for a retry.
+
+		// Connection dropout support. An interrupted range keeps what it has received, and asks only for the
+		// rest when retried; the hash carries on from where it left off.
+		bool prepareRetry();    // Uses up a retry attempt; returns false if there are none left.
+
 		void handleSuccess();
 		void handleFailure( const QString &error, int errorFlags );
-		void handleProgress( int percent );
+
+		// Called by whoever holds the request once they are done with it, successful or not. The request (and
+		// all the ranges of a split download) is deleted once every range has been released.
+		void release();
 
 	signals:
 		void transferSuccess( QVariantMap result );
@@ -73,18 +123,43 @@ class XferRequest : public QObject {
 		void transferProgress( int percent );
 
 	protected:
+		XferRequest( XferRequest *owner, qint64 offset, qint64 length );        // Constructs a range of a larger
+		                                                                        // download.
 		const QByteArray &prepareHeader();
 
+		bool isChunked();       // True for any part of a split download.
+
 	private:
 		bool mSudo;
 		bool mUpload;
 		QByteArray mFilename;
 
 		QByteArray mData;
+		char *mDataBuffer;      // Points into mData; ranges write into it from several threads at once.
 		QByteArray mRequestHeader;
 		QByteArray mChecksum;
-		QByteArray mEncodedData;
 		int mSize;
+
+		// Ranged download state. Ranges of a split download point at the request which owns the callback and
+		// the reassembly buffer.
+		qint64 mRangeOffset;
+		qint64 mRangeLength;
+		int mReceived;
+		QCryptographicHash mRangeHash;
+		XferRequest *mOwner;
+
+		int mRetriesLeft;
+		int mLastPercent;
+
+		// Owner-only bookkeeping, shared by every channel working on one of the ranges.
+		QMutex mChunkLock;
+		QList< XferRequest * > mChunks;
+		int mPendingChunks;
+		int mUnreleased;
+		bool mSizeKnown;
+		qint64 mTotalSize;
+		qint64 mTotalReceived;
+		bool mFailed;
 };
 
 #endif  // XFERREQUEST_H
@@ -0,0 +1,174 @@
+#include <string.h>
+
+#include "bincodec.h"
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+	#define BINCODEC_SSE2
+	#include <emmintrin.h>
+#endif
+
+#define BIN_NEWLINE     253
+#define BIN_RETURN      254
+#define BIN_ESCAPE      255
+
+namespace {
+	struct Tables {
+		Tables();
+
+		unsigned char encodeLength[ 256 ];      // 1 or 2
+		unsigned char encoded[ 256 ][ 2 ];
+		unsigned char decoded[ 256 ];           // For everything but BIN_ESCAPE
+		unsigned char unescaped[ 256 ];         // The byte following BIN_ESCAPE
+	};
+
+	Tables::Tables() {
+		for ( int c = 0; c < 256; c++ ) {
+			encodeLength[ c ] = 1;
+			encoded[ c ][ 0 ] = c;
+			encoded[ c ][ 1 ] = 0;
+			decoded[ c ] = c;
+			unescaped[ c ] = ( c < 128 ? c + 188 : c - 128 );
+		}
+
+		static const unsigned char controlBytes[] = { 0x3, 0x4, 0x8, 0x11, 0x13, 0x1D, 0x1E, 0x18, 0x1A, 0x1C, 0x7F };
+		for ( unsigned int i = 0; i < sizeof( controlBytes ); i++ ) {
+			unsigned char c = controlBytes[ i ];
+			encodeLength[ c ] = 2;
+			encoded[ c ][ 0 ] = BIN_ESCAPE;
+			encoded[ c ][ 1 ] = c + 128;
+		}
+
+		encoded[ 10 ][ 0 ] = BIN_NEWLINE;
+		encoded[ 13 ][ 0 ] = BIN_RETURN;
+		for ( int c = BIN_NEWLINE; c <= BIN_ESCAPE; c++ ) {
+			encodeLength[ c ] = 2;
+			encoded[ c ][ 0 ] = BIN_ESCAPE;
+			encoded[ c ][ 1 ] = 'A' + ( c - BIN_NEWLINE );
+		}
+
+		decoded[ BIN_NEWLINE ] = 10;
+		decoded[ BIN_RETURN ] = 13;
+	}
+
+	const Tables sTables;
+
+#ifdef BINCODEC_SSE2
+	// True if none of the 16 bytes needs encoding. Conservative: any control character sends the block down the
+	// table-driven path, which gets the details right.
+	inline bool isPlainBlock( __m128i block ) {
+		__m128i printable = _mm_cmpeq_epi8( _mm_max_epu8( block, _mm_set1_epi8( 0x20 ) ), block );
+		__m128i belowMarkers = _mm_cmpeq_epi8( _mm_min_epu8( block, _mm_set1_epi8( ( char ) 0xFC ) ), block );
+		__m128i del = _mm_cmpeq_epi8( block, _mm_set1_epi8( 0x7F ) );
+		return _mm_movemask_epi8( _mm_andnot_si128( del, _mm_and_si128( printable, belowMarkers ) ) ) == 0xFFFF;
+	}
+
+	// True if none of the 16 bytes is a marker that needs decoding.
+	inline bool isMarkerFree( __m128i block ) {
+		return _mm_movemask_epi8(
+			_mm_cmpeq_epi8( _mm_min_epu8( block, _mm_set1_epi8( ( char ) 0xFC ) ), block ) ) == 0xFFFF;
+	}
+#endif
+}
+
+int BinCodec::encodedLength( const char *source, int length ) {
+	const unsigned char *c = ( const unsigned char * ) source;
+	const unsigned char *end = c + length;
+	int result = length;
+
+	while ( c < end ) {
+		const unsigned char *blockEnd = end;
+#ifdef BINCODEC_SSE2
+		if ( end - c >= 16 ) {
+			if ( isPlainBlock( _mm_loadu_si128( ( const __m128i * ) c ) ) ) {
+				c += 16;
+				continue;
+			}
+			blockEnd = c + 16;
+		}
+#endif
+		for (; c < blockEnd; c++ ) {
+			result += sTables.encodeLength[ *c ] - 1;
+		}
+	}
+
+	return result;
+}
+
+int BinCodec::encode( char *target, const char *source, int length ) {
+	const unsigned char *c = ( const unsigned char * ) source;
+	const unsigned char *end = c + length;
+	unsigned char *out = ( unsigned char * ) target;
+
+	while ( c < end ) {
+		const unsigned char *blockEnd = end;
+#ifdef BINCODEC_SSE2
+		if ( end - c >= 16 ) {
+			__m128i block = _mm_loadu_si128( ( const __m128i * ) c );
+			if ( isPlainBlock( block ) ) {
+				_mm_storeu_si128( ( __m128i * ) out, block );
+				c += 16;
+				out += 16;
+				continue;
+			}
+			blockEnd = c + 16;
+		}
+#endif
+		for (; c < blockEnd; c++ ) {
+			const unsigned char *code = sTables.encoded[ *c ];
+			*out++ = code[ 0 ];
+			if ( sTables.encodeLength[ *c ] == 2 ) {
+				*out++ = code[ 1 ];
+			}
+		}
+	}
+
+	return out - ( unsigned char * ) target;
+}
+
+QByteArray BinCodec::encode( const QByteArray &source ) {
+	QByteArray result( encodedLength( source.constData(), source.length() ), Qt::Uninitialized );
+	encode( result.data(), source.constData(), source.length() );
+	return result;
+}
+
+int BinCodec::decode( char *target,
+                      int maxTarget,
+                      const char *source,
+                      int maxSource,
+                      int *written,
+                      bool *leftoverEscape ) {
+	const unsigned char *c = ( const unsigned char * ) source;
+	const unsigned char *end = c + maxSource;
+	unsigned char *out = ( unsigned char * ) target;
+	unsigned char *outEnd = out + maxTarget;
+
+	if ( leftoverEscape && *leftoverEscape && c < end && out < outEnd ) {
+		*out++ = sTables.unescaped[ *c++ ];
+		*leftoverEscape = false;
+	}
+
+	while ( c < end && out < outEnd ) {
+#ifdef BINCODEC_SSE2
+		if ( end - c >= 16 && outEnd - out >= 16 ) {
+			__m128i block = _mm_loadu_si128( ( const __m128i * ) c );
+			if ( isMarkerFree( block ) ) {
+				_mm_storeu_si128( ( __m128i * ) out, block );
+				c += 16;
+				out += 16;
+				continue;
+			}
+		}
+#endif
+		unsigned char b = *c++;
+		if ( b != BIN_ESCAPE ) {
+			*out++ = sTables.decoded[ b ];
+		} else if ( c < end ) {
+			*out++ = sTables.unescaped[ *c++ ];
+		} else if ( leftoverEscape ) {
+			*leftoverEscape = true;
+		}
+	}
+
+	*written = out - ( unsigned char * ) target;
+	return c - ( const unsigned char * ) source;
+}
@@ -0,0 +1,31 @@
+#ifndef BINCODEC_H
+#define BINCODEC_H
+
+#include <QByteArray>
+
+//
+// Escape encoding used to push binary data through a pty to and from server.pl. Line endings and bytes the
+// terminal would interpret are replaced, and 253-255 are used as markers:
+//   253 -> \n, 254 -> \r, 255 <x> -> escaped byte (x < 128 ? x + 188 : x - 128)
+// Must match bin / unbin in server.pl.
+//
+
+class BinCodec {
+	public:
+		static int encodedLength( const char *source, int length );
+
+		// target must have room for encodedLength() bytes. Returns the number of bytes written.
+		static int encode( char *target, const char *source, int length );
+		static QByteArray encode( const QByteArray &source );
+
+		// Decodes up to maxTarget bytes into target. Returns the number of source bytes consumed; written receives
+		// the number of bytes decoded. An escape marker split across two calls is carried in leftoverEscape.
+		static int decode( char *target,
+		                   int maxTarget,
+		                   const char *source,
+		                   int maxSource,
+		                   int *written,
+		                   bool *leftoverEscape = NULL );
+};
+
+#endif  // BINCODEC_H
@@ -0,0 +1,85 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QList>
+
+//
+// Lock-free hand-off from any number of producer threads to a consumer. Producers push one value at a time; the
+// consumer takes everything pushed so far in one go, oldest first. Pushing never blocks, so the GUI thread can post
+// work without contending with session threads.
+//
+// takeAll() is safe from several threads at once, as each caller gets a disjoint batch; but consumers that care
+// about the order between batches should serialize among themselves.
+//
+
+template < class T > class MpscQueue {
+	public:
+		MpscQueue() :
+			mHead( NULL ),
+			mCount( 0 ) {}
+
+		~MpscQueue() {
+			Node *node = mHead.fetchAndStoreAcquire( NULL );
+			while ( node ) {
+				Node *next = node->next;
+				delete node;
+				node = next;
+			}
+		}
+
+		// Returns true if the queue was empty; ie: this push is the one that should wake the consumer.
+		bool push( const T &value ) {
+			Node *node = new Node( value );
+			mCount.ref();
+
+			Node *head;
+			do {
+				head = mHead.loadAcquire();
+				node->next = head;
+			} while ( ! mHead.testAndSetRelease( head, node ) );
+
+			return head == NULL;
+		}
+
+		QList< T > takeAll() {
+			// Producers only ever push onto the head, and whole lists are detached at once, so there is no ABA
+			// problem to worry about.
+			Node *node = mHead.fetchAndStoreAcquire( NULL );
+
+			// The list is newest first.
+			QList< T > result;
+			while ( node ) {
+				Node *next = node->next;
+				result.prepend( node->value );
+				delete node;
+				node = next;
+			}
+
+			mCount.fetchAndAddRelease( -result.length() );
+			return result;
+		}
+
+		inline bool isEmpty() const {
+			return mHead.loadAcquire() == NULL;
+		}
+
+		inline int count() const {     // Approximate while producers are busy.
+			return qMax( 0, mCount.loadAcquire() );
+		}
+
+	private:
+		struct Node {
+			Node( const T &value ) :
+				value( value ),
+				next( NULL ) {}
+			T value;
+			Node *next;
+		};
+
+		QAtomicPointer< Node > mHead;
+		QAtomicInt mCount;
+};
+
+#endif  // MPSCQUEUE_H
@@ -0,0 +1,7 @@
+TEMPLATE = subdirs
+
+SUBDIRS = \
+	filedelta \
+	listingcache \
+	locationpath \
+	remotetree
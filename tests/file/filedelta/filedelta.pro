@@ -0,0 +1,7 @@
+include( $$TESTSDIR/common.pri );
+
+TARGET = tst_filedelta
+
+SOURCES += \
+    tst_filedelta.cpp \
+	$$SRCDIR/file/filedelta.cpp
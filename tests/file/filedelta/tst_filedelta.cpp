@@ -0,0 +1,203 @@
+#include <QtTest>
+
+#include "file/filedelta.h"
+
+//
+// The expected values here were produced by Delta in server.pl (weak, and compute given the same signatures), so
+// they pin the two halves of the protocol to each other.
+//
+
+class TestsFileDelta : public QObject {
+	Q_OBJECT
+
+	private Q_SLOTS:
+		void testWeakChecksum_data();
+		void testWeakChecksum();
+		void testRollingChecksum();
+		void testSignatures();
+
+		void testApply_data();
+		void testApply();
+		void testApplyMalformed_data();
+		void testApplyMalformed();
+
+		void testToCharOffsets_data();
+		void testToCharOffsets();
+
+	private:
+		static QList< int > flatten( const QList< FileDelta::Hunk > &hunks );
+		static QList< int > ints( int a, int b, int c, int d );
+};
+
+QList< int > TestsFileDelta::flatten( const QList< FileDelta::Hunk > &hunks ) {
+	QList< int > result;
+	foreach ( const FileDelta::Hunk &hunk, hunks ) {
+		result << hunk.oldStart << hunk.oldLength << hunk.newStart << hunk.newLength;
+	}
+	return result;
+}
+
+QList< int > TestsFileDelta::ints( int a, int b, int c, int d ) {
+	return QList< int >() << a << b << c << d;
+}
+
+void TestsFileDelta::testWeakChecksum_data() {
+	QTest::addColumn< QByteArray >( "block" );
+	QTest::addColumn< uint >( "checksum" );
+
+	QTest::newRow( "empty" ) << QByteArray() << 0x00000000u;
+	QTest::newRow( "ascii" ) << QByteArray( "hello world" ) << 0x1a00045cu;
+	QTest::newRow( "multibyte crlf" ) << QByteArray( "\xc3\xa9t\xc3\xa9 \xe2\x82\xac\r\n" ) << 0x27200593u;
+}
+
+void TestsFileDelta::testWeakChecksum() {
+	QFETCH( QByteArray, block );
+	QFETCH( uint, checksum );
+
+	QCOMPARE( FileDelta::weakChecksum( ( const unsigned char * ) block.constData(), block.size() ), checksum );
+}
+
+void TestsFileDelta::testRollingChecksum() {
+	// The server rolls its window a byte at a time rather than summing each one afresh; both must agree, high bytes
+	// included.
+	QByteArray data;
+	for ( int i = 0; i < 1024; i++ ) {
+		data.append( ( char ) ( ( i * 37 + ( i >> 3 ) ) & 0xFF ) );
+	}
+	const unsigned char *bytes = ( const unsigned char * ) data.constData();
+
+	const int blockSize = 64;
+	quint32 checksum = FileDelta::weakChecksum( bytes, blockSize );
+	quint32 a = checksum & 0xFFFF;
+	quint32 b = checksum >> 16;
+	for ( int pos = 0; pos + blockSize < data.size(); pos++ ) {
+		quint32 out = bytes[ pos ];
+		quint32 in = bytes[ pos + blockSize ];
+		a = ( a - out + in ) & 0xFFFF;
+		b = ( b - blockSize * out + a ) & 0xFFFF;
+		QCOMPARE( a | ( b << 16 ), FileDelta::weakChecksum( bytes + pos + 1, blockSize ) );
+	}
+}
+
+void TestsFileDelta::testSignatures() {
+	QByteArray content( "The quick brown fox jumps over the lazy dog. 0123456789" );
+	QCOMPARE( FileDelta::signatures( content, 8 ),
+	          QByteArray( "0cce02f3b9b926540cdb02d307e531bd0dfa032926209f230cfe02e346dbd0ac"
+	                      "0ce302cd10b8e7230b1d021bc2de4c2c05cc017ab2130cc6" ) );
+	QCOMPARE( FileDelta::signatures( QByteArray(), 8 ), QByteArray() );
+}
+
+void TestsFileDelta::testApply_data() {
+	QTest::addColumn< QByteArray >( "oldContent" );
+	QTest::addColumn< int >( "blockSize" );
+	QTest::addColumn< QStringList >( "instructions" );
+	QTest::addColumn< QByteArray >( "newContent" );
+	QTest::addColumn< QList< int > >( "hunks" );
+
+	QTest::newRow( "changed middle" )
+	        << QByteArray( "The quick brown fox jumps over the lazy dog. 0123456789" ) << 8
+	        << ( QStringList() << "c0,2" << "lZm94IGxlYXA=" << "c3,4" )
+	        << QByteArray( "The quick brown fox leaps over the lazy dog. 0123456789" ) << ints( 16, 8, 16, 8 );
+
+	// Finding the old blocks after an insertion takes the rolling checksum; the partial last block matches too.
+	QTest::newRow( "inserted at start" )
+	        << QByteArray( "abcdefghijklmnopqrstuvwxyz0123456789" ) << 8
+	        << ( QStringList() << "lWFk=" << "c0,5" )
+	        << QByteArray( "XYabcdefghijklmnopqrstuvwxyz0123456789" ) << ints( 0, 0, 0, 2 );
+
+	QTest::newRow( "crlf" )
+	        << QByteArray( "line one\r\nline two\r\nline three\r\n" ) << 8
+	        << ( QStringList() << "c0,1" << "lDQpsaW5lIDI=" << "c1,1" << "laHJlZQ0K" )
+	        << QByteArray( "line one\r\nline 2\r\nline three\r\n" )
+	        << ( ints( 8, 0, 8, 8 ) << ints( 16, 16, 24, 6 ) );
+
+	QTest::newRow( "multibyte" )
+	        << QByteArray( "abc\xc3\xa9" "defghijk" ) << 4
+	        << ( QStringList() << "c0,1" << "lqGRlZg==" << "c2,2" )
+	        << QByteArray( "abc\xc3\xa8" "defghijk" ) << ints( 4, 4, 4, 4 );
+
+	QTest::newRow( "unchanged" )
+	        << QByteArray( "abcdefghij" ) << 4 << ( QStringList() << "c0,3" ) << QByteArray( "abcdefghij" )
+	        << QList< int >();
+
+	QTest::newRow( "emptied" )
+	        << QByteArray( "abcdefghij" ) << 4 << QStringList() << QByteArray() << ints( 0, 10, 0, 0 );
+}
+
+void TestsFileDelta::testApply() {
+	QFETCH( QByteArray, oldContent );
+	QFETCH( int, blockSize );
+	QFETCH( QStringList, instructions );
+	QFETCH( QByteArray, newContent );
+	QFETCH( QList< int >, hunks );
+
+	QByteArray rebuilt;
+	QList< FileDelta::Hunk > byteHunks;
+	QVERIFY( FileDelta::apply( oldContent, blockSize, QVariant( instructions ).toList(), &rebuilt, &byteHunks ) );
+	QCOMPARE( rebuilt, newContent );
+	QCOMPARE( flatten( byteHunks ), hunks );
+}
+
+void TestsFileDelta::testApplyMalformed_data() {
+	QTest::addColumn< QString >( "instruction" );
+
+	QTest::newRow( "unknown" ) << "x";
+	QTest::newRow( "no count" ) << "c0";
+	QTest::newRow( "zero count" ) << "c0,0";
+	QTest::newRow( "past end" ) << "c2,2";
+	QTest::newRow( "negative" ) << "c-1,1";
+	QTest::newRow( "not a number" ) << "ca,1";
+}
+
+void TestsFileDelta::testApplyMalformed() {
+	QFETCH( QString, instruction );
+
+	QByteArray rebuilt;
+	QList< FileDelta::Hunk > hunks;
+	QVERIFY( ! FileDelta::apply( "abcdefghij", 4, QVariantList() << instruction, &rebuilt, &hunks ) );
+}
+
+void TestsFileDelta::testToCharOffsets_data() {
+	QTest::addColumn< QByteArray >( "oldContent" );
+	QTest::addColumn< QByteArray >( "newContent" );
+	QTest::addColumn< QList< int > >( "byteHunks" );
+	QTest::addColumn< QList< int > >( "charHunks" );
+
+	QTest::newRow( "ascii" ) << QByteArray( "line one\r\nline two\r\nline three\r\n" )
+	                         << QByteArray( "line one\r\nline 2\r\nline three\r\n" )
+	                         << ( ints( 8, 0, 8, 8 ) << ints( 16, 16, 24, 6 ) )
+	                         << ( ints( 8, 0, 8, 8 ) << ints( 16, 16, 24, 6 ) );
+
+	// A hunk starting on the second byte of é is widened back to its first.
+	QTest::newRow( "split character" ) << QByteArray( "abc\xc3\xa9" "defghijk" )
+	                                   << QByteArray( "abc\xc3\xa8" "defghijk" )
+	                                   << ints( 4, 4, 4, 4 ) << ints( 3, 4, 3, 4 );
+
+	// Characters before the hunk count once each, however many bytes; one outside the BMP counts twice.
+	QTest::newRow( "utf-16" ) << QByteArray( "x\xe2\x82\xacy\xf0\x9f\x98\x80z" )
+	                          << QByteArray( "x\xe2\x82\xacy\xf0\x9f\x98\x81z" )
+	                          << ints( 8, 2, 8, 2 ) << ints( 3, 3, 3, 3 );
+
+	QTest::newRow( "accents" ) << QByteArray( "caf\xc3\xa9 cr\xc3\xa8me br\xc3\xbbl\xc3\xa9" "e, na\xc3\xafve" )
+	                           << QByteArray( "caf\xc3\xa9 cr\xc3\xa8me br\xc3\xbbl\xc3\xa9" "e, na\xc3\xa0ve" )
+	                           << ints( 24, 5, 24, 5 ) << ints( 20, 4, 20, 4 );
+}
+
+void TestsFileDelta::testToCharOffsets() {
+	QFETCH( QByteArray, oldContent );
+	QFETCH( QByteArray, newContent );
+	QFETCH( QList< int >, byteHunks );
+	QFETCH( QList< int >, charHunks );
+
+	QList< FileDelta::Hunk > hunks;
+	for ( int i = 0; i + 3 < byteHunks.size(); i += 4 ) {
+		FileDelta::Hunk hunk = { byteHunks[ i ], byteHunks[ i + 1 ], byteHunks[ i + 2 ], byteHunks[ i + 3 ] };
+		hunks.append( hunk );
+	}
+
+	QCOMPARE( flatten( FileDelta::toCharOffsets( oldContent, newContent, hunks ) ), charHunks );
+}
+
+QTEST_APPLESS_MAIN( TestsFileDelta )
+
+#include "tst_filedelta.moc"
@@ -0,0 +1,11 @@
+include( $$TESTSDIR/common.pri );
+
+TARGET = tst_listingcache
+
+# Short enough to watch a listing go stale.
+DEFINES += LISTING_CACHE_FRESH_MSEC=200
+
+SOURCES += \
+    tst_listingcache.cpp \
+	$$SRCDIR/file/listingcache.cpp \
+	$$SRCDIR/file/remotetree.cpp
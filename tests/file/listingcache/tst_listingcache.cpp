@@ -0,0 +1,182 @@
+#include <QtTest>
+
+#include "file/listingcache.h"
+
+class TestsListingCache : public QObject {
+	Q_OBJECT
+
+	private Q_SLOTS:
+		void testMiss();
+		void testStoreAndLookup();
+		void testChangeDetection();
+		void testFlavoursAreSeparate();
+		void testInvalidate();
+		void testDirectoryBound();
+		void testEntryBound();
+		void testSaveRestore();
+		void testTrees();
+
+	private:
+		static QVariantMap makeEntries( int count, int size = 100 );
+};
+
+QVariantMap TestsListingCache::makeEntries( int count, int size ) {
+	QVariantMap entries;
+	for ( int i = 0; i < count; i++ ) {
+		QVariantMap entry;
+		entry.insert( "f", "rw" );
+		entry.insert( "s", size );
+		entry.insert( "m", 1300000000 + i );
+		entries.insert( QString( "file%1" ).arg( i ), entry );
+	}
+	return entries;
+}
+
+void TestsListingCache::testMiss() {
+	ListingCache cache;
+	QVariantMap entries;
+	bool fresh = true;
+	QVERIFY( ! cache.lookup( "/home", 0, &entries, &fresh ) );
+	QCOMPARE( cache.count(), 0 );
+}
+
+void TestsListingCache::testStoreAndLookup() {
+	ListingCache cache;
+	QVERIFY( cache.store( "/home", 0, makeEntries( 3 ) ) );
+
+	QVariantMap entries;
+	bool fresh = false;
+	QVERIFY( cache.lookup( "/home", 0, &entries, &fresh ) );
+	QCOMPARE( entries, makeEntries( 3 ) );
+	QVERIFY( fresh );
+	QCOMPARE( cache.getTotalEntries(), 3 );
+}
+
+void TestsListingCache::testChangeDetection() {
+	ListingCache cache;
+	QVERIFY( cache.store( "/home", 0, makeEntries( 3 ) ) );
+	QVERIFY( ! cache.store( "/home", 0, makeEntries( 3 ) ) );
+
+	// A file changing size is news; so is one appearing.
+	QVERIFY( cache.store( "/home", 0, makeEntries( 3, 200 ) ) );
+	QVERIFY( cache.store( "/home", 0, makeEntries( 4, 200 ) ) );
+	QCOMPARE( cache.getTotalEntries(), 4 );
+}
+
+void TestsListingCache::testFlavoursAreSeparate() {
+	ListingCache cache;
+	cache.store( "/home", 0, makeEntries( 3 ) );
+
+	QVariantMap entries;
+	bool fresh;
+	QVERIFY( ! cache.lookup( "/home", ListingCache::Hidden, &entries, &fresh ) );
+	QVERIFY( ! cache.lookup( "/home", ListingCache::Sudo, &entries, &fresh ) );
+	QVERIFY( ! cache.lookup( "/home", ListingCache::Sftp, &entries, &fresh ) );
+}
+
+void TestsListingCache::testInvalidate() {
+	ListingCache cache;
+	cache.store( "/home", 0, makeEntries( 3 ) );
+	cache.store( "/home", ListingCache::Hidden | ListingCache::Sudo, makeEntries( 5 ) );
+	cache.store( "/home/sub", 0, makeEntries( 2 ) );
+
+	cache.invalidate( "/home" );
+	QCOMPARE( cache.count(), 1 );
+	QCOMPARE( cache.getTotalEntries(), 2 );
+}
+
+void TestsListingCache::testDirectoryBound() {
+	ListingCache cache;
+	for ( int i = 0; i < LISTING_CACHE_MAX_DIRECTORIES; i++ ) {
+		cache.store( QString( "/dir%1" ).arg( i ), 0, makeEntries( 1 ) );
+	}
+
+	// Using the first makes the second the oldest.
+	QVariantMap entries;
+	bool fresh;
+	QVERIFY( cache.lookup( "/dir0", 0, &entries, &fresh ) );
+
+	cache.store( "/another", 0, makeEntries( 1 ) );
+	QCOMPARE( cache.count(), LISTING_CACHE_MAX_DIRECTORIES );
+	QVERIFY( cache.lookup( "/dir0", 0, &entries, &fresh ) );
+	QVERIFY( ! cache.lookup( "/dir1", 0, &entries, &fresh ) );
+}
+
+void TestsListingCache::testEntryBound() {
+	ListingCache cache;
+	int half = LISTING_CACHE_MAX_ENTRIES / 2 + 1;
+	cache.store( "/first", 0, makeEntries( half ) );
+	cache.store( "/second", 0, makeEntries( half ) );
+	QCOMPARE( cache.count(), 1 );
+	QCOMPARE( cache.getTotalEntries(), half );
+
+	// A listing too big for the cache isn't kept, and doesn't push anything out either.
+	QVERIFY( cache.store( "/huge", 0, makeEntries( LISTING_CACHE_MAX_ENTRIES + 1 ) ) );
+	QCOMPARE( cache.count(), 1 );
+}
+
+void TestsListingCache::testSaveRestore() {
+	ListingCache cache;
+	cache.store( "/old", 0, makeEntries( 2 ) );
+	cache.store( "/new", ListingCache::Sftp, makeEntries( 3 ) );
+
+	ListingCache restored;
+	restored.restore( cache.save() );
+	QCOMPARE( restored.count(), 2 );
+	QCOMPARE( restored.getTotalEntries(), 5 );
+
+	QVariantMap entries;
+	bool fresh;
+	QVERIFY( restored.lookup( "/new", ListingCache::Sftp, &entries, &fresh ) );
+	QCOMPARE( entries, makeEntries( 3 ) );
+	QVERIFY( ! restored.store( "/new", ListingCache::Sftp, makeEntries( 3 ) ) );
+
+	// Only the most recently used listings are saved.
+	ListingCache big;
+	for ( int i = 0; i < LISTING_CACHE_SAVED_DIRECTORIES + 10; i++ ) {
+		big.store( QString( "/dir%1" ).arg( i ), 0, makeEntries( 1 ) );
+	}
+	QVariantList saved = big.save();
+	QCOMPARE( saved.length(), LISTING_CACHE_SAVED_DIRECTORIES );
+	QCOMPARE( saved.first().toMap().value( "path" ).toString(),
+	          QString( "/dir%1" ).arg( LISTING_CACHE_SAVED_DIRECTORIES + 9 ) );
+}
+
+void TestsListingCache::testTrees() {
+	ListingCache cache;
+	QSharedPointer< RemoteTree > tree( new RemoteTree( "/project", ListingCache::Sudo, 0, false ) );
+	tree->addEntries( QVariantList() << "src" << "drw" << 4096 << 1300000000 << "src/a.cpp" << "rw" << 10 << 1 );
+	cache.storeTree( tree );
+
+	// Folders the tree covers list from it, fresh for as long as a listing would be; cached listings still come first.
+	QVariantMap entries;
+	bool fresh = false;
+	QVERIFY( cache.lookup( "/project/src", ListingCache::Sudo, &entries, &fresh ) );
+	QCOMPARE( entries.keys(), QStringList() << "a.cpp" );
+	QVERIFY( fresh );
+	QVERIFY( ! cache.lookup( "/project/src", 0, &entries, &fresh ) );
+
+	QTest::qSleep( LISTING_CACHE_FRESH_MSEC + 5 );
+	QVERIFY( cache.lookup( "/project/src", ListingCache::Sudo, &entries, &fresh ) );
+	QVERIFY( ! fresh );
+
+	cache.store( "/project/src", ListingCache::Sudo, makeEntries( 2 ) );
+	QVERIFY( cache.lookup( "/project/src", ListingCache::Sudo, &entries, &fresh ) );
+	QCOMPARE( entries, makeEntries( 2 ) );
+
+	cache.invalidate( "/project/src" );
+	QVERIFY( ! cache.lookup( "/project/src", ListingCache::Sudo, &entries, &fresh ) );
+	QVERIFY( cache.lookup( "/project", ListingCache::Sudo, &entries, &fresh ) );
+	QVERIFY( cache.findTree( "/project/src", ListingCache::Sudo ) == tree );
+
+	// Only so many trees are kept.
+	for ( int i = 0; i < LISTING_CACHE_MAX_TREES; i++ ) {
+		cache.storeTree( QSharedPointer< RemoteTree >( new RemoteTree( QString( "/other%1" ).arg( i ), 0, 0, false ) ) );
+	}
+	QVERIFY( cache.findTree( "/project", ListingCache::Sudo ).isNull() );
+	QVERIFY( ! cache.findTree( "/other0", 0 ).isNull() );
+}
+
+QTEST_APPLESS_MAIN( TestsListingCache )
+
+#include "tst_listingcache.moc"
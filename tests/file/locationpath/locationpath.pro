@@ -0,0 +1,7 @@
+include( $$TESTSDIR/common.pri );
+
+TARGET = tst_locationpath
+
+SOURCES += \
+    tst_locationpath.cpp \
+	$$SRCDIR/file/locationpath.cpp
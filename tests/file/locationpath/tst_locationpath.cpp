@@ -0,0 +1,239 @@
+#include <QElapsedTimer>
+#include <QRegExp>
+#include <QtTest>
+
+#include "file/locationpath.h"
+
+#define BENCHMARK_COUNT 1000000
+
+class TestsLocationPath : public QObject {
+	Q_OBJECT
+
+	private Q_SLOTS:
+		void testParse_data();
+		void testParse();
+		void testChild_data();
+		void testChild();
+		void testChildIsLazy();
+
+		void benchmarkParse();
+		void benchmarkRegExpParse();
+		void benchmarkChildren();
+
+	private:
+		struct Parts {
+			int protocol;
+			QString path;
+			QString user;
+			QString host;
+			QString remotePath;
+			QString name;
+			bool sudo;
+		};
+
+		static Parts referenceParse( const QString &path );
+		static Parts parts( const LocationPath &path );
+		static void compare( const Parts &actual, const Parts &expected );
+		static void reportRate( const char *what, qint64 count, qint64 nsecs );
+};
+
+// How Location picked paths apart before, with regexes; LocationPath must agree with it.
+TestsLocationPath::Parts TestsLocationPath::referenceParse( const QString &source ) {
+	QRegExp sshServerRegExp( "^(?:([^@:]+)@)?([a-zA-Z0-9_\\-.]{2,}):(.+)?" );
+	QRegExp sftpServerRegExp( "^sftp://(([^@/]+)@)?([^/]+)(.*)" );
+
+	Parts result;
+	result.sudo = false;
+	result.path = source.trimmed();
+	result.path.replace( '\\', '/' );
+	while ( result.path.endsWith( '/' ) && result.path.length() > 1 ) {
+		result.path.truncate( result.path.length() - 1 );
+	}
+
+	if ( sftpServerRegExp.indexIn( result.path ) > -1 ) {
+		result.protocol = LocationPath::Sftp;
+		QStringList captured = sftpServerRegExp.capturedTexts();
+		result.user = captured[ 2 ];
+		result.host = captured[ 3 ];
+		result.remotePath = captured[ 4 ];
+		if ( result.remotePath.length() == 0 ) {
+			result.remotePath = "/";
+		}
+		result.remotePath.replace( QRegExp( "^/~" ), "~" );
+	} else if ( sshServerRegExp.indexIn( result.path ) > -1 ) {
+		result.protocol = LocationPath::Ssh;
+		QStringList captured = sshServerRegExp.capturedTexts();
+		result.user = captured[ 1 ];
+		result.host = captured[ 2 ];
+		result.remotePath = captured[ 3 ];
+		if ( result.remotePath.length() == 0 ) {
+			result.remotePath = "/";
+		}
+		if ( result.user.endsWith( '*' ) ) {
+			result.sudo = true;
+			result.user.truncate( result.user.length() - 1 );
+		}
+	} else if ( result.path.length() == 0 ) {
+		result.protocol = LocationPath::Unsaved;
+	} else {
+		result.protocol = LocationPath::Local;
+	}
+
+	bool remote = ( result.protocol == LocationPath::Ssh || result.protocol == LocationPath::Sftp );
+	result.name = result.path.mid( result.path.lastIndexOf( QRegExp( remote ? "[/:]" : "/" ) ) + 1 );
+	return result;
+}
+
+TestsLocationPath::Parts TestsLocationPath::parts( const LocationPath &path ) {
+	Parts result;
+	result.protocol = path.getProtocol();
+	result.path = path.getPath();
+	result.user = path.getUserName();
+	result.host = path.getHostName();
+	result.remotePath = path.getRemotePath();
+	result.name = path.getName();
+	result.sudo = path.isSudo();
+	return result;
+}
+
+void TestsLocationPath::compare( const Parts &actual, const Parts &expected ) {
+	QCOMPARE( actual.protocol, expected.protocol );
+	QCOMPARE( actual.path, expected.path );
+	QCOMPARE( actual.user, expected.user );
+	QCOMPARE( actual.host, expected.host );
+	QCOMPARE( actual.remotePath, expected.remotePath );
+	QCOMPARE( actual.name, expected.name );
+	QCOMPARE( actual.sudo, expected.sudo );
+}
+
+void TestsLocationPath::reportRate( const char *what, qint64 count, qint64 nsecs ) {
+	qDebug( "%s: %.0f per second", what, nsecs ? ( double ) count * 1e9 / ( double ) nsecs : 0.0 );
+}
+
+void TestsLocationPath::testParse_data() {
+	QTest::addColumn< QString >( "path" );
+
+	QTest::newRow( "empty" ) << "";
+	QTest::newRow( "root" ) << "/";
+	QTest::newRow( "local" ) << "/home/user/file.txt";
+	QTest::newRow( "local trailing" ) << "  /home/user/dir//  ";
+	QTest::newRow( "windows" ) << "C:\\Users\\file.txt";
+	QTest::newRow( "windows drive" ) << "C:";
+	QTest::newRow( "ssh" ) << "user@host.example.com:/var/www";
+	QTest::newRow( "ssh no user" ) << "host:~/src";
+	QTest::newRow( "ssh root" ) << "user@host:/";
+	QTest::newRow( "ssh bare" ) << "user@host:";
+	QTest::newRow( "ssh sudo" ) << "user*@host:/etc/hosts";
+	QTest::newRow( "ssh colon in path" ) << "user@host:/a:b/c";
+	QTest::newRow( "ssh empty user" ) << "@host:/x";
+	QTest::newRow( "ssh two ats" ) << "a@b@host:/x";
+	QTest::newRow( "ssh short host" ) << "user@h:/x";
+	QTest::newRow( "ssh bad host" ) << "user@ho st:/x";
+	QTest::newRow( "sftp" ) << "sftp://user@host/home/user";
+	QTest::newRow( "sftp no user" ) << "sftp://host";
+	QTest::newRow( "sftp home" ) << "sftp://user@host/~/src";
+	QTest::newRow( "sftp empty user" ) << "sftp://@host/x";
+	QTest::newRow( "sftp empty host" ) << "sftp://user@/x";
+	QTest::newRow( "sftp no authority" ) << "sftp:///x";
+	QTest::newRow( "sftp at in path" ) << "sftp://host/a@b";
+	QTest::newRow( "sftp two ats" ) << "sftp://a@b@host/x";
+}
+
+void TestsLocationPath::testParse() {
+	QFETCH( QString, path );
+	compare( parts( LocationPath( path ) ), referenceParse( path ) );
+}
+
+void TestsLocationPath::testChild_data() {
+	QTest::addColumn< QString >( "parent" );
+	QTest::addColumn< QString >( "name" );
+
+	QTest::newRow( "local" ) << "/home/user" << "file.txt";
+	QTest::newRow( "local root" ) << "/" << "etc";
+	QTest::newRow( "windows drive" ) << "C:" << "Users";
+	QTest::newRow( "ssh" ) << "user@host:/var" << "www";
+	QTest::newRow( "ssh root" ) << "user@host:/" << "etc";
+	QTest::newRow( "ssh home" ) << "user*@host:~" << "src";
+	QTest::newRow( "sftp" ) << "sftp://user@host/home" << "user";
+	QTest::newRow( "sftp root" ) << "sftp://host" << "tmp";
+	QTest::newRow( "sftp home" ) << "sftp://host/~" << "src";
+	QTest::newRow( "colon" ) << "user@host:/tmp" << "a:b";
+	QTest::newRow( "backslash" ) << "user@host:/tmp" << "a\\b";
+	QTest::newRow( "trailing space" ) << "/tmp" << "name ";
+	QTest::newRow( "unsaved" ) << "" << "name";
+}
+
+void TestsLocationPath::testChild() {
+	QFETCH( QString, parent );
+	QFETCH( QString, name );
+
+	LocationPath parentPath( parent );
+	LocationPath child( parentPath, name );
+	QString separator = parentPath.getPath().endsWith( '/' ) ? "" : "/";
+	compare( parts( child ), parts( LocationPath( parentPath.getPath() + separator + name ) ) );
+}
+
+void TestsLocationPath::testChildIsLazy() {
+	LocationPath parent( "user@host:/var/www" );
+	LocationPath child( parent, "index.html" );
+
+	// Shares the parent's strings until the full path is wanted.
+	QCOMPARE( child.getHostName().constData(), parent.getHostName().constData() );
+	QCOMPARE( child.getName(), QString( "index.html" ) );
+	QCOMPARE( child.getRemotePath(), QString( "/var/www/index.html" ) );
+	QCOMPARE( child.getPath(), QString( "user@host:/var/www/index.html" ) );
+
+	LocationPath grandchild( child, "x" );
+	QCOMPARE( grandchild.getPath(), QString( "user@host:/var/www/index.html/x" ) );
+}
+
+void TestsLocationPath::benchmarkParse() {
+	QElapsedTimer timer;
+	QString path( "user@host.example.com:/home/user/projects/ponyedit/src/file/location.cpp" );
+
+	timer.start();
+	QBENCHMARK {
+		for ( int i = 0; i < BENCHMARK_COUNT; i++ ) {
+			LocationPath parsed( path );
+		}
+	}
+	reportRate( "Parse", BENCHMARK_COUNT, timer.nsecsElapsed() );
+}
+
+void TestsLocationPath::benchmarkRegExpParse() {
+	QElapsedTimer timer;
+	QString path( "user@host.example.com:/home/user/projects/ponyedit/src/file/location.cpp" );
+
+	// For comparison, a tenth as many the old way.
+	timer.start();
+	QBENCHMARK {
+		for ( int i = 0; i < BENCHMARK_COUNT / 10; i++ ) {
+			referenceParse( path );
+		}
+	}
+	reportRate( "Parse with regexes", BENCHMARK_COUNT / 10, timer.nsecsElapsed() );
+}
+
+void TestsLocationPath::benchmarkChildren() {
+	QElapsedTimer timer;
+	LocationPath parent( "user@host.example.com:/home/user/projects/ponyedit/src/file" );
+	QVector< QString > names;
+	for ( int i = 0; i < 1000; i++ ) {
+		names.append( QString( "file%1.cpp" ).arg( i ) );
+	}
+
+	// A million entries of a listing, kept alive together as a listing would.
+	timer.start();
+	QBENCHMARK {
+		QVector< LocationPath > children;
+		children.reserve( BENCHMARK_COUNT );
+		for ( int i = 0; i < BENCHMARK_COUNT; i++ ) {
+			children.append( LocationPath( parent, names[ i % names.size() ] ) );
+		}
+	}
+	reportRate( "Children", BENCHMARK_COUNT, timer.nsecsElapsed() );
+}
+
+QTEST_APPLESS_MAIN( TestsLocationPath )
+
+#include "tst_locationpath.moc"
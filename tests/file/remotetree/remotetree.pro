@@ -0,0 +1,7 @@
+include( $$TESTSDIR/common.pri );
+
+TARGET = tst_remotetree
+
+SOURCES += \
+    tst_remotetree.cpp \
+	$$SRCDIR/file/remotetree.cpp
@@ -0,0 +1,139 @@
+#include <QtTest>
+
+#include "file/remotetree.h"
+
+class TestsRemoteTree : public QObject {
+	Q_OBJECT
+
+	private Q_SLOTS:
+		void testFiles();
+		void testListing();
+		void testDepthLimit();
+		void testUnwalkedFolders();
+		void testOutsideRoot();
+		void testFilteredAndTruncated();
+		void testInvalidate();
+
+	private:
+		static QVariantList makeFiles();
+};
+
+QVariantList TestsRemoteTree::makeFiles() {
+	QVariantList files;
+	files << "src" << "drw" << 4096 << 1300000000;
+	files << "README" << "rw" << 120 << 1300000001;
+	files << "src/main.cpp" << "rw" << 2000 << 1300000002;
+	files << "src/lib" << "drw" << 4096 << 1300000003;
+	files << "src/lib/util.cpp" << "r" << 300 << 1300000004;
+	return files;
+}
+
+void TestsRemoteTree::testFiles() {
+	RemoteTree tree( "/home/user/project/", 0, 0, false );
+	tree.addEntries( makeFiles() );
+	QCOMPARE( tree.getRootPath(), QString( "/home/user/project" ) );
+	QCOMPARE( tree.count(), 5 );
+
+	QStringList files = tree.getFiles();
+	files.sort();
+	QCOMPARE( files, QStringList() << "README" << "src/lib/util.cpp" << "src/main.cpp" );
+}
+
+void TestsRemoteTree::testListing() {
+	RemoteTree tree( "/home/user/project", 0, 0, false );
+
+	// Parts can split anywhere between entries.
+	QVariantList files = makeFiles();
+	tree.addEntries( files.mid( 0, 8 ) );
+	tree.addEntries( files.mid( 8 ) );
+
+	QVariantMap entries;
+	QVERIFY( tree.getListing( "/home/user/project", &entries ) );
+	QCOMPARE( entries.keys(), QStringList() << "README" << "src" );
+	QCOMPARE( entries.value( "src" ).toMap().value( "f" ).toString(), QString( "drw" ) );
+
+	QVERIFY( tree.getListing( "/home/user/project/src/", &entries ) );
+	QCOMPARE( entries.keys(), QStringList() << "lib" << "main.cpp" );
+	QCOMPARE( entries.value( "main.cpp" ).toMap().value( "s" ).toLongLong(), Q_INT64_C( 2000 ) );
+	QCOMPARE( entries.value( "main.cpp" ).toMap().value( "m" ).toLongLong(), Q_INT64_C( 1300000002 ) );
+
+	QVERIFY( tree.getListing( "/home/user/project/src/lib", &entries ) );
+	QCOMPARE( entries.keys(), QStringList() << "util.cpp" );
+
+	// Files aren't folders.
+	QVERIFY( ! tree.getListing( "/home/user/project/README", &entries ) );
+}
+
+void TestsRemoteTree::testDepthLimit() {
+	RemoteTree tree( "/home/user/project", 0, 2, false );
+	QVariantList files = makeFiles();
+	tree.addEntries( files.mid( 0, 16 ) );
+
+	// Two levels down, src/lib itself was listed but not what's in it.
+	QVariantMap entries;
+	QVERIFY( tree.getListing( "/home/user/project", &entries ) );
+	QVERIFY( tree.getListing( "/home/user/project/src", &entries ) );
+	QVERIFY( ! tree.getListing( "/home/user/project/src/lib", &entries ) );
+}
+
+void TestsRemoteTree::testUnwalkedFolders() {
+	RemoteTree tree( "/home/user/project", 0, 0, false );
+	QVariantList files = makeFiles();
+	files << "linked" << "drwl" << 4096 << 1300000005;
+	files << "locked" << "dw" << 4096 << 1300000006;
+	tree.addEntries( files );
+
+	// Symlinked and unreadable folders are listed, but the tree doesn't know what's in them; ls has to say.
+	QVariantMap entries;
+	QVERIFY( ! tree.getListing( "/home/user/project/linked", &entries ) );
+	QVERIFY( ! tree.getListing( "/home/user/project/locked", &entries ) );
+
+	QVERIFY( tree.getListing( "/home/user/project", &entries ) );
+	QCOMPARE( entries.value( "linked" ).toMap().value( "f" ).toString(), QString( "drw" ) );
+}
+
+void TestsRemoteTree::testOutsideRoot() {
+	RemoteTree tree( "/home/user/project", 0, 0, false );
+	tree.addEntries( makeFiles() );
+
+	QVariantMap entries;
+	QVERIFY( ! tree.getListing( "/home/user", &entries ) );
+	QVERIFY( ! tree.getListing( "/home/user/project2", &entries ) );
+	QVERIFY( ! tree.getListing( "/home/user/project/missing", &entries ) );
+	QVERIFY( tree.contains( "/home/user/project/src/lib" ) );
+	QVERIFY( ! tree.contains( "/home/user/project2" ) );
+
+	RemoteTree rootTree( "/", 0, 0, false );
+	rootTree.addEntries( makeFiles() );
+	QVERIFY( rootTree.getListing( "/src", &entries ) );
+	QCOMPARE( entries.count(), 2 );
+}
+
+void TestsRemoteTree::testFilteredAndTruncated() {
+	QVariantMap entries;
+
+	RemoteTree filtered( "/home/user/project", 0, 0, true );
+	filtered.addEntries( makeFiles() );
+	QVERIFY( ! filtered.getListing( "/home/user/project", &entries ) );
+	QCOMPARE( filtered.getFiles().length(), 3 );
+
+	RemoteTree truncated( "/home/user/project", 0, 0, false );
+	truncated.addEntries( makeFiles() );
+	truncated.setTruncated( true );
+	QVERIFY( ! truncated.getListing( "/home/user/project", &entries ) );
+}
+
+void TestsRemoteTree::testInvalidate() {
+	RemoteTree tree( "/home/user/project", 0, 0, false );
+	tree.addEntries( makeFiles() );
+	tree.invalidate( "/home/user/project/src" );
+
+	QVariantMap entries;
+	QVERIFY( ! tree.getListing( "/home/user/project/src", &entries ) );
+	QVERIFY( tree.getListing( "/home/user/project/src/lib", &entries ) );
+	QVERIFY( tree.getListing( "/home/user/project", &entries ) );
+}
+
+QTEST_APPLESS_MAIN( TestsRemoteTree )
+
+#include "tst_remotetree.moc"
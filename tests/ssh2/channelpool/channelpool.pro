@@ -0,0 +1,10 @@
+include( $$TESTSDIR/common.pri );
+
+TARGET = tst_channelpool
+
+# Short enough to run a few evaluation intervals without slowing the suite down.
+DEFINES += CHANNEL_POOL_INTERVAL_MSEC=20 CHANNEL_POOL_CEILING_DECAY_MSEC=200 CHANNEL_POOL_IDLE_INTERVALS=3
+
+SOURCES += \
+    tst_channelpool.cpp \
+	$$SRCDIR/ssh2/channelpool.cpp
@@ -0,0 +1,218 @@
+#include <QtTest>
+
+#include "ssh2/channelpool.h"
+
+class TestsChannelPool : public QObject {
+	Q_OBJECT
+
+	private Q_SLOTS:
+		void testDefaults();
+		void testMultiplierFollowsLatency();
+		void testGrowWhenSaturated();
+		void testWaitScalesWithRoundTrip();
+		void testRevertWithoutGain();
+		void testKeepGrowthWithGain();
+		void testCeilingDecays();
+		void testShrinkWhenIdle();
+		void testChannelLimit();
+		void testSaveRestore();
+
+	private:
+		static RequestQueueBase::Metrics makeMetrics( qint64 dequeued, qint64 totalWaitMsec );
+		static void nextInterval( ChannelPool *pool );
+};
+
+RequestQueueBase::Metrics TestsChannelPool::makeMetrics( qint64 dequeued, qint64 totalWaitMsec ) {
+	RequestQueueBase::Metrics metrics;
+	metrics.depth = 0;
+	for ( int i = 0; i < RequestQueueBase::PriorityCount; i++ ) {
+		metrics.depthByPriority[ i ] = 0;
+	}
+	metrics.oldestWaitMsec = 0;
+	metrics.dequeued = dequeued;
+	metrics.totalWaitMsec = totalWaitMsec;
+	metrics.maxWaitMsec = 0;
+	return metrics;
+}
+
+void TestsChannelPool::nextInterval( ChannelPool *pool ) {
+	pool->beginInterval();
+	QTest::qSleep( CHANNEL_POOL_INTERVAL_MSEC + 5 );
+	QVERIFY( pool->beginInterval() );
+}
+
+void TestsChannelPool::testDefaults() {
+	ChannelPool pool;
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Server ), 3 );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Xfer ), 7 );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Sftp ), 5 );
+	QCOMPARE( pool.getRoundTripMsec(), ( qint64 ) -1 );
+
+	// The first channel is always wanted; more once the queue is long enough.
+	QVERIFY( pool.wantsChannel( ChannelPool::Server, 1, 0 ) );
+	QVERIFY( ! pool.wantsChannel( ChannelPool::Server, 3, 1 ) );
+	QVERIFY( pool.wantsChannel( ChannelPool::Server, 4, 1 ) );
+	QVERIFY( ! pool.wantsChannel( ChannelPool::Server, 100, 3 ) );
+	QVERIFY( ! pool.beginInterval() );
+}
+
+void TestsChannelPool::testMultiplierFollowsLatency() {
+	ChannelPool near;
+	near.recordRoundTrip( 2 );
+	QCOMPARE( near.getQueueMultiplier( ChannelPool::Server ), 6 );
+	QCOMPARE( near.getQueueMultiplier( ChannelPool::Xfer ), 4 );
+
+	ChannelPool far;
+	far.recordRoundTrip( 300 );
+	QCOMPARE( far.getQueueMultiplier( ChannelPool::Server ), 1 );
+	QVERIFY( far.wantsChannel( ChannelPool::Server, 2, 1 ) );
+
+	// One slow reply doesn't make a fast host far away.
+	near.recordRoundTrip( 300 );
+	QVERIFY( near.getRoundTripMsec() < CHANNEL_POOL_FAR_MSEC );
+}
+
+void TestsChannelPool::testGrowWhenSaturated() {
+	ChannelPool pool;
+	nextInterval( &pool );
+
+	// Waiting, but there were idle channels; more wouldn't help.
+	QCOMPARE( pool.evaluate( ChannelPool::Server, makeMetrics( 10, 10000 ), false, 10 ), ChannelPool::Unchanged );
+
+	nextInterval( &pool );
+	QCOMPARE( pool.evaluate( ChannelPool::Server, makeMetrics( 20, 20000 ), true, 10 ), ChannelPool::Grown );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Server ), 4 );
+
+	// Busy, but nobody waited long.
+	nextInterval( &pool );
+	QCOMPARE( pool.evaluate( ChannelPool::Server, makeMetrics( 30, 20100 ), true, 10 ), ChannelPool::Unchanged );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Server ), 4 );
+}
+
+void TestsChannelPool::testWaitScalesWithRoundTrip() {
+	// Half a second is nothing on a link with 200msec round trips.
+	ChannelPool pool;
+	pool.recordRoundTrip( 200 );
+	nextInterval( &pool );
+	QCOMPARE( pool.evaluate( ChannelPool::Server, makeMetrics( 10, 5000 ), true, 10 ), ChannelPool::Unchanged );
+
+	nextInterval( &pool );
+	QCOMPARE( pool.evaluate( ChannelPool::Server, makeMetrics( 20, 15000 ), true, 10 ), ChannelPool::Grown );
+}
+
+void TestsChannelPool::testRevertWithoutGain() {
+	ChannelPool pool;
+	nextInterval( &pool );
+	pool.recordTransfer( ChannelPool::Xfer, 1000000 );
+	QCOMPARE( pool.evaluate( ChannelPool::Xfer, makeMetrics( 10, 10000 ), true, 10 ), ChannelPool::Grown );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Xfer ), 8 );
+
+	// The extra channel bought nothing; the link is full.
+	nextInterval( &pool );
+	pool.recordTransfer( ChannelPool::Xfer, 1000 );
+	QCOMPARE( pool.evaluate( ChannelPool::Xfer, makeMetrics( 20, 20000 ), true, 10 ), ChannelPool::Shrunk );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Xfer ), 7 );
+
+	// ...and it isn't tried again.
+	nextInterval( &pool );
+	QCOMPARE( pool.evaluate( ChannelPool::Xfer, makeMetrics( 30, 30000 ), true, 10 ), ChannelPool::Unchanged );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Xfer ), 7 );
+}
+
+void TestsChannelPool::testKeepGrowthWithGain() {
+	ChannelPool pool;
+	nextInterval( &pool );
+	pool.recordTransfer( ChannelPool::Sftp, 1000 );
+	QCOMPARE( pool.evaluate( ChannelPool::Sftp, makeMetrics( 10, 10000 ), true, 10 ), ChannelPool::Grown );
+
+	nextInterval( &pool );
+	pool.recordTransfer( ChannelPool::Sftp, 1000000 );
+	QCOMPARE( pool.evaluate( ChannelPool::Sftp, makeMetrics( 20, 20000 ), true, 10 ), ChannelPool::Grown );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Sftp ), 7 );
+}
+
+void TestsChannelPool::testCeilingDecays() {
+	ChannelPool pool;
+	nextInterval( &pool );
+	pool.recordTransfer( ChannelPool::Xfer, 1000000 );
+	QCOMPARE( pool.evaluate( ChannelPool::Xfer, makeMetrics( 10, 10000 ), true, 10 ), ChannelPool::Grown );
+	nextInterval( &pool );
+	pool.recordTransfer( ChannelPool::Xfer, 1000 );
+	QCOMPARE( pool.evaluate( ChannelPool::Xfer, makeMetrics( 20, 20000 ), true, 10 ), ChannelPool::Shrunk );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Xfer ), 7 );
+
+	// Once the ceiling has held for a while, the extra channel gets another trial.
+	QTest::qSleep( CHANNEL_POOL_CEILING_DECAY_MSEC + 5 );
+	nextInterval( &pool );
+	QCOMPARE( pool.evaluate( ChannelPool::Xfer, makeMetrics( 30, 30000 ), true, 10 ), ChannelPool::Grown );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Xfer ), 8 );
+
+	// Ceilings saved without a timestamp are overdue.
+	QVariantMap xfer;
+	xfer.insert( "max", 7 );
+	xfer.insert( "ceiling", 8 );
+	QVariantMap state;
+	state.insert( "xfer", xfer );
+
+	ChannelPool restored;
+	restored.restore( state );
+	nextInterval( &restored );
+	QCOMPARE( restored.evaluate( ChannelPool::Xfer, makeMetrics( 10, 10000 ), true, 10 ), ChannelPool::Grown );
+	QCOMPARE( restored.getMaxChannels( ChannelPool::Xfer ), 8 );
+}
+
+void TestsChannelPool::testShrinkWhenIdle() {
+	ChannelPool pool;
+	nextInterval( &pool );
+	QCOMPARE( pool.evaluate( ChannelPool::Server, makeMetrics( 10, 10000 ), true, 10 ), ChannelPool::Grown );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Server ), 4 );
+
+	for ( int i = 1; i < CHANNEL_POOL_IDLE_INTERVALS; i++ ) {
+		nextInterval( &pool );
+		QCOMPARE( pool.evaluate( ChannelPool::Server, makeMetrics( 10, 10000 ), false, 10 ), ChannelPool::Unchanged );
+	}
+	nextInterval( &pool );
+	QCOMPARE( pool.evaluate( ChannelPool::Server, makeMetrics( 10, 10000 ), false, 10 ), ChannelPool::Shrunk );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Server ), 3 );
+
+	// Never below the default.
+	for ( int i = 0; i < CHANNEL_POOL_IDLE_INTERVALS; i++ ) {
+		nextInterval( &pool );
+		QCOMPARE( pool.evaluate( ChannelPool::Server, makeMetrics( 10, 10000 ), false, 10 ), ChannelPool::Unchanged );
+	}
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Server ), 3 );
+}
+
+void TestsChannelPool::testChannelLimit() {
+	ChannelPool pool;
+	nextInterval( &pool );
+	QCOMPARE( pool.evaluate( ChannelPool::Xfer, makeMetrics( 0, 0 ), false, 4 ), ChannelPool::Shrunk );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Xfer ), 4 );
+
+	nextInterval( &pool );
+	QCOMPARE( pool.evaluate( ChannelPool::Xfer, makeMetrics( 10, 10000 ), true, 4 ), ChannelPool::Unchanged );
+	QCOMPARE( pool.getMaxChannels( ChannelPool::Xfer ), 4 );
+}
+
+void TestsChannelPool::testSaveRestore() {
+	ChannelPool pool;
+	pool.recordRoundTrip( 80 );
+	nextInterval( &pool );
+	pool.evaluate( ChannelPool::Server, makeMetrics( 10, 10000 ), true, 10 );
+
+	ChannelPool restored;
+	restored.restore( pool.save() );
+	QCOMPARE( restored.getMaxChannels( ChannelPool::Server ), 4 );
+	QCOMPARE( restored.getMaxChannels( ChannelPool::Xfer ), 7 );
+	QCOMPARE( restored.getRoundTripMsec(), ( qint64 ) 80 );
+
+	// Nothing saved means defaults.
+	ChannelPool blank;
+	blank.restore( QVariantMap() );
+	QCOMPARE( blank.getMaxChannels( ChannelPool::Server ), 3 );
+	QCOMPARE( blank.getRoundTripMsec(), ( qint64 ) -1 );
+}
+
+QTEST_APPLESS_MAIN( TestsChannelPool )
+
+#include "tst_channelpool.moc"
@@ -0,0 +1,134 @@
+#include <math.h>
+
+#include "linkshaper.h"
+
+ShapedPipe::ShapedPipe( QTcpSocket *from, QTcpSocket *to, const LinkProfile &profile, quint32 seed, QObject *parent ) :
+	QObject( parent ),
+	mFrom( from ),
+	mTo( to ),
+	mProfile( profile ),
+	mRandom( seed ),
+	mClock(),
+	mTimer(),
+	mChunks(),
+	mWireFreeAt( 0 ),
+	mClosing( false ) {
+	mClock.start();
+	mTimer.setSingleShot( true );
+	mTimer.setTimerType( Qt::PreciseTimer );
+
+	connect( &mTimer, SIGNAL( timeout() ), this, SLOT( sendDue() ) );
+	connect( mFrom, SIGNAL( readyRead() ), this, SLOT( readData() ) );
+	connect( mFrom, SIGNAL( disconnected() ), this, SLOT( sourceClosed() ) );
+}
+
+double ShapedPipe::now() const {
+	return mClock.nsecsElapsed() / 1000000.0;
+}
+
+void ShapedPipe::readData() {
+	QByteArray data = mFrom->readAll();
+	if ( data.isEmpty() ) {
+		return;
+	}
+
+	double start = qMax( now(), mWireFreeAt );
+	double wireTime = 0;
+	if ( mProfile.kbytesPerSec > 0 ) {
+		wireTime = ( data.length() * 1000.0 ) / ( mProfile.kbytesPerSec * 1024.0 );
+	}
+	mWireFreeAt = start + wireTime;
+
+	Chunk chunk;
+	chunk.due = mWireFreeAt + mProfile.latencyMsec;
+	chunk.data = data;
+
+	if ( mProfile.lossPercent > 0 ) {
+		double timeout = qMax( LINK_MIN_RTO_MSEC, mProfile.latencyMsec * 3 );
+		int segments = ( data.length() + LINK_SEGMENT_SIZE - 1 ) / LINK_SEGMENT_SIZE;
+		for ( int i = 0; i < segments; i++ ) {
+			if ( mRandom.generateDouble() * 100.0 < mProfile.lossPercent ) {
+				chunk.due += timeout;
+			}
+		}
+	}
+
+	// Chunks go out in order, so a stalled chunk holds up everything behind it, as it would on a TCP stream.
+	mChunks.enqueue( chunk );
+	if ( ! mTimer.isActive() ) {
+		sendDue();
+	}
+}
+
+void ShapedPipe::sendDue() {
+	double current = now();
+	while ( ! mChunks.isEmpty() && mChunks.head().due <= current ) {
+		mTo->write( mChunks.dequeue().data );
+	}
+
+	if ( ! mChunks.isEmpty() ) {
+		mTimer.start( ( int ) ceil( mChunks.head().due - current ) );
+	} else if ( mClosing ) {
+		mTo->disconnectFromHost();
+	}
+}
+
+void ShapedPipe::sourceClosed() {
+	readData();
+	mClosing = true;
+	if ( mChunks.isEmpty() ) {
+		mTo->disconnectFromHost();
+	}
+}
+
+ShaperServer::ShaperServer( quint16 targetPort, const LinkProfile &profile ) :
+	QTcpServer(),
+	mTargetPort( targetPort ),
+	mProfile( profile ),
+	mNextSeed( 1 ) {}
+
+void ShaperServer::incomingConnection( qintptr descriptor ) {
+	QTcpSocket *client = new QTcpSocket( this );
+	client->setSocketDescriptor( descriptor );
+	client->setSocketOption( QAbstractSocket::LowDelayOption, 1 );
+
+	// Anything the client sends before this connects is buffered by the socket.
+	QTcpSocket *upstream = new QTcpSocket( this );
+	upstream->connectToHost( QHostAddress::LocalHost, mTargetPort );
+	upstream->setSocketOption( QAbstractSocket::LowDelayOption, 1 );
+
+	// Fixed seeds, so a run with loss is repeatable.
+	new ShapedPipe( client, upstream, mProfile, mNextSeed++, this );
+	new ShapedPipe( upstream, client, mProfile, mNextSeed++, this );
+}
+
+LinkShaper::LinkShaper( quint16 targetPort, const LinkProfile &profile ) :
+	QThread(),
+	mTargetPort( targetPort ),
+	mProfile( profile ),
+	mListening(),
+	mPort( 0 ) {}
+
+LinkShaper::~LinkShaper() {
+	quit();
+	wait();
+}
+
+quint16 LinkShaper::listen() {
+	start();
+	mListening.acquire();
+	return mPort;
+}
+
+void LinkShaper::run() {
+	// Everything is created here, so it all lives in this thread.
+	ShaperServer server( mTargetPort, mProfile );
+	if ( server.listen( QHostAddress::LocalHost, 0 ) ) {
+		mPort = server.serverPort();
+	}
+	mListening.release();
+
+	if ( mPort ) {
+		exec();
+	}
+}
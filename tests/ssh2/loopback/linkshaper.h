@@ -0,0 +1,101 @@
+#ifndef LINKSHAPER_H
+#define LINKSHAPER_H
+
+#include <QElapsedTimer>
+#include <QQueue>
+#include <QRandomGenerator>
+#include <QSemaphore>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+
+//
+// A TCP proxy that makes loopback behave like a real link. Each direction is shaped separately:
+//
+//  - Bandwidth: data is serialized onto the "wire" at the given rate, so bursts queue up behind each other.
+//  - Latency: everything arrives this long after it leaves the wire.
+//  - Loss: each segment is dropped at random with the given probability. As TCP would retransmit it, the drop is
+//    modeled as a retransmit timeout stall; everything behind it waits too.
+//
+// The proxy runs its own thread, so a blocking client on the test thread doesn't stop the clock.
+//
+
+// The size of a segment for loss purposes, and the shortest retransmit timeout (what Linux uses).
+#define LINK_SEGMENT_SIZE 1448
+#define LINK_MIN_RTO_MSEC 200
+
+struct LinkProfile {
+	LinkProfile( int latencyMsec = 0, int kbytesPerSec = 0, double lossPercent = 0 ) :
+		latencyMsec( latencyMsec ),
+		kbytesPerSec( kbytesPerSec ),
+		lossPercent( lossPercent ) {}
+
+	int latencyMsec;        // One way.
+	int kbytesPerSec;       // Each way; 0 for unlimited.
+	double lossPercent;     // Per segment.
+};
+
+class ShapedPipe : public QObject {
+	Q_OBJECT
+
+	public:
+		ShapedPipe( QTcpSocket *from, QTcpSocket *to, const LinkProfile &profile, quint32 seed, QObject *parent );
+
+	private slots:
+		void readData();
+		void sendDue();
+		void sourceClosed();
+
+	private:
+		struct Chunk {
+			double due;
+			QByteArray data;
+		};
+
+		double now() const;
+
+		QTcpSocket *mFrom;
+		QTcpSocket *mTo;
+		LinkProfile mProfile;
+		QRandomGenerator mRandom;
+
+		QElapsedTimer mClock;
+		QTimer mTimer;
+		QQueue< Chunk > mChunks;
+		double mWireFreeAt;     // When the last queued byte is off the wire, in msec.
+		bool mClosing;
+};
+
+class ShaperServer : public QTcpServer {
+	public:
+		ShaperServer( quint16 targetPort, const LinkProfile &profile );
+
+	protected:
+		void incomingConnection( qintptr descriptor );
+
+	private:
+		quint16 mTargetPort;
+		LinkProfile mProfile;
+		quint32 mNextSeed;
+};
+
+class LinkShaper : public QThread {
+	public:
+		LinkShaper( quint16 targetPort, const LinkProfile &profile );
+		~LinkShaper();
+
+		// Starts the proxy; returns the port to connect to in place of targetPort, or 0 if it couldn't listen.
+		quint16 listen();
+
+	protected:
+		void run();
+
+	private:
+		quint16 mTargetPort;
+		LinkProfile mProfile;
+		QSemaphore mListening;
+		quint16 mPort;
+};
+
+#endif  // LINKSHAPER_H
@@ -0,0 +1,24 @@
+include( $$TESTSDIR/common.pri );
+
+TARGET = tst_loopback
+
+QT += network
+
+DEFINES += "SERVER_SCRIPT_PATH=\\\"$$SRCDIR/server/server.pl\\\""
+
+# The loopback server is only set up for Linux boxes.
+linux {
+	LIBS += -lssh2 -lcrypto -lssl
+}
+
+HEADERS += \
+	linkshaper.h \
+	loopbackclient.h \
+	loopbackserver.h
+
+SOURCES += \
+    tst_loopback.cpp \
+	linkshaper.cpp \
+	loopbackclient.cpp \
+	loopbackserver.cpp \
+	$$SRCDIR/tools/bincodec.cpp
@@ -0,0 +1,160 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "loopbackclient.h"
+
+#define LOOPBACK_SHELL_INIT " stty -echo; export PS1=\\%-ponyedit-\\%\n"
+#define LOOPBACK_PROMPT "%-ponyedit-%"
+
+LoopbackClient::LoopbackClient() :
+	mSocket( -1 ),
+	mHandle( NULL ),
+	mError() {}
+
+LoopbackClient::~LoopbackClient() {
+	if ( mHandle ) {
+		libssh2_session_disconnect( mHandle, "Done" );
+		libssh2_session_free( mHandle );
+	}
+	if ( mSocket != -1 ) {
+		close( mSocket );
+	}
+}
+
+bool LoopbackClient::connectTo( quint16 port,
+                                const QString &user,
+                                const QString &publicKey,
+                                const QString &privateKey ) {
+	mSocket = socket( AF_INET, SOCK_STREAM, 0 );
+	if ( mSocket == -1 ) {
+		mError = "Unable to open socket";
+		return false;
+	}
+
+	struct sockaddr_in sin;
+	memset( &sin, 0, sizeof( sockaddr_in ) );
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons( port );
+	sin.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	if ( ::connect( mSocket, ( struct sockaddr * ) &sin, sizeof( struct sockaddr_in ) ) != 0 ) {
+		mError = "Connection refused";
+		return false;
+	}
+
+	// The shaper decides when things arrive; Nagle shouldn't.
+	int noDelay = 1;
+	setsockopt( mSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof( noDelay ) );
+
+	mHandle = libssh2_session_init();
+	libssh2_session_set_blocking( mHandle, 1 );
+	if ( int rc = libssh2_session_handshake( mHandle, mSocket ) ) {
+		mError = QString( "Handshake failed: %1" ).arg( rc );
+		return false;
+	}
+
+	if ( int rc = libssh2_userauth_publickey_fromfile( mHandle,
+	                                                   user.toUtf8().constData(),
+	                                                   publicKey.toLocal8Bit().constData(),
+	                                                   privateKey.toLocal8Bit().constData(),
+	                                                   "" ) ) {
+		mError = QString( "Authentication failed: %1" ).arg( rc );
+		return false;
+	}
+
+	return true;
+}
+
+LoopbackShell::LoopbackShell( LoopbackClient *client ) :
+	mClient( client ),
+	mHandle( NULL ),
+	mBuffer() {}
+
+LoopbackShell::~LoopbackShell() {
+	if ( mHandle ) {
+		libssh2_channel_close( mHandle );
+		libssh2_channel_free( mHandle );
+	}
+}
+
+bool LoopbackShell::start( const QByteArray &command ) {
+	mHandle = libssh2_channel_open_session( mClient->getHandle() );
+	if ( ! mHandle ||
+	     libssh2_channel_request_pty( mHandle, "vanilla" ) ||
+	     libssh2_channel_exec( mHandle, "sh" ) ) {
+		return false;
+	}
+
+	return send( LOOPBACK_SHELL_INIT ) &&
+	       readUntil( LOOPBACK_PROMPT ) &&
+	       send( command ) &&
+	       readUntil( LOOPBACK_PROMPT );
+}
+
+bool LoopbackShell::send( const QByteArray &data ) {
+	const char *cursor = data.constData();
+	const char *end = cursor + data.length();
+	while ( cursor < end ) {
+		ssize_t rc = libssh2_channel_write( mHandle, cursor, end - cursor );
+		if ( rc < 0 ) {
+			return false;
+		}
+		cursor += rc;
+	}
+	return true;
+}
+
+bool LoopbackShell::receive() {
+	char buffer[ 65536 ];
+	ssize_t rc = libssh2_channel_read( mHandle, buffer, sizeof( buffer ) );
+	if ( rc <= 0 ) {
+		return false;
+	}
+	mBuffer.append( buffer, ( int ) rc );
+	return true;
+}
+
+bool LoopbackShell::readLine( QByteArray *line ) {
+	int end;
+	while ( ( end = mBuffer.indexOf( '\n' ) ) == -1 ) {
+		if ( ! receive() ) {
+			return false;
+		}
+	}
+
+	*line = mBuffer.left( end );
+	mBuffer.remove( 0, end + 1 );
+	if ( line->endsWith( '\r' ) ) {
+		line->chop( 1 );
+	}
+	return true;
+}
+
+bool LoopbackShell::readUntil( const QByteArray &marker ) {
+	int found;
+	while ( ( found = mBuffer.indexOf( marker ) ) == -1 ) {
+		if ( ! receive() ) {
+			return false;
+		}
+	}
+
+	mBuffer.remove( 0, found + marker.length() );
+	return true;
+}
+
+bool LoopbackShell::read( QByteArray *data ) {
+	if ( mBuffer.isEmpty() && ! receive() ) {
+		return false;
+	}
+
+	*data = mBuffer;
+	mBuffer.clear();
+	return true;
+}
+
+void LoopbackShell::unread( const QByteArray &data ) {
+	mBuffer.prepend( data );
+}
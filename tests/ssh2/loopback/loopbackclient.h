@@ -0,0 +1,63 @@
+#ifndef LOOPBACKCLIENT_H
+#define LOOPBACKCLIENT_H
+
+#include <QByteArray>
+#include <QString>
+#include <libssh2.h>
+#include <libssh2_sftp.h>
+
+//
+// A blocking libssh2 client for the loopback tests. It speaks the same protocols as the real channels, over the
+// same kind of connection, but without SshHost and its queues around it; so timings are of the transport and the
+// server script, not of the GUI.
+//
+
+class LoopbackClient {
+	public:
+		LoopbackClient();
+		~LoopbackClient();
+
+		bool connectTo( quint16 port, const QString &user, const QString &publicKey, const QString &privateKey );
+
+		inline LIBSSH2_SESSION *getHandle() const {
+			return mHandle;
+		}
+		inline const QString &getError() const {
+			return mError;
+		}
+
+	private:
+		int mSocket;
+		LIBSSH2_SESSION *mHandle;
+		QString mError;
+};
+
+//
+// A machine readable shell, set up the way ShellChannel sets one up: a pty, echo off and a recognisable prompt.
+//
+
+class LoopbackShell {
+	public:
+		LoopbackShell( LoopbackClient *client );
+		~LoopbackShell();
+
+		// Opens the shell, then runs command and waits for it to print a prompt (as server.pl does once it's ready).
+		bool start( const QByteArray &command );
+
+		bool send( const QByteArray &data );
+		bool readLine( QByteArray *line );              // Without the line ending.
+		bool readUntil( const QByteArray &marker );     // Discards everything up to and including marker.
+
+		// Returns whatever has been received but not read yet, waiting for more if there's nothing.
+		bool read( QByteArray *data );
+		void unread( const QByteArray &data );
+
+	private:
+		bool receive();
+
+		LoopbackClient *mClient;
+		LIBSSH2_CHANNEL *mHandle;
+		QByteArray mBuffer;
+};
+
+#endif  // LOOPBACKCLIENT_H
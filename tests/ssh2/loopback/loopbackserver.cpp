@@ -0,0 +1,160 @@
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStandardPaths>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <pwd.h>
+#include <unistd.h>
+
+#include "loopbackserver.h"
+
+// How long sshd gets to start listening.
+#define LOOPBACK_START_MSEC 5000
+
+LoopbackServer::LoopbackServer() :
+	mDir(),
+	mProcess(),
+	mPort( 0 ),
+	mError() {}
+
+LoopbackServer::~LoopbackServer() {
+	stop();
+}
+
+QString LoopbackServer::getUser() const {
+	struct passwd *entry = getpwuid( geteuid() );
+	return entry ? QString::fromLocal8Bit( entry->pw_name ) : QString::fromLocal8Bit( qgetenv( "USER" ) );
+}
+
+QString LoopbackServer::getPrivateKeyFile() const {
+	return mDir.filePath( "client_key" );
+}
+
+QString LoopbackServer::getPublicKeyFile() const {
+	return mDir.filePath( "client_key.pub" );
+}
+
+QString LoopbackServer::getWorkPath() const {
+	return mDir.filePath( "work" );
+}
+
+bool LoopbackServer::start() {
+	// sshd insists on being run by its full path.
+	QString sshd = QStandardPaths::findExecutable( "sshd", QStringList() << "/usr/sbin" << "/usr/local/sbin" << "/sbin" );
+	if ( sshd.isEmpty() ) {
+		sshd = QStandardPaths::findExecutable( "sshd" );
+	}
+	QString keygen = QStandardPaths::findExecutable( "ssh-keygen" );
+	if ( sshd.isEmpty() || keygen.isEmpty() ) {
+		mError = "sshd and ssh-keygen are needed to run a loopback server";
+		return false;
+	}
+
+	if ( ! mDir.isValid() ) {
+		mError = "Failed to create a temporary directory";
+		return false;
+	}
+
+	// PEM ecdsa keys are the ones every libssh2 build can read.
+	QStringList keyOptions = QStringList() << "-q" << "-t" << "ecdsa" << "-b" << "256" << "-m" << "PEM" << "-N" << "";
+	if ( ! run( keygen, QStringList( keyOptions ) << "-f" << mDir.filePath( "host_key" ) ) ||
+	     ! run( keygen, QStringList( keyOptions ) << "-f" << getPrivateKeyFile() ) ) {
+		return false;
+	}
+	if ( ! QFile::copy( getPublicKeyFile(), mDir.filePath( "authorized_keys" ) ) ||
+	     ! QDir().mkpath( getWorkPath() + "/.ponyedit" ) ) {
+		mError = "Failed to set up the server directory";
+		return false;
+	}
+
+	// Find a free port. Something else could take it before sshd does, but not on a test box.
+	QTcpServer probe;
+	if ( ! probe.listen( QHostAddress::LocalHost, 0 ) ) {
+		mError = "Failed to find a free port";
+		return false;
+	}
+	mPort = probe.serverPort();
+	probe.close();
+
+	QString config = mDir.filePath( "sshd_config" );
+	if ( ! writeConfig( config ) ) {
+		return false;
+	}
+
+	mProcess.setProcessChannelMode( QProcess::MergedChannels );
+	mProcess.start( sshd, QStringList() << "-D" << "-e" << "-f" << config );
+	if ( ! mProcess.waitForStarted() ) {
+		mError = "Failed to start " + sshd;
+		return false;
+	}
+
+	return waitForPort();
+}
+
+void LoopbackServer::stop() {
+	if ( mProcess.state() != QProcess::NotRunning ) {
+		mProcess.terminate();
+		if ( ! mProcess.waitForFinished( 2000 ) ) {
+			mProcess.kill();
+			mProcess.waitForFinished();
+		}
+	}
+}
+
+bool LoopbackServer::run( const QString &program, const QStringList &arguments ) {
+	QProcess process;
+	process.setProcessChannelMode( QProcess::MergedChannels );
+	process.start( program, arguments );
+	if ( ! process.waitForFinished() || process.exitCode() != 0 ) {
+		mError = program + " failed: " + QString::fromLocal8Bit( process.readAll() );
+		return false;
+	}
+	return true;
+}
+
+bool LoopbackServer::writeConfig( const QString &path ) {
+	QFile file( path );
+	if ( ! file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) {
+		mError = "Failed to write " + path;
+		return false;
+	}
+
+	QByteArray config;
+	config += "Port " + QByteArray::number( mPort ) + "\n";
+	config += "ListenAddress 127.0.0.1\n";
+	config += "HostKey " + mDir.filePath( "host_key" ).toLocal8Bit() + "\n";
+	config += "PidFile " + mDir.filePath( "sshd.pid" ).toLocal8Bit() + "\n";
+	config += "AuthorizedKeysFile " + mDir.filePath( "authorized_keys" ).toLocal8Bit() + "\n";
+	config += "PubkeyAuthentication yes\n";
+	config += "PasswordAuthentication no\n";
+	config += "StrictModes no\n";
+	config += "UsePAM no\n";
+	config += "LogLevel ERROR\n";
+	config += "Subsystem sftp internal-sftp\n";
+
+	file.write( config );
+	return true;
+}
+
+bool LoopbackServer::waitForPort() {
+	QElapsedTimer timer;
+	timer.start();
+	while ( timer.elapsed() < LOOPBACK_START_MSEC ) {
+		if ( mProcess.state() == QProcess::NotRunning ) {
+			mError = "sshd exited: " + QString::fromLocal8Bit( mProcess.readAll() );
+			return false;
+		}
+
+		QTcpSocket probe;
+		probe.connectToHost( QHostAddress::LocalHost, mPort );
+		if ( probe.waitForConnected( 100 ) ) {
+			return true;
+		}
+		QThread::msleep( 50 );
+	}
+
+	mError = "sshd didn't start listening";
+	return false;
+}
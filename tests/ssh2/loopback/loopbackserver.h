@@ -0,0 +1,44 @@
+#ifndef LOOPBACKSERVER_H
+#define LOOPBACKSERVER_H
+
+#include <QProcess>
+#include <QString>
+#include <QTemporaryDir>
+
+//
+// A private sshd on 127.0.0.1, running as the current user out of a temporary directory with its own host key and
+// a single authorized client key. Nothing outside the directory is touched, and nothing needs the network.
+//
+
+class LoopbackServer {
+	public:
+		LoopbackServer();
+		~LoopbackServer();
+
+		bool start();       // Returns false, with getError() set, if sshd couldn't be started here.
+		void stop();
+
+		inline quint16 getPort() const {
+			return mPort;
+		}
+		inline const QString &getError() const {
+			return mError;
+		}
+
+		QString getUser() const;
+		QString getPrivateKeyFile() const;
+		QString getPublicKeyFile() const;
+		QString getWorkPath() const;      // Scratch space for the tests; also where server.pl runs.
+
+	private:
+		bool run( const QString &program, const QStringList &arguments );
+		bool writeConfig( const QString &path );
+		bool waitForPort();
+
+		QTemporaryDir mDir;
+		QProcess mProcess;
+		quint16 mPort;
+		QString mError;
+};
+
+#endif  // LOOPBACKSERVER_H
@@ -0,0 +1,372 @@
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QMap>
+#include <QRandomGenerator>
+#include <QVector>
+#include <QtTest>
+#include <algorithm>
+
+#include "linkshaper.h"
+#include "loopbackclient.h"
+#include "loopbackserver.h"
+#include "tools/bincodec.h"
+
+//
+// Runs the server script, the xfer protocol and SFTP against a private sshd on loopback, through a shaped link, and
+// reports request latencies and transfer rates for each link profile. Skipped where there's no sshd.
+//
+// Add a profile of your own with PONYEDIT_LOOPBACK_LINK=<latency msec>,<KB/sec>,<loss %>.
+//
+
+#ifndef LOOPBACK_REQUEST_ROUNDS
+	#define LOOPBACK_REQUEST_ROUNDS 40
+#endif
+#ifndef LOOPBACK_TRANSFER_BYTES
+	#define LOOPBACK_TRANSFER_BYTES ( 4 * 1024 * 1024 )
+#endif
+
+// What SFTPChannel starts out reading and writing at a time, and what XferChannel sends at a time.
+#define LOOPBACK_SFTP_IO_SIZE ( 128 * 1024 )
+#define LOOPBACK_XFER_SEND_SIZE ( 64 * 1024 )
+
+class TestsLoopback : public QObject {
+	Q_OBJECT
+
+	private Q_SLOTS:
+		void initTestCase();
+		void cleanupTestCase();
+
+		void testServerRequests_data();
+		void testServerRequests();
+		void testXferTransfers_data();
+		void testXferTransfers();
+		void testSftpTransfers_data();
+		void testSftpTransfers();
+
+	private:
+		static void addLinkColumns();
+		static QByteArray makePayload( int length );
+		static QByteArray md5( const QByteArray &data );
+		static void reportLatency( const char *operation, QVector< qint64 > nsecs );
+		static void reportThroughput( const char *operation, qint64 bytes, qint64 nsecs );
+
+		bool connectClient( LinkShaper *shaper, LoopbackClient *client );
+		bool serverRequest( LoopbackShell *shell, const QByteArray &command, const QVariantMap &params, int bufferId,
+		                    QVariantMap *reply, qint64 *nsecs );
+
+		LoopbackServer mServer;
+		QString mScriptPath;
+		int mNextMessageId;
+};
+
+void TestsLoopback::initTestCase() {
+	mNextMessageId = 1;
+	if ( ! mServer.start() ) {
+		QSKIP( qPrintable( mServer.getError() ) );
+	}
+	QVERIFY( libssh2_init( 0 ) == 0 );
+
+	// A copy of the script, so the test never leaves anything next to the source.
+	mScriptPath = mServer.getWorkPath() + "/server.pl";
+	QVERIFY( QFile::copy( SERVER_SCRIPT_PATH, mScriptPath ) );
+
+	QFile document( mServer.getWorkPath() + "/document.txt" );
+	QVERIFY( document.open( QIODevice::WriteOnly ) );
+	for ( int i = 0; i < 2000; i++ ) {
+		document.write( "The quick brown fox jumps over the lazy dog, line " + QByteArray::number( i ) + "\n" );
+	}
+}
+
+void TestsLoopback::cleanupTestCase() {
+	mServer.stop();
+	libssh2_exit();
+}
+
+void TestsLoopback::addLinkColumns() {
+	QTest::addColumn< int >( "latencyMsec" );
+	QTest::addColumn< int >( "kbytesPerSec" );
+	QTest::addColumn< double >( "lossPercent" );
+
+	QTest::newRow( "loopback" ) << 0 << 0 << 0.0;
+	QTest::newRow( "lan" ) << 1 << 0 << 0.0;
+	QTest::newRow( "wan" ) << 40 << 4096 << 0.5;
+
+	QList< QByteArray > custom = qgetenv( "PONYEDIT_LOOPBACK_LINK" ).split( ',' );
+	if ( custom.length() == 3 ) {
+		QTest::newRow( "custom" ) << custom[ 0 ].toInt() << custom[ 1 ].toInt() << custom[ 2 ].toDouble();
+	}
+}
+
+QByteArray TestsLoopback::makePayload( int length ) {
+	// Every byte value turns up, so the transfer pays for escaping the way real binaries do.
+	QRandomGenerator random( 42 );
+	QByteArray payload( length, 0 );
+	for ( int i = 0; i < length; i++ ) {
+		payload[ i ] = ( char ) random.bounded( 256 );
+	}
+	return payload;
+}
+
+QByteArray TestsLoopback::md5( const QByteArray &data ) {
+	return QCryptographicHash::hash( data, QCryptographicHash::Md5 ).toHex();
+}
+
+void TestsLoopback::reportLatency( const char *operation, QVector< qint64 > nsecs ) {
+	if ( nsecs.isEmpty() ) {
+		return;
+	}
+
+	std::sort( nsecs.begin(), nsecs.end() );
+	int last = nsecs.length() - 1;
+	qDebug( "%s %-6s p50 %8.2f  p90 %8.2f  p99 %8.2f msec",
+	        QTest::currentDataTag(),
+	        operation,
+	        nsecs[ qMin( last, nsecs.length() * 50 / 100 ) ] / 1000000.0,
+	        nsecs[ qMin( last, nsecs.length() * 90 / 100 ) ] / 1000000.0,
+	        nsecs[ qMin( last, nsecs.length() * 99 / 100 ) ] / 1000000.0 );
+}
+
+void TestsLoopback::reportThroughput( const char *operation, qint64 bytes, qint64 nsecs ) {
+	qDebug( "%s %-8s %8.2f MB/s",
+	        QTest::currentDataTag(),
+	        operation,
+	        ( bytes / ( 1024.0 * 1024.0 ) ) / ( qMax( nsecs, 1LL ) / 1000000000.0 ) );
+}
+
+bool TestsLoopback::connectClient( LinkShaper *shaper, LoopbackClient *client ) {
+	quint16 port = shaper->listen();
+	if ( ! port ) {
+		qWarning( "The link shaper couldn't listen" );
+		return false;
+	}
+
+	if ( ! client->connectTo( port, mServer.getUser(), mServer.getPublicKeyFile(), mServer.getPrivateKeyFile() ) ) {
+		qWarning( "%s", qPrintable( client->getError() ) );
+		return false;
+	}
+	return true;
+}
+
+bool TestsLoopback::serverRequest( LoopbackShell *shell,
+                                   const QByteArray &command,
+                                   const QVariantMap &params,
+                                   int bufferId,
+                                   QVariantMap *reply,
+                                   qint64 *nsecs ) {
+	// Packed the way ServerRequest::prepare() does it.
+	QVariantMap request;
+	request.insert( "i", mNextMessageId++ );
+	request.insert( "c", command );
+	request.insert( "p", params );
+	if ( bufferId > -1 ) {
+		request.insert( "b", bufferId );
+	}
+	QByteArray packed = BinCodec::encode( QJsonDocument::fromVariant( request ).toJson() ) + "\n";
+
+	QElapsedTimer timer;
+	timer.start();
+	QByteArray line;
+	if ( ! shell->send( packed ) || ! shell->readLine( &line ) ) {
+		return false;
+	}
+	*nsecs = timer.nsecsElapsed();
+
+	*reply = QJsonDocument::fromJson( line ).toVariant().toMap();
+	if ( reply->value( "i" ).toInt() != request.value( "i" ).toInt() || reply->contains( "error" ) ) {
+		qWarning( "Bad reply to %s: %s", command.constData(), line.constData() );
+		return false;
+	}
+	return true;
+}
+
+void TestsLoopback::testServerRequests_data() {
+	addLinkColumns();
+}
+
+void TestsLoopback::testServerRequests() {
+	QFETCH( int, latencyMsec );
+	QFETCH( int, kbytesPerSec );
+	QFETCH( double, lossPercent );
+
+	LinkShaper shaper( mServer.getPort(), LinkProfile( latencyMsec, kbytesPerSec, lossPercent ) );
+	LoopbackClient client;
+	QVERIFY( connectClient( &shaper, &client ) );
+
+	LoopbackShell shell( &client );
+	QVERIFY( shell.start( " cd " + mServer.getWorkPath().toLocal8Bit() + ";exec perl " + mScriptPath.toLocal8Bit() +
+	                      "\n" ) );
+
+	// The life of an edit: look around, open, change, save, close.
+	QMap< QByteArray, QVector< qint64 > > timings;
+	QString document = mServer.getWorkPath() + "/document.txt";
+	for ( int i = 0; i < LOOPBACK_REQUEST_ROUNDS; i++ ) {
+		qint64 nsecs = 0;
+		QVariantMap params;
+		QVariantMap reply;
+
+		params.insert( "dir", mServer.getWorkPath() );
+		QVERIFY( serverRequest( &shell, "ls", params, -1, &reply, &nsecs ) );
+		QVERIFY( reply.contains( "entries" ) );
+		timings[ "ls" ].append( nsecs );
+
+		params.clear();
+		params.insert( "file", document );
+		QVERIFY( serverRequest( &shell, "open", params, -1, &reply, &nsecs ) );
+		QVERIFY( reply.contains( "bufferId" ) );
+		timings[ "open" ].append( nsecs );
+		int bufferId = reply.value( "bufferId" ).toInt();
+
+		params.clear();
+		params.insert( "p", 0 );
+		params.insert( "a", QString( "Edit %1\n" ).arg( i ) );
+		QVERIFY( serverRequest( &shell, "change", params, bufferId, &reply, &nsecs ) );
+		timings[ "change" ].append( nsecs );
+
+		QVERIFY( serverRequest( &shell, "save", QVariantMap(), bufferId, &reply, &nsecs ) );
+		timings[ "save" ].append( nsecs );
+
+		QVERIFY( serverRequest( &shell, "close", QVariantMap(), bufferId, &reply, &nsecs ) );
+		timings[ "close" ].append( nsecs );
+	}
+
+	foreach ( const QByteArray &operation, timings.keys() ) {
+		reportLatency( operation.constData(), timings.value( operation ) );
+	}
+
+	// Every save landed.
+	QFile saved( document );
+	QVERIFY( saved.open( QIODevice::ReadOnly ) );
+	QVERIFY( saved.readAll().startsWith( QString( "Edit %1\n" ).arg( LOOPBACK_REQUEST_ROUNDS - 1 ).toUtf8() ) );
+}
+
+void TestsLoopback::testXferTransfers_data() {
+	addLinkColumns();
+}
+
+void TestsLoopback::testXferTransfers() {
+	QFETCH( int, latencyMsec );
+	QFETCH( int, kbytesPerSec );
+	QFETCH( double, lossPercent );
+
+	LinkShaper shaper( mServer.getPort(), LinkProfile( latencyMsec, kbytesPerSec, lossPercent ) );
+	LoopbackClient client;
+	QVERIFY( connectClient( &shaper, &client ) );
+
+	LoopbackShell shell( &client );
+	QVERIFY( shell.start( " cd " + mServer.getWorkPath().toLocal8Bit() + ";exec perl " + mScriptPath.toLocal8Bit() +
+	                      " xfer\n" ) );
+
+	QByteArray payload = makePayload( LOOPBACK_TRANSFER_BYTES );
+	QByteArray path = ( mServer.getWorkPath() + "/xfer.bin" ).toLocal8Bit();
+	QByteArray line;
+
+	// Upload, framed the way XferRequest does it.
+	QElapsedTimer timer;
+	timer.start();
+	QByteArray encoded = BinCodec::encode( payload );
+	QVERIFY( shell.send( path + "u\n" + QByteArray::number( encoded.length() ) + "\n" + md5( payload ) + "\n" ) );
+	QVERIFY( shell.readLine( &line ) );
+	QCOMPARE( line, QByteArray( "Ready" ) );
+	for ( int sent = 0; sent < encoded.length(); sent += LOOPBACK_XFER_SEND_SIZE ) {
+		QVERIFY( shell.send( encoded.mid( sent, LOOPBACK_XFER_SEND_SIZE ) ) );
+	}
+	QVERIFY( shell.readLine( &line ) );
+	QCOMPARE( line, QByteArray( "OK" ) );
+	reportThroughput( "upload", payload.length(), timer.nsecsElapsed() );
+
+	// Ranged download of the whole thing.
+	timer.restart();
+	QVERIFY( shell.send( path + "r\n0," + QByteArray::number( payload.length() ) + "\n" ) );
+	QVERIFY( shell.readLine( &line ) );
+	QList< QByteArray > header = line.split( ',' );
+	QCOMPARE( header.length(), 3 );
+	int want = header[ 1 ].toInt();
+	QCOMPARE( want, payload.length() );
+
+	QByteArray downloaded( want, 0 );
+	int written = 0;
+	bool leftoverEscape = false;
+	while ( written < want ) {
+		QByteArray data;
+		QVERIFY( shell.read( &data ) );
+
+		int decoded = 0;
+		int consumed = BinCodec::decode( downloaded.data() + written,
+		                                 want - written,
+		                                 data.constData(),
+		                                 data.length(),
+		                                 &decoded,
+		                                 &leftoverEscape );
+		written += decoded;
+		if ( consumed < data.length() ) {
+			shell.unread( data.mid( consumed ) );
+		}
+	}
+	QVERIFY( shell.readLine( &line ) );
+	QCOMPARE( line, QByteArray( "OK" ) );
+	reportThroughput( "download", want, timer.nsecsElapsed() );
+
+	QCOMPARE( md5( downloaded ), header[ 2 ] );
+	QCOMPARE( downloaded, payload );
+}
+
+void TestsLoopback::testSftpTransfers_data() {
+	addLinkColumns();
+}
+
+void TestsLoopback::testSftpTransfers() {
+	QFETCH( int, latencyMsec );
+	QFETCH( int, kbytesPerSec );
+	QFETCH( double, lossPercent );
+
+	LinkShaper shaper( mServer.getPort(), LinkProfile( latencyMsec, kbytesPerSec, lossPercent ) );
+	LoopbackClient client;
+	QVERIFY( connectClient( &shaper, &client ) );
+
+	LIBSSH2_SFTP *sftp = libssh2_sftp_init( client.getHandle() );
+	QVERIFY( sftp );
+
+	QByteArray payload = makePayload( LOOPBACK_TRANSFER_BYTES );
+	QByteArray path = ( mServer.getWorkPath() + "/sftp.bin" ).toLocal8Bit();
+
+	QElapsedTimer timer;
+	timer.start();
+	LIBSSH2_SFTP_HANDLE *handle = libssh2_sftp_open( sftp,
+	                                                 path.constData(),
+	                                                 LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC,
+	                                                 LIBSSH2_SFTP_S_IRUSR | LIBSSH2_SFTP_S_IWUSR );
+	QVERIFY( handle );
+	for ( int sent = 0; sent < payload.length(); ) {
+		ssize_t rc = libssh2_sftp_write( handle,
+		                                 payload.constData() + sent,
+		                                 qMin( LOOPBACK_SFTP_IO_SIZE, payload.length() - sent ) );
+		QVERIFY( rc > 0 );
+		sent += rc;
+	}
+	libssh2_sftp_close( handle );
+	reportThroughput( "upload", payload.length(), timer.nsecsElapsed() );
+
+	timer.restart();
+	handle = libssh2_sftp_open( sftp, path.constData(), LIBSSH2_FXF_READ, 0 );
+	QVERIFY( handle );
+	QByteArray downloaded( payload.length(), 0 );
+	int received = 0;
+	while ( received < downloaded.length() ) {
+		ssize_t rc = libssh2_sftp_read( handle,
+		                                downloaded.data() + received,
+		                                qMin( LOOPBACK_SFTP_IO_SIZE, downloaded.length() - received ) );
+		QVERIFY( rc > 0 );
+		received += rc;
+	}
+	libssh2_sftp_close( handle );
+	reportThroughput( "download", received, timer.nsecsElapsed() );
+
+	libssh2_sftp_shutdown( sftp );
+	QCOMPARE( downloaded, payload );
+}
+
+QTEST_GUILESS_MAIN( TestsLoopback )
+
+#include "tst_loopback.moc"
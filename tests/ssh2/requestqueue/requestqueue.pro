@@ -0,0 +1,9 @@
+include( $$TESTSDIR/common.pri );
+
+TARGET = tst_requestqueue
+
+# Short enough to test aging without slowing the suite down.
+DEFINES += REQUEST_AGING_MSEC=50
+
+SOURCES += \
+    tst_requestqueue.cpp
@@ -0,0 +1,175 @@
+#include <QList>
+#include <QtTest>
+
+#include "ssh2/requestqueue.h"
+
+struct TestRequest {
+	TestRequest( int id, RequestQueueBase::Priority priority, uint orderKey = 0 ) :
+		id( id ),
+		priority( priority ),
+		orderKey( orderKey ) {}
+
+	inline RequestQueueBase::Priority getPriority() const {
+		return priority;
+	}
+
+	inline uint getOrderKey() const {
+		return orderKey;
+	}
+
+	int id;
+	RequestQueueBase::Priority priority;
+	uint orderKey;
+};
+
+typedef RequestQueue< TestRequest, int > TestQueue;
+
+class TestsRequestQueue : public QObject {
+	Q_OBJECT
+
+	private Q_SLOTS:
+		void testPriorityOrder();
+		void testFifoWithinClass();
+		void testOrderKeys();
+		void testRoutes();
+		void testTakeRoutes();
+		void testAging();
+		void testRequeue();
+		void testMetrics();
+
+	private:
+		static QList< int > drain( TestQueue *queue, const QList< int > &routes = QList< int >() );
+};
+
+QList< int > TestsRequestQueue::drain( TestQueue *queue, const QList< int > &routes ) {
+	QList< int > result;
+	while ( TestRequest *request = queue->dequeue( routes ) ) {
+		result.append( request->id );
+		delete request;
+	}
+	return result;
+}
+
+void TestsRequestQueue::testPriorityOrder() {
+	TestQueue queue;
+	queue.enqueue( new TestRequest( 1, RequestQueueBase::Bulk ) );
+	queue.enqueue( new TestRequest( 2, RequestQueueBase::Listing ) );
+	queue.enqueue( new TestRequest( 3, RequestQueueBase::Interactive ) );
+
+	QCOMPARE( queue.length(), 3 );
+	QCOMPARE( drain( &queue ), QList< int >() << 3 << 2 << 1 );
+	QVERIFY( queue.isEmpty() );
+}
+
+void TestsRequestQueue::testFifoWithinClass() {
+	TestQueue queue;
+	for ( int i = 0; i < 5; i++ ) {
+		queue.enqueue( new TestRequest( i, RequestQueueBase::Listing ) );
+	}
+
+	QCOMPARE( drain( &queue ), QList< int >() << 0 << 1 << 2 << 3 << 4 );
+}
+
+void TestsRequestQueue::testOrderKeys() {
+	// A save queued behind a read of the same file must not overtake it; an unrelated save can.
+	TestQueue queue;
+	queue.enqueue( new TestRequest( 1, RequestQueueBase::Bulk, 42 ) );
+	queue.enqueue( new TestRequest( 2, RequestQueueBase::Interactive, 42 ) );
+	queue.enqueue( new TestRequest( 3, RequestQueueBase::Interactive, 7 ) );
+
+	QCOMPARE( drain( &queue ), QList< int >() << 3 << 1 << 2 );
+
+	// Once the earlier request is gone, the key no longer holds anything back.
+	queue.enqueue( new TestRequest( 4, RequestQueueBase::Bulk, 42 ) );
+	TestRequest *request = queue.dequeue();
+	QCOMPARE( request->id, 4 );
+	delete request;
+
+	queue.enqueue( new TestRequest( 5, RequestQueueBase::Bulk ) );
+	queue.enqueue( new TestRequest( 6, RequestQueueBase::Interactive, 42 ) );
+	QCOMPARE( drain( &queue ), QList< int >() << 6 << 5 );
+}
+
+void TestsRequestQueue::testRoutes() {
+	TestQueue queue;
+	queue.enqueue( new TestRequest( 1, RequestQueueBase::Interactive ), 10 );
+	queue.enqueue( new TestRequest( 2, RequestQueueBase::Listing ) );
+	queue.enqueue( new TestRequest( 3, RequestQueueBase::Interactive ), 20 );
+
+	// Without the route, routed requests are invisible; even to a higher priority.
+	QCOMPARE( drain( &queue ), QList< int >() << 2 );
+	QCOMPARE( queue.length(), 2 );
+
+	QCOMPARE( drain( &queue, QList< int >() << 20 ), QList< int >() << 3 );
+	QCOMPARE( drain( &queue, QList< int >() << 10 << 20 ), QList< int >() << 1 );
+	QVERIFY( queue.isEmpty() );
+}
+
+void TestsRequestQueue::testTakeRoutes() {
+	TestQueue queue;
+	queue.enqueue( new TestRequest( 1, RequestQueueBase::Interactive ), 10 );
+	queue.enqueue( new TestRequest( 2, RequestQueueBase::Interactive ) );
+	queue.enqueue( new TestRequest( 3, RequestQueueBase::Bulk ), 10 );
+	queue.enqueue( new TestRequest( 4, RequestQueueBase::Interactive ), 20 );
+
+	QList< int > taken;
+	foreach ( TestRequest *request, queue.takeRoutes( QList< int >() << 10 ) ) {
+		taken.append( request->id );
+		delete request;
+	}
+
+	QCOMPARE( taken, QList< int >() << 1 << 3 );
+	QCOMPARE( queue.length(), 2 );
+	QCOMPARE( drain( &queue, QList< int >() << 10 << 20 ), QList< int >() << 2 << 4 );
+}
+
+void TestsRequestQueue::testAging() {
+	// A bulk request that has waited more than two aging periods outranks fresh interactive work.
+	TestQueue queue;
+	queue.enqueue( new TestRequest( 1, RequestQueueBase::Bulk ) );
+	QTest::qSleep( REQUEST_AGING_MSEC * 3 );
+
+	queue.enqueue( new TestRequest( 2, RequestQueueBase::Interactive ) );
+	queue.enqueue( new TestRequest( 3, RequestQueueBase::Interactive ) );
+
+	QCOMPARE( drain( &queue ), QList< int >() << 1 << 2 << 3 );
+}
+
+void TestsRequestQueue::testRequeue() {
+	TestQueue queue;
+	queue.enqueue( new TestRequest( 1, RequestQueueBase::Bulk ) );
+	queue.enqueue( new TestRequest( 2, RequestQueueBase::Bulk ) );
+	queue.requeue( new TestRequest( 3, RequestQueueBase::Bulk ) );
+	queue.enqueue( new TestRequest( 4, RequestQueueBase::Interactive ) );
+
+	QCOMPARE( drain( &queue ), QList< int >() << 4 << 3 << 1 << 2 );
+}
+
+void TestsRequestQueue::testMetrics() {
+	TestQueue queue;
+	queue.enqueue( new TestRequest( 1, RequestQueueBase::Bulk ) );
+	queue.enqueue( new TestRequest( 2, RequestQueueBase::Interactive ), 10 );
+	queue.enqueue( new TestRequest( 3, RequestQueueBase::Listing ) );
+
+	RequestQueueBase::Metrics metrics = queue.getMetrics();
+	QCOMPARE( metrics.depth, 3 );
+	QCOMPARE( metrics.depthByPriority[ RequestQueueBase::Interactive ], 1 );
+	QCOMPARE( metrics.depthByPriority[ RequestQueueBase::Listing ], 1 );
+	QCOMPARE( metrics.depthByPriority[ RequestQueueBase::Bulk ], 1 );
+	QCOMPARE( metrics.dequeued, ( qint64 ) 0 );
+
+	QTest::qSleep( 20 );
+	QVERIFY( queue.getMetrics().oldestWaitMsec >= 20 );
+
+	drain( &queue, QList< int >() << 10 );
+	metrics = queue.getMetrics();
+	QCOMPARE( metrics.depth, 0 );
+	QCOMPARE( metrics.dequeued, ( qint64 ) 3 );
+	QVERIFY( metrics.maxWaitMsec >= 20 );
+	QVERIFY( metrics.totalWaitMsec >= 60 );
+	QCOMPARE( metrics.toVariantMap().value( "depth" ).toInt(), 0 );
+}
+
+QTEST_APPLESS_MAIN( TestsRequestQueue )
+
+#include "tst_requestqueue.moc"
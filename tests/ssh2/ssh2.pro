@@ -1,4 +1,9 @@
 TEMPLATE = subdirs
 
 SUBDIRS = \
+	channelpool \
+	requestqueue \
 	sshsettings
+
+# Uses POSIX sockets and runs a private sshd.
+linux: SUBDIRS += loopback
@@ -1,4 +1,6 @@
 TEMPLATE = subdirs
 
 SUBDIRS = \
-	ssh2
+	file \
+	ssh2 \
+	tools
@@ -0,0 +1,7 @@
+include( $$TESTSDIR/common.pri );
+
+TARGET = tst_bincodec
+
+SOURCES += \
+    tst_bincodec.cpp \
+	$$SRCDIR/tools/bincodec.cpp
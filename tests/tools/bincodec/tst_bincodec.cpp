@@ -0,0 +1,211 @@
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QtTest>
+
+#include "tools/bincodec.h"
+
+#define BENCHMARK_SIZE ( 32 * 1024 * 1024 )
+
+class TestsBinCodec : public QObject {
+	Q_OBJECT
+
+	public:
+		TestsBinCodec();
+
+	private Q_SLOTS:
+		void testEncode_data();
+		void testEncode();
+
+		void testRoundTrip_data();
+		void testRoundTrip();
+
+		void testSplitDecode();
+		void testLimitedTarget();
+
+		void benchmarkEncode_data();
+		void benchmarkEncode();
+
+		void benchmarkDecode_data();
+		void benchmarkDecode();
+
+	private:
+		static QByteArray referenceBin( const QByteArray &source );
+		static QByteArray randomData( int length, bool text );
+		static void reportThroughput( const char *what, qint64 bytes, qint64 nsecs );
+};
+
+TestsBinCodec::TestsBinCodec() {
+	qsrand( 1 );
+}
+
+// The original byte-at-a-time encoder; the table-driven one must produce identical output.
+QByteArray TestsBinCodec::referenceBin( const QByteArray &source ) {
+	QByteArray result;
+	foreach ( char ch, source ) {
+		unsigned char c = ch;
+		if ( c == 0x3 || c == 0x4 || c == 0x8 || c == 0x11 || c == 0x13 || c == 0x1D || c == 0x1E ||
+		     c == 0x18 || c == 0x1A || c == 0x1C || c == 0x7F ) {
+			result.append( ( char ) 255 ).append( ( char ) ( c + 128 ) );
+		} else if ( c == 10 ) {
+			result.append( ( char ) 253 );
+		} else if ( c == 13 ) {
+			result.append( ( char ) 254 );
+		} else if ( c >= 253 ) {
+			result.append( ( char ) 255 ).append( ( char ) ( 'A' + c - 253 ) );
+		} else {
+			result.append( ( char ) c );
+		}
+	}
+	return result;
+}
+
+QByteArray TestsBinCodec::randomData( int length, bool text ) {
+	static const char sample[] = "int main( int argc, char *argv[] ) {\n\treturn 0;\r\n}\n";
+	QByteArray result( length, Qt::Uninitialized );
+	for ( int i = 0; i < length; i++ ) {
+		result[ i ] = text ? sample[ qrand() % ( sizeof( sample ) - 1 ) ] : ( char ) ( qrand() & 0xFF );
+	}
+	return result;
+}
+
+void TestsBinCodec::reportThroughput( const char *what, qint64 bytes, qint64 nsecs ) {
+	qDebug( "%s: %.2f GB/s", what, nsecs ? ( double ) bytes / ( double ) nsecs : 0.0 );
+}
+
+void TestsBinCodec::testEncode_data() {
+	QTest::addColumn< QByteArray >( "source" );
+
+	QByteArray everyByte;
+	for ( int i = 0; i < 256; i++ ) {
+		everyByte.append( ( char ) i );
+	}
+
+	QTest::newRow( "empty" ) << QByteArray();
+	QTest::newRow( "every byte" ) << everyByte;
+	QTest::newRow( "every byte, unaligned" ) << everyByte.mid( 7 ) + everyByte;
+	QTest::newRow( "plain text" ) << QByteArray( "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ" );
+	QTest::newRow( "text" ) << randomData( 4099, true );
+	QTest::newRow( "binary" ) << randomData( 4099, false );
+}
+
+void TestsBinCodec::testEncode() {
+	QFETCH( QByteArray, source );
+
+	QByteArray expected = referenceBin( source );
+	QCOMPARE( BinCodec::encodedLength( source.constData(), source.length() ), expected.length() );
+	QCOMPARE( BinCodec::encode( source ), expected );
+}
+
+void TestsBinCodec::testRoundTrip_data() {
+	testEncode_data();
+}
+
+void TestsBinCodec::testRoundTrip() {
+	QFETCH( QByteArray, source );
+
+	QByteArray encoded = BinCodec::encode( source );
+	QByteArray decoded( source.length(), Qt::Uninitialized );
+	int written;
+	int consumed = BinCodec::decode( decoded.data(),
+	                                 decoded.length(),
+	                                 encoded.constData(),
+	                                 encoded.length(),
+	                                 &written );
+
+	QCOMPARE( consumed, encoded.length() );
+	QCOMPARE( written, source.length() );
+	QCOMPARE( decoded, source );
+}
+
+void TestsBinCodec::testSplitDecode() {
+	// Feed the decoder in small pieces, splitting escape sequences at every possible point.
+	QByteArray source = randomData( 1000, false );
+	QByteArray encoded = BinCodec::encode( source );
+
+	for ( int step = 1; step < 40; step++ ) {
+		QByteArray decoded( source.length(), Qt::Uninitialized );
+		bool leftoverEscape = false;
+		int decodedLength = 0;
+
+		for ( int offset = 0; offset < encoded.length(); offset += step ) {
+			int written;
+			int consumed = BinCodec::decode( decoded.data() + decodedLength,
+			                                 decoded.length() - decodedLength,
+			                                 encoded.constData() + offset,
+			                                 qMin( step, encoded.length() - offset ),
+			                                 &written,
+			                                 &leftoverEscape );
+			QCOMPARE( consumed, qMin( step, encoded.length() - offset ) );
+			decodedLength += written;
+		}
+
+		QVERIFY( ! leftoverEscape );
+		QCOMPARE( decodedLength, source.length() );
+		QCOMPARE( decoded, source );
+	}
+}
+
+void TestsBinCodec::testLimitedTarget() {
+	// Decoding stops once the target is full, leaving the rest of the source unconsumed.
+	QByteArray source = randomData( 100, false );
+	QByteArray encoded = BinCodec::encode( source + source );
+
+	QByteArray decoded( source.length(), Qt::Uninitialized );
+	int written;
+	int consumed = BinCodec::decode( decoded.data(),
+	                                 decoded.length(),
+	                                 encoded.constData(),
+	                                 encoded.length(),
+	                                 &written );
+
+	QCOMPARE( written, source.length() );
+	QCOMPARE( decoded, source );
+	QCOMPARE( consumed, BinCodec::encode( source ).length() );
+}
+
+void TestsBinCodec::benchmarkEncode_data() {
+	QTest::addColumn< QByteArray >( "source" );
+
+	QTest::newRow( "text" ) << randomData( BENCHMARK_SIZE, true );
+	QTest::newRow( "binary" ) << randomData( BENCHMARK_SIZE, false );
+}
+
+void TestsBinCodec::benchmarkEncode() {
+	QFETCH( QByteArray, source );
+
+	QByteArray target( BinCodec::encodedLength( source.constData(), source.length() ), Qt::Uninitialized );
+	QElapsedTimer timer;
+	qint64 bytes = 0;
+
+	timer.start();
+	QBENCHMARK {
+		BinCodec::encode( target.data(), source.constData(), source.length() );
+		bytes += source.length();
+	}
+	reportThroughput( "Encode", bytes, timer.nsecsElapsed() );
+}
+
+void TestsBinCodec::benchmarkDecode_data() {
+	benchmarkEncode_data();
+}
+
+void TestsBinCodec::benchmarkDecode() {
+	QFETCH( QByteArray, source );
+
+	QByteArray encoded = BinCodec::encode( source );
+	QByteArray target( source.length(), Qt::Uninitialized );
+	QElapsedTimer timer;
+	qint64 bytes = 0;
+	int written;
+
+	timer.start();
+	QBENCHMARK {
+		BinCodec::decode( target.data(), target.length(), encoded.constData(), encoded.length(), &written );
+		bytes += source.length();
+	}
+	reportThroughput( "Decode", bytes, timer.nsecsElapsed() );
+}
+
+QTEST_APPLESS_MAIN( TestsBinCodec )
+
+#include "tst_bincodec.moc"
@@ -0,0 +1,6 @@
+include( $$TESTSDIR/common.pri );
+
+TARGET = tst_mpscqueue
+
+SOURCES += \
+    tst_mpscqueue.cpp
@@ -0,0 +1,209 @@
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QList>
+#include <QThread>
+#include <QVector>
+#include <QtTest>
+
+#include "tools/mpscqueue.h"
+
+#define STRESS_PRODUCERS 4
+#define STRESS_ITEMS_PER_PRODUCER 200000
+
+// Values encode the producer in the top byte and a sequence number in the rest.
+static inline quint32 encodeValue( int producer, int sequence ) {
+	return ( ( quint32 ) producer << 24 ) | ( quint32 ) sequence;
+}
+
+class Producer : public QThread {
+	public:
+		Producer( MpscQueue< quint32 > *queue, int id, QAtomicInt *wakeups ) :
+			mQueue( queue ),
+			mId( id ),
+			mWakeups( wakeups ) {}
+
+		void run() {
+			for ( int i = 0; i < STRESS_ITEMS_PER_PRODUCER; i++ ) {
+				if ( mQueue->push( encodeValue( mId, i ) ) ) {
+					mWakeups->ref();
+				}
+			}
+		}
+
+	private:
+		MpscQueue< quint32 > *mQueue;
+		int mId;
+		QAtomicInt *mWakeups;
+};
+
+class Consumer : public QThread {
+	public:
+		Consumer( MpscQueue< quint32 > *queue, QAtomicInt *producersDone, int producers ) :
+			mQueue( queue ),
+			mProducersDone( producersDone ),
+			mProducers( producers ),
+			mBatches( 0 ) {}
+
+		void run() {
+			while ( true ) {
+				bool done = ( mProducersDone->loadAcquire() == mProducers );
+				QList< quint32 > batch = mQueue->takeAll();
+				if ( ! batch.isEmpty() ) {
+					mBatches++;
+					mReceived.append( batch );
+				} else if ( done ) {
+					break;
+				} else {
+					QThread::yieldCurrentThread();
+				}
+			}
+		}
+
+		QList< quint32 > mReceived;
+		int mBatches;
+
+	private:
+		MpscQueue< quint32 > *mQueue;
+		QAtomicInt *mProducersDone;
+		int mProducers;
+};
+
+class TestsMpscQueue : public QObject {
+	Q_OBJECT
+
+	private Q_SLOTS:
+		void testOrder();
+		void testWakeOnlyWhenEmpty();
+		void testCount();
+		void testDestroyWithItems();
+		void testStressSingleConsumer();
+		void testStressTwoConsumers();
+
+	private:
+		static void runStress( int consumers );
+};
+
+void TestsMpscQueue::testOrder() {
+	MpscQueue< int > queue;
+	QVERIFY( queue.isEmpty() );
+	QVERIFY( queue.takeAll().isEmpty() );
+
+	for ( int i = 0; i < 10; i++ ) {
+		queue.push( i );
+	}
+
+	QCOMPARE( queue.takeAll(), QList< int >() << 0 << 1 << 2 << 3 << 4 << 5 << 6 << 7 << 8 << 9 );
+	QVERIFY( queue.isEmpty() );
+}
+
+void TestsMpscQueue::testWakeOnlyWhenEmpty() {
+	MpscQueue< int > queue;
+	QVERIFY( queue.push( 1 ) );
+	QVERIFY( ! queue.push( 2 ) );
+	QVERIFY( ! queue.push( 3 ) );
+
+	queue.takeAll();
+	QVERIFY( queue.push( 4 ) );
+}
+
+void TestsMpscQueue::testCount() {
+	MpscQueue< int > queue;
+	QCOMPARE( queue.count(), 0 );
+	queue.push( 1 );
+	queue.push( 2 );
+	QCOMPARE( queue.count(), 2 );
+	queue.takeAll();
+	QCOMPARE( queue.count(), 0 );
+}
+
+void TestsMpscQueue::testDestroyWithItems() {
+	MpscQueue< QByteArray > *queue = new MpscQueue< QByteArray >();
+	queue->push( QByteArray( 1024, 'x' ) );
+	queue->push( QByteArray( 1024, 'y' ) );
+	delete queue;
+}
+
+void TestsMpscQueue::runStress( int consumerCount ) {
+	MpscQueue< quint32 > queue;
+	QAtomicInt wakeups( 0 );
+	QAtomicInt producersDone( 0 );
+
+	QList< Consumer * > consumers;
+	for ( int i = 0; i < consumerCount; i++ ) {
+		consumers.append( new Consumer( &queue, &producersDone, STRESS_PRODUCERS ) );
+		consumers.last()->start();
+	}
+
+	QList< Producer * > producers;
+	for ( int i = 0; i < STRESS_PRODUCERS; i++ ) {
+		producers.append( new Producer( &queue, i, &wakeups ) );
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	foreach ( Producer *producer, producers ) {
+		producer->start();
+	}
+	foreach ( Producer *producer, producers ) {
+		producer->wait();
+		producersDone.ref();
+	}
+	foreach ( Consumer *consumer, consumers ) {
+		consumer->wait();
+	}
+	qint64 elapsed = timer.nsecsElapsed();
+
+	// Every value arrives exactly once; with a single consumer, each producer's values arrive in order.
+	QVector< int > nextSequence( STRESS_PRODUCERS, 0 );
+	QVector< int > seen( STRESS_PRODUCERS, 0 );
+	int batches = 0;
+	foreach ( Consumer *consumer, consumers ) {
+		QVector< int > consumerNext( STRESS_PRODUCERS, -1 );
+		foreach ( quint32 value, consumer->mReceived ) {
+			int producer = value >> 24;
+			int sequence = value & 0xFFFFFF;
+			QVERIFY( producer < STRESS_PRODUCERS );
+
+			// Within one consumer, a producer's values always come in order.
+			QVERIFY( sequence > consumerNext[ producer ] );
+			consumerNext[ producer ] = sequence;
+
+			if ( consumerCount == 1 ) {
+				QCOMPARE( sequence, nextSequence[ producer ] );
+				nextSequence[ producer ]++;
+			}
+			seen[ producer ]++;
+		}
+		batches += consumer->mBatches;
+	}
+
+	for ( int i = 0; i < STRESS_PRODUCERS; i++ ) {
+		QCOMPARE( seen[ i ], STRESS_ITEMS_PER_PRODUCER );
+	}
+
+	// A wakeup is only due for a push into an empty queue, so there can't be more than there were batches taken.
+	QVERIFY( wakeups.loadAcquire() >= 1 );
+	QVERIFY( wakeups.loadAcquire() <= batches );
+	QCOMPARE( queue.count(), 0 );
+
+	qDebug( "%d consumer(s): %.1f M items/s, %d batches, %d wakeups",
+	        consumerCount,
+	        ( double ) ( STRESS_PRODUCERS * STRESS_ITEMS_PER_PRODUCER ) * 1000.0 / ( double ) qMax( elapsed, 1LL ),
+	        batches,
+	        wakeups.loadAcquire() );
+
+	qDeleteAll( producers );
+	qDeleteAll( consumers );
+}
+
+void TestsMpscQueue::testStressSingleConsumer() {
+	runStress( 1 );
+}
+
+void TestsMpscQueue::testStressTwoConsumers() {
+	runStress( 2 );
+}
+
+QTEST_APPLESS_MAIN( TestsMpscQueue )
+
+#include "tst_mpscqueue.moc"